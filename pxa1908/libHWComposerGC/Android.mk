@@ -24,6 +24,7 @@ LOCAL_SRC_FILES := \
 	gc_hwc_debug.cpp \
 	gc_hwc_prepare.cpp \
 	gc_hwc_set.cpp \
+	gc_hwc_area.cpp \
 	gc_hwc_compose.cpp \
 	gc_hwc_overlay.cpp
 
@@ -53,3 +54,23 @@ LOCAL_MODULE_PATH    := $(TARGET_OUT_SHARED_LIBRARIES)/hw
 LOCAL_PRELINK_MODULE := false
 include $(BUILD_SHARED_LIBRARY)
 
+
+#
+# gc_hwc_area_test, host unit test of the area geometry.
+#
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := \
+	gc_hwc_area.cpp \
+	tests/gc_hwc_area_test.cpp
+
+LOCAL_CFLAGS := \
+	-Wall \
+	-Wextra
+
+LOCAL_C_INCLUDES := \
+	$(AQROOT)/hal/inc
+
+LOCAL_MODULE         := gc_hwc_area_test
+LOCAL_MODULE_TAGS    := optional
+include $(BUILD_HOST_NATIVE_TEST)
@@ -26,6 +26,7 @@
 #include <errno.h>
 
 #include <sys/time.h>
+#include <time.h>
 
 static int
 hwc_prepare(
@@ -134,6 +135,9 @@ hwc_set(
         return HWC_EGL_ERROR;
     }
 
+    /* Stages run in this set are timed again. */
+    memset(&context->stages, 0, sizeof (context->stages));
+
     /* Check layer count. */
     if ((list == NULL)
     ||  (list->numHwLayers == 0)
@@ -178,9 +182,13 @@ hwc_set(
     eglSwapBuffers((EGLDisplay) dpy, (EGLSurface) surf);
 
     /* Commit and stall. */
+    context->stages.commitStart = hwcGetTime();
+
     gcmVERIFY_OK(
         gcoHAL_Commit(context->hal, gcvTRUE));
 
+    context->stages.commitEnd = hwcGetTime();
+
 #if DUMP_SET_TIME
     gettimeofday(&curr, NULL);
 
@@ -243,7 +251,11 @@ hwc_device_close(
     gcmVERIFY_OK(
         gcoOS_Destroy(context->os));
 
-    /* TODO: Free allocated memory. */
+    /* Free area pools. */
+    hwcFreeAreas(context);
+
+    /* Free layer store. */
+    free(context->layers);
 
     /* Clean context. */
     free(context);
@@ -356,6 +368,22 @@ hwc_device_open(
     context->opf =
         gcoHAL_IsFeatureAvailable(context->hal, gcvFEATURE_2D_TILING);
 
+#if ENABLE_COMPRESSED_FB
+    /* Check 2D compressed target feature. */
+    context->compression =
+        gcoHAL_IsFeatureAvailable(context->hal, gcvFEATURE_2D_COMPRESSION);
+
+    /* Gralloc tells where compression headers go. */
+    if (context->compression
+    &&  hw_get_module(GRALLOC_HARDWARE_MODULE_ID,
+                      (const hw_module_t **) &context->gralloc) != 0
+    )
+    {
+        context->gralloc     = gcvNULL;
+        context->compression = gcvFALSE;
+    }
+#endif
+
     /* Switch back to 3D core. */
     if (context->separated2D)
     {
@@ -373,7 +401,8 @@ hwc_device_open(
          "2D PE20:              %s\n"
          "Multi-source blit:    %s\n"
          "Multi-source blit Ex: %s\n"
-         "OPF/YUV blit/Tiling : %s\n",
+         "OPF/YUV blit/Tiling : %s\n"
+         "Compressed target:    %s\n",
          HMI.common.version_major,
          HMI.common.version_minor,
          (void *) context,
@@ -381,7 +410,8 @@ hwc_device_open(
          (context->pe20             ? "YES" : "NO"),
          (context->multiSourceBlt   ? "YES" : "NO"),
          (context->multiSourceBltEx ? "YES" : "NO"),
-         (context->opf              ? "YES" : "NO"));
+         (context->opf              ? "YES" : "NO"),
+         (context->compression      ? "YES" : "NO"));
 
     return 0;
 
@@ -408,3 +438,35 @@ OnError:
     return -EINVAL;
 }
 
+
+gctINT64
+hwcGetTime(
+    void
+    )
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (gctINT64) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+
+int
+hwc_get_stage_times(
+    struct hw_device_t * dev,
+    struct hwcStageTimes * times
+    )
+{
+    hwcContext * context = (hwcContext *) dev;
+
+    /* Check device handle. */
+    if ((context == gcvNULL) || (times == NULL))
+    {
+        return -EINVAL;
+    }
+
+    *times = context->stages;
+
+    return 0;
+}
@@ -28,6 +28,14 @@
 */
 #define ENABLE_SWAP_RECTANGLE 1
 
+/*
+    HWC_BATCH_RECTS
+
+        Rectangles submitted by one swap rectangle copy or worm hole clear.
+        A frame with more of them takes more submissions.
+*/
+#define HWC_BATCH_RECTS       32
+
 /*
     ENABLE_DIM
 
@@ -54,23 +62,60 @@
 */
 #define CLEAR_FB_FOR_OVERLAY  1
 
+/*
+    ENABLE_COMPRESSED_FB
+
+        Set to 1 to compose compressed frames into the framebuffer when the
+        2D core supports compressed targets and gralloc reserved header room
+        (see FB_COMPRESSION in gc_gralloc_fb.cpp). The display controller
+        decompresses them on scan-out.
+*/
+#define ENABLE_COMPRESSED_FB  1
+
+/*
+    ENABLE_STATE_CACHE
+
+        Set to 1 to skip 2D state calls which would program the value the
+        engine already holds. Calls issued, and skipped when enabled, are
+        counted, see DUMP_STATE.
+*/
+#define ENABLE_STATE_CACHE    1
+
+/*
+    ENABLE_MERGE_AREA
+
+        Set to 1 to merge adjacent areas with the same owners after area split
+        on geometry change, so they are composed with fewer blits. See
+        DUMP_AREA_COUNT.
+*/
+#define ENABLE_MERGE_AREA     1
+
 
 /******************************************************************************/
 
 #include <stdlib.h>
 
 #include <hardware/hwcomposer.h>
+#include <hardware/gralloc.h>
 #include <ui/android_native_buffer.h>
 #include <cutils/log.h>
 
 #include <gc_hal_base.h>
 #include <gc_hal_raster.h>
 
+#include "gc_hwc_area.h"
+#include "gc_hwc_trace.h"
+
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/* gralloc perform operations for the compressed framebuffer.
+ * Must match libgralloc/gralloc_priv.h. */
+#define HWC_GRALLOC_PERFORM_GET_FB_HEADER      0x4D560003
+#define HWC_GRALLOC_PERFORM_SET_FB_COMPRESSED  0x4D560004
+
 /* Extended composition types. */
 enum
 {
@@ -83,9 +128,30 @@ enum
 };
 
 
+/* Blit operation of a layer, chosen once per geometry change. */
+enum
+{
+    /* Filter blit, for YUV sources the blitter can not read directly. */
+    HWC_BLIT_FILTER = 0,
+
+    /* Stretch blit. */
+    HWC_BLIT_STRETCH,
+
+    /* Bit blit. */
+    HWC_BLIT_BIT,
+
+    /* Clear with color32. */
+    HWC_BLIT_CLEAR,
+
+    /* Blended color32 from a solid brush. */
+    HWC_BLIT_PATTERN
+};
+
+
 /* A framebuffer buffer. */
 struct hwcBuffer;
 
+
 /* Framebuffer window struct. */
 struct hwcFramebuffer
 {
@@ -107,6 +173,18 @@ struct hwcFramebuffer
     /* Swap rectangles are valid? */
     gctBOOL                          valid;
 
+    /* Frames composed by hwc, numbers the frames of damage. */
+    gctUINT32                        frameCount;
+
+    /* Damage of the last frames, indexed by frame number. */
+    hwcRegion                        damage[HWC_DAMAGE_HISTORY];
+
+    /* Buffer holding the previous frame, source of swap rectangle copies. */
+    struct hwcBuffer *               front;
+
+    /* Offset of the compression header in a buffer, 0 if none. */
+    gctUINT32                        headerOffset;
+
     /* The first framebuffer buffer. */
     struct hwcBuffer *               head;
 
@@ -127,40 +205,19 @@ struct hwcBuffer
      /* Swap rectangle. */
      gcsRECT                         swapRect;
 
+     /* Frame last composed into this buffer, 0 if its contents are
+      * unknown. */
+     gctUINT32                       frame;
+
+     /* Buffer holds a compressed frame. */
+     gctBOOL                         compressed;
+
      /* Point to prev/next buffer. */
      struct hwcBuffer *              prev;
      struct hwcBuffer *              next;
 };
 
 
-/* Area struct. */
-struct hwcArea
-{
-    /* Area potisition. */
-    gcsRECT                          rect;
-
-    /* Bit field, layers who own this Area. */
-    gctUINT32                        owners;
-
-    /* Point to next area. */
-    struct hwcArea *                 next;
-};
-
-
-/* Area pool struct. */
-struct hwcAreaPool
-{
-    /* Pre-allocated areas. */
-    hwcArea *                        areas;
-
-    /* Point to free area. */
-    hwcArea *                        freeNodes;
-
-    /* Next area pool. */
-    hwcAreaPool *                    next;
-};
-
-
 /* Layer struct. */
 struct hwcLayer
 {
@@ -211,6 +268,9 @@ struct hwcLayer
     /* Bytes per pixel. */
     gctUINT32                        bytesPerPixel;
 
+    /* Physical address of the source buffer of the last frame. */
+    gctUINT32                        physical;
+
     /* Original source rectangle before transformation. */
     gcsRECT                          orgRect;
 
@@ -275,6 +335,84 @@ struct hwcLayer
 
     /* Stretch flag. */
     gctBOOL                          stretch;
+
+    /***************************************************************************
+    ** Blit descriptor, built by hwcSet when geometry changes.
+    */
+
+    /* Blit operation, HWC_BLIT_*. */
+    gctUINT32                        blitType;
+
+    /* Stretch factors in 16.16 fixed point. */
+    gctINT32                         hfactor16;
+    gctINT32                         vfactor16;
+
+    /* Non-opaque DIM layers above this layer. */
+    hwcOwners                        dimMask;
+
+    /* Source eigenvalue is (eigenOrigin +/- an edge of the area) & eigenMask,
+     * see _GetSourceEigen. */
+    gctINT                           eigenOrigin;
+    gctUINT32                        eigenMask;
+};
+
+
+/* 2D sources shadowed by the state cache. */
+#define HWC_STATE_SOURCES     8
+
+/* Shadowed state of one 2D source. */
+struct hwcSourceState
+{
+    /* Mirror. */
+    gctBOOL                          mirrorValid;
+    gctBOOL                          hMirror;
+    gctBOOL                          vMirror;
+
+    /* Alpha blending, blend is gcvFALSE if disabled. */
+    gctBOOL                          blendValid;
+    gctBOOL                          blend;
+    gceSURF_PIXEL_ALPHA_MODE         srcAlphaMode;
+    gceSURF_PIXEL_ALPHA_MODE         dstAlphaMode;
+    gceSURF_GLOBAL_ALPHA_MODE        srcGlobalAlphaMode;
+    gceSURF_GLOBAL_ALPHA_MODE        dstGlobalAlphaMode;
+    gceSURF_BLEND_FACTOR_MODE        srcFactorMode;
+    gceSURF_BLEND_FACTOR_MODE        dstFactorMode;
+
+    /* Premultiply. */
+    gctBOOL                          multiplyValid;
+    gce2D_PIXEL_COLOR_MULTIPLY_MODE  srcPremultSrcAlpha;
+    gce2D_PIXEL_COLOR_MULTIPLY_MODE  dstPremultDstAlpha;
+    gce2D_GLOBAL_COLOR_MULTIPLY_MODE srcPremultGlobalMode;
+    gce2D_PIXEL_COLOR_MULTIPLY_MODE  dstDemultDstAlpha;
+
+    /* Global colors. */
+    gctBOOL                          srcGlobalValid;
+    gctUINT32                        srcGlobalColor;
+    gctBOOL                          dstGlobalValid;
+    gctUINT32                        dstGlobalColor;
+};
+
+
+/* Shadow of the 2D engine state programmed by hwc. Other users may touch the
+ * engine between frames, it is dropped at the start of each composition. */
+struct hwcState
+{
+    /* Current source index. */
+    gctBOOL                          indexValid;
+    gctUINT32                        index;
+
+    /* Target. Stride, tiling and format can not change within a frame. */
+    gctBOOL                          targetValid;
+    gctUINT32                        targetAddress;
+    gctUINT32                        targetWidth;
+    gctUINT32                        targetHeight;
+
+    /* Clipping. */
+    gctBOOL                          clipValid;
+    gcsRECT                          clip;
+
+    /* Sources. */
+    hwcSourceState                   sources[HWC_STATE_SOURCES];
 };
 
 
@@ -304,6 +442,9 @@ struct hwcContext
     /* Feature: One pass filter/YUV blit/2D tiling input. */
     gctBOOL                          opf;
 
+    /* Feature: 2D compressed target. */
+    gctBOOL                          compression;
+
     /***************************************************************************
     ** States.
     */
@@ -326,18 +467,36 @@ struct hwcContext
     /* Target framebuffer information. */
     hwcFramebuffer *                 framebuffer;
 
-    /* Layers, max 32 layers. */
+    /* Layers, max HWC_MAX_LAYERS layers. Grown as needed. */
     gctUINT32                        layerCount;
-    hwcLayer                         layers[32];
+    gctUINT32                        layerCapacity;
+    hwcLayer *                       layers;
 
     /* Splited composition area queue. */
     hwcArea *                        compositionArea;
 
+    /* Areas could not be allocated, compose by 3D from next prepare. */
+    gctBOOL                          areaFailed;
+
     /* Rectangles to be copyed from previous buffer. */
     hwcArea *                        swapArea;
 
-    /* Pre-allocated area pool. */
-    hwcAreaPool                      areaPool;
+    /* Region of the target composed this frame. */
+    hwcRegion                        swapRegion;
+
+    /* Composition area arenas. Double buffered, areas of last geometry
+     * stay in the other arena. */
+    hwcAreaArena                     compositionArenas[2];
+    gctUINT32                        compositionArena;
+
+    /* Swap area arena, reset every frame. */
+    hwcAreaArena                     swapArena;
+
+    /* Areas of last geometry, damaged again on geometry change. */
+    hwcArea *                        lastCompositionArea;
+
+    /* Shadow of the 2D engine state. */
+    hwcState                         state;
 
     /***************************************************************************
     ** GC Objects.
@@ -352,6 +511,27 @@ struct hwcContext
     /* Raster engine */
     gco2D                            engine;
 
+    /* Gralloc module, to mark compressed framebuffer buffers. */
+    const gralloc_module_t *         gralloc;
+
+    /***************************************************************************
+    ** Statistics.
+    */
+
+    /* Pixels composed by hwc, and pixels on screen in those frames. */
+    gctUINT64                        composedPixels;
+    gctUINT64                        screenPixels;
+
+    /* 2D state calls issued, and skipped by the state cache. */
+    gctUINT64                        stateIssued;
+    gctUINT64                        stateElided;
+
+    /* 2D blits and clears submitted. */
+    gctUINT64                        blits;
+
+    /* Stage times of the last set. */
+    struct hwcStageTimes             stages;
+
 #if defined(gcdDEFER_RESOLVES) && gcdDEFER_RESOLVES
     /* Imported render target. */
     gcoSURF                          importedRT;
@@ -384,6 +564,19 @@ hwcCompose(
     );
 
 
+void
+hwcFreeAreas(
+    IN hwcContext * Context
+    );
+
+
+/* CLOCK_MONOTONIC in ns, the clock of hwcStageTimes. */
+gctINT64
+hwcGetTime(
+    void
+    );
+
+
 int
 hwcOverlay(
     IN hwcContext * Context,
@@ -0,0 +1,1068 @@
+/****************************************************************************
+*
+*    Copyright (c) 2005 - 2012 by Vivante Corp.  All rights reserved.
+*
+*    The material in this file is confidential and contains trade secrets
+*    of Vivante Corporation. This is proprietary information owned by
+*    Vivante Corporation. No part of this work may be disclosed,
+*    reproduced, copied, transmitted, or used in any way for any purpose,
+*    without the express written permission of Vivante Corporation.
+*
+*****************************************************************************/
+
+
+
+
+#include "gc_hwc_area.h"
+
+#include <stdlib.h>
+
+
+/*
+ * Area spliting feature depends on the following functions:
+ * 'hwcAllocateArea', 'hwcResetArena' and 'hwcSplitArea'.
+ *
+ * Areas come from an arena, a chain of pools which is reset as a whole.
+ * Pools after the current one are free, so reset only rewinds to the first
+ * pool. Pools not used for HWC_AREA_IDLE_RESETS resets are freed.
+ *
+ * hwcAllocateArea returns NULL when no pool can be allocated, and the split
+ * fails with gcvSTATUS_OUT_OF_MEMORY leaving the area list incomplete.
+ */
+#define POOL_SIZE 512
+
+hwcArea *
+hwcAllocateArea(
+    IN hwcAreaArena * Arena,
+    IN hwcArea * Slibing,
+    IN gcsRECT * Rect,
+    IN hwcOwners * Owners
+    )
+{
+    hwcArea * area;
+    hwcAreaPool * pool = Arena->pool;
+
+    if ((pool == NULL)
+    ||  (pool->freeNodes - pool->areas >= POOL_SIZE)
+    )
+    {
+        /* No pool used since reset, or this pool is full. */
+        hwcAreaPool * next = (pool == NULL) ? Arena->pools : pool->next;
+
+        if (next == NULL)
+        {
+            /* No more pools, allocate one with its areas. */
+            next = (hwcAreaPool *)
+                malloc(sizeof (hwcAreaPool) + sizeof (hwcArea) * POOL_SIZE);
+
+            if (next == NULL)
+            {
+                return NULL;
+            }
+
+            next->areas = (hwcArea *) (next + 1);
+            next->next  = NULL;
+
+            if (pool == NULL)
+            {
+                Arena->pools = next;
+            }
+
+            else
+            {
+                pool->next = next;
+            }
+
+            Arena->poolCount++;
+        }
+
+        /* Pools after current one are free. */
+        next->freeNodes = next->areas;
+
+        Arena->pool = pool = next;
+        Arena->poolUsed++;
+    }
+
+    /* Get area and update freeNodes. */
+    area = pool->freeNodes++;
+
+    if (++Arena->areaCount > Arena->areaPeak)
+    {
+        Arena->areaPeak = Arena->areaCount;
+    }
+
+    /* Update area fields. */
+    area->rect = *Rect;
+
+    if (Owners == NULL)
+    {
+        hwcOwnersClear(&area->owners);
+    }
+
+    else
+    {
+        area->owners = *Owners;
+    }
+
+    if (Slibing == NULL)
+    {
+        area->next = NULL;
+    }
+
+    else if (Slibing->next == NULL)
+    {
+        area->next = NULL;
+        Slibing->next = area;
+    }
+
+    else
+    {
+        area->next = Slibing->next;
+        Slibing->next = area;
+    }
+
+    return area;
+}
+
+
+void
+hwcResetArena(
+    IN hwcAreaArena * Arena
+    )
+{
+    /* Track pools used since last trim. */
+    if (Arena->poolUsed > Arena->windowUsed)
+    {
+        Arena->windowUsed = Arena->poolUsed;
+    }
+
+    if (++Arena->resets >= HWC_AREA_IDLE_RESETS)
+    {
+        /* Give back pools idle since last trim. */
+        hwcTrimArena(Arena, Arena->windowUsed);
+
+        Arena->windowUsed = 0U;
+        Arena->resets     = 0U;
+    }
+
+    /* All areas are free. */
+    Arena->pool      = NULL;
+    Arena->poolUsed  = 0U;
+    Arena->areaCount = 0U;
+}
+
+
+void
+hwcTrimArena(
+    IN hwcAreaArena * Arena,
+    IN gctUINT32 Keep
+    )
+{
+    hwcAreaPool ** link = &Arena->pools;
+
+    /* Skip pools to keep. */
+    for (gctUINT32 i = 0; (i < Keep) && (*link != NULL); i++)
+    {
+        link = &(*link)->next;
+    }
+
+    /* Free the rest. */
+    while (*link != NULL)
+    {
+        hwcAreaPool * pool = *link;
+
+        *link = pool->next;
+        free(pool);
+
+        Arena->poolCount--;
+    }
+}
+
+
+gceSTATUS
+hwcSplitArea(
+    IN hwcAreaArena * Arena,
+    IN hwcArea * Area,
+    IN gcsRECT * Rect,
+    IN gctUINT32 Owner
+    )
+{
+    gcsRECT r0[4];
+    gcsRECT r1[4];
+    gctUINT32 c0 = 0;
+    gctUINT32 c1 = 0;
+
+    gcsRECT * rect;
+
+    /* Owners of rects outside all areas. */
+    hwcOwners owners;
+
+    hwcOwnersClear(&owners);
+
+    if (Owner != HWC_NO_OWNER)
+    {
+        hwcOwnersAdd(&owners, Owner);
+    }
+
+    for (;;)
+    {
+        rect = &Area->rect;
+
+        if ((Rect->left   < rect->right)
+        &&  (Rect->top    < rect->bottom)
+        &&  (Rect->right  > rect->left)
+        &&  (Rect->bottom > rect->top)
+        )
+        {
+            /* Overlapped. */
+            break;
+        }
+
+        if (Area->next == NULL)
+        {
+            /* This rectangle is not overlapped with any area. */
+            return (hwcAllocateArea(Arena, Area, Rect, &owners) == NULL)
+                 ? gcvSTATUS_OUT_OF_MEMORY : gcvSTATUS_OK;
+        }
+
+        Area = Area->next;
+    }
+
+    /* OK, the rectangle is overlapped with 'rect' area. */
+    if ((Rect->left <= rect->left)
+    &&  (Rect->right >= rect->right)
+    )
+    {
+        /* |-><-| */
+        /* +---+---+---+
+         * | X | X | X |
+         * +---+---+---+
+         * | X | X | X |
+         * +---+---+---+
+         * | X | X | X |
+         * +---+---+---+
+         */
+
+        if (Rect->left < rect->left)
+        {
+            r1[c1].left   = Rect->left;
+            r1[c1].top    = Rect->top;
+            r1[c1].right  = rect->left;
+            r1[c1].bottom = Rect->bottom;
+
+            c1++;
+        }
+
+        if (Rect->top < rect->top)
+        {
+            r1[c1].left   = rect->left;
+            r1[c1].top    = Rect->top;
+            r1[c1].right  = rect->right;
+            r1[c1].bottom = rect->top;
+
+            c1++;
+        }
+
+        else if (rect->top < Rect->top)
+        {
+            r0[c0].left   = rect->left;
+            r0[c0].top    = rect->top;
+            r0[c0].right  = rect->right;
+            r0[c0].bottom = Rect->top;
+
+            c0++;
+        }
+
+        if (Rect->right > rect->right)
+        {
+            r1[c1].left   = rect->right;
+            r1[c1].top    = Rect->top;
+            r1[c1].right  = Rect->right;
+            r1[c1].bottom = Rect->bottom;
+
+            c1++;
+        }
+
+        if (Rect->bottom > rect->bottom)
+        {
+            r1[c1].left   = rect->left;
+            r1[c1].top    = rect->bottom;
+            r1[c1].right  = rect->right;
+            r1[c1].bottom = Rect->bottom;
+
+            c1++;
+        }
+
+        else if (rect->bottom > Rect->bottom)
+        {
+            r0[c0].left   = rect->left;
+            r0[c0].top    = Rect->bottom;
+            r0[c0].right  = rect->right;
+            r0[c0].bottom = rect->bottom;
+
+            c0++;
+        }
+    }
+
+    else if (Rect->left <= rect->left)
+    {
+        /* |-> */
+        /* +---+---+---+
+         * | X | X |   |
+         * +---+---+---+
+         * | X | X |   |
+         * +---+---+---+
+         * | X | X |   |
+         * +---+---+---+
+         */
+
+        if (Rect->left < rect->left)
+        {
+            r1[c1].left   = Rect->left;
+            r1[c1].top    = Rect->top;
+            r1[c1].right  = rect->left;
+            r1[c1].bottom = Rect->bottom;
+
+            c1++;
+        }
+
+        if (Rect->top < rect->top)
+        {
+            r1[c1].left   = rect->left;
+            r1[c1].top    = Rect->top;
+            r1[c1].right  = Rect->right;
+            r1[c1].bottom = rect->top;
+
+            c1++;
+        }
+
+        else if (rect->top < Rect->top)
+        {
+            r0[c0].left   = rect->left;
+            r0[c0].top    = rect->top;
+            r0[c0].right  = Rect->right;
+            r0[c0].bottom = Rect->top;
+
+            c0++;
+        }
+
+        /* if (rect->right > Rect->right) */
+        {
+            r0[c0].left   = Rect->right;
+            r0[c0].top    = rect->top;
+            r0[c0].right  = rect->right;
+            r0[c0].bottom = rect->bottom;
+
+            c0++;
+        }
+
+        if (Rect->bottom > rect->bottom)
+        {
+            r1[c1].left   = rect->left;
+            r1[c1].top    = rect->bottom;
+            r1[c1].right  = Rect->right;
+            r1[c1].bottom = Rect->bottom;
+
+            c1++;
+        }
+
+        else if (rect->bottom > Rect->bottom)
+        {
+            r0[c0].left   = rect->left;
+            r0[c0].top    = Rect->bottom;
+            r0[c0].right  = Rect->right;
+            r0[c0].bottom = rect->bottom;
+
+            c0++;
+        }
+    }
+
+    else if (Rect->right >= rect->right)
+    {
+        /*    <-| */
+        /* +---+---+---+
+         * |   | X | X |
+         * +---+---+---+
+         * |   | X | X |
+         * +---+---+---+
+         * |   | X | X |
+         * +---+---+---+
+         */
+
+        /* if (rect->left < Rect->left) */
+        {
+            r0[c0].left   = rect->left;
+            r0[c0].top    = rect->top;
+            r0[c0].right  = Rect->left;
+            r0[c0].bottom = rect->bottom;
+
+            c0++;
+        }
+
+        if (Rect->top < rect->top)
+        {
+            r1[c1].left   = Rect->left;
+            r1[c1].top    = Rect->top;
+            r1[c1].right  = rect->right;
+            r1[c1].bottom = rect->top;
+
+            c1++;
+        }
+
+        else if (rect->top < Rect->top)
+        {
+            r0[c0].left   = Rect->left;
+            r0[c0].top    = rect->top;
+            r0[c0].right  = rect->right;
+            r0[c0].bottom = Rect->top;
+
+            c0++;
+        }
+
+        if (Rect->right > rect->right)
+        {
+            r1[c1].left   = rect->right;
+            r1[c1].top    = Rect->top;
+            r1[c1].right  = Rect->right;
+            r1[c1].bottom = Rect->bottom;
+
+            c1++;
+        }
+
+        if (Rect->bottom > rect->bottom)
+        {
+            r1[c1].left   = Rect->left;
+            r1[c1].top    = rect->bottom;
+            r1[c1].right  = rect->right;
+            r1[c1].bottom = Rect->bottom;
+
+            c1++;
+        }
+
+        else if (rect->bottom > Rect->bottom)
+        {
+            r0[c0].left   = Rect->left;
+            r0[c0].top    = Rect->bottom;
+            r0[c0].right  = rect->right;
+            r0[c0].bottom = rect->bottom;
+
+            c0++;
+        }
+    }
+
+    else
+    {
+        /* | */
+        /* +---+---+---+
+         * |   | X |   |
+         * +---+---+---+
+         * |   | X |   |
+         * +---+---+---+
+         * |   | X |   |
+         * +---+---+---+
+         */
+
+        /* if (rect->left < Rect->left) */
+        {
+            r0[c0].left   = rect->left;
+            r0[c0].top    = rect->top;
+            r0[c0].right  = Rect->left;
+            r0[c0].bottom = rect->bottom;
+
+            c0++;
+        }
+
+        if (Rect->top < rect->top)
+        {
+            r1[c1].left   = Rect->left;
+            r1[c1].top    = Rect->top;
+            r1[c1].right  = Rect->right;
+            r1[c1].bottom = rect->top;
+
+            c1++;
+        }
+
+        else if (rect->top < Rect->top)
+        {
+            r0[c0].left   = Rect->left;
+            r0[c0].top    = rect->top;
+            r0[c0].right  = Rect->right;
+            r0[c0].bottom = Rect->top;
+
+            c0++;
+        }
+
+        /* if (rect->right > Rect->right) */
+        {
+            r0[c0].left   = Rect->right;
+            r0[c0].top    = rect->top;
+            r0[c0].right  = rect->right;
+            r0[c0].bottom = rect->bottom;
+
+            c0++;
+        }
+
+        if (Rect->bottom > rect->bottom)
+        {
+            r1[c1].left   = Rect->left;
+            r1[c1].top    = rect->bottom;
+            r1[c1].right  = Rect->right;
+            r1[c1].bottom = Rect->bottom;
+
+            c1++;
+        }
+
+        else if (rect->bottom > Rect->bottom)
+        {
+            r0[c0].left   = Rect->left;
+            r0[c0].top    = Rect->bottom;
+            r0[c0].right  = Rect->right;
+            r0[c0].bottom = rect->bottom;
+
+            c0++;
+        }
+    }
+
+    if (c1 > 0)
+    {
+        /* Process rects outside area. */
+        if (Area->next == NULL)
+        {
+            /* Save rects outside area. */
+            for (gctUINT32 i = 0; i < c1; i++)
+            {
+                if (hwcAllocateArea(Arena, Area, &r1[i], &owners) == NULL)
+                {
+                    return gcvSTATUS_OUT_OF_MEMORY;
+                }
+            }
+        }
+
+        else
+        {
+            /* Rects outside area. */
+            for (gctUINT32 i = 0; i < c1; i++)
+            {
+                gceSTATUS status = hwcSplitArea(Arena, Area, &r1[i], Owner);
+
+                if (gcmIS_ERROR(status))
+                {
+                    return status;
+                }
+            }
+        }
+    }
+
+    if (c0 > 0)
+    {
+        /* Save rects inside area but not overlapped. */
+        for (gctUINT32 i = 0; i < c0; i++)
+        {
+            if (hwcAllocateArea(Arena, Area, &r0[i], &Area->owners) == NULL)
+            {
+                return gcvSTATUS_OUT_OF_MEMORY;
+            }
+        }
+
+        /* Update overlapped area. */
+        if (rect->left   < Rect->left)   { rect->left   = Rect->left;   }
+        if (rect->top    < Rect->top)    { rect->top    = Rect->top;    }
+        if (rect->right  > Rect->right)  { rect->right  = Rect->right;  }
+        if (rect->bottom > Rect->bottom) { rect->bottom = Rect->bottom; }
+    }
+
+    /* The area is owned by the new owner as well. */
+    if (Owner != HWC_NO_OWNER)
+    {
+        hwcOwnersAdd(&Area->owners, Owner);
+    }
+
+    return gcvSTATUS_OK;
+}
+
+
+/*
+ * Merge areas with the same owners which share a whole edge, until no more
+ * can be merged. Merged areas are unlinked and stay in the pool till next
+ * hwcResetArena. Returns count of areas merged into others.
+ */
+gctUINT32
+hwcMergeArea(
+    IN hwcArea * Head
+    )
+{
+    gctUINT32 merged = 0U;
+    gctBOOL again    = gcvTRUE;
+
+    while (again)
+    {
+        again = gcvFALSE;
+
+        for (hwcArea * area = Head; area != NULL; area = area->next)
+        {
+            hwcArea * prev = area;
+            hwcArea * next = area->next;
+
+            while (next != NULL)
+            {
+                gcsRECT * r0 = &area->rect;
+                gcsRECT * r1 = &next->rect;
+
+                /* Side by side with the same height, or one upon the other
+                 * with the same width. */
+                gctBOOL horizontal = (r0->top    == r1->top)
+                                  && (r0->bottom == r1->bottom)
+                                  && (  (r0->right == r1->left)
+                                     || (r1->right == r0->left));
+
+                gctBOOL vertical   = (r0->left   == r1->left)
+                                  && (r0->right  == r1->right)
+                                  && (  (r0->bottom == r1->top)
+                                     || (r1->bottom == r0->top));
+
+                if ((horizontal || vertical)
+                &&  hwcOwnersEqual(&area->owners, &next->owners)
+                )
+                {
+                    /* Grow this area and drop the other. */
+                    r0->left   = gcmMIN(r0->left,   r1->left);
+                    r0->top    = gcmMIN(r0->top,    r1->top);
+                    r0->right  = gcmMAX(r0->right,  r1->right);
+                    r0->bottom = gcmMAX(r0->bottom, r1->bottom);
+
+                    prev->next = next->next;
+                    next       = next->next;
+
+                    merged++;
+                    again = gcvTRUE;
+                    continue;
+                }
+
+                prev = next;
+                next = next->next;
+            }
+        }
+    }
+
+    return merged;
+}
+
+
+/*
+ * Swap areas of a frame. Areas owned by layer 0 are composed, areas with no
+ * owner are copied from the buffer holding the previous frame.
+ */
+static gceSTATUS
+_AddArea(
+    IN hwcAreaArena * Arena,
+    IN hwcArea ** Head,
+    IN gcsRECT * Rect,
+    IN gctUINT32 Owner
+    )
+{
+    if (*Head == NULL)
+    {
+        hwcOwners owners;
+
+        hwcOwnersClear(&owners);
+
+        if (Owner != HWC_NO_OWNER)
+        {
+            hwcOwnersAdd(&owners, Owner);
+        }
+
+        *Head = hwcAllocateArea(Arena, NULL, Rect, &owners);
+
+        return (*Head == NULL) ? gcvSTATUS_OUT_OF_MEMORY : gcvSTATUS_OK;
+    }
+
+    return hwcSplitArea(Arena, *Head, Rect, Owner);
+}
+
+
+/*******************************************************************************
+**
+**  hwcSplitDamage
+**
+**  Split swap areas with the damage of this frame, then with the damage of
+**  the frames the target buffer missed. Parts damaged in this frame are
+**  composed, the rest of the missed damage is copied from the front buffer.
+**
+**  INPUT:
+**
+**      hwcAreaArena * Arena
+**          Arena of the swap areas, reset by the caller.
+**
+**      hwcRegion * Damage
+**          Damage of this frame.
+**
+**      hwcRegion * History
+**          Damage of the last HWC_DAMAGE_HISTORY frames, indexed by frame
+**          number.
+**
+**      gctUINT32 First
+**      gctUINT32 Last
+**          Frames the target missed, both included. None if First is after
+**          Last.
+**
+**  OUTPUT:
+**
+**      hwcArea ** Areas
+**          Swap area list, NULL if nothing is damaged.
+**
+**  RETURN:
+**
+**      gcvSTATUS_OUT_OF_MEMORY when an area pool could not be allocated.
+*/
+gceSTATUS
+hwcSplitDamage(
+    IN hwcAreaArena * Arena,
+    IN hwcRegion * Damage,
+    IN hwcRegion * History,
+    IN gctUINT32 First,
+    IN gctUINT32 Last,
+    OUT hwcArea ** Areas
+    )
+{
+    gceSTATUS status;
+
+    *Areas = NULL;
+
+    /* Put target damage. Any owner means the area is composed. */
+    for (gctUINT32 i = 0; i < Damage->count; i++)
+    {
+        status = _AddArea(Arena, Areas, &Damage->rects[i], 0U);
+
+        if (gcmIS_ERROR(status))
+        {
+            return status;
+        }
+    }
+
+    if (First > Last)
+    {
+        /* The target missed no frame. */
+        return gcvSTATUS_OK;
+    }
+
+    /* Split area with the damage of the frames the target missed (with
+     * no-owner). Now no owner means we need copy area from front buffer. */
+    for (gctUINT32 frame = First; ; frame++)
+    {
+        hwcRegion * region = &History[frame % HWC_DAMAGE_HISTORY];
+
+        for (gctUINT32 i = 0; i < region->count; i++)
+        {
+            status = _AddArea(Arena, Areas, &region->rects[i], HWC_NO_OWNER);
+
+            if (gcmIS_ERROR(status))
+            {
+                return status;
+            }
+        }
+
+        if (frame == Last)
+        {
+            break;
+        }
+    }
+
+    return gcvSTATUS_OK;
+}
+
+
+/*
+ * Damage regions, see hwcRegion.
+ */
+void
+hwcResetRegion(
+    IN hwcRegion * Region
+    )
+{
+    Region->count         = 0U;
+    Region->bounds.left   = 0;
+    Region->bounds.top    = 0;
+    Region->bounds.right  = 0;
+    Region->bounds.bottom = 0;
+}
+
+
+void
+hwcAddRegion(
+    IN hwcRegion * Region,
+    IN gcsRECT * Rect,
+    IN gcsRECT * Clip
+    )
+{
+    gcsRECT rect;
+    gctUINT32 merge = 0U;
+    gctINT64 growth = -1;
+
+    /* Clip the rectangle. */
+    rect.left   = gcmMAX(Rect->left,   Clip->left);
+    rect.top    = gcmMAX(Rect->top,    Clip->top);
+    rect.right  = gcmMIN(Rect->right,  Clip->right);
+    rect.bottom = gcmMIN(Rect->bottom, Clip->bottom);
+
+    if ((rect.left >= rect.right) || (rect.top >= rect.bottom))
+    {
+        /* Nothing left. */
+        return;
+    }
+
+    for (gctUINT32 i = 0; i < Region->count; i++)
+    {
+        gcsRECT * r = &Region->rects[i];
+
+        /* Area added to r when merging the rectangle into it. */
+        gctINT64 g = (gctINT64) (gcmMAX(r->right, rect.right) - gcmMIN(r->left, rect.left))
+                   * (gcmMAX(r->bottom, rect.bottom) - gcmMIN(r->top, rect.top))
+                   - (gctINT64) (r->right - r->left) * (r->bottom - r->top);
+
+        if ((rect.left >= r->left) && (rect.right  <= r->right)
+        &&  (rect.top  >= r->top)  && (rect.bottom <= r->bottom)
+        )
+        {
+            /* Already covered. */
+            return;
+        }
+
+        if ((growth < 0) || (g < growth))
+        {
+            growth = g;
+            merge  = i;
+        }
+    }
+
+    if (Region->count < HWC_DAMAGE_RECTS)
+    {
+        /* Room for one more. */
+        Region->rects[Region->count++] = rect;
+    }
+
+    else
+    {
+        /* Merge into the rectangle growing the least. */
+        gcsRECT * r = &Region->rects[merge];
+
+        r->left   = gcmMIN(r->left,   rect.left);
+        r->top    = gcmMIN(r->top,    rect.top);
+        r->right  = gcmMAX(r->right,  rect.right);
+        r->bottom = gcmMAX(r->bottom, rect.bottom);
+    }
+
+    /* Update bounding box. */
+    if (Region->count == 1U)
+    {
+        Region->bounds = rect;
+    }
+
+    else
+    {
+        Region->bounds.left   = gcmMIN(Region->bounds.left,   rect.left);
+        Region->bounds.top    = gcmMIN(Region->bounds.top,    rect.top);
+        Region->bounds.right  = gcmMAX(Region->bounds.right,  rect.right);
+        Region->bounds.bottom = gcmMAX(Region->bounds.bottom, rect.bottom);
+    }
+}
+
+
+/*******************************************************************************
+**
+**  hwcBlitRect
+**
+**  Get the rectangle a single-source blit covers to compose the damaged part
+**  of an area.
+**
+**  A resampling blit (stretch or filter) covers the whole area, whatever the
+**  damage: its source rectangle, and so the source phase and the filter taps
+**  at the edges, must not depend on how the damage is cut. Output is then
+**  restricted to the damage by clipping. Other blits cover the damage only.
+**
+**  INPUT:
+**
+**      gcsRECT * Area
+**          Area rectangle.
+**
+**      gcsRECT * Clip
+**          Damaged part of the area.
+**
+**      gctBOOL Resample
+**          Blit is a stretch or filter blit.
+**
+**  OUTPUT:
+**
+**      gcsRECT * Rect
+**          Rectangle to blit.
+**
+**      gcsRECT * SubRect
+**          Clip relative to Rect.
+*/
+void
+hwcBlitRect(
+    IN gcsRECT * Area,
+    IN gcsRECT * Clip,
+    IN gctBOOL Resample,
+    OUT gcsRECT * Rect,
+    OUT gcsRECT * SubRect
+    )
+{
+    *Rect = Resample ? *Area : *Clip;
+
+    SubRect->left   = Clip->left   - Rect->left;
+    SubRect->top    = Clip->top    - Rect->top;
+    SubRect->right  = Clip->right  - Rect->left;
+    SubRect->bottom = Clip->bottom - Rect->top;
+}
+
+
+/*******************************************************************************
+**
+**  hwcMapSource
+**
+**  Map a blit rectangle inside the dest rectangle of a layer back to its
+**  source rectangle.
+**
+**  INPUT:
+**
+**      gcsRECT * SrcRect
+**      gcsRECT * DstRect
+**          Full source and dest rectangles of the layer.
+**
+**      gctFLOAT HFactor
+**      gctFLOAT VFactor
+**          Source pixels per dest pixel.
+**
+**      gctBOOL HMirror
+**      gctBOOL VMirror
+**          Layer mirror.
+**
+**      gcsRECT * Rect
+**          Rectangle to blit, inside DstRect.
+**
+**  OUTPUT:
+**
+**      gcsRECT * Source
+**          Source rectangle for Rect.
+*/
+void
+hwcMapSource(
+    IN gcsRECT * SrcRect,
+    IN gcsRECT * DstRect,
+    IN gctFLOAT HFactor,
+    IN gctFLOAT VFactor,
+    IN gctBOOL HMirror,
+    IN gctBOOL VMirror,
+    IN gcsRECT * Rect,
+    OUT gcsRECT * Source
+    )
+{
+    /* Compute delta(s). */
+    gctFLOAT dl = (DstRect->left   - Rect->left)   * HFactor;
+    gctFLOAT dt = (DstRect->top    - Rect->top)    * VFactor;
+    gctFLOAT dr = (DstRect->right  - Rect->right)  * HFactor;
+    gctFLOAT db = (DstRect->bottom - Rect->bottom) * VFactor;
+
+    if (HMirror)
+    {
+        gctFLOAT tl = dl;
+
+        dl = -dr;
+        dr = -tl;
+    }
+
+    if (VMirror)
+    {
+        gctFLOAT tt = dt;
+
+        dt = -db;
+        db = -tt;
+    }
+
+    Source->left   = gctINT(SrcRect->left   - dl);
+    Source->top    = gctINT(SrcRect->top    - dt);
+    Source->right  = gctINT(SrcRect->right  - dr);
+    Source->bottom = gctINT(SrcRect->bottom - db);
+}
+
+
+/*******************************************************************************
+**
+**  hwcPlanPasses
+**
+**  Partition layers of an area into the minimum number of passes. Layers are
+**  blended in order, so each pass is a run of consecutive layers, either a
+**  single-source blit or a multi-source blit checked by CanGroup.
+**
+**  For each prefix of the layers, the minimum passes is found by trying every
+**  possible last pass, which is at most MaxSource layers long.
+**
+**  INPUT:
+**
+**      gctUINT32 * Indices
+**          Layer indices, bottom to top.
+**
+**      gctUINT32 Count
+**          Layer count, at most HWC_MAX_LAYERS.
+**
+**      gctUINT32 MaxSource
+**          Most layers in a pass, 1 for single-source blits only.
+**
+**      hwcCanGroup CanGroup
+**      gctPOINTER Data
+**          Check for a multi-source pass, and its data.
+**
+**  OUTPUT:
+**
+**      gctUINT32 * Lengths
+**          Layer count of each pass.
+**
+**  RETURN:
+**
+**      Pass count.
+*/
+gctUINT32
+hwcPlanPasses(
+    IN gctUINT32 * Indices,
+    IN gctUINT32 Count,
+    IN gctUINT32 MaxSource,
+    IN hwcCanGroup CanGroup,
+    IN gctPOINTER Data,
+    OUT gctUINT32 * Lengths
+    )
+{
+    /* Minimum passes of first k layers, and the length of its last pass. */
+    gctUINT32 passes[HWC_MAX_LAYERS + 1];
+    gctUINT32 last[HWC_MAX_LAYERS + 1];
+    gctUINT32 count;
+
+    passes[0] = 0U;
+
+    for (gctUINT32 k = 1; k <= Count; k++)
+    {
+        /* Single source blit for layer k - 1. */
+        passes[k] = passes[k - 1] + 1U;
+        last[k]   = 1U;
+
+        for (gctUINT32 n = 2; (n <= k) && (n <= MaxSource); n++)
+        {
+            if ((passes[k - n] + 1U < passes[k])
+            &&  CanGroup(Data, &Indices[k - n], n)
+            )
+            {
+                passes[k] = passes[k - n] + 1U;
+                last[k]   = n;
+            }
+        }
+    }
+
+    count = passes[Count];
+
+    /* Walk back to get passes in order. */
+    for (gctUINT32 k = Count, p = count; k > 0; k -= last[k])
+    {
+        Lengths[--p] = last[k];
+    }
+
+    return count;
+}
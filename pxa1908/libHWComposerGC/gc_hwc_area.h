@@ -0,0 +1,454 @@
+/****************************************************************************
+*
+*    Copyright (c) 2005 - 2012 by Vivante Corp.  All rights reserved.
+*
+*    The material in this file is confidential and contains trade secrets
+*    of Vivante Corporation. This is proprietary information owned by
+*    Vivante Corporation. No part of this work may be disclosed,
+*    reproduced, copied, transmitted, or used in any way for any purpose,
+*    without the express written permission of Vivante Corporation.
+*
+*****************************************************************************/
+
+
+
+
+#ifndef __gc_hwc_area_h_
+#define __gc_hwc_area_h_
+
+/*
+ * Areas, owner bitsets and damage regions of the GC composition, and the
+ * geometry on them. Plain computation on GAL types, no GAL calls, so that it
+ * is unit tested on the host, see tests/gc_hwc_area_test.cpp.
+ */
+
+
+/*******************************************************************************
+** Build options.
+*/
+
+/*
+    HWC_DAMAGE_HISTORY
+
+        Frames of swap rectangles kept for swap rectangle optimization. A
+        framebuffer buffer last composed more frames ago is redrawn whole.
+*/
+#define HWC_DAMAGE_HISTORY    4
+
+/*
+    HWC_DAMAGE_RECTS
+
+        Rectangles kept in a damage region. More rectangles are merged into
+        the one growing the least.
+*/
+#define HWC_DAMAGE_RECTS      8
+
+/*
+    HWC_MAX_LAYERS
+
+        Layers hwc composes in a frame, frames with more layers are composed
+        by 3D. This is a hard cap: area owners are fixed bitsets of this many
+        layers so that areas stay plain pool entries, only the layer store
+        grows with the list. Keep it a multiple of 32.
+*/
+#define HWC_MAX_LAYERS        128
+
+/*
+    HWC_AREA_IDLE_RESETS
+
+        Area arenas give pools back to the system when they were not used in
+        this many resets. Composition areas reset on geometry change, swap
+        areas every frame.
+*/
+#define HWC_AREA_IDLE_RESETS  300
+
+
+/******************************************************************************/
+
+#include <gc_hal_types.h>
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Damage region. */
+struct hwcRegion
+{
+    /* Rectangles, may overlap. */
+    gctUINT32                        count;
+    gcsRECT                          rects[HWC_DAMAGE_RECTS];
+
+    /* Bounding box of all rectangles. */
+    gcsRECT                          bounds;
+};
+
+
+/* Owner bitset words. */
+#define HWC_OWNER_WORDS       (HWC_MAX_LAYERS / 32)
+
+/* Layer index standing for no owner. */
+#define HWC_NO_OWNER          (~0U)
+
+/* Layers who own an area, bit i for layer i. */
+struct hwcOwners
+{
+    gctUINT32                        bits[HWC_OWNER_WORDS];
+};
+
+
+/* Area struct. */
+struct hwcArea
+{
+    /* Area potisition. */
+    gcsRECT                          rect;
+
+    /* Bit field, layers who own this Area. */
+    hwcOwners                        owners;
+
+    /* Point to next area. */
+    struct hwcArea *                 next;
+};
+
+
+/* Area pool struct. */
+struct hwcAreaPool
+{
+    /* Pre-allocated areas, right after the pool. */
+    hwcArea *                        areas;
+
+    /* Point to free area. */
+    hwcArea *                        freeNodes;
+
+    /* Next area pool. */
+    hwcAreaPool *                    next;
+};
+
+
+/* Area arena, a chain of pools reset as a whole. */
+struct hwcAreaArena
+{
+    /* Pool chain, and the pool areas come from. NULL pool means nothing
+     * allocated since last reset. */
+    hwcAreaPool *                    pools;
+    hwcAreaPool *                    pool;
+
+    /* Pools in chain, and pools used since last reset. */
+    gctUINT32                        poolCount;
+    gctUINT32                        poolUsed;
+
+    /* Most pools used in resets since last trim, and the resets. */
+    gctUINT32                        windowUsed;
+    gctUINT32                        resets;
+
+    /* Areas allocated since last reset, and the high-water mark. */
+    gctUINT32                        areaCount;
+    gctUINT32                        areaPeak;
+};
+
+
+/*******************************************************************************
+** Owner bitsets.
+*/
+
+static inline void
+hwcOwnersClear(
+    IN hwcOwners * Owners
+    )
+{
+    for (gctUINT32 i = 0; i < HWC_OWNER_WORDS; i++)
+    {
+        Owners->bits[i] = 0U;
+    }
+}
+
+
+/* Own by all layers. */
+static inline void
+hwcOwnersFill(
+    IN hwcOwners * Owners
+    )
+{
+    for (gctUINT32 i = 0; i < HWC_OWNER_WORDS; i++)
+    {
+        Owners->bits[i] = ~0U;
+    }
+}
+
+
+static inline void
+hwcOwnersAdd(
+    IN hwcOwners * Owners,
+    IN gctUINT32 Index
+    )
+{
+    Owners->bits[Index >> 5] |= (1U << (Index & 31));
+}
+
+
+static inline void
+hwcOwnersRemove(
+    IN hwcOwners * Owners,
+    IN gctUINT32 Index
+    )
+{
+    Owners->bits[Index >> 5] &= ~(1U << (Index & 31));
+}
+
+
+static inline void
+hwcOwnersMerge(
+    IN hwcOwners * Owners,
+    IN const hwcOwners * Other
+    )
+{
+    for (gctUINT32 i = 0; i < HWC_OWNER_WORDS; i++)
+    {
+        Owners->bits[i] |= Other->bits[i];
+    }
+}
+
+
+static inline gctBOOL
+hwcOwnersHas(
+    IN const hwcOwners * Owners,
+    IN gctUINT32 Index
+    )
+{
+    return (Owners->bits[Index >> 5] & (1U << (Index & 31))) != 0U;
+}
+
+
+static inline gctBOOL
+hwcOwnersEmpty(
+    IN const hwcOwners * Owners
+    )
+{
+    for (gctUINT32 i = 0; i < HWC_OWNER_WORDS; i++)
+    {
+        if (Owners->bits[i] != 0U)
+        {
+            return gcvFALSE;
+        }
+    }
+
+    return gcvTRUE;
+}
+
+
+static inline gctBOOL
+hwcOwnersEqual(
+    IN const hwcOwners * Owners,
+    IN const hwcOwners * Other
+    )
+{
+    for (gctUINT32 i = 0; i < HWC_OWNER_WORDS; i++)
+    {
+        if (Owners->bits[i] != Other->bits[i])
+        {
+            return gcvFALSE;
+        }
+    }
+
+    return gcvTRUE;
+}
+
+
+/* Any owner below layer Index? */
+static inline gctBOOL
+hwcOwnersBelow(
+    IN const hwcOwners * Owners,
+    IN gctUINT32 Index
+    )
+{
+    gctUINT32 word = Index >> 5;
+
+    for (gctUINT32 i = 0; i < word; i++)
+    {
+        if (Owners->bits[i] != 0U)
+        {
+            return gcvTRUE;
+        }
+    }
+
+    return (Owners->bits[word] & ((1U << (Index & 31)) - 1U)) != 0U;
+}
+
+
+/* Drop owners below layer Index. */
+static inline void
+hwcOwnersRemoveBelow(
+    IN hwcOwners * Owners,
+    IN gctUINT32 Index
+    )
+{
+    gctUINT32 word = Index >> 5;
+
+    for (gctUINT32 i = 0; i < word; i++)
+    {
+        Owners->bits[i] = 0U;
+    }
+
+    Owners->bits[word] &= ~((1U << (Index & 31)) - 1U);
+}
+
+
+/* First owner from layer Index on, HWC_MAX_LAYERS if none. */
+static inline gctUINT32
+hwcOwnersNext(
+    IN const hwcOwners * Owners,
+    IN gctUINT32 Index
+    )
+{
+    gctUINT32 word = Index >> 5;
+    gctUINT32 bits;
+
+    if (word >= HWC_OWNER_WORDS)
+    {
+        return HWC_MAX_LAYERS;
+    }
+
+    bits = Owners->bits[word] & (~0U << (Index & 31));
+
+    while (bits == 0U)
+    {
+        if (++word == HWC_OWNER_WORDS)
+        {
+            return HWC_MAX_LAYERS;
+        }
+
+        bits = Owners->bits[word];
+    }
+
+    return (word << 5) + __builtin_ctz(bits);
+}
+
+
+/*******************************************************************************
+** Functions.
+*/
+
+/* Take an area from the arena, linked after Slibing if not NULL. No owners
+ * if Owners is NULL. Returns NULL when out of memory. */
+hwcArea *
+hwcAllocateArea(
+    IN hwcAreaArena * Arena,
+    IN hwcArea * Slibing,
+    IN gcsRECT * Rect,
+    IN hwcOwners * Owners
+    );
+
+
+/* Free all areas of the arena. */
+void
+hwcResetArena(
+    IN hwcAreaArena * Arena
+    );
+
+
+/* Free pools of the arena after the first Keep ones. */
+void
+hwcTrimArena(
+    IN hwcAreaArena * Arena,
+    IN gctUINT32 Keep
+    );
+
+
+/* Split areas from Area on so that Rect is covered by whole areas, which
+ * Owner then owns as well. Areas stay disjoint. Fails with
+ * gcvSTATUS_OUT_OF_MEMORY when no area can be allocated. */
+gceSTATUS
+hwcSplitArea(
+    IN hwcAreaArena * Arena,
+    IN hwcArea * Area,
+    IN gcsRECT * Rect,
+    IN gctUINT32 Owner
+    );
+
+
+/* Merge adjacent areas with the same owners. Returns areas merged. */
+gctUINT32
+hwcMergeArea(
+    IN hwcArea * Head
+    );
+
+
+/* Split swap areas of a frame. The area list is NULL if no damage. */
+gceSTATUS
+hwcSplitDamage(
+    IN hwcAreaArena * Arena,
+    IN hwcRegion * Damage,
+    IN hwcRegion * History,
+    IN gctUINT32 First,
+    IN gctUINT32 Last,
+    OUT hwcArea ** Areas
+    );
+
+
+void
+hwcResetRegion(
+    IN hwcRegion * Region
+    );
+
+
+/* Add Rect clipped to Clip to the region. */
+void
+hwcAddRegion(
+    IN hwcRegion * Region,
+    IN gcsRECT * Rect,
+    IN gcsRECT * Clip
+    );
+
+
+/* Rectangle a single-source blit covers to compose the damaged part Clip of
+ * an area, and Clip relative to it. */
+void
+hwcBlitRect(
+    IN gcsRECT * Area,
+    IN gcsRECT * Clip,
+    IN gctBOOL Resample,
+    OUT gcsRECT * Rect,
+    OUT gcsRECT * SubRect
+    );
+
+
+/* Source rectangle of a layer blitted to Rect, through its scale and
+ * mirror. */
+void
+hwcMapSource(
+    IN gcsRECT * SrcRect,
+    IN gcsRECT * DstRect,
+    IN gctFLOAT HFactor,
+    IN gctFLOAT VFactor,
+    IN gctBOOL HMirror,
+    IN gctBOOL VMirror,
+    IN gcsRECT * Rect,
+    OUT gcsRECT * Source
+    );
+
+
+/* Check whether a run of layers can be blitted in one multi-source pass. */
+typedef gctBOOL (* hwcCanGroup)(
+    IN gctPOINTER Data,
+    IN gctUINT32 * Indices,
+    IN gctUINT32 Count
+    );
+
+
+/* Partition layers of an area into minimum passes. Returns pass count. */
+gctUINT32
+hwcPlanPasses(
+    IN gctUINT32 * Indices,
+    IN gctUINT32 Count,
+    IN gctUINT32 MaxSource,
+    IN hwcCanGroup CanGroup,
+    IN gctPOINTER Data,
+    OUT gctUINT32 * Lengths
+    );
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __gc_hwc_area_h_ */
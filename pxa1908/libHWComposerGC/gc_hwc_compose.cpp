@@ -20,17 +20,41 @@
 #include <gc_gralloc_priv.h>
 
 
+/* Setup framebuffer target. */
+static gceSTATUS
+_SetTarget(
+    IN hwcContext * Context
+    );
+
 /* Setup framebuffer source(for swap rectangle). */
 static gceSTATUS
 _SwapRectangle(
     IN hwcContext * Context
     );
 
-/* Setup worm hole source. */
+/* Clear worm holes. */
 static gceSTATUS
 _WormHole(
     IN hwcContext * Context,
-    IN gcsRECT * Rect
+    IN gcsRECT * Rects,
+    IN gctUINT32 Count
+    );
+
+/* Clip area to each rectangle of the swap region. */
+static gctUINT32
+_ClipArea(
+    IN hwcContext * Context,
+    IN hwcArea * Area,
+    OUT gcsRECT * Clips
+    );
+
+/* Compose all owner layers of an area. */
+static gceSTATUS
+_ComposeArea(
+    IN hwcContext * Context,
+    IN hwcArea * Area,
+    IN gcsRECT * Clip,
+    IN gctBOOL MultiSourceBlt
     );
 
 /* Setup blit source. */
@@ -38,7 +62,8 @@ static gceSTATUS
 _Blit(
     IN hwcContext * Context,
     IN gctUINT32 Index,
-    IN hwcArea * Area
+    IN hwcArea * Area,
+    IN gcsRECT * Clip
     );
 
 static gctUINT32
@@ -47,17 +72,108 @@ _GetSourceEigen(
     IN  gcsRECT *  DestRect
     );
 
+/* Check whether layers can be blitted in one multi-source pass. */
+static gctBOOL
+_CanGroup(
+    IN hwcContext * Context,
+    IN hwcArea * Area,
+    IN gctUINT32 * Indices,
+    IN gctUINT32 Count,
+    IN gctUINT32 EigenD
+    );
+
+/* Area checked by _CanGroupArea. */
+struct _hwcGroupArea
+{
+    hwcContext *                     context;
+    hwcArea *                        area;
+    gctUINT32                        eigenD;
+};
+
+/* _CanGroup for hwcPlanPasses. */
+static gctBOOL
+_CanGroupArea(
+    IN gctPOINTER Data,
+    IN gctUINT32 * Indices,
+    IN gctUINT32 Count
+    );
+
 /* Setup multi-source blit source. */
 static gceSTATUS
 _MultiSourceBlit(
     IN hwcContext * Context,
-    IN gctUINT32 Indices[4],
+    IN gctUINT32 * Indices,
     IN gctUINT32 Count,
     IN gctUINT32 EigenL,
     IN gctUINT32 EigenD,
     IN hwcArea * Area
     );
 
+/* 2D state setup through the state cache. */
+static void
+_ResetState(
+    IN hwcContext * Context
+    );
+
+static gceSTATUS
+_SetSourceIndex(
+    IN hwcContext * Context,
+    IN gctUINT32 Index
+    );
+
+static gceSTATUS
+_SetGenericTarget(
+    IN hwcContext * Context,
+    IN gctUINT32 Address,
+    IN gctUINT32 Width,
+    IN gctUINT32 Height
+    );
+
+static gceSTATUS
+_SetClipping(
+    IN hwcContext * Context,
+    IN gcsRECT * Rect
+    );
+
+static gceSTATUS
+_SetMirror(
+    IN hwcContext * Context,
+    IN gctBOOL HMirror,
+    IN gctBOOL VMirror
+    );
+
+static gceSTATUS
+_DisableAlphaBlend(
+    IN hwcContext * Context
+    );
+
+static gceSTATUS
+_EnableAlphaBlend(
+    IN hwcContext * Context,
+    IN hwcLayer * Layer
+    );
+
+static gceSTATUS
+_SetMultiplyMode(
+    IN hwcContext * Context,
+    IN gce2D_PIXEL_COLOR_MULTIPLY_MODE SrcPremultSrcAlpha,
+    IN gce2D_PIXEL_COLOR_MULTIPLY_MODE DstPremultDstAlpha,
+    IN gce2D_GLOBAL_COLOR_MULTIPLY_MODE SrcPremultGlobalMode,
+    IN gce2D_PIXEL_COLOR_MULTIPLY_MODE DstDemultDstAlpha
+    );
+
+static gceSTATUS
+_SetSourceGlobalColor(
+    IN hwcContext * Context,
+    IN gctUINT32 Color32
+    );
+
+static gceSTATUS
+_SetTargetGlobalColor(
+    IN hwcContext * Context,
+    IN gctUINT32 Color32
+    );
+
 
 /*******************************************************************************
 **
@@ -68,7 +184,16 @@ _MultiSourceBlit(
 **  1. Do swap rectangle optimization if enabled.
 **  2. Compose all layers which can be composed by hwcomposer: dim layer,
 **     'clear hole' layer, normal layer and 'overlay clear'.
-**  3. Fill worm holes with opaque black.
+**  3. Fill worm holes with opaque black, all in one clear.
+**
+**  Each area is clipped to every rectangle of the swap region it meets and
+**  composed once per clip, pixels between the damage rectangles are left
+**  alone.
+**
+**  The target is written compressed when hwcSet decided so for this frame.
+**
+**  2D states go through a shadow of the engine state (see hwcState), calls
+**  programming the value already set are skipped.
 **
 **  INPUT:
 **
@@ -90,11 +215,31 @@ hwcCompose(
     hwcFramebuffer * framebuffer = Context->framebuffer;
     hwcBuffer * target           = framebuffer->target;
 
+    /* Worm holes to clear. */
+    gcsRECT wormHoles[HWC_BATCH_RECTS];
+    gctUINT32 wormHoleCount = 0U;
+
+#if DUMP_STATE
+    gctUINT64 stateIssued = Context->stateIssued;
+    gctUINT64 stateElided = Context->stateElided;
+#endif
+
+#if DUMP_AREA_COUNT
+    gctUINT64 blits = Context->blits;
+#endif
+
+    /* Multi-source blit moves the target address to the area, which the tile
+     * status of a compressed target can not follow. */
+    gctBOOL multiSourceBlt = Context->multiSourceBlt && !target->compressed;
+
 #if DUMP_COMPOSE
 
     LOGD("COMPOSE %d layers", Context->layerCount);
 #endif
 
+    /* Engine may be used by others since last frame. */
+    _ResetState(Context);
+
 
     /***************************************************************************
     ** Swap Rectangle Optimization.
@@ -122,317 +267,337 @@ hwcCompose(
 
     area = Context->compositionArea;
 
-    /* Setup clipping to swap rectangle. */
-    gcmONERROR(
-        gco2D_SetClipping(Context->engine,
-                          &target->swapRect));
+    /* Count full screen pixels for this frame. */
+    Context->screenPixels += (gctUINT64) framebuffer->res.right
+                           * framebuffer->res.bottom;
 
     /* Go througn all areas. */
     while (area != NULL)
     {
-        /* Check worm hole first. */
-        if (area->owners == 0U)
-        {
-            /* Setup worm hole source. */
-            gcmONERROR(
-                _WormHole(Context, &area->rect));
+        gcsRECT clips[HWC_DAMAGE_RECTS];
+        gctUINT32 clipCount;
 
-            /* Advance to next area. */
-            area = area->next;
-            continue;
-        }
+        /* Compare with swap region. */
+        clipCount = _ClipArea(Context, area, clips);
 
-#if ENABLE_SWAP_RECTANGLE
-        /* Compare with swap rectangle. */
-        if ((area->rect.left   > target->swapRect.right)
-        ||  (area->rect.top    > target->swapRect.bottom)
-        ||  (area->rect.right  < target->swapRect.left)
-        ||  (area->rect.bottom < target->swapRect.top)
-        )
+        for (gctUINT32 c = 0; c < clipCount; c++)
         {
-            /* Skip areas out of swap rectangle. */
-            area = area->next;
-            continue;
+            Context->composedPixels += (gctUINT64) (clips[c].right - clips[c].left)
+                                     * (clips[c].bottom - clips[c].top);
+
+            /* Check worm hole first. */
+            if (hwcOwnersEmpty(&area->owners))
+            {
+                if (wormHoleCount == HWC_BATCH_RECTS)
+                {
+                    /* Batch is full. */
+                    gcmONERROR(
+                        _WormHole(Context, wormHoles, wormHoleCount));
+
+                    wormHoleCount = 0U;
+                }
+
+                /* Clip lies in the area, clear it directly. */
+                wormHoles[wormHoleCount++] = clips[c];
+                continue;
+            }
+
+            /* Setup clipping to the damaged part of the area. */
+            gcmONERROR(
+                _SetClipping(Context, &clips[c]));
+
+            /* Compose the damaged part of the area only. */
+            gcmONERROR(
+                _ComposeArea(Context, area, &clips[c], multiSourceBlt));
         }
-#endif
 
-        /* Detect multi-source capabitilty and adjust source/dest surface
-         * address(es) and coordinates according to hardware limitation.
-         *
-         * Multi-source blit limmitation is, source rectangle and dest rectangle
-         * must be the same (actually source rectnagle can be smaller than dest
-         * rectangle for second or more layers. But this feature makes no sense
-         * for hwcomposer).
-         * Secondly, physical address of the surfaces(source and dest) MUST be 8
-         * pixel aligned.
-         *
-         * We then need to move blit rectangle to a proper size and make some
-         * corresponding adjustment in physical address(es).
-         *
-         * Considering both limitations in surface address and rectangle
-         * coordinates, we move left coordinate to (0~7) which is the lowest 3
-         * bits of left coordinate of area rectangle aka dest rectangle. This
-         * can make dest surface address always aligned.
-         *
-         * Without rotation in source surface, we need check corresponding
-         * address of source address. But if source surface is rotated, which
-         * means, left coordinate is some vertical value for surface surface,
-         * so, it is always aligned because 'stride' is always 8 pixel aligned.
-         *
-         * In the same theory, top coordinate can be arbitrary value if source
-         * surface is not rotated because 'stride' is algned.  But if source
-         * surface rotated, top coordinate is actually some horizontal value for
-         * source surface. Let's pick up top/bottom coordinate from source
-         * surface and check the dest then.
-         */
+        /* Advance to next area. */
+        area = area->next;
+    }
 
-        /* Multi-source blit locals. */
-        gctUINT32 sourceIndices[4];
-        gctUINT32 sourceCount = 0U;
+    if (wormHoleCount > 0U)
+    {
+        /* Clear all worm holes. */
+        gcmONERROR(
+            _WormHole(Context, wormHoles, wormHoleCount));
+    }
 
-        /* Get dest eigen value. */
-        gctUINT32 eigenD = area->rect.left
-                         & ((16 / framebuffer->bytesPerPixel - 1));
+#if DUMP_DAMAGE
 
-        /* Source eigen values. */
-        gctUINT32 eigenL = 0U;
+    LOGD("DAMAGE %d rects, composed %llu/%llu pixels",
+         Context->swapRegion.count,
+         (unsigned long long) Context->composedPixels,
+         (unsigned long long) Context->screenPixels);
+#endif
 
-        /* YUV input existed.
-         * Multi-source blit can only support one YUV input. */
-        gctBOOL hasYuv   = gcvFALSE;
+#if DUMP_STATE
 
-        /* Last source rotation. */
-        /* TODO: Support different rotation for sources. */
-        gceSURF_ROTATION rotation = gcvSURF_0_DEGREE;
+    LOGD("STATE %llu calls issued, %llu elided",
+         (unsigned long long) (Context->stateIssued - stateIssued),
+         (unsigned long long) (Context->stateElided - stateElided));
+#endif
 
-        /* eigenvalues determined?. */
-        gctBOOL determined = gcvFALSE;
+#if DUMP_AREA_COUNT
 
-        /* Has multiple layers for this area?
-         * If it is not the case, we do not need multi-source blit. */
-        gctBOOL multiLayer = ((area->owners - 1U) & (area->owners)) != 0U;
+    LOGD("BLITS %llu submitted",
+         (unsigned long long) (Context->blits - blits));
+#endif
 
-        /* Go through all layers. */
-        for (gctUINT32 i = 0; i < Context->layerCount; i++)
-        {
-            gctUINT32 owner = (1U << i);
+#if ENABLE_COMPRESSED_FB
+    if (target->compressed)
+    {
+        /* Do not leave tile status on for other users of the engine. */
+        gcmONERROR(
+            gco2D_SetTargetTileStatus(Context->engine,
+                                      gcv2D_TSC_DISABLE,
+                                      gcvSURF_UNKNOWN,
+                                      0U,
+                                      ~0U));
+    }
+#endif
 
-            if (!(area->owners & owner))
-            {
-                if (owner > area->owners)
-                {
-                    /* No more layers. */
-                    break;
-                }
+    return gcvSTATUS_OK;
 
-                /* No such layer, go to next. */
-                continue;
-            }
+OnError:
+    LOGE("Failed in %s: status=%d", __FUNCTION__, status);
+    return status;
+}
 
-            /* Get short cut. */
-            hwcLayer * layer = &Context->layers[i];
 
-            /* Check multi-source blit when multiple layers are there. */
-            if (multiLayer && Context->multiSourceBlt)
-            {
-                /* Check source surface. */
-                if (layer->source == gcvNULL)
-                {
-                    /* No source layers will not affect this detection.  But if
-                     * it is the case, this layer can be done with multi-source
-                     * blit.
-                     *
-                     * No source layers are: OVERLAY, DIM and CLEAR_HOLE.
-                     *
-                     * For OVERLAY, it will have only one layer in the area
-                     * (see hwcSet, OVERLAY correction part), so it will never
-                     * come here.
-                     *
-                     * For DIM, since we optimized DIM as global alpha
-                     * premultiply, it will not affect anything. But a corener
-                     * case is, when the DIM layer is on the very bottom of
-                     * this area. We must treat it as a layer and use a solid
-                     * brush for color source.
-                     *
-                     * For CLEAR_HOLE, it can only be on the very bottom (see
-                     * hwcSet, CLEAR_HOLE correction part). We treat it as a
-                     * layer and use a solid brush for color source.
-                     *
-                     * Multi-source blit can only have one solid brush. So it
-                     * will have problems if multiple layers are no source
-                     * layers. Fortunately, this problem can never happen
-                     * because bottom DIM layer and bottom CLEAR_HOLE layer can
-                     * never exist together.
-                     *
-                     * So here we only treat a very bottom no source layer as
-                     * a multi-source blit source input. Do thing for other
-                     * cases(must be other DIM layers).
-                     */
-                    if (((owner - 1U) & area->owners) == 0U)
-                    {
-                        /* Update source array. */
-                        sourceIndices[sourceCount++] = i;
-                    }
-
-                    /* No source layers is always handled. */
-                    continue;
-                }
+/*******************************************************************************
+**
+**  _ComposeArea
+**
+**  Blit the owner layers of an area, bottom to top, in as few multi-source
+**  passes as possible.
+**
+**  INPUT:
+**
+**      hwcContext * Context
+**          hwcomposer context pointer.
+**
+**      hwcArea * Area
+**          Area to compose, not a worm hole.
+**
+**      gcsRECT * Clip
+**          Damaged part of the area, the clipping rectangle.
+**
+**      gctBOOL MultiSourceBlt
+**          Multi-source blit can be used for this target.
+**
+**  OUTPUT:
+**
+**      Nothing.
+*/
+gceSTATUS
+_ComposeArea(
+    IN hwcContext * Context,
+    IN hwcArea * Area,
+    IN gcsRECT * Clip,
+    IN gctBOOL MultiSourceBlt
+    )
+{
+    gceSTATUS status;
+    hwcFramebuffer * framebuffer = Context->framebuffer;
 
-                /* Get eigenvalue of the area on this layer.
-                 * See _GetSourceEigen on what eigenvalue means here. */
-                gctUINT32 eigen = _GetSourceEigen(layer, &area->rect);
+    /* Detect multi-source capabitilty and adjust source/dest surface
+     * address(es) and coordinates according to hardware limitation.
+     *
+     * Multi-source blit limmitation is, source rectangle and dest rectangle
+     * must be the same (actually source rectnagle can be smaller than dest
+     * rectangle for second or more layers. But this feature makes no sense
+     * for hwcomposer).
+     * Secondly, physical address of the surfaces(source and dest) MUST be 8
+     * pixel aligned.
+     *
+     * We then need to move blit rectangle to a proper size and make some
+     * corresponding adjustment in physical address(es).
+     *
+     * Considering both limitations in surface address and rectangle
+     * coordinates, we move left coordinate to (0~7) which is the lowest 3
+     * bits of left coordinate of area rectangle aka dest rectangle. This
+     * can make dest surface address always aligned.
+     *
+     * Without rotation in source surface, we need check corresponding
+     * address of source address. But if source surface is rotated, which
+     * means, left coordinate is some vertical value for surface surface,
+     * so, it is always aligned because 'stride' is always 8 pixel aligned.
+     *
+     * In the same theory, top coordinate can be arbitrary value if source
+     * surface is not rotated because 'stride' is algned.  But if source
+     * surface rotated, top coordinate is actually some horizontal value for
+     * source surface. Let's pick up top/bottom coordinate from source
+     * surface and check the dest then.
+     */
 
-                if (determined)
-                {
-                    /* Source engin must be the same to do multi-source blit
-                     * together with previous layers.  */
-                    if ((eigen == eigenL)
-                    &&  (layer->stretch  == gcvFALSE)
-                    &&  (layer->rotation == rotation)
-                    &&  (
-                            (hasYuv == gcvFALSE)
-                        ||  (layer->yuv == gcvFALSE)
-                        )
-                    )
-                    {
-                        /* Update source array. */
-                        sourceIndices[sourceCount++] = i;
-
-                        /* Update hasYuv flag. */
-                        hasYuv = layer->yuv;
-
-                        /* Check max source limitation. */
-                        if ((
-                               (!Context->layers[sourceIndices[0]].opaque)
-                            && (sourceCount >= Context->maxSource - 1)
-                            )
-                        ||  (sourceCount >= Context->maxSource)
-                        )
-                        {
-                            /* Trigger multi-source blit. */
-                            gcmONERROR(
-                                _MultiSourceBlit(Context,
-                                                 sourceIndices,
-                                                 sourceCount,
-                                                 eigenL,
-                                                 eigenD,
-                                                 area));
-
-                            sourceCount = 0U;
-                            hasYuv      = gcvFALSE;
-                            determined  = gcvFALSE;
-                        }
-
-                        continue;
-                    }
-
-                    else
-                    {
-                        /* This layer can not do multi-source with previous
-                         * layers. So we need to start multi-source blit on
-                         * accumulated previous layers. */
-                        if (sourceCount > 1)
-                        {
-                            /* Trigger multi-source blit. */
-                            gcmONERROR(
-                                _MultiSourceBlit(Context,
-                                                 sourceIndices,
-                                                 sourceCount,
-                                                 eigenL,
-                                                 eigenD,
-                                                 area));
-                        }
-
-                        else
-                        /* sourceCount == 1 */
-                        {
-                            /* Use single-source blit instead. */
-                            gcmONERROR(_Blit(Context, sourceIndices[0], area));
-                        }
-
-                        /* Reset multi-source count. */
-                        sourceCount = 0U;
-                        hasYuv      = gcvFALSE;
-                    }
-                }
+    /* Layers to blit for this area, bottom to top. */
+    gctUINT32 indices[HWC_MAX_LAYERS];
+    gctUINT32 count = 0U;
 
-                /* eigenL is not determined, or this layer can not do multi-
-                 * source blit with preivous layers.  but it may be able to
-                 * do multi-source blit still with later layers. */
-                determined = (layer->stretch == gcvFALSE)
-                          && (
-                                 (layer->rotation != gcvSURF_0_DEGREE)
-                              || (eigen == eigenD)
-                             );
+    /* Layer count of each pass. */
+    gctUINT32 lengths[HWC_MAX_LAYERS];
+    gctUINT32 passCount;
+    struct _hwcGroupArea group;
 
-                if (determined)
-                {
-                    /* Yes, this layer can use multi-source blit. */
-                    eigenL = eigen;
+    /* Multi-source blits cover the damaged part of the area only. */
+    hwcArea part = *Area;
 
-                    /* Update source count. */
-                    sourceIndices[sourceCount++] = i;
+    part.rect = *Clip;
 
-                    /* Update hasYuv flag. */
-                    hasYuv = layer->yuv;
+    /* Get dest eigen value. */
+    gctUINT32 eigenD = part.rect.left
+                     & ((16 / framebuffer->bytesPerPixel - 1));
 
-                    /* Update source rotation. */
-                    rotation = layer->rotation;
+    /* Go through owner layers only. */
+    for (gctUINT32 i = hwcOwnersNext(&Area->owners, 0);
+         i < Context->layerCount;
+         i = hwcOwnersNext(&Area->owners, i + 1))
+    {
+        /* No source layers are OVERLAY, DIM and CLEAR_HOLE.
+         *
+         * For OVERLAY, it will have only one layer in the area (see
+         * hwcSet, OVERLAY correction part).
+         *
+         * For DIM, since we optimized DIM as global alpha premultiply, it
+         * will not affect anything. But a corener case is, when the DIM
+         * layer is on the very bottom of this area. We must treat it as a
+         * layer and use a solid brush for color source.
+         *
+         * For CLEAR_HOLE, it can only be on the very bottom (see hwcSet,
+         * CLEAR_HOLE correction part). We treat it as a layer and use a
+         * solid brush for color source.
+         *
+         * Multi-source blit can only have one solid brush. Fortunately,
+         * bottom DIM layer and bottom CLEAR_HOLE layer can never exist
+         * together. So only a very bottom no source layer is blitted. */
+        if ((Context->layers[i].source == gcvNULL)
+        &&  hwcOwnersBelow(&Area->owners, i)
+        )
+        {
+            continue;
+        }
 
-                    continue;
-                }
+        indices[count++] = i;
+    }
 
-                else if (sourceCount > 0)
-                {
-                    /* Layer exists before the first source layer, there must
-                     * be a no-source DIM layer. And must be ONLY ONE. Blit
-                     * the previous DIM layer before current layer. */
-                    gcmONERROR(_Blit(Context, sourceIndices[0], area));
+    /* Partition layers into multi-source passes. */
+    group.context = Context;
+    group.area    = &part;
+    group.eigenD  = eigenD;
 
-                    /* Reset source count. */
-                    sourceCount = 0U;
-                }
-            }
+    passCount = hwcPlanPasses(indices,
+                              count,
+                              MultiSourceBlt ? Context->maxSource : 1U,
+                              _CanGroupArea,
+                              &group,
+                              lengths);
 
-            if ((layer->source == gcvNULL)
-            &&  (((owner - 1U) & area->owners) != 0U)
-            )
-            {
-                /* Skip all non-bottom and no-source layers.
-                 * See comments above for reason. */
-                continue;
-            }
+#if DUMP_COMPOSE
+    LOGD("  %d layers in %d passes", count, passCount);
+#endif
 
+    for (gctUINT32 p = 0, first = 0; p < passCount; first += lengths[p++])
+    {
+        if (lengths[p] == 1U)
+        {
             /* Using single source blit. */
-            gcmONERROR(_Blit(Context, i, area));
+            gcmONERROR(_Blit(Context, indices[first], Area, Clip));
         }
 
-        /* Start multi-source blit for accumulated layers if any. */
-        if (Context->multiSourceBlt && sourceCount > 0)
+        else
         {
-            if (sourceCount > 1)
-            {
-                /* Trigger multi-source blit. */
-                gcmONERROR(
-                    _MultiSourceBlit(Context,
-                                     sourceIndices,
-                                     sourceCount,
-                                     eigenL,
-                                     eigenD,
-                                     area));
-            }
+            /* Eigenvalue of the first layer with source. A no source
+             * layer can only be the first one. */
+            gctUINT32 anchor = first
+                             + (Context->layers[indices[first]].source == gcvNULL);
 
-            else
-            /* sourceCount == 1 */
-            {
-                /* Use single-source blit instead. */
-                gcmONERROR(_Blit(Context, sourceIndices[0], area));
-            }
+            gctUINT32 eigenL =
+                _GetSourceEigen(&Context->layers[indices[anchor]],
+                                &part.rect);
+
+            /* Trigger multi-source blit. */
+            gcmONERROR(
+                _MultiSourceBlit(Context,
+                                 &indices[first],
+                                 lengths[p],
+                                 eigenL,
+                                 eigenD,
+                                 &part));
         }
+    }
 
-        /* Advance to next area. */
-        area = area->next;
+    return gcvSTATUS_OK;
+
+OnError:
+    LOGE("Failed in %s: status=%d", __FUNCTION__, status);
+    return status;
+}
+
+
+gctUINT32
+_ClipArea(
+    IN hwcContext * Context,
+    IN hwcArea * Area,
+    OUT gcsRECT * Clips
+    )
+{
+    hwcRegion * region = &Context->swapRegion;
+    gctUINT32 count    = 0U;
+
+    /* One clip per region rectangle meeting the area. Region rectangles may
+     * overlap, every clip recomposes from the ground layer so an overlap
+     * composed twice gets the same pixels. */
+    for (gctUINT32 i = 0; i < region->count; i++)
+    {
+        gcsRECT * rect = &region->rects[i];
+        gcsRECT * clip = &Clips[count];
+
+        clip->left   = gcmMAX(Area->rect.left,   rect->left);
+        clip->top    = gcmMAX(Area->rect.top,    rect->top);
+        clip->right  = gcmMIN(Area->rect.right,  rect->right);
+        clip->bottom = gcmMIN(Area->rect.bottom, rect->bottom);
+
+        if ((clip->left >= clip->right) || (clip->top >= clip->bottom))
+        {
+            /* Not intersected. */
+            continue;
+        }
+
+        count++;
+    }
+
+    return count;
+}
+
+
+gceSTATUS
+_SetTarget(
+    IN hwcContext * Context
+    )
+{
+    gceSTATUS status;
+    hwcFramebuffer * framebuffer = Context->framebuffer;
+    hwcBuffer * target           = framebuffer->target;
+
+    gcmONERROR(
+        _SetGenericTarget(Context,
+                          target->physical,
+                          framebuffer->res.right,
+                          framebuffer->res.bottom));
+
+#if ENABLE_COMPRESSED_FB
+    if (target->compressed)
+    {
+        /* Compress into the header room gralloc reserved after the pixels. */
+        gcmONERROR(
+            gco2D_SetTargetTileStatus(Context->engine,
+                                      gcv2D_TSC_2D_COMPRESSED,
+                                      framebuffer->format,
+                                      0U,
+                                      target->physical
+                                      + framebuffer->headerOffset));
     }
+#endif
 
     return gcvSTATUS_OK;
 
@@ -450,8 +615,13 @@ _SwapRectangle(
     gceSTATUS status;
     hwcFramebuffer * framebuffer = Context->framebuffer;
     hwcBuffer * target           = framebuffer->target;
+    hwcBuffer * front            = framebuffer->front;
     hwcArea * area               = Context->swapArea;
 
+    /* Rectangles to copy. */
+    gcsRECT rects[HWC_BATCH_RECTS];
+    gctUINT32 count = 0U;
+
 
     /***************************************************************************
     ** Setup Source.
@@ -459,12 +629,12 @@ _SwapRectangle(
 
     /* Setup source index. */
     gcmONERROR(
-        gco2D_SetCurrentSourceIndex(Context->engine, 0U));
+        _SetSourceIndex(Context, 0U));
 
     /* Setup source. */
     gcmONERROR(
         gco2D_SetGenericSource(Context->engine,
-                               &target->prev->physical,
+                               &front->physical,
                                1U,
                                &framebuffer->stride,
                                1U,
@@ -474,28 +644,42 @@ _SwapRectangle(
                                framebuffer->res.right,
                                framebuffer->res.bottom));
 
+#if ENABLE_COMPRESSED_FB
+    if (front->compressed)
+    {
+        /* Front buffer holds a compressed frame. */
+        gcmONERROR(
+            gco2D_SetSourceTileStatus(Context->engine,
+                                      gcv2D_TSC_2D_COMPRESSED,
+                                      framebuffer->format,
+                                      0U,
+                                      front->physical
+                                      + framebuffer->headerOffset));
+    }
+#endif
+
     /* Setup mirror. */
     gcmONERROR(
-        gco2D_SetBitBlitMirror(Context->engine,
-                               gcvFALSE,
-                               gcvFALSE));
+        _SetMirror(Context,
+                   gcvFALSE,
+                   gcvFALSE));
 
     /* Disable alhpa blending. */
     gcmONERROR(
-        gco2D_DisableAlphaBlend(Context->engine));
+        _DisableAlphaBlend(Context));
 
     /* Disable premultiply. */
     gcmONERROR(
-        gco2D_SetPixelMultiplyModeAdvanced(Context->engine,
-                                           gcv2D_COLOR_MULTIPLY_DISABLE,
-                                           gcv2D_COLOR_MULTIPLY_DISABLE,
-                                           gcv2D_GLOBAL_COLOR_MULTIPLY_DISABLE,
-                                           gcv2D_COLOR_MULTIPLY_DISABLE));
+        _SetMultiplyMode(Context,
+                         gcv2D_COLOR_MULTIPLY_DISABLE,
+                         gcv2D_COLOR_MULTIPLY_DISABLE,
+                         gcv2D_GLOBAL_COLOR_MULTIPLY_DISABLE,
+                         gcv2D_COLOR_MULTIPLY_DISABLE));
 
     /* Setup clipping to full screen. */
     gcmONERROR(
-        gco2D_SetClipping(Context->engine,
-                          &framebuffer->res));
+        _SetClipping(Context,
+                     &framebuffer->res));
 
 
     /***************************************************************************
@@ -503,16 +687,7 @@ _SwapRectangle(
     */
 
     gcmONERROR(
-        gco2D_SetGenericTarget(Context->engine,
-                               &target->physical,
-                               1U,
-                               &framebuffer->stride,
-                               1U,
-                               framebuffer->tiling,
-                               framebuffer->format,
-                               gcvSURF_0_DEGREE,
-                               framebuffer->res.right,
-                               framebuffer->res.bottom));
+        _SetTarget(Context));
 
     /***************************************************************************
     ** Copy Swap Areas.
@@ -522,17 +697,25 @@ _SwapRectangle(
     {
         /* Blit only layers without owners. No owner means we need copy area
          * from front buffer to current. */
-        if (area->owners == 0U)
+        if (hwcOwnersEmpty(&area->owners))
         {
-            /* Do batchblit. */
-            gcmONERROR(
-                gco2D_BatchBlit(Context->engine,
-                                1U,
-                                &area->rect,
-                                &area->rect,
-                                0xCC,
-                                0xCC,
-                                framebuffer->format));
+            if (count == HWC_BATCH_RECTS)
+            {
+                /* Batch is full. */
+                gcmONERROR(
+                    gco2D_BatchBlit(Context->engine,
+                                    count,
+                                    rects,
+                                    rects,
+                                    0xCC,
+                                    0xCC,
+                                    framebuffer->format));
+
+                Context->blits++;
+                count = 0U;
+            }
+
+            rects[count++] = area->rect;
 
 #if DUMP_COMPOSE
 
@@ -541,7 +724,7 @@ _SwapRectangle(
              area->rect.top,
              area->rect.right,
              area->rect.bottom,
-             target->prev->physical,
+             front->physical,
              target->physical);
 #endif
         }
@@ -550,18 +733,47 @@ _SwapRectangle(
         area = area->next;
     }
 
-    return gcvSTATUS_OK;
+    if (count > 0U)
+    {
+        /* Copy all swap areas in one batchblit. */
+        gcmONERROR(
+            gco2D_BatchBlit(Context->engine,
+                            count,
+                            rects,
+                            rects,
+                            0xCC,
+                            0xCC,
+                            framebuffer->format));
+
+        Context->blits++;
+    }
 
-OnError:
-    LOGE("Failed in %s: status=%d", __FUNCTION__, status);
-    return status;
+#if ENABLE_COMPRESSED_FB
+    if (front->compressed)
+    {
+        /* Layer sources use the same source index. */
+        gcmONERROR(
+            gco2D_SetSourceTileStatus(Context->engine,
+                                      gcv2D_TSC_DISABLE,
+                                      gcvSURF_UNKNOWN,
+                                      0U,
+                                      ~0U));
+    }
+#endif
+
+    return gcvSTATUS_OK;
+
+OnError:
+    LOGE("Failed in %s: status=%d", __FUNCTION__, status);
+    return status;
 }
 
 
 gceSTATUS
 _WormHole(
     IN hwcContext * Context,
-    IN gcsRECT * Rect
+    IN gcsRECT * Rects,
+    IN gctUINT32 Count
     )
 {
     gceSTATUS status;
@@ -570,49 +782,50 @@ _WormHole(
 
     /* Disable alpha blending. */
     gcmONERROR(
-        gco2D_DisableAlphaBlend(Context->engine));
+        _DisableAlphaBlend(Context));
 
     /* No premultiply. */
     gcmONERROR(
-        gco2D_SetPixelMultiplyModeAdvanced(Context->engine,
-                                           gcv2D_COLOR_MULTIPLY_DISABLE,
-                                           gcv2D_COLOR_MULTIPLY_DISABLE,
-                                           gcv2D_GLOBAL_COLOR_MULTIPLY_DISABLE,
-                                           gcv2D_COLOR_MULTIPLY_DISABLE));
+        _SetMultiplyMode(Context,
+                         gcv2D_COLOR_MULTIPLY_DISABLE,
+                         gcv2D_COLOR_MULTIPLY_DISABLE,
+                         gcv2D_GLOBAL_COLOR_MULTIPLY_DISABLE,
+                         gcv2D_COLOR_MULTIPLY_DISABLE));
 
     /* Setup Target. */
     gcmONERROR(
-        gco2D_SetGenericTarget(Context->engine,
-                               &target->physical,
-                               1U,
-                               &framebuffer->stride,
-                               1U,
-                               framebuffer->tiling,
-                               framebuffer->format,
-                               gcvSURF_0_DEGREE,
-                               framebuffer->res.right,
-                               framebuffer->res.bottom));
+        _SetTarget(Context));
+
+    /* Rectangles are already clipped. */
+    gcmONERROR(
+        _SetClipping(Context,
+                     &framebuffer->res));
 
 #if DUMP_COMPOSE
 
+    for (gctUINT32 i = 0; i < Count; i++)
+    {
         LOGD("  WORMHOLE: [%d,%d,%d,%d] (%08x)",
-             Rect->left,
-             Rect->top,
-             Rect->right,
-             Rect->bottom,
+             Rects[i].left,
+             Rects[i].top,
+             Rects[i].right,
+             Rects[i].bottom,
              framebuffer->target->physical);
+    }
 #endif
 
     /* Perform a Clear. */
     gcmONERROR(
         gco2D_Clear(Context->engine,
-                    1U,
-                    Rect,
+                    Count,
+                    Rects,
                     0x00000000,
                     0xCC,
                     0xCC,
                     framebuffer->format));
 
+    Context->blits++;
+
 
     return gcvSTATUS_OK;
 
@@ -627,11 +840,14 @@ gceSTATUS
 _Blit(
     IN hwcContext * Context,
     IN gctUINT32 Index,
-    IN hwcArea * Area
+    IN hwcArea * Area,
+    IN gcsRECT * Clip
     )
 {
     gceSTATUS status;
     gcsRECT srcRect;
+    gcsRECT rect;
+    gcsRECT subRect;
 
     hwcFramebuffer * framebuffer = Context->framebuffer;
     hwcBuffer * target           = framebuffer->target;
@@ -639,7 +855,16 @@ _Blit(
     hwcLayer * layer = &Context->layers[Index];
 
     /* This layer is the very bottom layer? */
-    gctBOOL ground = (((1U << Index) - 1U) & Area->owners) == 0U;
+    gctBOOL ground = !hwcOwnersBelow(&Area->owners, Index);
+
+    /* Resampling blits go over the whole area so that the source mapping
+     * does not depend on the damage; clipping restricts the output. */
+    hwcBlitRect(&Area->rect,
+                Clip,
+                (layer->blitType == HWC_BLIT_FILTER)
+                || (layer->blitType == HWC_BLIT_STRETCH),
+                &rect,
+                &subRect);
 
 
     /***************************************************************************
@@ -667,24 +892,18 @@ _Blit(
     gctBOOL   hasDim   = gcvFALSE;
     gctUINT32 alphaDim = 0xFF;
 
-    if (Context->hasDim)
+    /* DIM layers above which cover this area. */
+    for (gctUINT32 i = hwcOwnersNext(&layer->dimMask, Index + 1);
+         i < HWC_MAX_LAYERS;
+         i = hwcOwnersNext(&layer->dimMask, i + 1))
     {
-        /* Go through above layers. */
-        for (gctUINT32 i = Index + 1; i < Context->layerCount; i++)
+        if (hwcOwnersHas(&Area->owners, i))
         {
-            gctUINT32 owner = (1U << i);
-
-            if ((Context->layers[i].opaque == gcvFALSE)
-            &&  (Context->layers[i].compositionType == HWC_DIM)
-            &&  (Area->owners & owner)
-            )
-            {
-               /* OK, find a dim layer and it covers the currect layer. */
-               alphaDim  *= 0xFF - (Context->layers[i].color32 >> 24);
-               alphaDim >>= 8;
+           /* OK, find a dim layer and it covers the currect layer. */
+           alphaDim  *= 0xFF - (Context->layers[i].color32 >> 24);
+           alphaDim >>= 8;
 
-               hasDim = gcvTRUE;
-            }
+           hasDim = gcvTRUE;
         }
     }
 
@@ -695,41 +914,20 @@ _Blit(
 
     /* Setup source index. */
     gcmONERROR(
-        gco2D_SetCurrentSourceIndex(Context->engine, 0U));
+        _SetSourceIndex(Context, 0U));
 
     /* Setup source. */
     if (layer->source != gcvNULL)
     {
-        /* Get shortcuts. */
-        gctFLOAT hfactor = layer->hfactor;
-        gctFLOAT vfactor = layer->vfactor;
-
-        /* Compute delta(s). */
-        gctFLOAT dl = (layer->dstRect.left   - Area->rect.left)   * hfactor;
-        gctFLOAT dt = (layer->dstRect.top    - Area->rect.top)    * vfactor;
-        gctFLOAT dr = (layer->dstRect.right  - Area->rect.right)  * hfactor;
-        gctFLOAT db = (layer->dstRect.bottom - Area->rect.bottom) * vfactor;
-
-        if (layer->hMirror)
-        {
-            gctFLOAT tl = dl;
-
-            dl = -dr;
-            dr = -tl;
-        }
-
-        if (layer->vMirror)
-        {
-            gctFLOAT tt = dt;
-
-            dt = -db;
-            db = -tt;
-        }
-
-        srcRect.left   = gctINT(layer->srcRect.left   - dl);
-        srcRect.top    = gctINT(layer->srcRect.top    - dt);
-        srcRect.right  = gctINT(layer->srcRect.right  - dr);
-        srcRect.bottom = gctINT(layer->srcRect.bottom - db);
+        /* Map blit rectangle back to source. */
+        hwcMapSource(&layer->srcRect,
+                     &layer->dstRect,
+                     layer->hfactor,
+                     layer->vfactor,
+                     layer->hMirror,
+                     layer->vMirror,
+                     &rect,
+                     &srcRect);
 
         /* TODO: skip if out of clip rectangle. */
         gcmONERROR(
@@ -746,9 +944,9 @@ _Blit(
 
         /* Setup mirror. */
         gcmONERROR(
-            gco2D_SetBitBlitMirror(Context->engine,
-                                   layer->hMirror,
-                                   layer->vMirror));
+            _SetMirror(Context,
+                       layer->hMirror,
+                       layer->vMirror));
 
 
         /* Set source rect. */
@@ -767,10 +965,10 @@ _Blit(
              srcRect.right,
              srcRect.bottom,
              layer->addresses[0],
-             Area->rect.left,
-             Area->rect.top,
-             Area->rect.right,
-             Area->rect.bottom,
+             rect.left,
+             rect.top,
+             rect.right,
+             rect.bottom,
              framebuffer->target->physical);
 #endif
     }
@@ -789,10 +987,10 @@ _Blit(
         LOGD("  BLIT: layer[%d]: color32=0x%08x => [%d,%d,%d,%d] (%08x)",
              Index,
              layer->color32,
-             Area->rect.left,
-             Area->rect.top,
-             Area->rect.right,
-             Area->rect.bottom,
+             rect.left,
+             rect.top,
+             rect.right,
+             rect.bottom,
              framebuffer->target->physical);
 #endif
     }
@@ -807,19 +1005,13 @@ _Blit(
          * But we can easily disable alpha blending to get the same
          * result. */
         gcmONERROR(
-            gco2D_DisableAlphaBlend(Context->engine));
+            _DisableAlphaBlend(Context));
     }
 
     else
     {
         gcmONERROR(
-            gco2D_EnableAlphaBlendAdvanced(Context->engine,
-                                           layer->srcAlphaMode,
-                                           layer->dstAlphaMode,
-                                           layer->srcGlobalAlphaMode,
-                                           layer->dstGlobalAlphaMode,
-                                           layer->srcFactorMode,
-                                           layer->dstFactorMode));
+            _EnableAlphaBlend(Context, layer));
     }
 
     /* Setup premultiply. */
@@ -833,37 +1025,37 @@ _Blit(
 
         /* Dim optimization. */
         gcmONERROR(
-            gco2D_SetPixelMultiplyModeAdvanced(Context->engine,
-                                               layer->srcPremultSrcAlpha,
-                                               layer->dstPremultDstAlpha,
-                                               gcv2D_GLOBAL_COLOR_MULTIPLY_ALPHA,
-                                               layer->dstDemultDstAlpha));
+            _SetMultiplyMode(Context,
+                             layer->srcPremultSrcAlpha,
+                             layer->dstPremultDstAlpha,
+                             gcv2D_GLOBAL_COLOR_MULTIPLY_ALPHA,
+                             layer->dstDemultDstAlpha));
 
         gcmONERROR(
-            gco2D_SetSourceGlobalColorAdvanced(Context->engine,
-                                               srcGlobalAlpha));
+            _SetSourceGlobalColor(Context,
+                                  srcGlobalAlpha));
 
         gcmONERROR(
-            gco2D_SetTargetGlobalColorAdvanced(Context->engine,
-                                               dstGlobalAlpha));
+            _SetTargetGlobalColor(Context,
+                                  dstGlobalAlpha));
     }
 
     else
     {
         gcmONERROR(
-            gco2D_SetPixelMultiplyModeAdvanced(Context->engine,
-                                               layer->srcPremultSrcAlpha,
-                                               layer->dstPremultDstAlpha,
-                                               layer->srcPremultGlobalMode,
-                                               layer->dstDemultDstAlpha));
+            _SetMultiplyMode(Context,
+                             layer->srcPremultSrcAlpha,
+                             layer->dstPremultDstAlpha,
+                             layer->srcPremultGlobalMode,
+                             layer->dstDemultDstAlpha));
 
         gcmONERROR(
-            gco2D_SetSourceGlobalColorAdvanced(Context->engine,
-                                               layer->srcGlobalAlpha));
+            _SetSourceGlobalColor(Context,
+                                  layer->srcGlobalAlpha));
 
         gcmONERROR(
-            gco2D_SetTargetGlobalColorAdvanced(Context->engine,
-                                               layer->dstGlobalAlpha));
+            _SetTargetGlobalColor(Context,
+                                  layer->dstGlobalAlpha));
     }
 
 
@@ -872,118 +1064,108 @@ _Blit(
     */
 
     gcmONERROR(
-        gco2D_SetGenericTarget(Context->engine,
-                               &target->physical,
-                               1U,
-                               &framebuffer->stride,
-                               1U,
-                               framebuffer->tiling,
-                               framebuffer->format,
-                               gcvSURF_0_DEGREE,
-                               framebuffer->res.right,
-                               framebuffer->res.bottom));
+        _SetTarget(Context));
 
 
     /***************************************************************************
     ** Start Single-Source Blit(Clear).
     */
 
-    if (layer->source != gcvNULL)
+    switch (layer->blitType)
     {
-        if ((layer->yuv)
-        &&  (layer->stretch || Context->opf == gcvFALSE)
-        )
-        {
-            /* Use filterBlit to blit YUV source if YUV blit not supported. */
-            /* Set kernel size. */
-            gcmONERROR(
-                gco2D_SetKernelSize(Context->engine,
-                                    layer->hkernel,
-                                    layer->vkernel));
+    case HWC_BLIT_FILTER:
+        /* Use filterBlit to blit YUV source if YUV blit not supported. */
+        /* Set kernel size. */
+        gcmONERROR(
+            gco2D_SetKernelSize(Context->engine,
+                                layer->hkernel,
+                                layer->vkernel));
 
-            gcmONERROR(
-                gco2D_SetFilterType(Context->engine,
-                                    gcvFILTER_SYNC));
+        gcmONERROR(
+            gco2D_SetFilterType(Context->engine,
+                                gcvFILTER_SYNC));
 
-            /* Trigger filter blit. */
-            gcmONERROR(
-                gco2D_FilterBlitEx(Context->engine,
-                                   layer->addresses[0],
-                                   layer->strides[0],
-                                   layer->addresses[1],
-                                   layer->strides[1],
-                                   layer->addresses[2],
-                                   layer->strides[2],
-                                   layer->format,
-                                   layer->rotation,
-                                   layer->width,
-                                   layer->height,
-                                   &srcRect,
-                                   target->physical,
-                                   framebuffer->stride,
-                                   framebuffer->format,
-                                   gcvSURF_0_DEGREE,
-                                   framebuffer->res.right,
-                                   framebuffer->res.bottom,
-                                   &Area->rect,
-                                   gcvNULL));
-        }
+        /* Trigger filter blit. */
+        gcmONERROR(
+            gco2D_FilterBlitEx(Context->engine,
+                               layer->addresses[0],
+                               layer->strides[0],
+                               layer->addresses[1],
+                               layer->strides[1],
+                               layer->addresses[2],
+                               layer->strides[2],
+                               layer->format,
+                               layer->rotation,
+                               layer->width,
+                               layer->height,
+                               &srcRect,
+                               target->physical,
+                               framebuffer->stride,
+                               framebuffer->format,
+                               gcvSURF_0_DEGREE,
+                               framebuffer->res.right,
+                               framebuffer->res.bottom,
+                               &rect,
+                               &subRect));
 
-        else if (layer->stretch)
-        {
-            /* Update stretch factors. */
-            gcmONERROR(
-                gco2D_SetStretchFactors(Context->engine,
-                                        (gctINT32) (layer->hfactor * 65536),
-                                        (gctINT32) (layer->vfactor * 65536)));
-            /* StretchBlit. */
-            gcmONERROR(
-                gco2D_StretchBlit(Context->engine,
-                                  1U,
-                                  &Area->rect,
-                                  0xCC,
-                                  0xCC,
-                                  framebuffer->format));
-        }
+        /* Filter blit programs target and source states of its own. */
+        _ResetState(Context);
+        break;
 
-        else
-        {
-            /* Do bit blit. */
-            gcmONERROR(
-                gco2D_Blit(Context->engine,
-                           1U,
-                           &Area->rect,
-                           0xCC,
-                           0xCC,
-                           framebuffer->format));
-        }
-    }
+    case HWC_BLIT_STRETCH:
+        /* Update stretch factors. */
+        gcmONERROR(
+            gco2D_SetStretchFactors(Context->engine,
+                                    layer->hfactor16,
+                                    layer->vfactor16));
+        /* StretchBlit. */
+        gcmONERROR(
+            gco2D_StretchBlit(Context->engine,
+                              1U,
+                              &rect,
+                              0xCC,
+                              0xCC,
+                              framebuffer->format));
+        break;
 
-    else if (layer->opaque)
-    {
+    case HWC_BLIT_BIT:
+    default:
+        /* Do bit blit. */
+        gcmONERROR(
+            gco2D_Blit(Context->engine,
+                       1U,
+                       &rect,
+                       0xCC,
+                       0xCC,
+                       framebuffer->format));
+        break;
+
+    case HWC_BLIT_CLEAR:
         /* Do clear. */
         gcmONERROR(
             gco2D_Clear(Context->engine,
                         1U,
-                        &Area->rect,
+                        &rect,
                         layer->color32,
                         0xCC,
                         0xCC,
                         framebuffer->format));
-    }
+        break;
 
-    else
-    {
+    case HWC_BLIT_PATTERN:
         /* Do bit blit. */
         gcmONERROR(
             gco2D_Blit(Context->engine,
                        1U,
-                       &Area->rect,
+                       &rect,
                        0xF0,
                        0xF0,
                        framebuffer->format));
+        break;
     }
 
+    Context->blits++;
+
     return gcvSTATUS_OK;
 
 OnError:
@@ -1047,35 +1229,162 @@ _GetSourceEigen(
     IN  gcsRECT *  DestRect
     )
 {
-    gctUINT32 left;
+    gctINT left;
 
-    /* Compute left coordinate value in origin coord sys. */
+    /* Compute left coordinate value in origin coord sys. The part from the
+     * layer alone is in eigenOrigin. */
     switch (Layer->rotation)
     {
     case gcvSURF_0_DEGREE:
     default:
-        left   = Layer->orgRect.left
-               - (Layer->dstRect.left   - DestRect->left);
+        left = Layer->eigenOrigin + DestRect->left;
         break;
 
     case gcvSURF_90_DEGREE:
-        left   = Layer->orgRect.left
-               + (Layer->dstRect.bottom - DestRect->bottom);
+        left = Layer->eigenOrigin - DestRect->bottom;
         break;
 
     case gcvSURF_180_DEGREE:
-        left   = Layer->orgRect.left
-               + (Layer->dstRect.right  - DestRect->right);
+        left = Layer->eigenOrigin - DestRect->right;
         break;
 
     case gcvSURF_270_DEGREE:
-        left   = Layer->orgRect.left
-               - (Layer->dstRect.top    - DestRect->top);
+        left = Layer->eigenOrigin + DestRect->top;
         break;
     }
 
     /* Generate source eigenvalue. */
-    return (left & ((Layer->yuv ? 64 : 16) / Layer->bytesPerPixel - 1));
+    return ((gctUINT32) left & Layer->eigenMask);
+}
+
+
+/*******************************************************************************
+**
+**  _CanGroup
+**
+**  Check whether layers can be blitted in one multi-source pass. Requirements
+**  are,
+**
+**  1. A no source layer can only be the first layer, as solid brush.
+**  2. Other layers must not be stretched. The first of them must have the
+**     same eigenvalue as dest if not rotated.
+**  3. Rotation and eigenvalue of all layers with source must be the same.
+**  4. At most one YUV input.
+**  5. Layers fit in maxSource, counting the target which is inserted as the
+**     first source when the first layer blends with layers below.
+**
+**  INPUT:
+**
+**      hwcContext * Context
+**          hwcomposer context pointer.
+**
+**      hwcArea * Area
+**          Area to compose.
+**
+**      gctUINT32 * Indices
+**          Layer indices, bottom to top.
+**
+**      gctUINT32 Count
+**          Layer count.
+**
+**      gctUINT32 EigenD
+**          Dest eigenvalue of the area.
+**
+**  OUTPUT:
+**
+**      Nothing.
+*/
+gctBOOL
+_CanGroup(
+    IN hwcContext * Context,
+    IN hwcArea * Area,
+    IN gctUINT32 * Indices,
+    IN gctUINT32 Count,
+    IN gctUINT32 EigenD
+    )
+{
+    hwcLayer * first = &Context->layers[Indices[0]];
+
+    /* First layer with source. */
+    gctUINT32 anchor = (first->source == gcvNULL) ? 1U : 0U;
+
+    /* Source slots taken. */
+    gctUINT32 slots = Count;
+
+    gctUINT32 eigenL = 0U;
+    gctBOOL hasYuv   = gcvFALSE;
+
+    gceSURF_ROTATION rotation = gcvSURF_0_DEGREE;
+
+    if (!first->opaque
+    &&  hwcOwnersBelow(&Area->owners, Indices[0])
+    )
+    {
+        /* Target will be inserted as source 0. */
+        slots++;
+    }
+
+    if ((Count < 2U) || (slots > Context->maxSource))
+    {
+        return gcvFALSE;
+    }
+
+    for (gctUINT32 i = anchor; i < Count; i++)
+    {
+        hwcLayer * layer = &Context->layers[Indices[i]];
+        gctUINT32 eigen;
+
+        if ((layer->source == gcvNULL) || layer->stretch)
+        {
+            return gcvFALSE;
+        }
+
+        eigen = _GetSourceEigen(layer, &Area->rect);
+
+        if (i == anchor)
+        {
+            /* eigenL and eigenD must be the same when no rotation. */
+            if ((layer->rotation == gcvSURF_0_DEGREE) && (eigen != EigenD))
+            {
+                return gcvFALSE;
+            }
+
+            eigenL   = eigen;
+            rotation = layer->rotation;
+        }
+
+        else if ((eigen != eigenL) || (layer->rotation != rotation))
+        {
+            /* TODO: Support different rotation for sources. */
+            return gcvFALSE;
+        }
+
+        if (layer->yuv)
+        {
+            if (hasYuv)
+            {
+                /* Multi-source blit can only support one YUV input. */
+                return gcvFALSE;
+            }
+
+            hasYuv = gcvTRUE;
+        }
+    }
+
+    return gcvTRUE;
+}
+
+
+gctBOOL
+_CanGroupArea(
+    IN gctPOINTER Data,
+    IN gctUINT32 * Indices,
+    IN gctUINT32 Count
+    )
+{
+    struct _hwcGroupArea * group = (struct _hwcGroupArea *) Data;
+
+    return _CanGroup(group->context, group->area, Indices, Count, group->eigenD);
 }
 
 
@@ -1083,7 +1392,7 @@ _GetSourceEigen(
 gceSTATUS
 _MultiSourceBlit(
     IN hwcContext * Context,
-    IN gctUINT32 Indices[4],
+    IN gctUINT32 * Indices,
     IN gctUINT32 Count,
     IN gctUINT32 EigenL,
     IN gctUINT32 EigenD,
@@ -1096,7 +1405,7 @@ _MultiSourceBlit(
     hwcBuffer * target           = framebuffer->target;
 
     /* This layer is the very bottom layer? */
-    gctBOOL ground = (((1U << Indices[0]) - 1U) & Area->owners) == 0U;
+    gctBOOL ground = !hwcOwnersBelow(&Area->owners, Indices[0]);
 
     gctUINT32 sourceMask = 0U;
     gctUINT32 sourceNum  = 0U;
@@ -1291,16 +1600,10 @@ _MultiSourceBlit(
 
     /* Setup target. */
     gcmONERROR(
-        gco2D_SetGenericTarget(Context->engine,
-                               &dstAddress,
-                               1U,
-                               &framebuffer->stride,
-                               1U,
-                               framebuffer->tiling,
-                               framebuffer->format,
-                               gcvSURF_0_DEGREE,
-                               width,
-                               height));
+        _SetGenericTarget(Context,
+                          dstAddress,
+                          width,
+                          height));
 
 #if DUMP_COMPOSE
 
@@ -1333,7 +1636,7 @@ _MultiSourceBlit(
     {
         /* Setup source index. */
         gcmONERROR(
-            gco2D_SetCurrentSourceIndex(Context->engine, 0U));
+            _SetSourceIndex(Context, 0U));
 
         /* This layer is the first layer in this multi-source blit batch.
          * Hardware limitation, first layer will NOT do alpha blending with
@@ -1353,9 +1656,9 @@ _MultiSourceBlit(
 
         /* Setup mirror. */
         gcmONERROR(
-            gco2D_SetBitBlitMirror(Context->engine,
-                                   gcvFALSE,
-                                   gcvFALSE));
+            _SetMirror(Context,
+                       gcvFALSE,
+                       gcvFALSE));
 
         /* Set source rect. */
         gcmONERROR(
@@ -1370,14 +1673,14 @@ _MultiSourceBlit(
 
         /* Can never have alpha blending for this case. */
         gcmONERROR(
-            gco2D_DisableAlphaBlend(Context->engine));
+            _DisableAlphaBlend(Context));
 
         gcmONERROR(
-            gco2D_SetPixelMultiplyModeAdvanced(Context->engine,
-                                               gcv2D_COLOR_MULTIPLY_DISABLE,
-                                               gcv2D_COLOR_MULTIPLY_DISABLE,
-                                               gcv2D_GLOBAL_COLOR_MULTIPLY_DISABLE,
-                                               gcv2D_COLOR_MULTIPLY_DISABLE));
+            _SetMultiplyMode(Context,
+                             gcv2D_COLOR_MULTIPLY_DISABLE,
+                             gcv2D_COLOR_MULTIPLY_DISABLE,
+                             gcv2D_GLOBAL_COLOR_MULTIPLY_DISABLE,
+                             gcv2D_COLOR_MULTIPLY_DISABLE));
 
         /* Target source inserted at index 0. So we need to update
          * index and source count. */
@@ -1409,30 +1712,23 @@ _MultiSourceBlit(
         }
 
         /* Dim detection. */
-        if (Context->hasDim)
+        for (gctUINT32 i = hwcOwnersNext(&layer->dimMask, Indices[j] + 1);
+             i < HWC_MAX_LAYERS;
+             i = hwcOwnersNext(&layer->dimMask, i + 1))
         {
-            /* Go through above layers. */
-            for (gctUINT32 i = Indices[j] + 1; i < Context->layerCount; i++)
+            if (hwcOwnersHas(&Area->owners, i))
             {
-                gctUINT32 owner = (1U << i);
-
-                if ((Context->layers[i].opaque == gcvFALSE)
-                &&  (Context->layers[i].compositionType == HWC_DIM)
-                &&  (Area->owners & owner)
-                )
-                {
-                   /* OK, find a dim layer and it covers the currect layer. */
-                   alphaDim  *= 0xFF - (Context->layers[i].color32 >> 24);
-                   alphaDim >>= 8;
+               /* OK, find a dim layer and it covers the currect layer. */
+               alphaDim  *= 0xFF - (Context->layers[i].color32 >> 24);
+               alphaDim >>= 8;
 
-                   hasDim = gcvTRUE;
-                }
+               hasDim = gcvTRUE;
             }
         }
 
         /* Setup source index. */
         gcmONERROR(
-            gco2D_SetCurrentSourceIndex(Context->engine, sourceNum));
+            _SetSourceIndex(Context, sourceNum));
 
         /* Setup source. */
         if (layer->source != gcvNULL)
@@ -1551,9 +1847,9 @@ _MultiSourceBlit(
 
             /* Setup mirror. */
             gcmONERROR(
-                gco2D_SetBitBlitMirror(Context->engine,
-                                       layer->hMirror,
-                                       layer->vMirror));
+                _SetMirror(Context,
+                           layer->hMirror,
+                           layer->vMirror));
 
 
             /* Set source rect (equal to dstRect). */
@@ -1586,9 +1882,9 @@ _MultiSourceBlit(
 
             /* Setup mirror. */
             gcmONERROR(
-                gco2D_SetBitBlitMirror(Context->engine,
-                                       gcvFALSE,
-                                       gcvFALSE));
+                _SetMirror(Context,
+                           gcvFALSE,
+                           gcvFALSE));
 
             /* Set source rect (equal to dstRect). */
             gcmONERROR(
@@ -1625,19 +1921,13 @@ _MultiSourceBlit(
              * But we can easily disable alpha blending to get the same
              * result. */
             gcmONERROR(
-                gco2D_DisableAlphaBlend(Context->engine));
+                _DisableAlphaBlend(Context));
         }
 
         else
         {
             gcmONERROR(
-                gco2D_EnableAlphaBlendAdvanced(Context->engine,
-                                               layer->srcAlphaMode,
-                                               layer->dstAlphaMode,
-                                               layer->srcGlobalAlphaMode,
-                                               layer->dstGlobalAlphaMode,
-                                               layer->srcFactorMode,
-                                               layer->dstFactorMode));
+                _EnableAlphaBlend(Context, layer));
         }
 
         /* Setup premultiply. */
@@ -1651,37 +1941,37 @@ _MultiSourceBlit(
 
             /* Dim optimization. */
             gcmONERROR(
-                gco2D_SetPixelMultiplyModeAdvanced(Context->engine,
-                                                   layer->srcPremultSrcAlpha,
-                                                   layer->dstPremultDstAlpha,
-                                                   gcv2D_GLOBAL_COLOR_MULTIPLY_ALPHA,
-                                                   layer->dstDemultDstAlpha));
+                _SetMultiplyMode(Context,
+                                 layer->srcPremultSrcAlpha,
+                                 layer->dstPremultDstAlpha,
+                                 gcv2D_GLOBAL_COLOR_MULTIPLY_ALPHA,
+                                 layer->dstDemultDstAlpha));
 
             gcmONERROR(
-                gco2D_SetSourceGlobalColorAdvanced(Context->engine,
-                                                   srcGlobalAlpha));
+                _SetSourceGlobalColor(Context,
+                                      srcGlobalAlpha));
 
             gcmONERROR(
-                gco2D_SetTargetGlobalColorAdvanced(Context->engine,
-                                                   dstGlobalAlpha));
+                _SetTargetGlobalColor(Context,
+                                      dstGlobalAlpha));
         }
 
         else
         {
             gcmONERROR(
-                gco2D_SetPixelMultiplyModeAdvanced(Context->engine,
-                                                   layer->srcPremultSrcAlpha,
-                                                   layer->dstPremultDstAlpha,
-                                                   layer->srcPremultGlobalMode,
-                                                   layer->dstDemultDstAlpha));
+                _SetMultiplyMode(Context,
+                                 layer->srcPremultSrcAlpha,
+                                 layer->dstPremultDstAlpha,
+                                 layer->srcPremultGlobalMode,
+                                 layer->dstDemultDstAlpha));
 
             gcmONERROR(
-                gco2D_SetSourceGlobalColorAdvanced(Context->engine,
-                                                   layer->srcGlobalAlpha));
+                _SetSourceGlobalColor(Context,
+                                      layer->srcGlobalAlpha));
 
             gcmONERROR(
-                gco2D_SetTargetGlobalColorAdvanced(Context->engine,
-                                                   layer->dstGlobalAlpha));
+                _SetTargetGlobalColor(Context,
+                                      layer->dstGlobalAlpha));
         }
 
         /* Append mask to sourceMask. */
@@ -1700,6 +1990,211 @@ _MultiSourceBlit(
                               &blitRect,
                               1U));
 
+    Context->blits++;
+
+    return gcvSTATUS_OK;
+
+OnError:
+    LOGE("Failed in %s: status=%d", __FUNCTION__, status);
+    return status;
+}
+
+
+/*
+ * State cache. Each function programs one 2D state group unless the shadow
+ * says the engine already holds the value. A failed call leaves the state
+ * group unknown.
+ */
+static hwcSourceState *
+_CurrentSource(
+    IN hwcContext * Context
+    )
+{
+    hwcState * state = &Context->state;
+
+    if (!state->indexValid || (state->index >= HWC_STATE_SOURCES))
+    {
+        /* Not shadowed. */
+        return gcvNULL;
+    }
+
+    return &state->sources[state->index];
+}
+
+
+void
+_ResetState(
+    IN hwcContext * Context
+    )
+{
+    memset(&Context->state, 0, sizeof (hwcState));
+}
+
+
+gceSTATUS
+_SetSourceIndex(
+    IN hwcContext * Context,
+    IN gctUINT32 Index
+    )
+{
+    gceSTATUS status;
+    hwcState * state = &Context->state;
+
+#if ENABLE_STATE_CACHE
+    if (state->indexValid && (state->index == Index))
+    {
+        Context->stateElided++;
+        return gcvSTATUS_OK;
+    }
+#endif
+
+    state->indexValid = gcvFALSE;
+    Context->stateIssued++;
+
+    gcmONERROR(
+        gco2D_SetCurrentSourceIndex(Context->engine, Index));
+
+    state->indexValid = gcvTRUE;
+    state->index      = Index;
+
+    return gcvSTATUS_OK;
+
+OnError:
+    LOGE("Failed in %s: status=%d", __FUNCTION__, status);
+    return status;
+}
+
+
+gceSTATUS
+_SetGenericTarget(
+    IN hwcContext * Context,
+    IN gctUINT32 Address,
+    IN gctUINT32 Width,
+    IN gctUINT32 Height
+    )
+{
+    gceSTATUS status;
+    hwcState * state             = &Context->state;
+    hwcFramebuffer * framebuffer = Context->framebuffer;
+
+#if ENABLE_STATE_CACHE
+    if (state->targetValid
+    &&  (state->targetAddress == Address)
+    &&  (state->targetWidth   == Width)
+    &&  (state->targetHeight  == Height)
+    )
+    {
+        Context->stateElided++;
+        return gcvSTATUS_OK;
+    }
+#endif
+
+    state->targetValid = gcvFALSE;
+    Context->stateIssued++;
+
+    gcmONERROR(
+        gco2D_SetGenericTarget(Context->engine,
+                               &Address,
+                               1U,
+                               &framebuffer->stride,
+                               1U,
+                               framebuffer->tiling,
+                               framebuffer->format,
+                               gcvSURF_0_DEGREE,
+                               Width,
+                               Height));
+
+    state->targetValid   = gcvTRUE;
+    state->targetAddress = Address;
+    state->targetWidth   = Width;
+    state->targetHeight  = Height;
+
+    return gcvSTATUS_OK;
+
+OnError:
+    LOGE("Failed in %s: status=%d", __FUNCTION__, status);
+    return status;
+}
+
+
+gceSTATUS
+_SetClipping(
+    IN hwcContext * Context,
+    IN gcsRECT * Rect
+    )
+{
+    gceSTATUS status;
+    hwcState * state = &Context->state;
+
+#if ENABLE_STATE_CACHE
+    if (state->clipValid
+    &&  (state->clip.left   == Rect->left)
+    &&  (state->clip.top    == Rect->top)
+    &&  (state->clip.right  == Rect->right)
+    &&  (state->clip.bottom == Rect->bottom)
+    )
+    {
+        Context->stateElided++;
+        return gcvSTATUS_OK;
+    }
+#endif
+
+    state->clipValid = gcvFALSE;
+    Context->stateIssued++;
+
+    gcmONERROR(
+        gco2D_SetClipping(Context->engine, Rect));
+
+    state->clipValid = gcvTRUE;
+    state->clip      = *Rect;
+
+    return gcvSTATUS_OK;
+
+OnError:
+    LOGE("Failed in %s: status=%d", __FUNCTION__, status);
+    return status;
+}
+
+
+gceSTATUS
+_SetMirror(
+    IN hwcContext * Context,
+    IN gctBOOL HMirror,
+    IN gctBOOL VMirror
+    )
+{
+    gceSTATUS status;
+    hwcSourceState * source = _CurrentSource(Context);
+
+#if ENABLE_STATE_CACHE
+    if ((source != gcvNULL)
+    &&  source->mirrorValid
+    &&  (source->hMirror == HMirror)
+    &&  (source->vMirror == VMirror)
+    )
+    {
+        Context->stateElided++;
+        return gcvSTATUS_OK;
+    }
+#endif
+
+    Context->stateIssued++;
+
+    if (source != gcvNULL)
+    {
+        source->mirrorValid = gcvFALSE;
+    }
+
+    gcmONERROR(
+        gco2D_SetBitBlitMirror(Context->engine, HMirror, VMirror));
+
+    if (source != gcvNULL)
+    {
+        source->mirrorValid = gcvTRUE;
+        source->hMirror     = HMirror;
+        source->vMirror     = VMirror;
+    }
+
     return gcvSTATUS_OK;
 
 OnError:
@@ -1707,3 +2202,252 @@ OnError:
     return status;
 }
 
+
+gceSTATUS
+_DisableAlphaBlend(
+    IN hwcContext * Context
+    )
+{
+    gceSTATUS status;
+    hwcSourceState * source = _CurrentSource(Context);
+
+#if ENABLE_STATE_CACHE
+    if ((source != gcvNULL)
+    &&  source->blendValid
+    &&  !source->blend
+    )
+    {
+        Context->stateElided++;
+        return gcvSTATUS_OK;
+    }
+#endif
+
+    Context->stateIssued++;
+
+    if (source != gcvNULL)
+    {
+        source->blendValid = gcvFALSE;
+    }
+
+    gcmONERROR(
+        gco2D_DisableAlphaBlend(Context->engine));
+
+    if (source != gcvNULL)
+    {
+        source->blendValid = gcvTRUE;
+        source->blend      = gcvFALSE;
+    }
+
+    return gcvSTATUS_OK;
+
+OnError:
+    LOGE("Failed in %s: status=%d", __FUNCTION__, status);
+    return status;
+}
+
+
+gceSTATUS
+_EnableAlphaBlend(
+    IN hwcContext * Context,
+    IN hwcLayer * Layer
+    )
+{
+    gceSTATUS status;
+    hwcSourceState * source = _CurrentSource(Context);
+
+#if ENABLE_STATE_CACHE
+    if ((source != gcvNULL)
+    &&  source->blendValid
+    &&  source->blend
+    &&  (source->srcAlphaMode       == Layer->srcAlphaMode)
+    &&  (source->dstAlphaMode       == Layer->dstAlphaMode)
+    &&  (source->srcGlobalAlphaMode == Layer->srcGlobalAlphaMode)
+    &&  (source->dstGlobalAlphaMode == Layer->dstGlobalAlphaMode)
+    &&  (source->srcFactorMode      == Layer->srcFactorMode)
+    &&  (source->dstFactorMode      == Layer->dstFactorMode)
+    )
+    {
+        Context->stateElided++;
+        return gcvSTATUS_OK;
+    }
+#endif
+
+    Context->stateIssued++;
+
+    if (source != gcvNULL)
+    {
+        source->blendValid = gcvFALSE;
+    }
+
+    gcmONERROR(
+        gco2D_EnableAlphaBlendAdvanced(Context->engine,
+                                       Layer->srcAlphaMode,
+                                       Layer->dstAlphaMode,
+                                       Layer->srcGlobalAlphaMode,
+                                       Layer->dstGlobalAlphaMode,
+                                       Layer->srcFactorMode,
+                                       Layer->dstFactorMode));
+
+    if (source != gcvNULL)
+    {
+        source->blendValid         = gcvTRUE;
+        source->blend              = gcvTRUE;
+        source->srcAlphaMode       = Layer->srcAlphaMode;
+        source->dstAlphaMode       = Layer->dstAlphaMode;
+        source->srcGlobalAlphaMode = Layer->srcGlobalAlphaMode;
+        source->dstGlobalAlphaMode = Layer->dstGlobalAlphaMode;
+        source->srcFactorMode      = Layer->srcFactorMode;
+        source->dstFactorMode      = Layer->dstFactorMode;
+    }
+
+    return gcvSTATUS_OK;
+
+OnError:
+    LOGE("Failed in %s: status=%d", __FUNCTION__, status);
+    return status;
+}
+
+
+gceSTATUS
+_SetMultiplyMode(
+    IN hwcContext * Context,
+    IN gce2D_PIXEL_COLOR_MULTIPLY_MODE SrcPremultSrcAlpha,
+    IN gce2D_PIXEL_COLOR_MULTIPLY_MODE DstPremultDstAlpha,
+    IN gce2D_GLOBAL_COLOR_MULTIPLY_MODE SrcPremultGlobalMode,
+    IN gce2D_PIXEL_COLOR_MULTIPLY_MODE DstDemultDstAlpha
+    )
+{
+    gceSTATUS status;
+    hwcSourceState * source = _CurrentSource(Context);
+
+#if ENABLE_STATE_CACHE
+    if ((source != gcvNULL)
+    &&  source->multiplyValid
+    &&  (source->srcPremultSrcAlpha   == SrcPremultSrcAlpha)
+    &&  (source->dstPremultDstAlpha   == DstPremultDstAlpha)
+    &&  (source->srcPremultGlobalMode == SrcPremultGlobalMode)
+    &&  (source->dstDemultDstAlpha    == DstDemultDstAlpha)
+    )
+    {
+        Context->stateElided++;
+        return gcvSTATUS_OK;
+    }
+#endif
+
+    Context->stateIssued++;
+
+    if (source != gcvNULL)
+    {
+        source->multiplyValid = gcvFALSE;
+    }
+
+    gcmONERROR(
+        gco2D_SetPixelMultiplyModeAdvanced(Context->engine,
+                                           SrcPremultSrcAlpha,
+                                           DstPremultDstAlpha,
+                                           SrcPremultGlobalMode,
+                                           DstDemultDstAlpha));
+
+    if (source != gcvNULL)
+    {
+        source->multiplyValid        = gcvTRUE;
+        source->srcPremultSrcAlpha   = SrcPremultSrcAlpha;
+        source->dstPremultDstAlpha   = DstPremultDstAlpha;
+        source->srcPremultGlobalMode = SrcPremultGlobalMode;
+        source->dstDemultDstAlpha    = DstDemultDstAlpha;
+    }
+
+    return gcvSTATUS_OK;
+
+OnError:
+    LOGE("Failed in %s: status=%d", __FUNCTION__, status);
+    return status;
+}
+
+
+gceSTATUS
+_SetSourceGlobalColor(
+    IN hwcContext * Context,
+    IN gctUINT32 Color32
+    )
+{
+    gceSTATUS status;
+    hwcSourceState * source = _CurrentSource(Context);
+
+#if ENABLE_STATE_CACHE
+    if ((source != gcvNULL)
+    &&  source->srcGlobalValid
+    &&  (source->srcGlobalColor == Color32)
+    )
+    {
+        Context->stateElided++;
+        return gcvSTATUS_OK;
+    }
+#endif
+
+    Context->stateIssued++;
+
+    if (source != gcvNULL)
+    {
+        source->srcGlobalValid = gcvFALSE;
+    }
+
+    gcmONERROR(
+        gco2D_SetSourceGlobalColorAdvanced(Context->engine, Color32));
+
+    if (source != gcvNULL)
+    {
+        source->srcGlobalValid = gcvTRUE;
+        source->srcGlobalColor = Color32;
+    }
+
+    return gcvSTATUS_OK;
+
+OnError:
+    LOGE("Failed in %s: status=%d", __FUNCTION__, status);
+    return status;
+}
+
+
+gceSTATUS
+_SetTargetGlobalColor(
+    IN hwcContext * Context,
+    IN gctUINT32 Color32
+    )
+{
+    gceSTATUS status;
+    hwcSourceState * source = _CurrentSource(Context);
+
+#if ENABLE_STATE_CACHE
+    if ((source != gcvNULL)
+    &&  source->dstGlobalValid
+    &&  (source->dstGlobalColor == Color32)
+    )
+    {
+        Context->stateElided++;
+        return gcvSTATUS_OK;
+    }
+#endif
+
+    Context->stateIssued++;
+
+    if (source != gcvNULL)
+    {
+        source->dstGlobalValid = gcvFALSE;
+    }
+
+    gcmONERROR(
+        gco2D_SetTargetGlobalColorAdvanced(Context->engine, Color32));
+
+    if (source != gcvNULL)
+    {
+        source->dstGlobalValid = gcvTRUE;
+        source->dstGlobalColor = Color32;
+    }
+
+    return gcvSTATUS_OK;
+
+OnError:
+    LOGE("Failed in %s: status=%d", __FUNCTION__, status);
+    return status;
+}
@@ -113,40 +113,33 @@ hwcDumpArea(
 
     while (area != NULL)
     {
-        char buf[128];
+        char buf[64 + HWC_MAX_LAYERS * 4];
         char digit[8];
         bool first = true;
 
         sprintf(buf,
-                "Area[%d,%d,%d,%d] owners=%08x:",
+                "Area[%d,%d,%d,%d] owners=",
                 area->rect.left,
                 area->rect.top,
                 area->rect.right,
-                area->rect.bottom,
-                area->owners);
+                area->rect.bottom);
 
-        for (gctUINT32 i = 0; i < 32; i++)
+        for (gctINT32 w = HWC_OWNER_WORDS - 1; w >= 0; w--)
         {
-            /* Build decimal layer indices. */
-            if (area->owners & (1U << i))
-            {
-                if (first)
-                {
-                    sprintf(digit, " %d", i);
-                    strcat(buf, digit);
-                    first = false;
-                }
-                else
-                {
-                    sprintf(digit, ",%d", i);
-                    strcat(buf, digit);
-                }
-            }
-
-            if (area->owners < (1U << i))
-            {
-                break;
-            }
+            sprintf(digit, "%08x", area->owners.bits[w]);
+            strcat(buf, digit);
+        }
+
+        strcat(buf, ":");
+
+        /* Build decimal layer indices. */
+        for (gctUINT32 i = hwcOwnersNext(&area->owners, 0);
+             i < HWC_MAX_LAYERS;
+             i = hwcOwnersNext(&area->owners, i + 1))
+        {
+            sprintf(digit, first ? " %d" : ",%d", i);
+            strcat(buf, digit);
+            first = false;
         }
 
         LOGD("%s", buf);
@@ -65,6 +65,31 @@
  */
 #define DUMP_SET_TIME       0
 
+/*
+    DUMP_DAMAGE
+
+        Dump damage region and pixels composed against pixels on screen.
+        Dump only when hwc compsoition.
+ */
+#define DUMP_DAMAGE         0
+
+/*
+    DUMP_STATE
+
+        Dump 2D state calls issued and skipped by the state cache in every
+        frame. Dump only when hwc compsoition.
+ */
+#define DUMP_STATE          0
+
+/*
+    DUMP_AREA_COUNT
+
+        Dump area count before and after merging adjacent areas on geometry
+        change, 2D blits submitted and area arena usage in every frame.
+        Dump only when hwc compsoition.
+ */
+#define DUMP_AREA_COUNT     0
+
 
 /******************************************************************************/
 
@@ -122,7 +122,9 @@ hwcPrepare(
     IN hwc_layer_list_t * List
     )
 {
-    if (!(List->flags & HWC_GEOMETRY_CHANGED))
+    if (!(List->flags & HWC_GEOMETRY_CHANGED)
+    &&  !Context->areaFailed
+    )
     {
 #if ENABLE_CLEAR_HOLE
         if (Context->hasClearHole)
@@ -157,6 +159,24 @@ hwcPrepare(
     Context->hasDim          = gcvFALSE;
     Context->hasOverlay      = gcvFALSE;
 
+    if (List->numHwLayers > HWC_MAX_LAYERS)
+    {
+        /* Too many layers for area owners, fail back to 3D composition. */
+        Context->hasComposition = gcvFALSE;
+
+        LOGI("hwc prepare: %d layers, over %d", (int) List->numHwLayers, HWC_MAX_LAYERS);
+    }
+
+    if (Context->areaFailed)
+    {
+        /* Last set ran out of memory for areas, fail back to 3D composition
+         * until next geometry change. */
+        Context->hasComposition = gcvFALSE;
+        Context->areaFailed     = gcvFALSE;
+
+        LOGE("hwc prepare: out of memory for areas, composing by 3D");
+    }
+
     /* Go through all layer. */
     for (size_t i = 0; i < List->numHwLayers; i++)
     {
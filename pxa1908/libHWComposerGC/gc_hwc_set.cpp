@@ -26,31 +26,10 @@
 #include <linux/fb.h>
 
 #include <stdlib.h>
+#include <string.h>
 #include <errno.h>
 
 
-static hwcArea *
-_AllocateArea(
-    IN hwcContext * Context,
-    IN hwcArea * Slibing,
-    IN gcsRECT * Rect,
-    IN gctUINT32 Owner
-    );
-
-static void
-_FreeArea(
-    IN hwcContext * Context,
-    IN hwcArea *    Head
-    );
-
-static void
-_SplitArea(
-    IN hwcContext * Context,
-    IN hwcArea * Area,
-    IN gcsRECT * Rect,
-    IN gctUINT32 Owner
-    );
-
 static gceTILING
 _TranslateTiling(
     IN gceSURF_TYPE Type
@@ -89,6 +68,12 @@ _ComputeUVAddress(
 **  Swap rectangle change is not indicated by geometry chagne, so swap rect
 **  clamp is not done in parameter generation.
 **
+**  The damage of a frame is the visible region of the layers whose buffer
+**  changed, clipped to the swap rectangle. It is kept as a few rectangles so
+**  that disjoint updates do not compose their bounding box. On geometry
+**  change it also covers the areas composed for the last geometry, so what
+**  moved or removed layers left behind is composed again or cleared.
+**
 **
 **  INPUT:
 **
@@ -114,6 +99,30 @@ hwcSet(
 {
     gceSTATUS status = gcvSTATUS_OK;
 
+    /* Layers whose contents changed this frame. */
+    hwcOwners changed;
+
+    /* Swap rectangle given by android. */
+    gcsRECT dirty = { 0, 0, 0, 0 };
+
+    /* The target can not be partly updated this frame. */
+    gctBOOL redrawAll = gcvFALSE;
+
+#if ENABLE_SWAP_RECTANGLE
+    /* Layers may have moved or gone since the last frame. */
+    gctBOOL geometryChanged = Context->geometryChanged;
+#endif
+
+    if (Context->geometryChanged)
+    {
+        hwcOwnersFill(&changed);
+    }
+
+    else
+    {
+        hwcOwnersClear(&changed);
+    }
+
 
     /***************************************************************************
     ** Framebuffer Detection.
@@ -184,6 +193,25 @@ hwcSet(
             /* Clear valid flag. */
             framebuffer->valid = gcvFALSE;
 
+            /* No frame composed yet. */
+            framebuffer->frameCount = 0U;
+            framebuffer->front      = NULL;
+
+            /* Get compression header room, all buffers are alike. */
+            framebuffer->headerOffset = 0U;
+
+#if ENABLE_COMPRESSED_FB
+            if (Context->compression
+            &&  Context->gralloc->perform(Context->gralloc,
+                                          HWC_GRALLOC_PERFORM_GET_FB_HEADER,
+                                          (buffer_handle_t) handle,
+                                          &framebuffer->headerOffset) != 0
+            )
+            {
+                framebuffer->headerOffset = 0U;
+            }
+#endif
+
             /* Allocate target framebuffer buffer. */
             target = (hwcBuffer *) malloc(sizeof (hwcBuffer));
 
@@ -193,6 +221,10 @@ hwcSet(
             /* Save physical address. */
             target->physical = (gctUINT32) handle->phys;
 
+            /* Not rendered yet. */
+            target->compressed = gcvFALSE;
+            target->frame      = 0U;
+
             /* Point prev/next buffer to self. */
             target->prev = target->next = target;
 
@@ -247,6 +279,10 @@ hwcSet(
             /* Get buffer address. */
             target->physical = (gctUINT32) handle->phys;
 
+            /* Not rendered yet. */
+            target->compressed = gcvFALSE;
+            target->frame      = 0U;
+
             /* Insert the new buffer to proper place. */
             if (target->physical < framebuffer->head->physical)
             {
@@ -330,29 +366,65 @@ hwcSet(
         target->swapRect = framebuffer->res;
 #endif
 
+        dirty = target->swapRect;
+
+        /* Compress this frame? Overlay clears and other users of the
+         * framebuffer write it uncompressed. */
+        gctBOOL compressed = (framebuffer->headerOffset != 0U)
+                          && !Context->hasOverlay;
+
+        if (compressed != target->compressed)
+        {
+            /* Pixels outside of the swap rectangle do not match the
+             * compression header, redraw all. */
+            target->swapRect   = framebuffer->res;
+            target->compressed = compressed;
+            redrawAll          = gcvTRUE;
+        }
+
         /* Update valid flag. */
         if (framebuffer->valid == gcvFALSE)
         {
-            /* Reset swap rectangles of other buffers. */
-            hwcBuffer * buffer = target;
+            /* Frames composed by 3D are not in the damage history, forget
+             * the contents of all buffers. */
+            hwcBuffer * buffer = framebuffer->head;
 
-            while (buffer != target)
+            do
             {
-                /* Reset size to full screen. */
-                buffer->swapRect = framebuffer->res;
-
+                buffer->frame = 0U;
                 buffer = buffer->next;
             }
+            while (buffer != framebuffer->head);
 
             /* Set valid falg. */
             framebuffer->valid = gcvTRUE;
         }
+
+        /* The target misses the damage of the frames composed since it was
+         * last. Redraw all if those are unknown or no longer in history. */
+        if ((target->frame == 0U)
+        ||  (framebuffer->frameCount - target->frame > HWC_DAMAGE_HISTORY)
+        )
+        {
+            target->swapRect = framebuffer->res;
+            redrawAll        = gcvTRUE;
+        }
     }
 
     else if (Context->framebuffer != NULL)
     {
         /* 3D composition path, remove the valid flag. */
         Context->framebuffer->valid = gcvFALSE;
+
+        /* 3D renders uncompressed. */
+        hwcBuffer * buffer = Context->framebuffer->head;
+
+        do
+        {
+            buffer->compressed = gcvFALSE;
+            buffer = buffer->next;
+        }
+        while (buffer != Context->framebuffer->head);
     }
 
 
@@ -360,10 +432,34 @@ hwcSet(
     ** Update Layer Information and Geometry.
     */
 
+    if (Context->geometryChanged && Context->hasComposition)
+    {
+        Context->stages.splitStart = hwcGetTime();
+    }
+
     if (Context->geometryChanged && Context->hasComposition)
     {
         /* Geometry changed and has composition. */
 
+        /* Grow layer store. */
+        if (List->numHwLayers > Context->layerCapacity)
+        {
+            hwcLayer * layers = (hwcLayer *)
+                realloc(Context->layers, sizeof (hwcLayer) * List->numHwLayers);
+
+            if (layers == NULL)
+            {
+                gcmONERROR(gcvSTATUS_OUT_OF_MEMORY);
+            }
+
+            memset(layers + Context->layerCapacity,
+                   0,
+                   sizeof (hwcLayer) * (List->numHwLayers - Context->layerCapacity));
+
+            Context->layers        = layers;
+            Context->layerCapacity = List->numHwLayers;
+        }
+
         /* Update layer count. */
         Context->layerCount = List->numHwLayers;
 
@@ -827,29 +923,38 @@ hwcSet(
             }
         }
 
-        /* Reset allocated areas. */
-        if (Context->compositionArea != NULL)
-        {
-            _FreeArea(Context, Context->compositionArea);
+        /* Get the composition arena. */
+        hwcAreaArena * arena;
+
+        /* Keep areas of last geometry, reuse the arena before it. */
+        Context->lastCompositionArea = Context->compositionArea;
+        Context->compositionArena   ^= 1U;
+
+        arena = &Context->compositionArenas[Context->compositionArena];
+        hwcResetArena(arena);
 
-            Context->compositionArea = NULL;
+        Context->compositionArea = NULL;
 #if ENABLE_SWAP_RECTANGLE
-            Context->swapArea        = NULL;
+        Context->swapArea        = NULL;
 #endif
-        }
 
         /* Generate new areas. */
         /* Put a no-owner area with screen size, this is for worm hole,
          * and is needed for clipping. */
-        Context->compositionArea = _AllocateArea(Context,
-                                                 NULL,
-                                                 &Context->framebuffer->res,
-                                                 0U);
+        Context->compositionArea = hwcAllocateArea(arena,
+                                                   NULL,
+                                                   &Context->framebuffer->res,
+                                                   NULL);
+
+        if (Context->compositionArea == NULL)
+        {
+            Context->areaFailed = gcvTRUE;
+            gcmONERROR(gcvSTATUS_OUT_OF_MEMORY);
+        }
 
         /* Split areas: go through all regions. */
         for (gctUINT32 i = 0; i < List->numHwLayers; i++)
         {
-            gctUINT32 owner = 1U << i;
             hwc_layer_t *  hwLayer = &List->hwLayers[i];
             hwc_region_t * region  = &hwLayer->visibleRegionScreen;
 
@@ -857,10 +962,17 @@ hwcSet(
             for (gctUINT32 j = 0; j < region->numRects; j++)
             {
                 /* Assume the region will never go out of dest surface. */
-                _SplitArea(Context,
-                           Context->compositionArea,
-                           (gcsRECT *) &region->rects[j],
-                           owner);
+                status = hwcSplitArea(arena,
+                                      Context->compositionArea,
+                                      (gcsRECT *) &region->rects[j],
+                                      i);
+
+                if (gcmIS_ERROR(status))
+                {
+                    /* Areas are incomplete, this frame can not be composed. */
+                    Context->areaFailed = gcvTRUE;
+                    gcmONERROR(status);
+                }
             }
         }
     }
@@ -883,18 +995,18 @@ hwcSet(
             if (Context->layers[i].compositionType == HWC_CLEAR_HOLE)
             {
                 /* Find a layer with clear hole. */
-                gctUINT32 owner = (1U << i);
-
                 hwcArea * area = Context->compositionArea;
 
                 while (area != NULL)
                 {
-                    if ((area->owners & owner) && (area->owners & (owner - 1U)))
+                    if (hwcOwnersHas(&area->owners, i)
+                    &&  hwcOwnersBelow(&area->owners, i)
+                    )
                     {
                         /* This area has clear hole layer, but it also has
                          * other layers below it. So it should NOT be
                          * cleared */
-                        area->owners &= ~owner;
+                        hwcOwnersRemove(&area->owners, i);
                     }
 
                     /* Advance to next area. */
@@ -926,18 +1038,18 @@ hwcSet(
             )
             {
                 /* Find a layer with solid dim. */
-                gctUINT32 owner = (1U << i);
-
                 hwcArea * area = Context->compositionArea;
 
                 while (area != NULL)
                 {
-                    if ((area->owners & owner) && (area->owners & (owner - 1U)))
+                    if (hwcOwnersHas(&area->owners, i)
+                    &&  hwcOwnersBelow(&area->owners, i)
+                    )
                     {
                         /* This area has solid dim, but it also has
                          * other layers below it. We do not need to blit
                          * layers below it. */
-                        area->owners &= ~(owner - 1U);
+                        hwcOwnersRemoveBelow(&area->owners, i);
                     }
 
                     /* Advance to next area. */
@@ -965,17 +1077,18 @@ hwcSet(
             if (Context->layers[i].compositionType == HWC_OVERLAY)
             {
                 /* Find a layer with clear hole. */
-                gctUINT32 owner = (1U << i);
-
                 hwcArea * area = Context->compositionArea;
 
                 while (area != NULL)
                 {
-                    if ((area->owners & owner) && (area->owners & ~owner))
+                    if (hwcOwnersHas(&area->owners, i)
+                    &&  (hwcOwnersBelow(&area->owners, i)
+                        || (hwcOwnersNext(&area->owners, i + 1) != HWC_MAX_LAYERS))
+                    )
                     {
                         /* Do not need clear fb layer if other non-overlay
                          * layers are there. */
-                        area->owners &= ~owner;
+                        hwcOwnersRemove(&area->owners, i);
                     }
 
                     /* Advance to next area. */
@@ -986,6 +1099,113 @@ hwcSet(
     }
 #endif
 
+#if ENABLE_MERGE_AREA
+
+    /***************************************************************************
+    ** Area Merge.
+    */
+
+    if (Context->hasComposition && Context->geometryChanged)
+    {
+        /* Owners are final now. Merge adjacent areas split by layers which
+         * do not make a difference to them. */
+        gctUINT32 merged = hwcMergeArea(Context->compositionArea);
+
+#if DUMP_AREA_COUNT
+        gctUINT32 count = 0U;
+
+        for (hwcArea * area = Context->compositionArea;
+             area != NULL;
+             area = area->next)
+        {
+            count++;
+        }
+
+        LOGD("MERGE AREA %d => %d areas", count + merged, count);
+#else
+        (void) merged;
+#endif
+    }
+#endif
+
+    /***************************************************************************
+    ** Blit Descriptors.
+    */
+
+    if (Context->hasComposition && Context->geometryChanged)
+    {
+        /* Everything hwcCompose needs from a layer which does not depend on
+         * the area or the source buffer. */
+        for (gctUINT32 i = 0; i < Context->layerCount; i++)
+        {
+            /* Get shortcuts. */
+            hwcLayer * layer = &Context->layers[i];
+
+            /* Choose blit operation. */
+            if (layer->source != gcvNULL)
+            {
+                layer->blitType = (layer->yuv
+                                  && (layer->stretch || Context->opf == gcvFALSE))
+                                ? HWC_BLIT_FILTER
+                                : layer->stretch ? HWC_BLIT_STRETCH
+                                : HWC_BLIT_BIT;
+            }
+
+            else
+            {
+                layer->blitType = layer->opaque ? HWC_BLIT_CLEAR
+                                : HWC_BLIT_PATTERN;
+            }
+
+            layer->hfactor16 = (gctINT32) (layer->hfactor * 65536);
+            layer->vfactor16 = (gctINT32) (layer->vfactor * 65536);
+
+            /* Collect DIM layers above. */
+            hwcOwnersClear(&layer->dimMask);
+
+            for (gctUINT32 j = i + 1; Context->hasDim && j < Context->layerCount; j++)
+            {
+                if ((Context->layers[j].opaque == gcvFALSE)
+                &&  (Context->layers[j].compositionType == HWC_DIM)
+                )
+                {
+                    hwcOwnersAdd(&layer->dimMask, j);
+                }
+            }
+
+            /* Left coordinate in origin coord sys, less the area edge. */
+            switch (layer->rotation)
+            {
+            case gcvSURF_0_DEGREE:
+            default:
+                layer->eigenOrigin = layer->orgRect.left - layer->dstRect.left;
+                break;
+
+            case gcvSURF_90_DEGREE:
+                layer->eigenOrigin = layer->orgRect.left + layer->dstRect.bottom;
+                break;
+
+            case gcvSURF_180_DEGREE:
+                layer->eigenOrigin = layer->orgRect.left + layer->dstRect.right;
+                break;
+
+            case gcvSURF_270_DEGREE:
+                layer->eigenOrigin = layer->orgRect.left - layer->dstRect.top;
+                break;
+            }
+
+            layer->eigenMask = (layer->source != gcvNULL)
+                             ? (layer->yuv ? 64 : 16) / layer->bytesPerPixel - 1
+                             : 0U;
+        }
+    }
+
+    if (Context->stages.splitStart != 0)
+    {
+        /* Geometry done: layer information, areas and blit descriptors. */
+        Context->stages.splitEnd = hwcGetTime();
+    }
+
     /***************************************************************************
     ** Source Buffer Detection.
     */
@@ -999,12 +1219,25 @@ hwcSet(
             /* Get shortcuts. */
             hwcLayer * layer = &Context->layers[i];
 
+            /* Solid color layers may change without notice. */
+            if (layer->source == gcvNULL)
+            {
+                hwcOwnersAdd(&changed, i);
+            }
+
             /* Update layer source (for blitter layer). */
-            if (layer->source != gcvNULL)
+            else
             {
                 gc_private_handle_t * handle
                     = (gc_private_handle_t *) List->hwLayers[i].handle;
 
+                /* A new buffer damages the visible region of the layer. */
+                if (layer->physical != (gctUINT32) handle->phys)
+                {
+                    hwcOwnersAdd(&changed, i);
+                    layer->physical = (gctUINT32) handle->phys;
+                }
+
                 /* Assume the two(or more) buffers are same in size,
                  * format, tiling etc. */
                 if (layer->yuv)
@@ -1054,45 +1287,128 @@ hwcSet(
     {
         /* Get short cuts. */
         hwcFramebuffer * framebuffer = Context->framebuffer;
-        hwcBuffer * buffer           = framebuffer->target;
+        hwcBuffer * target           = framebuffer->target;
+        hwcBuffer * buffer           = target->next;
 
-        /* Free all allocated swap areas. */
-        if (Context->swapArea != NULL)
+        /* Damage of this frame. */
+        hwcRegion damage;
+
+        hwcResetRegion(&damage);
+
+        for (gctUINT32 i = 0; i < List->numHwLayers; i++)
         {
-            _FreeArea(Context, Context->swapArea);
-            Context->swapArea = NULL;
+            hwc_region_t * region = &List->hwLayers[i].visibleRegionScreen;
+
+            if (!hwcOwnersHas(&changed, i))
+            {
+                continue;
+            }
+
+            for (gctUINT32 j = 0; j < region->numRects; j++)
+            {
+                hwcAddRegion(&damage, (gcsRECT *) &region->rects[j], &dirty);
+            }
         }
 
-        /* Optimize: do not need split area for full screen composition. */
-        if (
-            (   (buffer->swapRect.left > 0)
-            ||  (buffer->swapRect.top  > 0)
-            ||  (buffer->swapRect.right  < framebuffer->res.right)
-            ||  (buffer->swapRect.bottom < framebuffer->res.bottom)
-            )
-        &&  (buffer != buffer->next)
+        if (geometryChanged)
+        {
+            /* Areas composed for the last geometry may now be uncovered or
+             * hold other layers, compose them again. */
+            for (hwcArea * area = Context->lastCompositionArea;
+                 area != NULL;
+                 area = area->next)
+            {
+                if (!hwcOwnersEmpty(&area->owners))
+                {
+                    hwcAddRegion(&damage, &area->rect, &dirty);
+                }
+            }
+        }
+
+        /* Swap areas are used by this frame only. */
+        hwcResetArena(&Context->swapArena);
+
+        Context->swapArea = NULL;
+
+        framebuffer->front = NULL;
+
+        /* Optimize: do not need split area for full screen composition, nor
+         * when the target already holds the previous frame. */
+        if (!redrawAll
+        &&  (target->frame != framebuffer->frameCount)
         )
         {
-            /* Put target swap rectangle. */
-            Context->swapArea = _AllocateArea(Context,
-                                              NULL,
-                                              &buffer->swapRect,
-                                              1U);
+            /* Find the buffer holding the previous frame. Buffers are not
+             * always used in the order of the ring. */
+            while ((buffer != target)
+            &&     (buffer->frame != framebuffer->frameCount)
+            )
+            {
+                buffer = buffer->next;
+            }
 
-            /* Point to earlier buffer. */
-            buffer = buffer->next;
+            if (buffer == target)
+            {
+                /* Lost track of the previous frame, redraw all. */
+                redrawAll = gcvTRUE;
+            }
 
-            /* Split area with rectangles of earlier buffer(with no-owner).
-             * Now owner 0 means we need copy area from front buffer.
-             * 1 means target swap rectangle. */
-            while (buffer != framebuffer->target)
+            else
             {
-                _SplitArea(Context, Context->swapArea, &buffer->swapRect, 0U);
+                /* Compose this frame's damage, copy what the target missed
+                 * from the buffer holding the previous frame. */
+                status = hwcSplitDamage(&Context->swapArena,
+                                        &damage,
+                                        framebuffer->damage,
+                                        target->frame + 1U,
+                                        framebuffer->frameCount,
+                                        &Context->swapArea);
+
+                if (gcmIS_ERROR(status))
+                {
+                    /* No swap areas, redraw all instead. */
+                    Context->swapArea = NULL;
+                    redrawAll         = gcvTRUE;
+                    status            = gcvSTATUS_OK;
+                }
 
-                /* Advance to next framebuffer buffer. */
-                buffer = buffer->next;
+                else
+                {
+                    framebuffer->front = buffer;
+                }
             }
         }
+
+        /* Region to compose. */
+        if (redrawAll)
+        {
+            hwcResetRegion(&Context->swapRegion);
+            hwcAddRegion(&Context->swapRegion, &framebuffer->res, &framebuffer->res);
+        }
+
+        else
+        {
+            Context->swapRegion = damage;
+        }
+
+        target->swapRect = Context->swapRegion.bounds;
+
+        /* Record the damage of this frame. */
+        framebuffer->frameCount++;
+        framebuffer->damage[framebuffer->frameCount % HWC_DAMAGE_HISTORY]
+            = damage;
+
+        target->frame = framebuffer->frameCount;
+    }
+#else
+
+    if (Context->hasComposition)
+    {
+        /* Compose full screen. */
+        hwcResetRegion(&Context->swapRegion);
+        hwcAddRegion(&Context->swapRegion,
+                     &Context->framebuffer->res,
+                     &Context->framebuffer->res);
     }
 #endif
 
@@ -1115,6 +1431,26 @@ hwcSet(
     }
 #endif
 
+#if DUMP_AREA_COUNT
+
+    if (Context->hasComposition)
+    {
+        hwcAreaArena * composition =
+            &Context->compositionArenas[Context->compositionArena];
+
+        hwcAreaArena * swap = &Context->swapArena;
+
+        LOGD("AREA ARENA composition %d (peak %d, %d pools), "
+             "swap %d (peak %d, %d pools)",
+             composition->areaCount,
+             composition->areaPeak,
+             composition->poolCount,
+             swap->areaCount,
+             swap->areaPeak,
+             swap->poolCount);
+    }
+#endif
+
 #if DUMP_SPLIT_AREA
 
     if (Context->hasComposition)
@@ -1141,8 +1477,23 @@ hwcSet(
     if (Context->hasComposition)
     {
         /* Start composition if we have hwc composition. */
+        Context->stages.composeStart = hwcGetTime();
+
         gcmONERROR(
             hwcCompose(Context));
+
+        Context->stages.composeEnd = hwcGetTime();
+
+#if ENABLE_COMPRESSED_FB
+        if (Context->framebuffer->target->compressed)
+        {
+            /* Let gralloc flip it in decompress mode. */
+            Context->gralloc->perform(Context->gralloc,
+                                      HWC_GRALLOC_PERFORM_SET_FB_COMPRESSED,
+                                      (buffer_handle_t) BackBuffer->handle,
+                                      1);
+        }
+#endif
     }
 
 
@@ -1284,518 +1635,43 @@ _ComputeUVAddress(
 }
 
 
-/*
- * Area spliting feature depends on the following 3 functions:
- * '_AllocateArea', '_FreeArea' and '_SplitArea'.
- */
-#define POOL_SIZE 512
 
-hwcArea *
-_AllocateArea(
-    IN hwcContext * Context,
-    IN hwcArea * Slibing,
-    IN gcsRECT * Rect,
-    IN gctUINT32 Owner
-    )
-{
-    hwcArea * area;
-    hwcAreaPool * pool  = &Context->areaPool;
 
-    for (;;)
-    {
-        if (pool->areas == NULL)
-        {
-            /* No areas allocated, allocate now. */
-            pool->areas = (hwcArea *) malloc(sizeof (hwcArea) * POOL_SIZE);
-
-            /* Get area. */
-            area = pool->areas;
-
-            /* Update freeNodes. */
-            pool->freeNodes = area + 1;
-
-            break;
-        }
-
-        else if (pool->freeNodes - pool->areas >= POOL_SIZE)
-        {
-            /* This pool is full. */
-            if (pool->next == NULL)
-            {
-                /* No more pools, allocate one. */
-                pool->next = (hwcAreaPool *) malloc(sizeof (hwcAreaPool));
-
-                /* Point to the new pool. */
-                pool = pool->next;
-
-                /* Clear fields. */
-                pool->areas     = NULL;
-                pool->freeNodes = NULL;
-                pool->next      = NULL;
-            }
-
-            else
-            {
-                /* Advance to next pool. */
-                pool = pool->next;
-            }
-        }
-
-        else
-        {
-            /* Get area and update freeNodes. */
-            area = pool->freeNodes++;
-
-            break;
-        }
-    }
-
-    /* Update area fields. */
-    area->rect   = *Rect;
-    area->owners = Owner;
-
-    if (Slibing == NULL)
-    {
-        area->next = NULL;
-    }
-
-    else if (Slibing->next == NULL)
-    {
-        area->next = NULL;
-        Slibing->next = area;
-    }
-
-    else
-    {
-        area->next = Slibing->next;
-        Slibing->next = area;
-    }
-
-    return area;
-}
-
-
-void
-_FreeArea(
-    IN hwcContext * Context,
-    IN hwcArea* Head
-    )
-{
-    /* Free the first node is enough. */
-    hwcAreaPool * pool  = &Context->areaPool;
-
-    while (pool != NULL)
-    {
-        if (Head >= pool->areas && Head < pool->areas + POOL_SIZE)
-        {
-            /* Belongs to this pool. */
-            if (Head < pool->freeNodes)
-            {
-                /* Update freeNodes if the 'Head' is older. */
-                pool->freeNodes = Head;
-
-                /* Reset all later pools. */
-                while (pool->next != NULL)
-                {
-                    /* Advance to next pool. */
-                    pool = pool->next;
-
-                    /* Reset freeNodes. */
-                    pool->freeNodes = pool->areas;
-                }
-            }
-
-            /* Done. */
-            break;
-        }
 
-        else if (pool->freeNodes < pool->areas + POOL_SIZE)
-        {
-            /* Already tagged as freed. */
-            break;
-        }
 
-        else
-        {
-            /* Advance to next pool. */
-            pool = pool->next;
-        }
-    }
-}
 
 
+/*******************************************************************************
+**
+**  hwcFreeAreas
+**
+**  Free all area pools of the context.
+**
+**  INPUT:
+**
+**      hwcContext * Context
+**          hwcomposer context pointer.
+**
+**  OUTPUT:
+**
+**      Nothing.
+*/
 void
-_SplitArea(
-    IN hwcContext * Context,
-    IN hwcArea * Area,
-    IN gcsRECT * Rect,
-    IN gctUINT32 Owner
+hwcFreeAreas(
+    IN hwcContext * Context
     )
 {
-    gcsRECT r0[4];
-    gcsRECT r1[4];
-    gctUINT32 c0 = 0;
-    gctUINT32 c1 = 0;
-
-    gcsRECT * rect;
-
-    for (;;)
-    {
-        rect = &Area->rect;
-
-        if ((Rect->left   < rect->right)
-        &&  (Rect->top    < rect->bottom)
-        &&  (Rect->right  > rect->left)
-        &&  (Rect->bottom > rect->top)
-        )
-        {
-            /* Overlapped. */
-            break;
-        }
-
-        if (Area->next == NULL)
-        {
-            /* This rectangle is not overlapped with any area. */
-            _AllocateArea(Context, Area, Rect, Owner);
-            return;
-        }
-
-        Area = Area->next;
-    }
-
-    /* OK, the rectangle is overlapped with 'rect' area. */
-    if ((Rect->left <= rect->left)
-    &&  (Rect->right >= rect->right)
-    )
-    {
-        /* |-><-| */
-        /* +---+---+---+
-         * | X | X | X |
-         * +---+---+---+
-         * | X | X | X |
-         * +---+---+---+
-         * | X | X | X |
-         * +---+---+---+
-         */
-
-        if (Rect->left < rect->left)
-        {
-            r1[c1].left   = Rect->left;
-            r1[c1].top    = Rect->top;
-            r1[c1].right  = rect->left;
-            r1[c1].bottom = Rect->bottom;
-
-            c1++;
-        }
-
-        if (Rect->top < rect->top)
-        {
-            r1[c1].left   = rect->left;
-            r1[c1].top    = Rect->top;
-            r1[c1].right  = rect->right;
-            r1[c1].bottom = rect->top;
-
-            c1++;
-        }
-
-        else if (rect->top < Rect->top)
-        {
-            r0[c0].left   = rect->left;
-            r0[c0].top    = rect->top;
-            r0[c0].right  = rect->right;
-            r0[c0].bottom = Rect->top;
-
-            c0++;
-        }
-
-        if (Rect->right > rect->right)
-        {
-            r1[c1].left   = rect->right;
-            r1[c1].top    = Rect->top;
-            r1[c1].right  = Rect->right;
-            r1[c1].bottom = Rect->bottom;
-
-            c1++;
-        }
-
-        if (Rect->bottom > rect->bottom)
-        {
-            r1[c1].left   = rect->left;
-            r1[c1].top    = rect->bottom;
-            r1[c1].right  = rect->right;
-            r1[c1].bottom = Rect->bottom;
-
-            c1++;
-        }
-
-        else if (rect->bottom > Rect->bottom)
-        {
-            r0[c0].left   = rect->left;
-            r0[c0].top    = Rect->bottom;
-            r0[c0].right  = rect->right;
-            r0[c0].bottom = rect->bottom;
-
-            c0++;
-        }
-    }
-
-    else if (Rect->left <= rect->left)
-    {
-        /* |-> */
-        /* +---+---+---+
-         * | X | X |   |
-         * +---+---+---+
-         * | X | X |   |
-         * +---+---+---+
-         * | X | X |   |
-         * +---+---+---+
-         */
-
-        if (Rect->left < rect->left)
-        {
-            r1[c1].left   = Rect->left;
-            r1[c1].top    = Rect->top;
-            r1[c1].right  = rect->left;
-            r1[c1].bottom = Rect->bottom;
-
-            c1++;
-        }
-
-        if (Rect->top < rect->top)
-        {
-            r1[c1].left   = rect->left;
-            r1[c1].top    = Rect->top;
-            r1[c1].right  = Rect->right;
-            r1[c1].bottom = rect->top;
-
-            c1++;
-        }
-
-        else if (rect->top < Rect->top)
-        {
-            r0[c0].left   = rect->left;
-            r0[c0].top    = rect->top;
-            r0[c0].right  = Rect->right;
-            r0[c0].bottom = Rect->top;
-
-            c0++;
-        }
-
-        /* if (rect->right > Rect->right) */
-        {
-            r0[c0].left   = Rect->right;
-            r0[c0].top    = rect->top;
-            r0[c0].right  = rect->right;
-            r0[c0].bottom = rect->bottom;
-
-            c0++;
-        }
-
-        if (Rect->bottom > rect->bottom)
-        {
-            r1[c1].left   = rect->left;
-            r1[c1].top    = rect->bottom;
-            r1[c1].right  = Rect->right;
-            r1[c1].bottom = Rect->bottom;
-
-            c1++;
-        }
-
-        else if (rect->bottom > Rect->bottom)
-        {
-            r0[c0].left   = rect->left;
-            r0[c0].top    = Rect->bottom;
-            r0[c0].right  = Rect->right;
-            r0[c0].bottom = rect->bottom;
-
-            c0++;
-        }
-    }
-
-    else if (Rect->right >= rect->right)
-    {
-        /*    <-| */
-        /* +---+---+---+
-         * |   | X | X |
-         * +---+---+---+
-         * |   | X | X |
-         * +---+---+---+
-         * |   | X | X |
-         * +---+---+---+
-         */
-
-        /* if (rect->left < Rect->left) */
-        {
-            r0[c0].left   = rect->left;
-            r0[c0].top    = rect->top;
-            r0[c0].right  = Rect->left;
-            r0[c0].bottom = rect->bottom;
-
-            c0++;
-        }
-
-        if (Rect->top < rect->top)
-        {
-            r1[c1].left   = Rect->left;
-            r1[c1].top    = Rect->top;
-            r1[c1].right  = rect->right;
-            r1[c1].bottom = rect->top;
-
-            c1++;
-        }
-
-        else if (rect->top < Rect->top)
-        {
-            r0[c0].left   = Rect->left;
-            r0[c0].top    = rect->top;
-            r0[c0].right  = rect->right;
-            r0[c0].bottom = Rect->top;
-
-            c0++;
-        }
-
-        if (Rect->right > rect->right)
-        {
-            r1[c1].left   = rect->right;
-            r1[c1].top    = Rect->top;
-            r1[c1].right  = Rect->right;
-            r1[c1].bottom = Rect->bottom;
-
-            c1++;
-        }
-
-        if (Rect->bottom > rect->bottom)
-        {
-            r1[c1].left   = Rect->left;
-            r1[c1].top    = rect->bottom;
-            r1[c1].right  = rect->right;
-            r1[c1].bottom = Rect->bottom;
-
-            c1++;
-        }
-
-        else if (rect->bottom > Rect->bottom)
-        {
-            r0[c0].left   = Rect->left;
-            r0[c0].top    = Rect->bottom;
-            r0[c0].right  = rect->right;
-            r0[c0].bottom = rect->bottom;
-
-            c0++;
-        }
-    }
-
-    else
-    {
-        /* | */
-        /* +---+---+---+
-         * |   | X |   |
-         * +---+---+---+
-         * |   | X |   |
-         * +---+---+---+
-         * |   | X |   |
-         * +---+---+---+
-         */
-
-        /* if (rect->left < Rect->left) */
-        {
-            r0[c0].left   = rect->left;
-            r0[c0].top    = rect->top;
-            r0[c0].right  = Rect->left;
-            r0[c0].bottom = rect->bottom;
-
-            c0++;
-        }
-
-        if (Rect->top < rect->top)
-        {
-            r1[c1].left   = Rect->left;
-            r1[c1].top    = Rect->top;
-            r1[c1].right  = Rect->right;
-            r1[c1].bottom = rect->top;
-
-            c1++;
-        }
-
-        else if (rect->top < Rect->top)
-        {
-            r0[c0].left   = Rect->left;
-            r0[c0].top    = rect->top;
-            r0[c0].right  = Rect->right;
-            r0[c0].bottom = Rect->top;
-
-            c0++;
-        }
-
-        /* if (rect->right > Rect->right) */
-        {
-            r0[c0].left   = Rect->right;
-            r0[c0].top    = rect->top;
-            r0[c0].right  = rect->right;
-            r0[c0].bottom = rect->bottom;
-
-            c0++;
-        }
-
-        if (Rect->bottom > rect->bottom)
-        {
-            r1[c1].left   = Rect->left;
-            r1[c1].top    = rect->bottom;
-            r1[c1].right  = Rect->right;
-            r1[c1].bottom = Rect->bottom;
-
-            c1++;
-        }
-
-        else if (rect->bottom > Rect->bottom)
-        {
-            r0[c0].left   = Rect->left;
-            r0[c0].top    = Rect->bottom;
-            r0[c0].right  = Rect->right;
-            r0[c0].bottom = rect->bottom;
-
-            c0++;
-        }
-    }
-
-    if (c1 > 0)
+    for (gctUINT32 i = 0; i < 2; i++)
     {
-        /* Process rects outside area. */
-        if (Area->next == NULL)
-        {
-            /* Save rects outside area. */
-            for (gctUINT32 i = 0; i < c1; i++)
-            {
-                _AllocateArea(Context, Area, &r1[i], Owner);
-            }
-        }
+        hwcTrimArena(&Context->compositionArenas[i], 0U);
 
-        else
-        {
-            /* Rects outside area. */
-            for (gctUINT32 i = 0; i < c1; i++)
-            {
-                _SplitArea(Context, Area, &r1[i], Owner);
-            }
-        }
+        Context->compositionArenas[i].pool = NULL;
     }
 
-    if (c0 > 0)
-    {
-        /* Save rects inside area but not overlapped. */
-        for (gctUINT32 i = 0; i < c0; i++)
-        {
-            _AllocateArea(Context, Area, &r0[i], Area->owners);
-        }
+    hwcTrimArena(&Context->swapArena, 0U);
 
-        /* Update overlapped area. */
-        if (rect->left   < Rect->left)   { rect->left   = Rect->left;   }
-        if (rect->top    < Rect->top)    { rect->top    = Rect->top;    }
-        if (rect->right  > Rect->right)  { rect->right  = Rect->right;  }
-        if (rect->bottom > Rect->bottom) { rect->bottom = Rect->bottom; }
-    }
-
-    /* The area is owned by the new owner as well. */
-    Area->owners |= Owner;
+    Context->swapArena.pool      = NULL;
+    Context->compositionArea     = NULL;
+    Context->swapArea            = NULL;
+    Context->lastCompositionArea = NULL;
 }
-
@@ -0,0 +1,64 @@
+/****************************************************************************
+*
+*    Copyright (c) 2005 - 2012 by Vivante Corp.  All rights reserved.
+*
+*    The material in this file is confidential and contains trade secrets
+*    of Vivante Corporation. This is proprietary information owned by
+*    Vivante Corporation. No part of this work may be disclosed,
+*    reproduced, copied, transmitted, or used in any way for any purpose,
+*    without the express written permission of Vivante Corporation.
+*
+*****************************************************************************/
+
+
+
+
+#ifndef __gc_hwc_trace_h_
+#define __gc_hwc_trace_h_
+
+/*
+ * Stage times of the GC composition, for the frame trace of the composer
+ * which loads this module. Only depends on system headers.
+ */
+
+#include <stdint.h>
+
+#include <hardware/hardware.h>
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Stages of the last set, CLOCK_MONOTONIC in ns. Both times of a stage are 0
+ * when it did not run in that set. */
+struct hwcStageTimes
+{
+    /* Layer information update and area split, on geometry change. */
+    int64_t                          splitStart;
+    int64_t                          splitEnd;
+
+    /* Area composition, submitting the 2D blits. */
+    int64_t                          composeStart;
+    int64_t                          composeEnd;
+
+    /* Commit, stalling until the 2D core finished the blits. */
+    int64_t                          commitStart;
+    int64_t                          commitEnd;
+};
+
+
+/* Copy the stage times of the last set. Returns 0, or -EINVAL for a bad
+ * device. */
+int
+hwc_get_stage_times(
+    struct hw_device_t * dev,
+    struct hwcStageTimes * times
+    );
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __gc_hwc_trace_h_ */
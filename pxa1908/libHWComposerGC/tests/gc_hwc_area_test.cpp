@@ -0,0 +1,758 @@
+/****************************************************************************
+*
+*    Copyright (c) 2005 - 2012 by Vivante Corp.  All rights reserved.
+*
+*    The material in this file is confidential and contains trade secrets
+*    of Vivante Corporation. This is proprietary information owned by
+*    Vivante Corporation. No part of this work may be disclosed,
+*    reproduced, copied, transmitted, or used in any way for any purpose,
+*    without the express written permission of Vivante Corporation.
+*
+*****************************************************************************/
+
+
+
+
+#include "gc_hwc_area.h"
+
+#include <string.h>
+
+#include <gtest/gtest.h>
+
+
+/* Screen of the tests, small enough to check area by pixel. */
+#define SCREEN_W 64
+#define SCREEN_H 64
+
+/* Owner bits of pixels, -1 for pixels outside all areas. */
+typedef gctINT64 OwnerMap[SCREEN_H][SCREEN_W];
+
+
+static gcsRECT
+_Rect(
+    gctINT32 Left,
+    gctINT32 Top,
+    gctINT32 Right,
+    gctINT32 Bottom
+    )
+{
+    gcsRECT rect = { Left, Top, Right, Bottom };
+    return rect;
+}
+
+
+static gctUINT32
+_Count(
+    hwcArea * Head
+    )
+{
+    gctUINT32 count = 0U;
+
+    for (hwcArea * area = Head; area != NULL; area = area->next)
+    {
+        count++;
+    }
+
+    return count;
+}
+
+
+/* Map owners of every pixel, fails if areas overlap. */
+static void
+_MapOwners(
+    hwcArea * Head,
+    OwnerMap Map
+    )
+{
+    for (gctINT32 y = 0; y < SCREEN_H; y++)
+    {
+        for (gctINT32 x = 0; x < SCREEN_W; x++)
+        {
+            Map[y][x] = -1;
+        }
+    }
+
+    for (hwcArea * area = Head; area != NULL; area = area->next)
+    {
+        gcsRECT * r = &area->rect;
+
+        ASSERT_LT(r->left, r->right);
+        ASSERT_LT(r->top, r->bottom);
+
+        for (gctINT32 y = r->top; y < r->bottom; y++)
+        {
+            for (gctINT32 x = r->left; x < r->right; x++)
+            {
+                ASSERT_EQ(-1, Map[y][x]) << "areas overlap at " << x << "," << y;
+                Map[y][x] = area->owners.bits[0];
+            }
+        }
+    }
+}
+
+
+static gctBOOL
+_Inside(
+    const gcsRECT * Rect,
+    gctINT32 X,
+    gctINT32 Y
+    )
+{
+    return (X >= Rect->left) && (X < Rect->right)
+        && (Y >= Rect->top)  && (Y < Rect->bottom);
+}
+
+
+static gctBOOL
+_InRegion(
+    const hwcRegion * Region,
+    gctINT32 X,
+    gctINT32 Y
+    )
+{
+    for (gctUINT32 i = 0; i < Region->count; i++)
+    {
+        if (_Inside(&Region->rects[i], X, Y))
+        {
+            return gcvTRUE;
+        }
+    }
+
+    return gcvFALSE;
+}
+
+
+class AreaTest : public ::testing::Test
+{
+protected:
+    virtual void SetUp()
+    {
+        memset(&arena, 0, sizeof(arena));
+    }
+
+    virtual void TearDown()
+    {
+        hwcTrimArena(&arena, 0U);
+    }
+
+    /* Split a screen size no-owner area with layer rectangles, as hwcSet
+     * does on geometry change. */
+    hwcArea * split(const gcsRECT * Rects, gctUINT32 Count)
+    {
+        gcsRECT screen = _Rect(0, 0, SCREEN_W, SCREEN_H);
+        hwcArea * head = hwcAllocateArea(&arena, NULL, &screen, NULL);
+
+        for (gctUINT32 i = 0; i < Count; i++)
+        {
+            gcsRECT rect = Rects[i];
+            EXPECT_EQ(gcvSTATUS_OK, hwcSplitArea(&arena, head, &rect, i));
+        }
+
+        return head;
+    }
+
+    hwcAreaArena arena;
+};
+
+
+/*******************************************************************************
+** Damage regions.
+*/
+
+TEST(RegionTest, ClipsToClip)
+{
+    hwcRegion region;
+    gcsRECT clip = _Rect(0, 0, 100, 100);
+    gcsRECT rect = _Rect(-10, 50, 20, 150);
+
+    hwcResetRegion(&region);
+    hwcAddRegion(&region, &rect, &clip);
+
+    ASSERT_EQ(1U, region.count);
+    EXPECT_EQ(0, region.rects[0].left);
+    EXPECT_EQ(50, region.rects[0].top);
+    EXPECT_EQ(20, region.rects[0].right);
+    EXPECT_EQ(100, region.rects[0].bottom);
+    EXPECT_EQ(0, memcmp(&region.rects[0], &region.bounds, sizeof(gcsRECT)));
+}
+
+TEST(RegionTest, DropsEmptyAndCovered)
+{
+    hwcRegion region;
+    gcsRECT clip    = _Rect(0, 0, 100, 100);
+    gcsRECT outside = _Rect(100, 0, 120, 10);
+    gcsRECT empty   = _Rect(10, 10, 10, 20);
+    gcsRECT big     = _Rect(10, 10, 50, 50);
+    gcsRECT small   = _Rect(20, 20, 30, 30);
+
+    hwcResetRegion(&region);
+    hwcAddRegion(&region, &outside, &clip);
+    hwcAddRegion(&region, &empty, &clip);
+    EXPECT_EQ(0U, region.count);
+
+    hwcAddRegion(&region, &big, &clip);
+    hwcAddRegion(&region, &small, &clip);
+    hwcAddRegion(&region, &big, &clip);
+    EXPECT_EQ(1U, region.count);
+}
+
+TEST(RegionTest, KeepsDisjointRectangles)
+{
+    hwcRegion region;
+    gcsRECT clip  = _Rect(0, 0, 1000, 1000);
+    gcsRECT top   = _Rect(0, 0, 1000, 10);
+    gcsRECT right = _Rect(990, 900, 1000, 1000);
+
+    hwcResetRegion(&region);
+    hwcAddRegion(&region, &top, &clip);
+    hwcAddRegion(&region, &right, &clip);
+
+    /* Two thin updates, not their bounding box. */
+    ASSERT_EQ(2U, region.count);
+    EXPECT_EQ(0, region.bounds.left);
+    EXPECT_EQ(0, region.bounds.top);
+    EXPECT_EQ(1000, region.bounds.right);
+    EXPECT_EQ(1000, region.bounds.bottom);
+}
+
+TEST(RegionTest, MergesIntoLeastGrowth)
+{
+    hwcRegion region;
+    gcsRECT clip = _Rect(0, 0, 1000, 1000);
+
+    hwcResetRegion(&region);
+
+    /* Fill the region with rectangles far apart on a diagonal. */
+    for (gctINT32 i = 0; i < HWC_DAMAGE_RECTS; i++)
+    {
+        gcsRECT rect = _Rect(i * 100, i * 100, i * 100 + 10, i * 100 + 10);
+        hwcAddRegion(&region, &rect, &clip);
+    }
+
+    ASSERT_EQ((gctUINT32) HWC_DAMAGE_RECTS, region.count);
+
+    /* Next to rectangle 2, it should absorb this one. */
+    gcsRECT next = _Rect(215, 200, 225, 210);
+    hwcAddRegion(&region, &next, &clip);
+
+    ASSERT_EQ((gctUINT32) HWC_DAMAGE_RECTS, region.count);
+    EXPECT_EQ(200, region.rects[2].left);
+    EXPECT_EQ(200, region.rects[2].top);
+    EXPECT_EQ(225, region.rects[2].right);
+    EXPECT_EQ(210, region.rects[2].bottom);
+
+    for (gctINT32 i = 0; i < HWC_DAMAGE_RECTS; i++)
+    {
+        if (i != 2)
+        {
+            EXPECT_EQ(i * 100 + 10, region.rects[i].right);
+        }
+    }
+
+    /* Merged rectangles still cover everything added. */
+    EXPECT_EQ(0, region.bounds.left);
+    EXPECT_EQ((HWC_DAMAGE_RECTS - 1) * 100 + 10, region.bounds.right);
+}
+
+
+/*******************************************************************************
+** Area split and the damage history.
+*/
+
+TEST_F(AreaTest, SplitKeepsOwnersPerPixel)
+{
+    gcsRECT layers[] =
+    {
+        _Rect(0, 0, 64, 64),
+        _Rect(8, 8, 40, 40),
+        _Rect(24, 4, 60, 30),
+        _Rect(30, 30, 50, 60),
+    };
+
+    hwcArea * head = split(layers, 4);
+    OwnerMap map;
+
+    ASSERT_NO_FATAL_FAILURE(_MapOwners(head, map));
+
+    for (gctINT32 y = 0; y < SCREEN_H; y++)
+    {
+        for (gctINT32 x = 0; x < SCREEN_W; x++)
+        {
+            gctINT64 owners = 0;
+
+            for (gctUINT32 i = 0; i < 4; i++)
+            {
+                if (_Inside(&layers[i], x, y))
+                {
+                    owners |= 1 << i;
+                }
+            }
+
+            ASSERT_EQ(owners, map[y][x]) << "at " << x << "," << y;
+        }
+    }
+}
+
+TEST_F(AreaTest, DamageIsComposedMissedDamageIsCopied)
+{
+    hwcRegion history[HWC_DAMAGE_HISTORY];
+    hwcRegion damage;
+    gcsRECT clip = _Rect(0, 0, SCREEN_W, SCREEN_H);
+
+    /* Frames 5 to 7 wrap around the history ring. */
+    gcsRECT missed[] =
+    {
+        _Rect(0, 0, 32, 16),
+        _Rect(40, 40, 64, 64),
+        _Rect(10, 10, 50, 20),
+    };
+
+    for (gctUINT32 i = 0; i < HWC_DAMAGE_HISTORY; i++)
+    {
+        hwcResetRegion(&history[i]);
+    }
+
+    for (gctUINT32 i = 0; i < 3; i++)
+    {
+        hwcAddRegion(&history[(5 + i) % HWC_DAMAGE_HISTORY], &missed[i], &clip);
+    }
+
+    gcsRECT rects[] = { _Rect(20, 0, 48, 24), _Rect(0, 50, 10, 60) };
+
+    hwcResetRegion(&damage);
+    hwcAddRegion(&damage, &rects[0], &clip);
+    hwcAddRegion(&damage, &rects[1], &clip);
+
+    hwcArea * head;
+    OwnerMap map;
+
+    ASSERT_EQ(gcvSTATUS_OK, hwcSplitDamage(&arena, &damage, history, 5U, 7U, &head));
+    ASSERT_TRUE(head != NULL);
+    ASSERT_NO_FATAL_FAILURE(_MapOwners(head, map));
+
+    for (gctINT32 y = 0; y < SCREEN_H; y++)
+    {
+        for (gctINT32 x = 0; x < SCREEN_W; x++)
+        {
+            gctBOOL missedPixel = gcvFALSE;
+
+            for (gctUINT32 i = 0; i < 3; i++)
+            {
+                missedPixel |= _Inside(&missed[i], x, y);
+            }
+
+            if (_InRegion(&damage, x, y))
+            {
+                /* Composed. */
+                ASSERT_EQ(1, map[y][x]) << "at " << x << "," << y;
+            }
+
+            else if (missedPixel)
+            {
+                /* Copied from the front buffer. */
+                ASSERT_EQ(0, map[y][x]) << "at " << x << "," << y;
+            }
+
+            else
+            {
+                /* Left alone. */
+                ASSERT_EQ(-1, map[y][x]) << "at " << x << "," << y;
+            }
+        }
+    }
+}
+
+TEST_F(AreaTest, NoMissedFrames)
+{
+    hwcRegion history[HWC_DAMAGE_HISTORY];
+    hwcRegion damage;
+    gcsRECT clip = _Rect(0, 0, SCREEN_W, SCREEN_H);
+    gcsRECT rect = _Rect(4, 4, 8, 8);
+
+    for (gctUINT32 i = 0; i < HWC_DAMAGE_HISTORY; i++)
+    {
+        hwcResetRegion(&history[i]);
+        hwcAddRegion(&history[i], &clip, &clip);
+    }
+
+    hwcArea * head;
+
+    hwcResetRegion(&damage);
+    ASSERT_EQ(gcvSTATUS_OK, hwcSplitDamage(&arena, &damage, history, 3U, 2U, &head));
+    EXPECT_TRUE(head == NULL);
+
+    hwcAddRegion(&damage, &rect, &clip);
+
+    /* First right after Last, and far after it: no missed frames either way,
+     * nothing from the history. */
+    gctUINT32 firsts[] = { 3U, 7U, 0xFFFFFFF0U };
+
+    for (gctUINT32 i = 0; i < 3; i++)
+    {
+        hwcResetArena(&arena);
+        ASSERT_EQ(gcvSTATUS_OK, hwcSplitDamage(&arena, &damage, history, firsts[i], 2U, &head));
+
+        ASSERT_EQ(1U, _Count(head));
+        EXPECT_EQ(0, memcmp(&head->rect, &rect, sizeof(gcsRECT)));
+        EXPECT_TRUE(hwcOwnersHas(&head->owners, 0U));
+    }
+}
+
+
+TEST_F(AreaTest, MissedFramesUpToCounterEnd)
+{
+    hwcRegion history[HWC_DAMAGE_HISTORY];
+    hwcRegion damage;
+    gcsRECT clip = _Rect(0, 0, SCREEN_W, SCREEN_H);
+    gcsRECT rect = _Rect(4, 4, 8, 8);
+    hwcArea * head;
+
+    for (gctUINT32 i = 0; i < HWC_DAMAGE_HISTORY; i++)
+    {
+        hwcResetRegion(&history[i]);
+    }
+
+    /* Only the last frame of the counter has damage. */
+    hwcAddRegion(&history[0xFFFFFFFFU % HWC_DAMAGE_HISTORY], &rect, &clip);
+    hwcResetRegion(&damage);
+
+    ASSERT_EQ(gcvSTATUS_OK,
+              hwcSplitDamage(&arena, &damage, history, 0xFFFFFFFEU, 0xFFFFFFFFU, &head));
+
+    ASSERT_EQ(1U, _Count(head));
+    EXPECT_EQ(0, memcmp(&head->rect, &rect, sizeof(gcsRECT)));
+    EXPECT_TRUE(hwcOwnersEmpty(&head->owners));
+}
+
+
+/*******************************************************************************
+** Area merge.
+*/
+
+TEST_F(AreaTest, MergeKeepsOwnersPerPixel)
+{
+    gctUINT32 seed        = 1U;
+    gctUINT32 totalMerged = 0U;
+
+    /* Random layer stacks, areas 8 pixels aligned as windows mostly are. */
+    for (gctUINT32 n = 0; n < 200; n++)
+    {
+        gcsRECT layers[6];
+
+        for (gctUINT32 i = 0; i < 6; i++)
+        {
+            gctINT32 v[4];
+
+            for (gctUINT32 j = 0; j < 4; j++)
+            {
+                seed = seed * 1103515245U + 12345U;
+                v[j] = (gctINT32) ((seed >> 16) % 9U) * 8;
+            }
+
+            layers[i] = _Rect(gcmMIN(v[0], v[1]), gcmMIN(v[2], v[3]),
+                              gcmMAX(v[0], v[1]), gcmMAX(v[2], v[3]));
+
+            if ((layers[i].left == layers[i].right)
+            ||  (layers[i].top  == layers[i].bottom)
+            )
+            {
+                layers[i] = _Rect(0, 0, SCREEN_W, SCREEN_H);
+            }
+        }
+
+        hwcResetArena(&arena);
+
+        hwcArea * head = split(layers, 6);
+        OwnerMap before;
+        OwnerMap after;
+
+        ASSERT_NO_FATAL_FAILURE(_MapOwners(head, before));
+
+        gctUINT32 count  = _Count(head);
+        gctUINT32 merged = hwcMergeArea(head);
+
+        ASSERT_EQ(count - merged, _Count(head));
+
+        ASSERT_NO_FATAL_FAILURE(_MapOwners(head, after));
+        ASSERT_EQ(0, memcmp(before, after, sizeof(OwnerMap))) << "stack " << n;
+
+        /* Nothing left to merge. */
+        ASSERT_EQ(0U, hwcMergeArea(head));
+
+        totalMerged += merged;
+    }
+
+    EXPECT_GT(totalMerged, 0U);
+}
+
+TEST_F(AreaTest, MergeChainsStrips)
+{
+    hwcOwners owners;
+
+    hwcOwnersClear(&owners);
+    hwcOwnersAdd(&owners, 1U);
+
+    gcsRECT r0 = _Rect(0, 0, 10, 10);
+    gcsRECT r1 = _Rect(20, 0, 30, 10);
+    gcsRECT r2 = _Rect(10, 0, 20, 10);
+    gcsRECT r3 = _Rect(0, 10, 30, 20);
+
+    hwcArea * head = hwcAllocateArea(&arena, NULL, &r0, &owners);
+    hwcArea * tail = hwcAllocateArea(&arena, head, &r1, &owners);
+    tail = hwcAllocateArea(&arena, tail, &r2, &owners);
+    hwcAllocateArea(&arena, tail, &r3, &owners);
+
+    /* r0 and r1 meet through r2 only, then the row meets r3. */
+    EXPECT_EQ(3U, hwcMergeArea(head));
+    ASSERT_EQ(1U, _Count(head));
+    EXPECT_EQ(0, head->rect.left);
+    EXPECT_EQ(0, head->rect.top);
+    EXPECT_EQ(30, head->rect.right);
+    EXPECT_EQ(20, head->rect.bottom);
+}
+
+TEST_F(AreaTest, MergeNeedsWholeEdgeAndSameOwners)
+{
+    hwcOwners a;
+    hwcOwners b;
+
+    hwcOwnersClear(&a);
+    hwcOwnersAdd(&a, 1U);
+    hwcOwnersClear(&b);
+    hwcOwnersAdd(&b, 2U);
+
+    gcsRECT r0 = _Rect(0, 0, 10, 10);
+    gcsRECT r1 = _Rect(10, 0, 20, 5);
+    gcsRECT r2 = _Rect(0, 10, 10, 20);
+
+    hwcArea * head = hwcAllocateArea(&arena, NULL, &r0, &a);
+    hwcArea * tail = hwcAllocateArea(&arena, head, &r1, &a);
+    hwcAllocateArea(&arena, tail, &r2, &b);
+
+    EXPECT_EQ(0U, hwcMergeArea(head));
+    EXPECT_EQ(3U, _Count(head));
+}
+
+
+/*******************************************************************************
+** Area arena.
+*/
+
+TEST_F(AreaTest, ArenaReusesPools)
+{
+    gcsRECT rect = _Rect(0, 0, 1, 1);
+
+    for (gctUINT32 i = 0; i < 1200; i++)
+    {
+        hwcAllocateArea(&arena, NULL, &rect, NULL);
+    }
+
+    gctUINT32 pools = arena.poolCount;
+
+    EXPECT_GE(pools, 3U);
+    EXPECT_EQ(1200U, arena.areaPeak);
+
+    hwcResetArena(&arena);
+    EXPECT_EQ(0U, arena.areaCount);
+
+    for (gctUINT32 i = 0; i < 1200; i++)
+    {
+        hwcAllocateArea(&arena, NULL, &rect, NULL);
+    }
+
+    EXPECT_EQ(pools, arena.poolCount);
+
+    hwcTrimArena(&arena, 1U);
+    EXPECT_EQ(1U, arena.poolCount);
+}
+
+
+/*******************************************************************************
+** Blit rectangles.
+*/
+
+static gctBOOL
+_Equal(
+    gcsRECT * A,
+    gcsRECT * B
+    )
+{
+    return (A->left  == B->left)  && (A->top    == B->top)
+        && (A->right == B->right) && (A->bottom == B->bottom);
+}
+
+TEST(BlitRectTest, ScaledLayerSplitByClips)
+{
+    /* 30 source columns stretched over 100, damage split at column 33. */
+    gcsRECT src    = _Rect(0, 0, 30, 100);
+    gcsRECT dst    = _Rect(0, 0, 100, 100);
+    gcsRECT area   = _Rect(0, 0, 100, 100);
+    gcsRECT clips[2] = { _Rect(0, 0, 33, 100), _Rect(33, 0, 100, 100) };
+
+    gcsRECT whole;
+    gctINT32 covered = 0;
+
+    hwcMapSource(&src, &dst, 0.3f, 1.0f, gcvFALSE, gcvFALSE, &area, &whole);
+    EXPECT_TRUE(_Equal(&src, &whole));
+
+    for (gctUINT32 c = 0; c < 2; c++)
+    {
+        gcsRECT rect;
+        gcsRECT subRect;
+        gcsRECT source;
+
+        hwcBlitRect(&area, &clips[c], gcvTRUE, &rect, &subRect);
+
+        /* Every clip samples the source as the whole area does. */
+        EXPECT_TRUE(_Equal(&area, &rect));
+
+        hwcMapSource(&src, &dst, 0.3f, 1.0f, gcvFALSE, gcvFALSE, &rect, &source);
+        EXPECT_TRUE(_Equal(&whole, &source));
+
+        /* Sub rectangles are the clips in the blit rectangle. */
+        EXPECT_EQ(clips[c].left  - rect.left, subRect.left);
+        EXPECT_EQ(clips[c].top   - rect.top,  subRect.top);
+        EXPECT_EQ(clips[c].right - rect.left, subRect.right);
+        EXPECT_EQ(clips[c].bottom - rect.top, subRect.bottom);
+
+        covered += (subRect.right - subRect.left) * (subRect.bottom - subRect.top);
+    }
+
+    EXPECT_EQ(100 * 100, covered);
+}
+
+TEST(BlitRectTest, UnscaledBlitUsesClip)
+{
+    gcsRECT area = _Rect(0, 0, 100, 100);
+    gcsRECT clip = _Rect(33, 10, 100, 60);
+    gcsRECT rect;
+    gcsRECT subRect;
+
+    hwcBlitRect(&area, &clip, gcvFALSE, &rect, &subRect);
+
+    EXPECT_TRUE(_Equal(&clip, &rect));
+    EXPECT_EQ(0, subRect.left);
+    EXPECT_EQ(0, subRect.top);
+    EXPECT_EQ(67, subRect.right);
+    EXPECT_EQ(50, subRect.bottom);
+}
+
+TEST(BlitRectTest, MirroredSource)
+{
+    /* Left half of the target comes from the right half of the source. */
+    gcsRECT src  = _Rect(0, 0, 50, 50);
+    gcsRECT dst  = _Rect(0, 0, 100, 100);
+    gcsRECT rect = _Rect(0, 0, 50, 100);
+    gcsRECT source;
+
+    hwcMapSource(&src, &dst, 0.5f, 0.5f, gcvTRUE, gcvFALSE, &rect, &source);
+
+    EXPECT_EQ(25, source.left);
+    EXPECT_EQ(0,  source.top);
+    EXPECT_EQ(50, source.right);
+    EXPECT_EQ(50, source.bottom);
+}
+
+
+/*******************************************************************************
+** Multi-source pass planning.
+*/
+
+/* Runs of layers allowed in one pass, as first layer and length. */
+struct _Runs
+{
+    gctUINT32 count;
+    gctUINT32 first[8];
+    gctUINT32 length[8];
+};
+
+static gctBOOL
+_CanGroupRun(
+    IN gctPOINTER Data,
+    IN gctUINT32 * Indices,
+    IN gctUINT32 Count
+    )
+{
+    _Runs * runs = (_Runs *) Data;
+
+    for (gctUINT32 i = 0; i < runs->count; i++)
+    {
+        if ((runs->first[i] == Indices[0]) && (runs->length[i] == Count))
+        {
+            return gcvTRUE;
+        }
+    }
+
+    return gcvFALSE;
+}
+
+static gctBOOL
+_CanGroupAll(
+    IN gctPOINTER Data,
+    IN gctUINT32 * Indices,
+    IN gctUINT32 Count
+    )
+{
+    (void) Data;
+    (void) Indices;
+    (void) Count;
+
+    return gcvTRUE;
+}
+
+TEST(PlanPassesTest, SingleSourceOnly)
+{
+    gctUINT32 indices[5] = { 0, 1, 2, 3, 4 };
+    gctUINT32 lengths[5];
+
+    ASSERT_EQ(5U, hwcPlanPasses(indices, 5, 1U, _CanGroupAll, NULL, lengths));
+
+    for (gctUINT32 i = 0; i < 5; i++)
+    {
+        EXPECT_EQ(1U, lengths[i]);
+    }
+}
+
+TEST(PlanPassesTest, GroupsUpToMaxSource)
+{
+    gctUINT32 indices[10];
+    gctUINT32 lengths[10];
+    gctUINT32 total = 0U;
+
+    for (gctUINT32 i = 0; i < 10; i++)
+    {
+        indices[i] = i;
+    }
+
+    gctUINT32 count = hwcPlanPasses(indices, 10, 4U, _CanGroupAll, NULL, lengths);
+
+    ASSERT_EQ(3U, count);
+
+    for (gctUINT32 p = 0; p < count; p++)
+    {
+        EXPECT_LE(lengths[p], 4U);
+        total += lengths[p];
+    }
+
+    EXPECT_EQ(10U, total);
+}
+
+TEST(PlanPassesTest, BeatsGreedyGrouping)
+{
+    gctUINT32 indices[5] = { 0, 1, 2, 3, 4 };
+    gctUINT32 lengths[5];
+
+    /* Greedy takes 0-2 and is left with 3 and 4 alone. */
+    _Runs runs = { 3, { 0, 0, 2 }, { 3, 2, 3 } };
+
+    ASSERT_EQ(2U, hwcPlanPasses(indices, 5, 4U, _CanGroupRun, &runs, lengths));
+    EXPECT_EQ(2U, lengths[0]);
+    EXPECT_EQ(3U, lengths[1]);
+}
+
+TEST(PlanPassesTest, NoLayers)
+{
+    gctUINT32 lengths[1];
+
+    EXPECT_EQ(0U, hwcPlanPasses(NULL, 0, 4U, _CanGroupAll, NULL, lengths));
+}
@@ -40,20 +40,32 @@ LOCAL_CFLAGS := \
 
 LOCAL_CFLAGS += $(common_flags) -DUSE_ION 
 
+# gc_gralloc_layout.h checks its layout table with C++14 constexpr.
+LOCAL_CPPFLAGS := -std=gnu++14
+
+# Room for compression headers in the framebuffer, see FB_COMPRESSION.
+ifeq ($(BOARD_ENABLE_FB_COMPRESSION), true)
+LOCAL_CFLAGS += -DFB_COMPRESSION=1
+endif
+
 LOCAL_SRC_FILES := \
 	gc_gralloc_fb.cpp \
 	gc_gralloc_alloc.cpp \
     gc_gralloc_map.cpp \
+	gc_gralloc_registry.cpp \
 	gralloc.cpp
 
 LOCAL_PRELINK_MODULE := false
 LOCAL_MODULE_TAGS := optional
 LOCAL_MODULE_PATH := $(TARGET_OUT_SHARED_LIBRARIES)/hw
-LOCAL_SHARED_LIBRARIES := $(common_libs) libbinder libmvmem libGAL
+LOCAL_SHARED_LIBRARIES := $(common_libs) libbinder libmvmem libGAL libsync
 LOCAL_C_INCLUDES       := $(common_includes) $(kernel_includes)
 
 # See hardware/libhardware/modules/README.android to see how this is named.
 
 LOCAL_MODULE := gralloc.$(TARGET_BOARD_PLATFORM)
 
+# Directory of the registry totals read by libmemtrack.
+LOCAL_INIT_RC := gralloc.rc
+
 include $(BUILD_SHARED_LIBRARY)
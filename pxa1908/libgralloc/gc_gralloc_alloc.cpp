@@ -38,6 +38,7 @@
 #include <binder/IPCThreadState.h>
 
 #include "gc_gralloc_gr.h"
+#include "gc_gralloc_layout.h"
 #include "gralloc_priv.h"
 #include "mrvl_pxl_formats.h"
 
@@ -126,78 +127,53 @@ _ConvertAndroid2HALFormat(
     }
 }
 
+/*******************************************************************************
+**
+**  _ConvertFormatToSurfaceInfo
+**
+**  Layout of an ION backed buffer, padded for its consumers only.
+**
+**  INPUT:
+**
+**      int Format
+**          Specified android pixel format.
+**
+**      int Width, Height
+**          Requested size.
+**
+**      int Usage
+**          Allocation usage, selects the consumers.
+**
+**      uint32_t PixelPipes
+**          Pixel pipes of the GPU.
+**
+**  OUTPUT:
+**
+**      size_t * Xstride, Ystride, Size
+**          Allocated width and height in pixels, size in bytes.
+*/
 int _ConvertFormatToSurfaceInfo(
     int Format,
     int Width,
     int Height,
+    int Usage,
+    uint32_t PixelPipes,
     size_t *Xstride,
     size_t *Ystride,
     size_t *Size
     )
 {
     //log_func_entry;
-    size_t xstride = 0;
-    size_t ystride = 0;
-    size_t size = 0;
+    gc_gralloc_layout layout =
+        gc_gralloc_layout_compute(Format, (uint32_t)Width, (uint32_t)Height,
+                                  gc_gralloc_layout_consumers(Usage), PixelPipes);
 
-    switch(Format)
-    {
-    case HAL_PIXEL_FORMAT_YV12:
-    case HAL_PIXEL_FORMAT_YCbCr_420_SP_MRVL:
-    case HAL_PIXEL_FORMAT_YCbCr_420_P:
-    case HAL_PIXEL_FORMAT_YCrCb_420_SP:
-        xstride = _ALIGN(Width, 64);
-        ystride = _ALIGN(Height, 64);
-        size = xstride * ystride * 3 / 2;
-        break;
-
-    case HAL_PIXEL_FORMAT_RGB_888:
-        xstride = _ALIGN(Width, 16);
-        ystride = _ALIGN(Height, 4);
-        size = xstride * ystride * 3;
-        break;
-
-    case HAL_PIXEL_FORMAT_RGBA_8888:
-    case HAL_PIXEL_FORMAT_RGBX_8888:
-    case HAL_PIXEL_FORMAT_BGRA_8888:
-        xstride = _ALIGN(Width, 16);
-        ystride = _ALIGN(Height, 4);
-        size = xstride * ystride * 4;
-        break;
-
-    case HAL_PIXEL_FORMAT_RGB_565:
-        xstride = _ALIGN(Width, 16);
-        ystride = _ALIGN(Height, 4);
-        size = xstride * ystride * 2;
-        break;
-
-    case HAL_PIXEL_FORMAT_YCbCr_422_SP:
-        xstride = _ALIGN(Width, 64);
-        ystride = _ALIGN(Height, 64);
-        size = xstride * ystride * 2;
-        break;
-
-    case HAL_PIXEL_FORMAT_CbYCrY_422_I:
-    case HAL_PIXEL_FORMAT_YCbCr_422_I:
-        xstride = _ALIGN(Width, 16);
-        ystride = _ALIGN(Height, 32);
-        size = xstride * ystride * 2;
-        break;
-
-    case HAL_PIXEL_FORMAT_IMPLEMENTATION_DEFINED:
-        xstride = _ALIGN(Width, 16);
-        ystride = _ALIGN(Height, 4);
-        size = xstride * ystride * 4;
-        break;
-
-    default:
+    if( layout.planes == 0 )
         return -EINVAL;
-    }
-
-    *Xstride = xstride;
-    *Ystride = ystride;
-    *Size = size;
 
+    *Xstride = layout.xstride;
+    *Ystride = layout.ystride;
+    *Size = layout.size;
     return 0;
 }
 
@@ -333,6 +309,8 @@ extern int gc_gralloc_alloc(alloc_device_t *Dev, int Width, int Height, int Form
     void *Vaddr; // [sp+74h] [bp-34h] MAPDST
     int alignedWidth2; // [sp+78h] [bp-30h]
     int alignedHeight2; // [sp+7Ch] [bp-2Ch] MAPDST
+    uint32_t legacySize;
+    int64_t layoutSaved = 0;
 
     dirtyHeight = Height;
     dirtyWidth = Width;
@@ -382,8 +360,16 @@ extern int gc_gralloc_alloc(alloc_device_t *Dev, int Width, int Height, int Form
       v24 = ((unsigned int)Usage >> 2) & 1;
       resolvePool = gcvPOOL_USER;
 
-      _ConvertFormatToSurfaceInfo(Format, Width, Height,
-                                 (size_t*)&xstride, (size_t*)&ystride, (size_t*)&size);
+      if ( _ConvertFormatToSurfaceInfo(Format, Width, Height, Usage, pixelPipes,
+                                 (size_t*)&xstride, (size_t*)&ystride, (size_t*)&size) < 0 )
+      {
+        ALOGE("error: no layout for HAL_PIXEL_FORMAT %x\n", Format);
+        master = -1;
+        goto OnError;
+      }
+      legacySize = gc_gralloc_layout_legacy(Format, Width, Height).size;
+      if ( legacySize != 0 )
+        layoutSaved = (int64_t)legacySize - (int64_t)size;
 
           size_rounded_to_page = _ALIGN(size, 4096);
           v33 = errno;
@@ -707,6 +693,17 @@ AllocBuffer:
         handle->mem_ystride = alignedHeight2;
         v42 = _MapBuffer((gralloc_module_t*)dev, handle, &Vaddr);
     }
+    if ( !v42 && gc_gralloc_registry_add(handle) < 0 )
+    {
+        gc_gralloc_unmap(handle);
+        v42 = -ENOMEM;
+    }
+    if ( !v42 && isPmemAlloc )
+    {
+        gc_gralloc_registry_account_layout(layoutSaved);
+        ALOGV("buffer=%p %dx%d format=%x layout %dx%d, %lld bytes saved",
+              handle, Width, Height, Format, xstride, ystride, (long long)layoutSaved);
+    }
     if ( !v42 )
     {
         *Handle = handle;
@@ -866,7 +863,8 @@ int setHwType71D0(int AllocUsage)
 **
 **  OUTPUT:
 **
-**      Nothing.
+**      0, or -EINVAL if the handle was not allocated in this process or is
+**      freed already.
 */
 int
 gc_gralloc_free(
@@ -886,6 +884,21 @@ gc_gralloc_free(
     /* Cast private buffer handle. */
     private_handle_t * hnd = (private_handle_t*)Handle;
 
+    /* Drop the allocation's own entry. A handle unknown here was freed
+     * already, or never allocated in this process. */
+    int refs = gc_gralloc_registry_release(hnd);
+    if( refs < 0 )
+        return -EINVAL;
+
+    /* Registrations still left go with the memory, an entry must not outlive
+     * the handle as a later one may be allocated at the same address. */
+    if( refs > 0 )
+    {
+        ALOGW("buffer=%p freed with %d registrations left in pid %d", hnd, refs, getpid());
+        while( refs > 0 )
+            refs = gc_gralloc_registry_release(hnd);
+    }
+
     gcoHAL_GetHardwareType(0, &hwtype);
     setHwType71D0(hnd->allocUsage);
     if( hnd->base )
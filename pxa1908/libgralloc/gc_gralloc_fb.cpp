@@ -18,6 +18,8 @@
 #include <sys/mman.h>
 
 #include <dlfcn.h>
+#include <poll.h>
+#include <time.h>
 
 #include <cutils/ashmem.h>
 #include <cutils/log.h>
@@ -37,6 +39,8 @@
 
 #include <linux/fb.h>
 
+#include <sync/sync.h>
+
 #include <video/mmp_disp.h>
 #include <video/mmp_ioctl.h>
 
@@ -44,116 +48,1040 @@
 #include "gc_gralloc_gr.h"
 
 
-/*
-     FRAMEBUFFER_PIXEL_FORMAT
+/*
+     FRAMEBUFFER_PIXEL_FORMAT
+
+         Set framebuffer pixel format to use for android.
+         If it is set to '0', current pixel format is detected and set.
+
+         Available format values are:
+             HAL_PIXEL_FORMAT_RGBA_8888 : 1
+             HAL_PIXEL_FORMAT_RGBX_8888 : 2
+             HAL_PIXEL_FORMAT_RGB_888   : 3
+             HAL_PIXEL_FORMAT_RGB_565   : 4
+             HAL_PIXEL_FORMAT_BGRA_8888 : 5
+ */
+#ifndef FRAMEBUFFER_PIXEL_FORMAT
+#define FRAMEBUFFER_PIXEL_FORMAT  5
+#endif
+
+/*
+     NUM_BUFFERS
+
+         Maximum numbers of buffers of framebuffer device for page flipping.
+
+         The count actually used is negotiated in mapFrameBufferLocked: as
+         many as fit in the framebuffer memory, between 2 and NUM_BUFFERS.
+         It can be capped with the 'persist.gralloc.fb.buffers' property.
+         The result is (yres_virtual / buffer lines), see private_module_t
+         numBuffers. Buffer lines include the FB_COMPRESSION header room.
+ */
+#ifndef NUM_BUFFERS
+#define NUM_BUFFERS               4
+#endif
+
+/*
+     DEPTH_WINDOW, DEPTH_MISS_LIMIT, DEPTH_CLEAN_WINDOWS
+
+         Render-ahead depth control, see _UpdateDepth.
+
+         The depth is how many buffers the display may hold, the one on
+         screen and the flips queued behind it. The release fence of each
+         flip goes back to the caller, so the producer normally waits for
+         its next buffer on the GPU and a post returns at once. Only when a
+         producer runs ahead of the depth does a post block its caller (the
+         composition thread of SurfaceFlinger) in poll on the oldest release
+         fence, 1 s at most on a stuck display. Depth 2 is double buffering,
+         depth 3 lets the producer queue one more frame.
+
+         Every DEPTH_WINDOW continuously presented frames, the depth goes to
+         3 if at least DEPTH_MISS_LIMIT frames missed their vsync, and back
+         to 2 after DEPTH_CLEAN_WINDOWS windows without any miss. Present
+         times come from the release fences, so without them (flips waiting
+         for vsync) the depth stays at 2.
+         The 'persist.gralloc.fb.depth' property pins the depth to 2 or 3.
+ */
+#define DEPTH_WINDOW              60
+#define DEPTH_MISS_LIMIT          3
+#define DEPTH_CLEAN_WINDOWS       4
+
+/*
+     FB_COMPRESSION
+
+         Set to 1 to reserve room for a compression header after the pixels
+         of each framebuffer buffer. Composers which can render compressed
+         frames then mark them with GRALLOC_MODULE_PERFORM_SET_FB_COMPRESSED,
+         and the display controller decompresses them (DECOMPRESS_MODE).
+
+         Off by default: the headers grow yres_virtual, which only pays off
+         when the 2D core renders compressed frames. Such boards set
+         BOARD_ENABLE_FB_COMPRESSION.
+
+         The 'persist.gralloc.fb.compress' property set to 0 disables it.
+         The 'persist.gralloc.fb.stats' property set to 1 samples compression
+         headers on post for the bytes saved counters, see _AccountFrame.
+ */
+#ifndef FB_COMPRESSION
+#define FB_COMPRESSION            0
+#endif
+
+/*
+     NUM_PAGES_MMAP
+
+         Numbers of pages to mmap framebuffer to userspace.
+
+         Normally the total buffer size should be rounded up to page boundary
+         and mapped to userspace. On some platform, maping the rounded size
+         will fail. Set non-zero value to specify the page count to map.
+ */
+#define NUM_PAGES_MMAP            0
+
+
+/* Framebuffer pixel format table. */
+static const struct
+{
+    int      format;
+    uint32_t bits_per_pixel;
+    uint32_t red_offset;
+    uint32_t red_length;
+    uint32_t green_offset;
+    uint32_t green_length;
+    uint32_t blue_offset;
+    uint32_t blue_length;
+    uint32_t transp_offset;
+    uint32_t transp_length;
+}
+formatTable[] =
+{
+    {HAL_PIXEL_FORMAT_RGBA_8888, 32,  0, 8,  8, 8,  16, 8, 24, 8},
+    {HAL_PIXEL_FORMAT_RGBX_8888, 32,  0, 8,  8, 8,  16, 8,  0, 0},
+    {HAL_PIXEL_FORMAT_RGB_888,   24,  0, 8,  8, 8,  16, 8,  0, 0},
+    {HAL_PIXEL_FORMAT_RGB_565,   16, 11, 5,  5, 6,   0, 5,  0, 0},
+    {HAL_PIXEL_FORMAT_BGRA_8888, 32, 16, 8,  8, 8,   0, 8, 24, 8}
+};
+
+extern int format = 0;
+
+#if MRVL_SUPPORT_DISPLAY_MODEL
+android::sp<android::IDisplayModel> displayModel = NULL;
+#endif
+
+struct fb_context_t
+{
+    framebuffer_device_t device;
+};
+
+/* Per framebuffer slot flip state. */
+static struct
+{
+    /* Cached mmp_surface, see _BuildSurface. compressed is also whether the
+     * last post of this slot was compressed. */
+    int         valid;
+    int         compressed;
+    mmp_surface surface;
+
+    /* Mark of fb_set_compressed for the next post, -1 if not marked. */
+    int         marked;
+
+    /* Fence the next flip of this slot waits for. */
+    int         acquireFd;
+
+    /* Fence returned by the last flip of this slot. */
+    int         releaseFd;
+}
+fbSlots[NUM_BUFFERS];
+
+static pthread_mutex_t fbLock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Whether the kernel returns release fences for flips, see
+ * _ProbeReleaseFence. */
+static int fbReleaseFence = 0;
+
+/* Render-ahead depth state. */
+static uint32_t fbDepth          = 2;
+static uint32_t fbDepthMax       = 2;
+static int      fbDepthPinned    = 0;
+static int64_t  fbLastPresent    = 0;
+static int64_t  fbCadence        = 0;
+static uint32_t fbPosts          = 0;
+static uint32_t fbMissed         = 0;
+static uint32_t fbCleanWindows   = 0;
+
+/* Release fences of the last flips, oldest first, not signaled yet when
+ * last checked. Each signals when the frame of the following flip is
+ * presented, see _CollectPresents. */
+static int      fbPresentFds[NUM_BUFFERS];
+static uint32_t fbPresentHead    = 0;
+static uint32_t fbPresentCount   = 0;
+
+/* Lines from one framebuffer buffer to the next, and offset of the
+ * compression header in a buffer (0 without compression). */
+static uint32_t fbSlotLines      = 0;
+static uint32_t fbHeaderOffset   = 0;
+
+/* Bandwidth counters, protected by fbLock. */
+static private_fb_stats_t fbStats;
+static int      fbSampleHeaders  = 0;
+
+/*******************************************************************************
+**
+**  fb_setSwapInterval
+**
+**  Set framebuffer swap interval.
+**
+**  INPUT:
+**
+**      framebuffer_device_t * Dev
+**          Specified framebuffer device.
+**
+**      int Interval
+**          Specified Interval value.
+**
+**  OUTPUT:
+**
+**      Nothing.
+*/
+static int
+fb_setSwapInterval(
+    struct framebuffer_device_t * Dev,
+    int Interval
+    )
+{
+    //log_func_entry;
+    if ((Interval < Dev->minSwapInterval)
+    ||  (Interval > Dev->maxSwapInterval)
+    )
+    {
+        return -EINVAL;
+    }
+
+    /* FIXME: implement fb_setSwapInterval. */
+    return 0;
+}
+
+/*******************************************************************************
+**
+**  _GetSlot
+**
+**  Get the framebuffer slot (page flip index) a framebuffer handle points to.
+**
+**  INPUT:
+**
+**      private_module_t * Module
+**          Specified gralloc module.
+**
+**      private_handle_t * Handle
+**          Specified framebuffer handle.
+**
+**  OUTPUT:
+**
+**      Slot index, or -1 if the handle is not inside the framebuffer.
+*/
+static int
+_GetSlot(
+    private_module_t * Module,
+    private_handle_t * Handle
+    )
+{
+    if ((Module->framebuffer == NULL)
+    ||  (fbSlotLines == 0)
+    ||  (Handle->base < Module->framebuffer->base)
+    )
+    {
+        return -1;
+    }
+
+    size_t line = (Handle->base - Module->framebuffer->base)
+                / Module->finfo.line_length;
+    size_t slot = line / fbSlotLines;
+
+    if ((slot >= Module->numBuffers) || (slot >= NUM_BUFFERS))
+    {
+        return -1;
+    }
+
+    return (int) slot;
+}
+
+/*******************************************************************************
+**
+**  _HeaderSize
+**
+**  Size of the compression header of a framebuffer buffer: one byte for each
+**  512 bytes of pixels, lines aligned to 4.
+**
+**  INPUT:
+**
+**      uint32_t Pitch
+**          Framebuffer line size in bytes.
+**
+**      uint32_t Height
+**          Framebuffer height in lines.
+**
+**  OUTPUT:
+**
+**      Header size in bytes.
+*/
+static inline uint32_t
+_HeaderSize(
+    uint32_t Pitch,
+    uint32_t Height
+    )
+{
+    return (Pitch * _ALIGN(Height, 4)) >> 9;
+}
+
+/*******************************************************************************
+**
+**  _BuildSurface
+**
+**  Build the mmp_surface template of a framebuffer slot. Everything here only
+**  depends on the screen info and the slot, so it is built once and reused
+**  on every flip of this slot.
+**
+**  INPUT:
+**
+**      private_module_t * Module
+**          Specified gralloc module.
+**
+**      int Slot
+**          Specified framebuffer slot.
+**
+**      int Compressed
+**          Whether the slot holds a compressed frame.
+**
+**  OUTPUT:
+**
+**      mmp_surface * Surface
+**          Template to fill.
+*/
+static void
+_BuildSurface(
+    private_module_t * Module,
+    int Slot,
+    int Compressed,
+    mmp_surface * Surface
+    )
+{
+    memset(Surface, 0, sizeof (*Surface));
+
+    Surface->win.xsrc = Module->info.xres;
+    Surface->win.ysrc = Module->info.yres;
+
+    Surface->win.xdst = Module->info.xres;
+    Surface->win.ydst = Module->info.yres;
+
+    switch( format )
+    {
+        case HAL_PIXEL_FORMAT_RGBA_8888:
+        case HAL_PIXEL_FORMAT_RGBX_8888:
+            Surface->win.pix_fmt = FB_VMODE_RGBA888; break;
+        case HAL_PIXEL_FORMAT_RGB_888   :
+            Surface->win.pix_fmt = FB_VMODE_RGB888PACK; break;
+        case HAL_PIXEL_FORMAT_RGB_565   :
+            Surface->win.pix_fmt = FB_VMODE_RGB565; break;
+        case HAL_PIXEL_FORMAT_BGRA_8888 :
+            Surface->win.pix_fmt = FB_VMODE_BGRA888; break;
+        default:
+            ALOGE("FB format(%d) is not supported.", format);
+            Surface->win.pix_fmt = 0;
+            break;
+    }
+
+    Surface->win.pitch[0] = Module->info.xres_virtual * (Module->info.bits_per_pixel/8);
+
+    Surface->addr.phys[0] = Module->finfo.smem_start
+                          + Surface->win.pitch[0] * fbSlotLines * Slot;
+
+    if( Compressed )
+    {
+        Surface->addr.hdr_addr[0] = Surface->addr.phys[0] + fbHeaderOffset;
+        Surface->addr.hdr_size[0] = _HeaderSize(Surface->win.pitch[0], Module->info.yres);
+        Surface->flag = DECOMPRESS_MODE;
+    }
+
+    Surface->fence_fd = -1;
+    Surface->fd = -1;
+}
+
+/*******************************************************************************
+**
+**  _ProbeReleaseFence
+**
+**  Find out once whether the kernel returns release fences for flips, so the
+**  first post already knows whether it has to wait for vsync. Flips to slot 0
+**  without acquire fence: it is the buffer on screen after FBIOPUT_VSCREENINFO,
+**  so nothing visible changes.
+**
+**  INPUT:
+**
+**      private_module_t * Module
+**          Specified gralloc module, screen info set.
+**
+**      int Fd
+**          Framebuffer device.
+**
+**  OUTPUT:
+**
+**      1 if the flip returned a release fence, 0 otherwise.
+*/
+static int
+_ProbeReleaseFence(
+    private_module_t * Module,
+    int Fd
+    )
+{
+    mmp_surface surface;
+    int commit = 1;
+
+    _BuildSurface(Module, 0, 0, &surface);
+
+    if (ioctl(Fd, FB_IOCTL_FLIP_USR_BUF, &surface) == -1)
+    {
+        ALOGW("Release fence probe flip failed: %s", strerror(errno));
+        return 0;
+    }
+
+    ioctl(Fd, FB_IOCTL_FLIP_COMMIT, &commit);
+
+    /* fence_fd goes in as -1, a kernel with release fences replaces it. */
+    if (surface.fence_fd < 0)
+    {
+        return 0;
+    }
+
+    close(surface.fence_fd);
+    return 1;
+}
+
+/*******************************************************************************
+**
+**  fb_set_acquire_fence
+**
+**  Attach the acquire fence of the next frame rendered into a framebuffer
+**  handle. fb_post hands it to the display controller, which waits for it
+**  before scanning out, so nobody has to block on it in userspace.
+**
+**  INPUT:
+**
+**      private_module_t * Module
+**          Specified gralloc module.
+**
+**      buffer_handle_t Buffer
+**          Specified framebuffer handle.
+**
+**      int FenceFd
+**          Acquire fence, not owned (duplicated here). -1 for none.
+**
+**  OUTPUT:
+**
+**      Nothing.
+*/
+int
+fb_set_acquire_fence(
+    private_module_t * Module,
+    buffer_handle_t Buffer,
+    int FenceFd
+    )
+{
+    private_handle_t * hnd = (private_handle_t *) Buffer;
+
+    if (private_handle_t::validate(Buffer) < 0)
+    {
+        return -EINVAL;
+    }
+
+    int slot = _GetSlot(Module, hnd);
+    if (slot < 0)
+    {
+        return -EINVAL;
+    }
+
+    pthread_mutex_lock(&fbLock);
+
+    if (fbSlots[slot].acquireFd >= 0)
+    {
+        close(fbSlots[slot].acquireFd);
+    }
+
+    fbSlots[slot].acquireFd = (FenceFd >= 0) ? dup(FenceFd) : -1;
+
+    pthread_mutex_unlock(&fbLock);
+    return 0;
+}
+
+/*******************************************************************************
+**
+**  fb_get_release_fence
+**
+**  Take the release fence the display controller returned for the last flip
+**  of a framebuffer handle. The fence signals when the buffer is no longer
+**  scanned out. Ownership goes to the caller.
+**
+**  INPUT:
+**
+**      private_module_t * Module
+**          Specified gralloc module.
+**
+**      buffer_handle_t Buffer
+**          Specified framebuffer handle.
+**
+**  OUTPUT:
+**
+**      int * FenceFd
+**          Release fence, -1 if there is none.
+*/
+int
+fb_get_release_fence(
+    private_module_t * Module,
+    buffer_handle_t Buffer,
+    int * FenceFd
+    )
+{
+    private_handle_t * hnd = (private_handle_t *) Buffer;
+
+    *FenceFd = -1;
+
+    if (private_handle_t::validate(Buffer) < 0)
+    {
+        return -EINVAL;
+    }
+
+    int slot = _GetSlot(Module, hnd);
+    if (slot < 0)
+    {
+        return -EINVAL;
+    }
+
+    pthread_mutex_lock(&fbLock);
+
+    *FenceFd = fbSlots[slot].releaseFd;
+    fbSlots[slot].releaseFd = -1;
+    hnd->fenceFd = -1;
+
+    pthread_mutex_unlock(&fbLock);
+    return 0;
+}
+
+/*******************************************************************************
+**
+**  fb_get_header
+**
+**  Get where the compression header of a framebuffer handle goes.
+**
+**  INPUT:
+**
+**      private_module_t * Module
+**          Specified gralloc module.
+**
+**      buffer_handle_t Buffer
+**          Specified framebuffer handle.
+**
+**  OUTPUT:
+**
+**      uint32_t * Offset
+**          Header offset from the start of the buffer, 0 if framebuffer
+**          compression is disabled.
+*/
+int
+fb_get_header(
+    private_module_t * Module,
+    buffer_handle_t Buffer,
+    uint32_t * Offset
+    )
+{
+    private_handle_t * hnd = (private_handle_t *) Buffer;
+
+    *Offset = 0;
+
+    if (private_handle_t::validate(Buffer) < 0)
+    {
+        return -EINVAL;
+    }
+
+    if (_GetSlot(Module, hnd) < 0)
+    {
+        return -EINVAL;
+    }
+
+    *Offset = fbHeaderOffset;
+    return 0;
+}
+
+/*******************************************************************************
+**
+**  fb_set_compressed
+**
+**  Mark the frame rendered into a framebuffer handle as compressed or not.
+**  fb_post consumes the mark, so it must be set again for every frame. The
+**  mark is kept in the slot, the handle layout is not touched.
+**
+**  INPUT:
+**
+**      private_module_t * Module
+**          Specified gralloc module.
+**
+**      buffer_handle_t Buffer
+**          Specified framebuffer handle.
+**
+**      int Compressed
+**          Whether the frame is compressed, see fb_get_header.
+**
+**  OUTPUT:
+**
+**      Nothing.
+*/
+int
+fb_set_compressed(
+    private_module_t * Module,
+    buffer_handle_t Buffer,
+    int Compressed
+    )
+{
+    private_handle_t * hnd = (private_handle_t *) Buffer;
+
+    if (private_handle_t::validate(Buffer) < 0)
+    {
+        return -EINVAL;
+    }
+
+    int slot = _GetSlot(Module, hnd);
+    if (slot < 0)
+    {
+        return -EINVAL;
+    }
+
+    if (Compressed && (fbHeaderOffset == 0))
+    {
+        /* No room for the header. */
+        return -EINVAL;
+    }
+
+    pthread_mutex_lock(&fbLock);
+    fbSlots[slot].marked = Compressed ? 1 : 0;
+    pthread_mutex_unlock(&fbLock);
+
+    return 0;
+}
+
+/*******************************************************************************
+**
+**  fb_get_compressed
+**
+**  Whether the frame in a framebuffer handle is compressed: the mark of
+**  fb_set_compressed when it was not posted yet, else the state of its last
+**  post. Composers reading the buffer after the post use this, the mark is
+**  gone by then.
+**
+**  INPUT:
+**
+**      private_module_t * Module
+**          Specified gralloc module.
+**
+**      buffer_handle_t Buffer
+**          Specified framebuffer handle.
+**
+**  OUTPUT:
+**
+**      int * Compressed
+**          Whether the frame is compressed.
+*/
+int
+fb_get_compressed(
+    private_module_t * Module,
+    buffer_handle_t Buffer,
+    int * Compressed
+    )
+{
+    private_handle_t * hnd = (private_handle_t *) Buffer;
+
+    *Compressed = 0;
+
+    if (private_handle_t::validate(Buffer) < 0)
+    {
+        return -EINVAL;
+    }
+
+    int slot = _GetSlot(Module, hnd);
+    if (slot < 0)
+    {
+        return -EINVAL;
+    }
+
+    pthread_mutex_lock(&fbLock);
+
+    if (fbSlots[slot].marked >= 0)
+    {
+        *Compressed = fbSlots[slot].marked;
+    }
+    else
+    {
+        *Compressed = fbSlots[slot].valid && fbSlots[slot].compressed;
+    }
+
+    pthread_mutex_unlock(&fbLock);
+    return 0;
+}
+
+/*******************************************************************************
+**
+**  fb_get_stats
+**
+**  Snapshot of the framebuffer bandwidth counters.
+**
+**  INPUT:
+**
+**      private_module_t * Module
+**          Specified gralloc module.
+**
+**  OUTPUT:
+**
+**      private_fb_stats_t * Stats
+**          Point to save the counters.
+*/
+int
+fb_get_stats(
+    private_module_t * Module,
+    private_fb_stats_t * Stats
+    )
+{
+    (void) Module;
+
+    pthread_mutex_lock(&fbLock);
+    *Stats = fbStats;
+    pthread_mutex_unlock(&fbLock);
+
+    return 0;
+}
+
+/*******************************************************************************
+**
+**  fb_get_slot_size
+**
+**  Bytes from one framebuffer buffer to the next, header room included.
+**
+**  INPUT:
+**
+**      private_module_t * Module
+**          Specified gralloc module, framebuffer mapped.
+**
+**  OUTPUT:
+**
+**      Buffer size in bytes.
+*/
+size_t
+fb_get_slot_size(
+    private_module_t * Module
+    )
+{
+    return size_t(Module->finfo.line_length) * fbSlotLines;
+}
+
+static inline int64_t
+_MonotonicNs(
+    void
+    )
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return int64_t(ts.tv_sec) * 1000000000LL + ts.tv_nsec;
+}
+
+/*******************************************************************************
+**
+**  _AccountFrame
+**
+**  Update the bandwidth counters for a posted frame.
+**
+**  For compressed frames, the header is sampled when enabled and when the
+**  frame is already rendered. A header byte of 0 marks a 512 bytes block the
+**  display does not fetch at all (cleared). Other blocks are counted as fully
+**  fetched, which makes bytesSaved a lower bound.
+**
+**  INPUT:
+**
+**      private_module_t * Module
+**          Specified gralloc module.
+**
+**      private_handle_t * Handle
+**          Posted framebuffer handle.
+**
+**      int Compressed
+**          Whether the frame is compressed.
+**
+**      int AcquireFd
+**          Acquire fence of the frame, -1 if it is rendered.
+**
+**  OUTPUT:
+**
+**      Nothing.
+*/
+static void
+_AccountFrame(
+    private_module_t * Module,
+    private_handle_t * Handle,
+    int Compressed,
+    int AcquireFd
+    )
+{
+    uint32_t pitch  = Module->finfo.line_length;
+    uint32_t saved  = 0;
+    int sampled     = 0;
+
+    if (Compressed && fbSampleHeaders)
+    {
+        struct pollfd fds;
+
+        fds.fd      = AcquireFd;
+        fds.events  = POLLIN;
+        fds.revents = 0;
 
-         Set framebuffer pixel format to use for android.
-         If it is set to '0', current pixel format is detected and set.
+        /* Do not read a header which is still being written. */
+        if ((AcquireFd < 0) || (poll(&fds, 1, 0) > 0))
+        {
+            const uint8_t * header =
+                (const uint8_t *) (Handle->base + fbHeaderOffset);
+            uint32_t size = _HeaderSize(pitch, Module->info.yres);
+
+            for (uint32_t i = 0; i < size; i++)
+            {
+                if (header[i] == 0)
+                {
+                    saved += 512;
+                }
+            }
+
+            sampled = 1;
+        }
+    }
 
-         Available format values are:
-             HAL_PIXEL_FORMAT_RGBA_8888 : 1
-             HAL_PIXEL_FORMAT_RGBX_8888 : 2
-             HAL_PIXEL_FORMAT_RGB_888   : 3
-             HAL_PIXEL_FORMAT_RGB_565   : 4
-             HAL_PIXEL_FORMAT_BGRA_8888 : 5
- */
-#ifndef FRAMEBUFFER_PIXEL_FORMAT
-#define FRAMEBUFFER_PIXEL_FORMAT  5
-#endif
+    pthread_mutex_lock(&fbLock);
 
-/*
-     NUM_BUFFERS
+    fbStats.frames++;
+    fbStats.bytes += uint64_t(pitch) * Module->info.yres;
 
-         Numbers of buffers of framebuffer device for page flipping.
+    if (Compressed)
+    {
+        fbStats.compressedFrames++;
+    }
 
-         Normally it can be '2' for double buffering, or '3' for tripple
-         buffering.
-         This value should equal to (yres_virtual / yres).
- */
-#ifndef NUM_BUFFERS
-#define NUM_BUFFERS               3
-#endif
+    if (sampled)
+    {
+        fbStats.sampledFrames++;
+        fbStats.bytesSaved    += saved;
+        fbStats.lastBytesSaved = saved;
+    }
 
-/*
-     NUM_PAGES_MMAP
+    pthread_mutex_unlock(&fbLock);
+}
 
-         Numbers of pages to mmap framebuffer to userspace.
+/*******************************************************************************
+**
+**  _FenceTime
+**
+**  Time a fence signaled, from its sync points.
+**
+**  INPUT:
+**
+**      int Fd
+**          Specified fence.
+**
+**  OUTPUT:
+**
+**      CLOCK_MONOTONIC time in ns, 0 if the fence is still pending and -1 on
+**      error.
+*/
+static int64_t
+_FenceTime(
+    int Fd
+    )
+{
+    struct sync_fence_info_data * info = sync_fence_info(Fd);
+    struct sync_pt_info * pt = NULL;
+    int64_t time = 0;
 
-         Normally the total buffer size should be rounded up to page boundary
-         and mapped to userspace. On some platform, maping the rounded size
-         will fail. Set non-zero value to specify the page count to map.
- */
-#define NUM_PAGES_MMAP            0
+    if (info == NULL)
+    {
+        return -1;
+    }
 
+    if (info->status == 1)
+    {
+        /* The fence signals with its last point. */
+        while ((pt = sync_pt_info(info, pt)) != NULL)
+        {
+            if (int64_t(pt->timestamp_ns) > time)
+            {
+                time = int64_t(pt->timestamp_ns);
+            }
+        }
+    }
+    else if (info->status < 0)
+    {
+        time = -1;
+    }
 
-/* Framebuffer pixel format table. */
-static const struct
-{
-    int      format;
-    uint32_t bits_per_pixel;
-    uint32_t red_offset;
-    uint32_t red_length;
-    uint32_t green_offset;
-    uint32_t green_length;
-    uint32_t blue_offset;
-    uint32_t blue_length;
-    uint32_t transp_offset;
-    uint32_t transp_length;
+    sync_fence_info_free(info);
+    return time;
 }
-formatTable[] =
+
+/*******************************************************************************
+**
+**  _UpdateDepth
+**
+**  Account one presented frame for the render-ahead depth control (see
+**  DEPTH_WINDOW). Present times are vsync aligned, so the gap from the
+**  previous frame is a whole number of refresh periods. A frame missed its
+**  vsync when that gap is longer than the cadence of the previous frame,
+**  which then stayed on screen one period more than the ones before. A
+**  steady cadence, 30 fps on a 60 Hz screen for instance, is not late.
+**  Gaps over 4 periods mean the screen was idle and are not counted.
+**
+**  INPUT:
+**
+**      private_module_t * Module
+**          Specified gralloc module.
+**
+**      int64_t Present
+**          Time the frame reached the screen, not above 0 if unknown.
+**
+**  OUTPUT:
+**
+**      Nothing.
+*/
+static void
+_UpdateDepth(
+    private_module_t * Module,
+    int64_t Present
+    )
 {
-    {HAL_PIXEL_FORMAT_RGBA_8888, 32,  0, 8,  8, 8,  16, 8, 24, 8},
-    {HAL_PIXEL_FORMAT_RGBX_8888, 32,  0, 8,  8, 8,  16, 8,  0, 0},
-    {HAL_PIXEL_FORMAT_RGB_888,   24,  0, 8,  8, 8,  16, 8,  0, 0},
-    {HAL_PIXEL_FORMAT_RGB_565,   16, 11, 5,  5, 6,   0, 5,  0, 0},
-    {HAL_PIXEL_FORMAT_BGRA_8888, 32, 16, 8,  8, 8,   0, 8, 24, 8}
-};
+    int64_t period = int64_t(1000000000.0f / (Module->fps > 0 ? Module->fps : 60.0f));
+    int64_t delta  = Present - fbLastPresent;
+    int64_t last   = fbLastPresent;
 
-extern int format = 0;
+    fbLastPresent = Present;
 
-#if MRVL_SUPPORT_DISPLAY_MODEL
-android::sp<android::IDisplayModel> displayModel = NULL;
-#endif
+    if (fbDepthPinned || (Present <= 0) || (last <= 0) || (delta > period * 4))
+    {
+        fbCadence = 0;
+        return;
+    }
 
-struct fb_context_t
-{
-    framebuffer_device_t device;
-};
+    /* Round to whole periods. */
+    int64_t periods = (delta + period / 2) / period;
+    int64_t cadence = fbCadence;
+
+    fbCadence = periods;
+
+    if (cadence == 0)
+    {
+        /* No cadence to compare with yet. */
+        return;
+    }
+
+    fbPosts++;
+    if (periods > cadence)
+    {
+        fbMissed++;
+    }
+
+    if (fbPosts < DEPTH_WINDOW)
+    {
+        return;
+    }
+
+    if (fbMissed >= DEPTH_MISS_LIMIT)
+    {
+        fbCleanWindows = 0;
+
+        if (fbDepth < fbDepthMax)
+        {
+            fbDepth++;
+            ALOGI("%u of %u frames late, render-ahead depth %u",
+                  fbMissed, fbPosts, fbDepth);
+        }
+    }
+    else if (fbMissed == 0)
+    {
+        if ((++fbCleanWindows >= DEPTH_CLEAN_WINDOWS) && (fbDepth > 2))
+        {
+            fbDepth--;
+            fbCleanWindows = 0;
+            ALOGI("No late frame, render-ahead depth %u", fbDepth);
+        }
+    }
+    else
+    {
+        fbCleanWindows = 0;
+    }
+
+    fbPosts  = 0;
+    fbMissed = 0;
+}
 
 /*******************************************************************************
 **
-**  fb_setSwapInterval
+**  _CollectPresents
 **
-**  Set framebuffer swap interval.
+**  Feed the present times of the frames which reached the screen since the
+**  last post to _UpdateDepth, and queue the release fence of this flip.
 **
 **  INPUT:
 **
-**      framebuffer_device_t * Dev
-**          Specified framebuffer device.
+**      private_module_t * Module
+**          Specified gralloc module.
 **
-**      int Interval
-**          Specified Interval value.
+**      int ReleaseFd
+**          Release fence of this flip, not owned. -1 for none.
 **
 **  OUTPUT:
 **
 **      Nothing.
 */
-static int
-fb_setSwapInterval(
-    struct framebuffer_device_t * Dev,
-    int Interval
+static void
+_CollectPresents(
+    private_module_t * Module,
+    int ReleaseFd
     )
 {
-    //log_func_entry;
-    if ((Interval < Dev->minSwapInterval)
-    ||  (Interval > Dev->maxSwapInterval)
-    )
+    while (fbPresentCount > 0)
     {
-        return -EINVAL;
+        int fd = fbPresentFds[fbPresentHead];
+        int64_t time = _FenceTime(fd);
+
+        if (time == 0)
+        {
+            /* Still on screen, later fences cannot have signaled. */
+            break;
+        }
+
+        _UpdateDepth(Module, time);
+
+        close(fd);
+        fbPresentHead = (fbPresentHead + 1) % NUM_BUFFERS;
+        fbPresentCount--;
     }
 
-    /* FIXME: implement fb_setSwapInterval. */
-    return 0;
+    if (ReleaseFd < 0)
+    {
+        return;
+    }
+
+    if (fbPresentCount == NUM_BUFFERS)
+    {
+        /* Lost track, do not compare the next present with an old one. */
+        close(fbPresentFds[fbPresentHead]);
+        fbPresentHead  = (fbPresentHead + 1) % NUM_BUFFERS;
+        fbPresentCount--;
+        fbLastPresent  = 0;
+    }
+
+    fbPresentFds[(fbPresentHead + fbPresentCount) % NUM_BUFFERS] = dup(ReleaseFd);
+    if (fbPresentFds[(fbPresentHead + fbPresentCount) % NUM_BUFFERS] >= 0)
+    {
+        fbPresentCount++;
+    }
 }
 
 /*******************************************************************************
@@ -162,6 +1090,16 @@ fb_setSwapInterval(
 **
 **  Post back buffer to display.
 **
+**  The flip does not wait for vsync: the acquire fence set with
+**  fb_set_acquire_fence is passed to the display controller, and the release
+**  fence it returns is kept for fb_get_release_fence. When the kernel does not
+**  return release fences (probed at init, see _ProbeReleaseFence), posts wait
+**  for vsync instead.
+**
+**  When the display then holds more buffers than the render-ahead depth, the
+**  post blocks until the oldest one is released, see DEPTH_WINDOW. Callers
+**  must not hold locks other threads need for the next frame across fb_post.
+**
 **  INPUT:
 **
 **      framebuffer_device_t * Dev
@@ -204,92 +1142,134 @@ fb_post(
     const size_t offset = hnd->base - m->framebuffer->base;
     mmp_surface surface;
 
+    int slot = _GetSlot(m, hnd);
+    if (slot < 0)
+    {
+        ALOGE("Cannot post buffer at offset %zu", offset);
+        return -EINVAL;
+    }
+
+    pthread_mutex_lock(&fbLock);
+
+    /* Marked by fb_set_compressed, possibly from another thread. The next
+     * frame rendered here is not compressed unless marked again. */
+    const int compressed = (fbSlots[slot].marked == 1) && (fbHeaderOffset != 0);
+    fbSlots[slot].marked = -1;
+
     m->info.activate = FB_ACTIVATE_VBL;
     m->info.yoffset  = offset / m->finfo.line_length;
 
-    if( hnd->field_A4 )
+    if( compressed )
         m->info.reserved[0] |= 2;
     else
         m->info.reserved[0] &= ~2;
 
-    surface.win.xsrc = m->info.xres;
-    surface.win.ysrc = m->info.yres;
+    /* Layout of a slot only changes with compression. */
+    if (!fbSlots[slot].valid || fbSlots[slot].compressed != compressed)
+    {
+        _BuildSurface(m, slot, compressed, &fbSlots[slot].surface);
 
-    surface.win.xdst = m->info.xres;
-    surface.win.ydst = m->info.yres;
+        fbSlots[slot].compressed = compressed;
+        fbSlots[slot].valid      = 1;
+    }
 
-    surface.win.xpos = 0;
-    surface.win.ypos = 0;
+    surface = fbSlots[slot].surface;
 
-    surface.win.left_crop   = 0;
-    surface.win.right_crop  = 0;
-    surface.win.up_crop     = 0;
-    surface.win.bottom_crop = 0;
+    int acquireFd = fbSlots[slot].acquireFd;
+    fbSlots[slot].acquireFd = -1;
 
-    switch( format )
-    {
-        case HAL_PIXEL_FORMAT_RGBA_8888:
-        case HAL_PIXEL_FORMAT_RGBX_8888:
-            surface.win.pix_fmt = FB_VMODE_RGBA888; break;
-        case HAL_PIXEL_FORMAT_RGB_888   :
-            surface.win.pix_fmt = FB_VMODE_RGB888PACK; break;
-        case HAL_PIXEL_FORMAT_RGB_565   :
-            surface.win.pix_fmt = FB_VMODE_RGB565; break;
-        case HAL_PIXEL_FORMAT_BGRA_8888 :
-            surface.win.pix_fmt = FB_VMODE_BGRA888; break;
-        default:
-            ALOGE("FB format(%d) is not supported.", format);
-            surface.win.pix_fmt = 0;
-            break;
-    }
+    pthread_mutex_unlock(&fbLock);
 
-    surface.win.pitch[0] = m->info.xres_virtual * (m->info.bits_per_pixel/8);
-    surface.win.pitch[1] = 0;
-    surface.win.pitch[2] = 0;
+    surface.fence_fd = acquireFd;
 
-    surface.addr.phys[0] = m->finfo.smem_start + surface.win.pitch[0] * m->info.yoffset;
+    int64_t postStart = _MonotonicNs();
 
-    if( hnd->field_A4 )
+    if (!fbReleaseFence)
     {
-        surface.addr.hdr_addr[0] = surface.addr.phys[0] + surface.win.pitch[0] * _ALIGN(m->info.yres,4);
-        surface.addr.hdr_addr[1] = 0;
-        surface.addr.hdr_addr[2] = 0;
-        surface.addr.hdr_size[0] = (surface.win.pitch[0] * _ALIGN(m->info.yres,4)) >> 9;
-        surface.flag = WAIT_VSYNC|DECOMPRESS_MODE;
+        surface.flag |= WAIT_VSYNC;
     }
-    else
+
+    int err = ioctl(m->framebuffer->fd, FB_IOCTL_FLIP_USR_BUF, &surface);
+
+    if (err != -1)
     {
-        surface.addr.hdr_addr[0] = 0;
-        surface.addr.hdr_addr[1] = 0;
-        surface.addr.hdr_addr[2] = 0;
-        surface.addr.hdr_size[0] = 0;
-        surface.flag = WAIT_VSYNC;
+        _AccountFrame(m, hnd, compressed, acquireFd);
     }
-    surface.addr.hdr_size[1] = 0;
-    surface.addr.hdr_size[2] = 0;
 
-    surface.fence_fd = -1;
-    surface.fd = -1;
+    /* The kernel holds its own reference on the acquire fence. */
+    if (acquireFd >= 0)
+    {
+        close(acquireFd);
+    }
 
-    if (ioctl(m->framebuffer->fd, FB_IOCTL_FLIP_USR_BUF, &surface) == -1)
+    if (err == -1)
     {
         ALOGE("IOCTL:0x6D08 FB_IOCTL_FLIP_USR_BUF FAILED:%s", strerror(errno));
         m->base.unlock((gralloc_module_t*)m,hnd);
         return -errno;
     }
 
+    /* Untouched fence_fd means no release fence from this kernel. */
+    int releaseFd = (surface.fence_fd != acquireFd) ? surface.fence_fd : -1;
+
     int commit = 1;
     if (ioctl(m->framebuffer->fd, FB_IOCTL_FLIP_COMMIT, &commit) == -1 )
     {
         ALOGE("IOCTL:0x6D1B FB_IOCTL_FLIP_COMMIT FAILED:%s", strerror(errno));
         m->base.unlock((gralloc_module_t*)m,hnd);
 
+        if (releaseFd >= 0)
+        {
+            close(releaseFd);
+        }
+
         return -errno;
     }
 
-    hnd->fenceFd = surface.fence_fd;
+    /* The probe found fences but this flip returned none. */
+    if ((releaseFd < 0) && fbReleaseFence)
+    {
+        ALOGW("No release fence from display, flips wait for vsync");
+        fbReleaseFence = 0;
+    }
+
+    pthread_mutex_lock(&fbLock);
+
+    /* Nobody took the fence of the previous flip. */
+    if (fbSlots[slot].releaseFd >= 0)
+    {
+        close(fbSlots[slot].releaseFd);
+    }
+
+    fbSlots[slot].releaseFd = releaseFd;
+
+    fbStats.lastPostStart = postStart;
+    fbStats.lastPostEnd   = _MonotonicNs();
+
+    pthread_mutex_unlock(&fbLock);
+
+    hnd->fenceFd = releaseFd;
     m->currentBuffer = hnd;
 
+    _CollectPresents(m, releaseFd);
+
+    /* Each queued release fence holds one buffer: the oldest is on screen,
+     * the others are flips not presented yet. Block only a producer which
+     * got ahead of the depth, until the oldest buffer is released. */
+    if (fbPresentCount > fbDepth)
+    {
+        struct pollfd fds;
+
+        fds.fd      = fbPresentFds[fbPresentHead];
+        fds.events  = POLLIN;
+        fds.revents = 0;
+
+        if (poll(&fds, 1, 1000) <= 0)
+        {
+            ALOGW("Timeout waiting for framebuffer release");
+        }
+    }
+
 
     return 0;
 }
@@ -415,24 +1395,78 @@ mapFrameBufferLocked(
         return -EINVAL;
     }
 
-    /* Request NUM_BUFFERS screens (at least 2 for page flipping) */
-    info.yres_virtual = info.yres * NUM_BUFFERS;
     /* Align xres to 16 multiple and set to xres_virtual as frame buffer actual stride */
     info.xres_virtual = _ALIGN(info.xres, 16);
 
-    if (ioctl(fd, FBIOPUT_VSCREENINFO, &info) == -1)
+    /* Request as many screens as fit in framebuffer memory, up to
+     * NUM_BUFFERS (at least 2 for page flipping). */
+    uint32_t pitch       = info.xres_virtual * (info.bits_per_pixel / 8);
+    uint32_t maxBuffers  = NUM_BUFFERS;
+    uint32_t headerLines = 0;
+    uint32_t numBuffers;
+    char value[PROPERTY_VALUE_MAX];
+
+    property_get("persist.gralloc.fb.buffers", value, "0");
+    if ((atoi(value) >= 2) && (uint32_t(atoi(value)) < maxBuffers))
+    {
+        maxBuffers = atoi(value);
+    }
+
+#if FB_COMPRESSION
+    property_get("persist.gralloc.fb.compress", value, "1");
+    if ((atoi(value) != 0) && (pitch > 0))
+    {
+        /* Header after the 4-line aligned pixels, see _BuildSurface. */
+        headerLines = _ALIGN(info.yres, 4) - info.yres
+                    + (_HeaderSize(pitch, info.yres) + pitch - 1) / pitch;
+    }
+#endif
+
+    /* Fall back to fewer screens if the driver refuses, and then to no
+     * compression header. */
+    flags = 0;
+    for (;;)
+    {
+        uint32_t screenSize = pitch * (info.yres + headerLines);
+
+        numBuffers = maxBuffers;
+        if ((screenSize > 0) && (finfo.smem_len / screenSize < numBuffers))
+        {
+            numBuffers = finfo.smem_len / screenSize;
+        }
+
+        for (; numBuffers >= 2; numBuffers--)
+        {
+            info.yres_virtual = (info.yres + headerLines) * numBuffers;
+
+            if (ioctl(fd, FBIOPUT_VSCREENINFO, &info) != -1)
+            {
+                flags = 1;
+                break;
+            }
+        }
+
+        if (flags || (headerLines == 0))
+        {
+            break;
+        }
+
+        ALOGW("No room for framebuffer compression headers");
+        headerLines = 0;
+    }
+
+    if (!flags)
     {
         info.yres_virtual = info.yres;
-        flags = 0;
+        headerLines = 0;
         ALOGE("FBIOPUT_VSCREENINFO failed, page flipping not supported");
     }
-    else
-        flags = 1;
 
-    if (info.yres_virtual < info.yres * 2)
+    if (info.yres_virtual < (info.yres + headerLines) * 2)
     {
         /* we need at least 2 for page-flipping. */
         info.yres_virtual = info.yres;
+        headerLines = 0;
         flags = 0;
 
         ALOGW("page flipping not supported "
@@ -542,9 +1576,47 @@ mapFrameBufferLocked(
     // TODO, LOOK AT THIS PART !!!
     Module->framebuffer = new private_handle_t(dup(fd), fbSize, 0);
 
-    Module->numBuffers = info.yres_virtual / info.yres;
+    fbSlotLines    = info.yres + headerLines;
+    fbHeaderOffset = headerLines ? pitch * _ALIGN(info.yres, 4) : 0;
+
+    Module->numBuffers = info.yres_virtual / fbSlotLines;
     Module->bufferMask = 0;
 
+    if (Module->numBuffers > NUM_BUFFERS)
+    {
+        Module->numBuffers = NUM_BUFFERS;
+    }
+
+    for (i = 0; i < NUM_BUFFERS; i++)
+    {
+        fbSlots[i].valid     = 0;
+        fbSlots[i].marked    = -1;
+        fbSlots[i].acquireFd = -1;
+        fbSlots[i].releaseFd = -1;
+    }
+
+    fbReleaseFence = _ProbeReleaseFence(Module, fd);
+
+    /* Triple buffering at most, one screen is always displayed. */
+    fbDepthMax = (Module->numBuffers > 3) ? 3 : Module->numBuffers;
+
+    property_get("persist.gralloc.fb.depth", value, "0");
+    fbDepthPinned = (atoi(value) >= 2);
+    fbDepth = fbDepthPinned ? atoi(value) : 2;
+    if (fbDepth > fbDepthMax)
+    {
+        fbDepth = fbDepthMax;
+    }
+
+    property_get("persist.gralloc.fb.stats", value, "0");
+    fbSampleHeaders = (atoi(value) != 0);
+    memset(&fbStats, 0, sizeof (fbStats));
+
+    ALOGI("%u framebuffers, render-ahead depth %u%s, compression %s, %s",
+          Module->numBuffers, fbDepth, fbDepthPinned ? " (pinned)" : "",
+          fbHeaderOffset ? "enabled" : "disabled",
+          fbReleaseFence ? "release fences" : "flips wait for vsync");
+
 
     void * vaddr = mmap(0, fbSize, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
 
@@ -696,7 +1768,7 @@ fb_device_open(
             const_cast<int&>(dev->device.minSwapInterval) = 1;
             const_cast<int&>(dev->device.maxSwapInterval) = 1;
 #if ANDROID_SDK_VERSION >= 17
-            const_cast<int&>(dev->device.numFramebuffers) = NUM_BUFFERS;
+            const_cast<int&>(dev->device.numFramebuffers) = m->numBuffers;
 #endif
 
             *Device = &dev->device.common;
@@ -34,6 +34,7 @@
 
 struct private_module_t;
 struct private_handle_t;
+struct gc_gralloc_registry_stats;
 
 #define _ALIGN( n, align_dst ) ( (n + (align_dst-1)) & ~(align_dst-1) )
 
@@ -51,6 +52,52 @@ mapFrameBufferLocked(
     struct private_module_t * Module
     );
 
+int
+fb_set_acquire_fence(
+    struct private_module_t * Module,
+    buffer_handle_t Buffer,
+    int FenceFd
+    );
+
+int
+fb_get_release_fence(
+    struct private_module_t * Module,
+    buffer_handle_t Buffer,
+    int * FenceFd
+    );
+
+int
+fb_get_header(
+    struct private_module_t * Module,
+    buffer_handle_t Buffer,
+    uint32_t * Offset
+    );
+
+int
+fb_set_compressed(
+    struct private_module_t * Module,
+    buffer_handle_t Buffer,
+    int Compressed
+    );
+
+int
+fb_get_compressed(
+    struct private_module_t * Module,
+    buffer_handle_t Buffer,
+    int * Compressed
+    );
+
+int
+fb_get_stats(
+    struct private_module_t * Module,
+    private_fb_stats_t * Stats
+    );
+
+size_t
+fb_get_slot_size(
+    struct private_module_t * Module
+    );
+
 int
 gc_gralloc_map(
     buffer_handle_t Handle,
@@ -148,4 +195,34 @@ gc_gralloc_notify_change(buffer_handle_t Handle);
 
 int setHwType71D0(int AllocUsage);
 
+int
+gc_gralloc_registry_acquire(
+    private_handle_t * Handle
+    );
+
+int
+gc_gralloc_registry_add(
+    private_handle_t * Handle
+    );
+
+int
+gc_gralloc_registry_release(
+    private_handle_t * Handle
+    );
+
+int
+gc_gralloc_registry_validate(
+    buffer_handle_t Handle
+    );
+
+void
+gc_gralloc_registry_get_stats(
+    gc_gralloc_registry_stats * Stats
+    );
+
+void
+gc_gralloc_registry_account_layout(
+    int64_t Saved
+    );
+
 #endif /* __gc_gralloc_gr_h_ */
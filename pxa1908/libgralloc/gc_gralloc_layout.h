@@ -0,0 +1,551 @@
+/*
+ * Copyright (C) 2016 The CyanogenMod Project
+ *               2017 The LineageOS Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __gc_gralloc_layout_h_
+#define __gc_gralloc_layout_h_
+
+/*
+ * Layout of ION backed buffers.
+ *
+ * Each consumer of a buffer has its own alignment requirements; a buffer only
+ * pays for the consumers it is allocated for instead of the worst case of all
+ * of them. Everything here is constexpr (C++14, see Android.mk) so the layout
+ * table at the end of this file is checked at build time.
+ */
+
+#include <stdint.h>
+
+#include <hardware/gralloc.h>
+#include <system/graphics.h>
+
+#include "mrvl_pxl_formats.h"
+
+/* Consumers of a buffer. */
+enum
+{
+    /* GC surface wrapping the buffer, always present. */
+    GC_LAYOUT_GPU               = 0x01,
+
+    /* GCU 2D blits. */
+    GC_LAYOUT_BLIT              = 0x02,
+
+    /* Display controller DMA (overlay). */
+    GC_LAYOUT_OVERLAY           = 0x04,
+
+    /* Video codec and camera, and YUV textured by the GPU: hardware decoder
+     * output is often only allocated for HW_TEXTURE. */
+    GC_LAYOUT_CODEC             = 0x08,
+};
+
+/* Plane arrangement of a format. */
+enum
+{
+    GC_LAYOUT_UNSUPPORTED       = 0,
+
+    /* Single plane, BytesPerPixel per pixel. */
+    GC_LAYOUT_PACKED            = 1,
+
+    /* Y plane followed by two chroma planes subsampled 2x2 (YV12, I420). */
+    GC_LAYOUT_PLANAR_420        = 2,
+
+    /* Y plane followed by an interleaved chroma plane, 2x2 (NV12, NV21). */
+    GC_LAYOUT_SEMIPLANAR_420    = 3,
+
+    /* Y plane followed by an interleaved chroma plane, 2x1 (NV16). */
+    GC_LAYOUT_SEMIPLANAR_422    = 4,
+
+    /* Single plane of interleaved 4:2:2 (YUY2, UYVY). */
+    GC_LAYOUT_PACKED_422        = 5,
+};
+
+struct gc_gralloc_layout
+{
+    /* Allocated width and height in pixels. */
+    uint32_t xstride;
+    uint32_t ystride;
+
+    /* Planes in memory order, 0 if the format is not supported. */
+    uint32_t planes;
+
+    /* Byte offset and pitch of each plane. */
+    uint32_t offset[3];
+    uint32_t stride[3];
+
+    /* Total size in bytes. */
+    uint32_t size;
+};
+
+struct gc_gralloc_layout_format
+{
+    uint32_t arrangement;
+    uint32_t bytesPerPixel;
+};
+
+static constexpr uint32_t
+gc_gralloc_layout_align(
+    uint32_t Value,
+    uint32_t Alignment
+    )
+{
+    return (Value + Alignment - 1) & ~(Alignment - 1);
+}
+
+static constexpr uint32_t
+gc_gralloc_layout_max(
+    uint32_t A,
+    uint32_t B
+    )
+{
+    return A > B ? A : B;
+}
+
+static constexpr gc_gralloc_layout_format
+gc_gralloc_layout_get_format(
+    int Format
+    )
+{
+    switch( Format )
+    {
+    case HAL_PIXEL_FORMAT_RGBA_8888:
+    case HAL_PIXEL_FORMAT_RGBX_8888:
+    case HAL_PIXEL_FORMAT_BGRA_8888:
+    case HAL_PIXEL_FORMAT_IMPLEMENTATION_DEFINED:
+        return { GC_LAYOUT_PACKED, 4 };
+
+    case HAL_PIXEL_FORMAT_RGB_888:
+        return { GC_LAYOUT_PACKED, 3 };
+
+    case HAL_PIXEL_FORMAT_RGB_565:
+        return { GC_LAYOUT_PACKED, 2 };
+
+    case HAL_PIXEL_FORMAT_YV12:
+    case HAL_PIXEL_FORMAT_YCbCr_420_P:
+        return { GC_LAYOUT_PLANAR_420, 1 };
+
+    case HAL_PIXEL_FORMAT_YCbCr_420_888:
+    case HAL_PIXEL_FORMAT_YCbCr_420_SP_MRVL:
+    case HAL_PIXEL_FORMAT_YCrCb_420_SP:
+        return { GC_LAYOUT_SEMIPLANAR_420, 1 };
+
+    case HAL_PIXEL_FORMAT_YCbCr_422_SP:
+        return { GC_LAYOUT_SEMIPLANAR_422, 1 };
+
+    case HAL_PIXEL_FORMAT_YCbCr_422_I:
+    case HAL_PIXEL_FORMAT_CbYCrY_422_I:
+        return { GC_LAYOUT_PACKED_422, 2 };
+
+    default:
+        return { GC_LAYOUT_UNSUPPORTED, 0 };
+    }
+}
+
+/*******************************************************************************
+**
+**  gc_gralloc_layout_consumers
+**
+**  Consumers implied by gralloc usage bits.
+**
+**  INPUT:
+**
+**      int Usage
+**          Allocation usage.
+**
+**  OUTPUT:
+**
+**      Mask of GC_LAYOUT_* consumers.
+*/
+static constexpr uint32_t
+gc_gralloc_layout_consumers(
+    int Usage
+    )
+{
+    uint32_t consumers = GC_LAYOUT_GPU;
+
+    if( Usage & GRALLOC_USAGE_HW_2D )
+        consumers |= GC_LAYOUT_BLIT;
+
+    if( Usage & GRALLOC_USAGE_HW_COMPOSER )
+        consumers |= GC_LAYOUT_OVERLAY | GC_LAYOUT_BLIT;
+
+    /* Marvell codecs allocate their buffers with private usage bits, the
+     * decoder output may carry HW_TEXTURE only. Codec alignment does not
+     * apply to RGB, so RGB textures keep the GPU layout. */
+    if( Usage & (GRALLOC_USAGE_HW_VIDEO_ENCODER
+               | GRALLOC_USAGE_HW_CAMERA_MASK
+               | GRALLOC_USAGE_HW_TEXTURE
+               | GRALLOC_USAGE_PRIVATE_MASK) )
+        consumers |= GC_LAYOUT_CODEC;
+
+    return consumers;
+}
+
+/*******************************************************************************
+**
+**  gc_gralloc_layout_planes
+**
+**  Fill plane offsets, pitches and total size once xstride/ystride are set.
+**
+**  INPUT:
+**
+**      gc_gralloc_layout_format Format
+**          Plane arrangement.
+**
+**  OUTPUT:
+**
+**      gc_gralloc_layout & Layout
+**          Layout to complete.
+*/
+static constexpr void
+gc_gralloc_layout_planes(
+    gc_gralloc_layout_format Format,
+    gc_gralloc_layout & Layout
+    )
+{
+    uint32_t luma = Layout.xstride * Layout.ystride;
+
+    switch( Format.arrangement )
+    {
+    case GC_LAYOUT_PLANAR_420:
+        Layout.planes    = 3;
+        Layout.stride[0] = Layout.xstride;
+        Layout.stride[1] = Layout.xstride / 2;
+        Layout.stride[2] = Layout.xstride / 2;
+        Layout.offset[1] = luma;
+        Layout.offset[2] = luma + luma / 4;
+        Layout.size      = luma * 3 / 2;
+        break;
+
+    case GC_LAYOUT_SEMIPLANAR_420:
+        Layout.planes    = 2;
+        Layout.stride[0] = Layout.xstride;
+        Layout.stride[1] = Layout.xstride;
+        Layout.offset[1] = luma;
+        Layout.size      = luma * 3 / 2;
+        break;
+
+    case GC_LAYOUT_SEMIPLANAR_422:
+        Layout.planes    = 2;
+        Layout.stride[0] = Layout.xstride;
+        Layout.stride[1] = Layout.xstride;
+        Layout.offset[1] = luma;
+        Layout.size      = luma * 2;
+        break;
+
+    default:
+        Layout.planes    = 1;
+        Layout.stride[0] = Layout.xstride * Format.bytesPerPixel;
+        Layout.size      = luma * Format.bytesPerPixel;
+        break;
+    }
+}
+
+/*******************************************************************************
+**
+**  gc_gralloc_layout_compute
+**
+**  Smallest layout satisfying every consumer in the set:
+**
+**      GPU      16 pixels, 4 lines per pixel pipe; planar chroma pitch must
+**               stay 16 pixel aligned. This also gives the 16 byte YV12
+**               chroma pitch Android requires for software access, which
+**               therefore adds nothing.
+**      BLIT     16 pixels.
+**      OVERLAY  16 bytes per line of every plane, even lines when the
+**               chroma is vertically subsampled.
+**      CODEC    64x64 macroblock tiles for 4:2:0 and semi-planar 4:2:2,
+**               16x32 for packed 4:2:2, 16x4 for RGB.
+**
+**  INPUT:
+**
+**      int Format
+**          Android or Marvell pixel format.
+**
+**      uint32_t Width, Height
+**          Requested size.
+**
+**      uint32_t Consumers
+**          Mask of GC_LAYOUT_* consumers, GC_LAYOUT_GPU is implied.
+**
+**      uint32_t PixelPipes
+**          Pixel pipes of the GPU.
+**
+**  OUTPUT:
+**
+**      Layout, planes is 0 for unsupported formats.
+*/
+static constexpr gc_gralloc_layout
+gc_gralloc_layout_compute(
+    int Format,
+    uint32_t Width,
+    uint32_t Height,
+    uint32_t Consumers,
+    uint32_t PixelPipes
+    )
+{
+    gc_gralloc_layout layout = {};
+    gc_gralloc_layout_format format = gc_gralloc_layout_get_format(Format);
+    uint32_t xalign = 16;
+    uint32_t yalign = 4 * gc_gralloc_layout_max(PixelPipes, 1);
+
+    if( format.arrangement == GC_LAYOUT_UNSUPPORTED )
+        return layout;
+
+    if( format.arrangement == GC_LAYOUT_PLANAR_420 )
+        xalign = 32;
+
+    if( Consumers & GC_LAYOUT_OVERLAY )
+    {
+        if( format.arrangement == GC_LAYOUT_PLANAR_420
+         || format.arrangement == GC_LAYOUT_SEMIPLANAR_420 )
+            yalign = gc_gralloc_layout_max(yalign, 2);
+    }
+
+    if( Consumers & GC_LAYOUT_CODEC )
+    {
+        switch( format.arrangement )
+        {
+        case GC_LAYOUT_PLANAR_420:
+        case GC_LAYOUT_SEMIPLANAR_420:
+        case GC_LAYOUT_SEMIPLANAR_422:
+            xalign = gc_gralloc_layout_max(xalign, 64);
+            yalign = gc_gralloc_layout_max(yalign, 64);
+            break;
+
+        case GC_LAYOUT_PACKED_422:
+            yalign = gc_gralloc_layout_max(yalign, 32);
+            break;
+
+        default:
+            break;
+        }
+    }
+
+    layout.xstride = gc_gralloc_layout_align(Width, xalign);
+    layout.ystride = gc_gralloc_layout_align(Height, yalign);
+    gc_gralloc_layout_planes(format, layout);
+
+    return layout;
+}
+
+/*******************************************************************************
+**
+**  gc_gralloc_layout_legacy
+**
+**  Fixed layout used for every ION buffer before consumer based layouts, kept
+**  to report the memory saved.
+**
+**  INPUT:
+**
+**      int Format
+**          Android or Marvell pixel format.
+**
+**      uint32_t Width, Height
+**          Requested size.
+**
+**  OUTPUT:
+**
+**      Layout, planes is 0 for unsupported formats.
+*/
+static constexpr gc_gralloc_layout
+gc_gralloc_layout_legacy(
+    int Format,
+    uint32_t Width,
+    uint32_t Height
+    )
+{
+    gc_gralloc_layout layout = {};
+    gc_gralloc_layout_format format = gc_gralloc_layout_get_format(Format);
+
+    /* Was never handled. */
+    if( Format == HAL_PIXEL_FORMAT_YCbCr_420_888 )
+        format.arrangement = GC_LAYOUT_UNSUPPORTED;
+
+    switch( format.arrangement )
+    {
+    case GC_LAYOUT_PLANAR_420:
+    case GC_LAYOUT_SEMIPLANAR_420:
+    case GC_LAYOUT_SEMIPLANAR_422:
+        layout.xstride = gc_gralloc_layout_align(Width, 64);
+        layout.ystride = gc_gralloc_layout_align(Height, 64);
+        break;
+
+    case GC_LAYOUT_PACKED_422:
+        layout.xstride = gc_gralloc_layout_align(Width, 16);
+        layout.ystride = gc_gralloc_layout_align(Height, 32);
+        break;
+
+    case GC_LAYOUT_PACKED:
+        layout.xstride = gc_gralloc_layout_align(Width, 16);
+        layout.ystride = gc_gralloc_layout_align(Height, 4);
+        break;
+
+    default:
+        return layout;
+    }
+
+    gc_gralloc_layout_planes(format, layout);
+    return layout;
+}
+
+/*
+ * Layout table, checked at build time.
+ */
+
+struct gc_gralloc_layout_case
+{
+    int format;
+    uint32_t width;
+    uint32_t height;
+    uint32_t consumers;
+    uint32_t pixelPipes;
+
+    gc_gralloc_layout_format expect;
+    uint32_t xstride;
+    uint32_t ystride;
+    uint32_t offset1;
+    uint32_t stride1;
+    uint32_t offset2;
+    uint32_t size;
+
+    /* Legacy size, 0 if the format was not handled. */
+    uint32_t legacySize;
+};
+
+#define GC_LAYOUT_ALL   (GC_LAYOUT_GPU | GC_LAYOUT_BLIT | GC_LAYOUT_OVERLAY \
+                         | GC_LAYOUT_CODEC)
+
+static constexpr gc_gralloc_layout_case sLayoutCases[] =
+{
+    /* RGB, identical to legacy with one pixel pipe. */
+    { HAL_PIXEL_FORMAT_RGBA_8888, 1080, 1920, GC_LAYOUT_GPU | GC_LAYOUT_OVERLAY, 1,
+      { GC_LAYOUT_PACKED, 4 }, 1088, 1920, 0, 0, 0, 1088 * 1920 * 4, 1088 * 1920 * 4 },
+    { HAL_PIXEL_FORMAT_RGBX_8888, 1, 1, GC_LAYOUT_ALL, 1,
+      { GC_LAYOUT_PACKED, 4 }, 16, 4, 0, 0, 0, 256, 256 },
+    { HAL_PIXEL_FORMAT_BGRA_8888, 720, 1280, GC_LAYOUT_GPU, 2,
+      { GC_LAYOUT_PACKED, 4 }, 720, 1280, 0, 0, 0, 720 * 1280 * 4, 720 * 1280 * 4 },
+    { HAL_PIXEL_FORMAT_BGRA_8888, 720, 1282, GC_LAYOUT_GPU, 2,
+      { GC_LAYOUT_PACKED, 4 }, 720, 1288, 0, 0, 0, 720 * 1288 * 4, 720 * 1284 * 4 },
+    { HAL_PIXEL_FORMAT_RGB_888, 100, 50, GC_LAYOUT_GPU | GC_LAYOUT_CODEC, 1,
+      { GC_LAYOUT_PACKED, 3 }, 112, 52, 0, 0, 0, 112 * 52 * 3, 112 * 52 * 3 },
+    { HAL_PIXEL_FORMAT_RGB_565, 33, 7, GC_LAYOUT_GPU, 1,
+      { GC_LAYOUT_PACKED, 2 }, 48, 8, 0, 0, 0, 48 * 8 * 2, 48 * 8 * 2 },
+    { HAL_PIXEL_FORMAT_IMPLEMENTATION_DEFINED, 640, 480, GC_LAYOUT_GPU, 1,
+      { GC_LAYOUT_PACKED, 4 }, 640, 480, 0, 0, 0, 640 * 480 * 4, 640 * 480 * 4 },
+
+    /* 4:2:0 planar: codec keeps the 64x64 tiles, others do not need them. */
+    { HAL_PIXEL_FORMAT_YV12, 1280, 720, GC_LAYOUT_GPU | GC_LAYOUT_CODEC, 1,
+      { GC_LAYOUT_PLANAR_420, 1 }, 1280, 768, 1280 * 768, 640, 1280 * 768 * 5 / 4,
+      1280 * 768 * 3 / 2, 1280 * 768 * 3 / 2 },
+    { HAL_PIXEL_FORMAT_YV12, 1280, 720, GC_LAYOUT_GPU, 1,
+      { GC_LAYOUT_PLANAR_420, 1 }, 1280, 720, 1280 * 720, 640, 1280 * 720 * 5 / 4,
+      1280 * 720 * 3 / 2, 1280 * 768 * 3 / 2 },
+    { HAL_PIXEL_FORMAT_YV12, 176, 144, GC_LAYOUT_GPU | GC_LAYOUT_OVERLAY, 1,
+      { GC_LAYOUT_PLANAR_420, 1 }, 192, 144, 192 * 144, 96, 192 * 144 * 5 / 4,
+      192 * 144 * 3 / 2, 192 * 192 * 3 / 2 },
+    { HAL_PIXEL_FORMAT_YCbCr_420_P, 1920, 1080, GC_LAYOUT_ALL, 1,
+      { GC_LAYOUT_PLANAR_420, 1 }, 1920, 1088, 1920 * 1088, 960, 1920 * 1088 * 5 / 4,
+      1920 * 1088 * 3 / 2, 1920 * 1088 * 3 / 2 },
+
+    /* 4:2:0 semi-planar. */
+    { HAL_PIXEL_FORMAT_YCbCr_420_SP_MRVL, 1920, 1080, GC_LAYOUT_GPU | GC_LAYOUT_BLIT, 1,
+      { GC_LAYOUT_SEMIPLANAR_420, 1 }, 1920, 1080, 1920 * 1080, 1920, 0,
+      1920 * 1080 * 3 / 2, 1920 * 1088 * 3 / 2 },
+    { HAL_PIXEL_FORMAT_YCbCr_420_SP_MRVL, 1920, 1080, GC_LAYOUT_GPU | GC_LAYOUT_CODEC, 1,
+      { GC_LAYOUT_SEMIPLANAR_420, 1 }, 1920, 1088, 1920 * 1088, 1920, 0,
+      1920 * 1088 * 3 / 2, 1920 * 1088 * 3 / 2 },
+    { HAL_PIXEL_FORMAT_YCrCb_420_SP, 800, 600, GC_LAYOUT_GPU | GC_LAYOUT_OVERLAY, 1,
+      { GC_LAYOUT_SEMIPLANAR_420, 1 }, 800, 600, 800 * 600, 800, 0,
+      800 * 600 * 3 / 2, 832 * 640 * 3 / 2 },
+    { HAL_PIXEL_FORMAT_YCbCr_420_888, 320, 240, GC_LAYOUT_GPU, 1,
+      { GC_LAYOUT_SEMIPLANAR_420, 1 }, 320, 240, 320 * 240, 320, 0,
+      320 * 240 * 3 / 2, 0 },
+
+    /* 4:2:2. */
+    { HAL_PIXEL_FORMAT_YCbCr_422_SP, 640, 480, GC_LAYOUT_GPU, 1,
+      { GC_LAYOUT_SEMIPLANAR_422, 1 }, 640, 480, 640 * 480, 640, 0,
+      640 * 480 * 2, 640 * 512 * 2 },
+    { HAL_PIXEL_FORMAT_YCbCr_422_I, 640, 480, GC_LAYOUT_GPU, 1,
+      { GC_LAYOUT_PACKED_422, 2 }, 640, 480, 0, 0, 0, 640 * 480 * 2, 640 * 480 * 2 },
+    { HAL_PIXEL_FORMAT_CbYCrY_422_I, 720, 500, GC_LAYOUT_GPU | GC_LAYOUT_CODEC, 1,
+      { GC_LAYOUT_PACKED_422, 2 }, 720, 512, 0, 0, 0, 720 * 512 * 2, 720 * 512 * 2 },
+    { HAL_PIXEL_FORMAT_CbYCrY_422_I, 720, 500, GC_LAYOUT_GPU | GC_LAYOUT_BLIT, 1,
+      { GC_LAYOUT_PACKED_422, 2 }, 720, 500, 0, 0, 0, 720 * 500 * 2, 720 * 512 * 2 },
+
+    /* Not supported. */
+    { HAL_PIXEL_FORMAT_YCbCr_420_I, 64, 64, GC_LAYOUT_ALL, 1,
+      { GC_LAYOUT_UNSUPPORTED, 0 }, 0, 0, 0, 0, 0, 0, 0 },
+};
+
+static constexpr bool
+gc_gralloc_layout_check(
+    const gc_gralloc_layout_case & Case
+    )
+{
+    gc_gralloc_layout_format format = gc_gralloc_layout_get_format(Case.format);
+    gc_gralloc_layout layout =
+        gc_gralloc_layout_compute(Case.format, Case.width, Case.height,
+                                  Case.consumers, Case.pixelPipes);
+    gc_gralloc_layout legacy =
+        gc_gralloc_layout_legacy(Case.format, Case.width, Case.height);
+
+    if( format.arrangement != Case.expect.arrangement
+     || format.bytesPerPixel != Case.expect.bytesPerPixel
+     || legacy.size != Case.legacySize )
+        return false;
+
+    if( format.arrangement == GC_LAYOUT_UNSUPPORTED )
+        return layout.planes == 0;
+
+    /* Never smaller than requested, planes must not overlap. */
+    if( layout.xstride < Case.width || layout.ystride < Case.height
+     || layout.offset[layout.planes - 1] >= layout.size )
+        return false;
+
+    return layout.xstride   == Case.xstride
+        && layout.ystride   == Case.ystride
+        && layout.offset[1] == Case.offset1
+        && layout.stride[1] == Case.stride1
+        && layout.offset[2] == Case.offset2
+        && layout.size      == Case.size;
+}
+
+static constexpr int
+gc_gralloc_layout_first_failure(
+    void
+    )
+{
+    for( uint32_t i = 0; i < sizeof(sLayoutCases) / sizeof(sLayoutCases[0]); ++i )
+    {
+        if( !gc_gralloc_layout_check(sLayoutCases[i]) )
+            return (int)i;
+    }
+
+    return -1;
+}
+
+static_assert(gc_gralloc_layout_first_failure() == -1,
+              "gc_gralloc_layout: layout table mismatch");
+
+/* YUV texture, as decoder output is allocated: keeps the 64x64 tiles. */
+static_assert(gc_gralloc_layout_compute(HAL_PIXEL_FORMAT_YCbCr_420_SP_MRVL, 1920, 1080,
+                                        gc_gralloc_layout_consumers(GRALLOC_USAGE_HW_TEXTURE),
+                                        1).ystride == 1088,
+              "gc_gralloc_layout: YUV textures lost codec alignment");
+
+#undef GC_LAYOUT_ALL
+
+#endif /* __gc_gralloc_layout_h_ */
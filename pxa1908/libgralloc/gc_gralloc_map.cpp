@@ -215,6 +215,10 @@ gc_gralloc_register_buffer(
     if( private_handle_t::validate(hnd) )
         return -EINVAL;
 
+    /* Already imported in this process, only take another reference. */
+    if( gc_gralloc_registry_acquire(hnd) )
+        return 0;
+
     if( gcoOS_ModuleConstructor() < 0 )
     {
 ON_ERROR:
@@ -318,6 +322,12 @@ ON_ERROR:
     if( hnd->shAddr )
         gcoSURF_BindShBuffer(surface, hnd->shAddr);
 
+    if( gc_gralloc_registry_add(hnd) < 0 )
+    {
+        ALOGE("Failed to record buffer=%p", hnd);
+        goto ON_ERROR;
+    }
+
     gcoHAL_SetHardwareType(0, hwtype);
 
     return 0;
@@ -359,6 +369,13 @@ gc_gralloc_unregister_buffer(
 
     private_handle_t* hnd = (private_handle_t*)Handle;
 
+    /* Not registered here, or still referenced by another registration. */
+    int refs = gc_gralloc_registry_release(hnd);
+    if( refs < 0 )
+        return -EINVAL;
+    if( refs > 0 )
+        return 0;
+
     gcoHAL_GetHardwareType(0, &hwtype);
     setHwType71D0(hnd->allocUsage);
     if( hnd->base )
@@ -447,7 +464,7 @@ gc_gralloc_lock(
     gceHARDWARE_TYPE hwtype = gcvHARDWARE_3D;
     private_handle_t *hnd = (private_handle_t*)Handle;
 
-    if( private_handle_t::validate(hnd) )
+    if( gc_gralloc_registry_validate(hnd) )
         return -EINVAL;
 
     if( hnd->surface == NULL )
@@ -496,7 +513,7 @@ gc_gralloc_lock_ycbcr(
     int stride;
     int colors[13];
     private_handle_t *hnd = (private_handle_t*)Handle;
-    if( private_handle_t::validate(hnd) )
+    if( gc_gralloc_registry_validate(hnd) )
         return -EINVAL;
 
     if( hnd->surface == NULL )
@@ -558,7 +575,7 @@ gc_gralloc_unlock(
 
     (void*)Module;
 
-    if (private_handle_t::validate(hnd) < 0)
+    if (gc_gralloc_registry_validate(hnd) < 0)
         return -EINVAL;
 
     if( hnd->surface == NULL )
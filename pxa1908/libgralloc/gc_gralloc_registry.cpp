@@ -0,0 +1,582 @@
+/*
+ * Copyright (C) 2016 The CyanogenMod Project
+ *               2017 The LineageOS Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <cutils/log.h>
+#include <cutils/properties.h>
+
+#include "gc_gralloc_gr.h"
+#include "gc_gralloc_registry.h"
+
+/*
+ * Per-process registry of buffer handles.
+ *
+ * Every handle registered (or allocated) in this process gets an entry keyed
+ * by the handle pointer, so lock/unlock can tell in O(1) whether the handle is
+ * live here. Entries point to a buffer node keyed by the identity of the
+ * underlying memory, so a buffer imported through several cloned handles is
+ * only accounted once.
+ */
+
+/* Must be a power of 2. */
+#define REGISTRY_BUCKETS        256
+
+enum
+{
+    /* GAL video memory, identified by its exported name (infoA1). */
+    IDENTITY_GCMEM              = 1,
+
+    /* Physically contiguous ION buffer, identified by its address. */
+    IDENTITY_ION_PHYS           = 2,
+
+    /* Scattered ION buffer, no global name: fall back to the handle. */
+    IDENTITY_HANDLE             = 3,
+};
+
+struct registry_buffer
+{
+    uint32_t kind;
+    uint32_t id;
+    uint32_t size;
+    uint32_t refs;
+    registry_buffer * next;
+};
+
+struct registry_entry
+{
+    const private_handle_t * handle;
+    registry_buffer * buffer;
+    gcoSURF surface;
+    uint32_t refs;
+    registry_entry * next;
+};
+
+static pthread_mutex_t sLock = PTHREAD_MUTEX_INITIALIZER;
+static registry_entry * sEntries[REGISTRY_BUCKETS];
+static registry_buffer * sBuffers[REGISTRY_BUCKETS];
+static gc_gralloc_registry_stats sStats;
+
+/* Bumped under sLock on every change of sStats. */
+static uint32_t sGeneration;
+
+/* Serializes publishing, taken before sLock. */
+static pthread_mutex_t sPublishLock = PTHREAD_MUTEX_INITIALIZER;
+static uint32_t sPublished;
+
+/* -2: not opened yet, -1: publishing disabled or unavailable. Read unlocked
+ * to skip early, a stale value is checked again under sPublishLock. */
+static volatile int sStatsFd = -2;
+
+/* Last time totals were due, in ms. Read unlocked like sStatsFd. */
+static volatile uint32_t sPublishTime;
+
+static inline uint32_t
+_HashPointer(
+    const void * Pointer
+    )
+{
+    uint32_t key = (uint32_t)((uintptr_t)Pointer >> 3);
+    return (key * 2654435761U) >> 24 & (REGISTRY_BUCKETS - 1);
+}
+
+static inline uint32_t
+_HashIdentity(
+    uint32_t Kind,
+    uint32_t Id
+    )
+{
+    return ((Id ^ (Kind << 29)) * 2654435761U) >> 24 & (REGISTRY_BUCKETS - 1);
+}
+
+static void
+_GetIdentity(
+    private_handle_t * Handle,
+    uint32_t * Kind,
+    uint32_t * Id
+    )
+{
+    if( Handle->flags & private_handle_t::PRIV_FLAGS_USES_PMEM )
+    {
+        int phys = 0;
+
+        if( mvmem_get_phys(Handle->master, &phys) >= 0 && phys != 0 )
+        {
+            *Kind = IDENTITY_ION_PHYS;
+            *Id   = (uint32_t)phys;
+            return;
+        }
+    }
+    else if( Handle->infoA1 != 0 )
+    {
+        *Kind = IDENTITY_GCMEM;
+        *Id   = (uint32_t)Handle->infoA1;
+        return;
+    }
+
+    *Kind = IDENTITY_HANDLE;
+    *Id   = (uint32_t)(uintptr_t)Handle;
+}
+
+static registry_entry *
+_FindEntryLocked(
+    const void * Handle
+    )
+{
+    registry_entry * entry = sEntries[_HashPointer(Handle)];
+
+    while( entry != NULL && entry->handle != Handle )
+        entry = entry->next;
+
+    return entry;
+}
+
+/* Record a change of the totals, called locked. */
+static inline void
+_ChangedLocked(
+    void
+    )
+{
+    sGeneration++;
+}
+
+/* Open the stats file of this process, truncated. */
+static int
+_OpenStats(
+    void
+    )
+{
+    char path[64];
+
+    snprintf(path, sizeof(path), GC_GRALLOC_REGISTRY_STATS_DIR "/%d", getpid());
+    return open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+}
+
+static inline uint32_t
+_NowMs(
+    void
+    )
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (uint32_t)ts.tv_sec * 1000U + (uint32_t)(ts.tv_nsec / 1000000);
+}
+
+/* Publish current totals for libmemtrack. Best effort, called unlocked so the
+ * file write never stalls lock/unlock. Changes within an interval are batched
+ * into one write, left to the next call after it. A write never replaces
+ * newer totals: the snapshot is taken while publishing is serialized. */
+static void
+_PublishStats(
+    void
+    )
+{
+    gc_gralloc_registry_stats stats;
+    uint32_t generation;
+    uint32_t now;
+    struct stat st;
+
+    if( sStatsFd == -1 )
+        return;
+
+    if( sStatsFd >= 0 && _NowMs() - sPublishTime < GC_GRALLOC_REGISTRY_PUBLISH_MS )
+        return;
+
+    pthread_mutex_lock(&sPublishLock);
+
+    now = _NowMs();
+    if( sStatsFd >= 0 && now - sPublishTime < GC_GRALLOC_REGISTRY_PUBLISH_MS )
+    {
+        pthread_mutex_unlock(&sPublishLock);
+        return;
+    }
+    sPublishTime = now;
+
+    if( sStatsFd == -2 )
+    {
+        char value[PROPERTY_VALUE_MAX];
+        uint64_t startTime;
+
+        /* Debug only, every process loading gralloc would try otherwise. */
+        property_get(GC_GRALLOC_REGISTRY_STATS_PROP, value, "0");
+        if( atoi(value) == 0 )
+        {
+            sStatsFd = -1;
+            pthread_mutex_unlock(&sPublishLock);
+            return;
+        }
+
+        if( gc_gralloc_read_start_time(getpid(), &startTime) )
+            startTime = 0;
+
+        pthread_mutex_lock(&sLock);
+        sStats.magic     = GC_GRALLOC_REGISTRY_MAGIC;
+        sStats.pid       = (uint32_t)getpid();
+        sStats.startTime = startTime;
+        pthread_mutex_unlock(&sLock);
+
+        /* Only processes allowed into the directory publish, memtrack falls
+         * back to the ION heap dump for the others. */
+        sStatsFd = _OpenStats();
+        if( sStatsFd < 0 )
+            sStatsFd = -1;
+    }
+
+    pthread_mutex_lock(&sLock);
+    stats      = sStats;
+    generation = sGeneration;
+    pthread_mutex_unlock(&sLock);
+
+    if( sStatsFd >= 0 && generation != sPublished )
+    {
+        /* memtrack removed the file, taking this pid for a dead process
+         * whose pid got recycled: start a new one. */
+        if( fstat(sStatsFd, &st) == 0 && st.st_nlink == 0 )
+        {
+            close(sStatsFd);
+            sStatsFd = _OpenStats();
+        }
+
+        if( sStatsFd >= 0 )
+            pwrite(sStatsFd, &stats, sizeof(stats), 0);
+        else
+            sStatsFd = -1;
+
+        sPublished = generation;
+    }
+
+    pthread_mutex_unlock(&sPublishLock);
+}
+
+/*******************************************************************************
+**
+**  gc_gralloc_registry_acquire
+**
+**  Take another reference on a handle which is already registered in this
+**  process. Registering a handle twice is a client bug: the second call only
+**  bumps the reference count instead of constructing another surface.
+**
+**  INPUT:
+**
+**      private_handle_t * Handle
+**          Specified buffer handle.
+**
+**  OUTPUT:
+**
+**      1 if the handle was already registered, 0 otherwise.
+*/
+int
+gc_gralloc_registry_acquire(
+    private_handle_t * Handle
+    )
+{
+    registry_entry * entry;
+
+    pthread_mutex_lock(&sLock);
+    entry = _FindEntryLocked(Handle);
+    if( entry != NULL )
+    {
+        entry->refs++;
+        sStats.doubleRegistrations++;
+        _ChangedLocked();
+    }
+    pthread_mutex_unlock(&sLock);
+
+    if( entry != NULL )
+    {
+        _PublishStats();
+        ALOGW("buffer=%p registered twice in pid %d", Handle, getpid());
+        return 1;
+    }
+
+    return 0;
+}
+
+/*******************************************************************************
+**
+**  gc_gralloc_registry_add
+**
+**  Record a handle once it is mapped and its surface constructed.
+**
+**  INPUT:
+**
+**      private_handle_t * Handle
+**          Specified buffer handle.
+**
+**  OUTPUT:
+**
+**      Nothing.
+*/
+int
+gc_gralloc_registry_add(
+    private_handle_t * Handle
+    )
+{
+    registry_entry * entry;
+    registry_buffer * buffer;
+    uint32_t kind;
+    uint32_t id;
+    uint32_t slot;
+
+    /* Query identity outside of the lock, it may be an ioctl. */
+    _GetIdentity(Handle, &kind, &id);
+
+    entry = (registry_entry*)malloc(sizeof(registry_entry));
+    if( entry == NULL )
+        return -ENOMEM;
+
+    pthread_mutex_lock(&sLock);
+
+    slot   = _HashIdentity(kind, id);
+    buffer = sBuffers[slot];
+    while( buffer != NULL && (buffer->kind != kind || buffer->id != id) )
+        buffer = buffer->next;
+
+    if( buffer == NULL )
+    {
+        buffer = (registry_buffer*)malloc(sizeof(registry_buffer));
+        if( buffer == NULL )
+        {
+            pthread_mutex_unlock(&sLock);
+            free(entry);
+            return -ENOMEM;
+        }
+
+        buffer->kind  = kind;
+        buffer->id    = id;
+        buffer->size  = (uint32_t)Handle->size;
+        buffer->refs  = 0;
+        buffer->next  = sBuffers[slot];
+        sBuffers[slot] = buffer;
+
+        sStats.buffers++;
+        sStats.importedBytes += buffer->size;
+        if( kind == IDENTITY_GCMEM )
+            sStats.videoMemoryBytes += buffer->size;
+        else if( kind == IDENTITY_ION_PHYS )
+            sStats.contiguousBytes += buffer->size;
+    }
+    buffer->refs++;
+
+    slot = _HashPointer(Handle);
+    entry->handle  = Handle;
+    entry->buffer  = buffer;
+    entry->surface = Handle->surface;
+    entry->refs    = 1;
+    entry->next    = sEntries[slot];
+    sEntries[slot] = entry;
+
+    sStats.handles++;
+    _ChangedLocked();
+
+    pthread_mutex_unlock(&sLock);
+
+    _PublishStats();
+    return 0;
+}
+
+/*******************************************************************************
+**
+**  gc_gralloc_registry_release
+**
+**  Drop a reference on a registered handle. The entry is removed when the last
+**  reference goes away, the caller must then release the handle resources.
+**
+**  INPUT:
+**
+**      private_handle_t * Handle
+**          Specified buffer handle.
+**
+**  OUTPUT:
+**
+**      Remaining references, or -ENOENT if the handle is not registered.
+*/
+int
+gc_gralloc_registry_release(
+    private_handle_t * Handle
+    )
+{
+    registry_entry ** link;
+    registry_entry * entry;
+    int refs;
+
+    pthread_mutex_lock(&sLock);
+
+    link = &sEntries[_HashPointer(Handle)];
+    while( *link != NULL && (*link)->handle != Handle )
+        link = &(*link)->next;
+
+    entry = *link;
+    if( entry == NULL )
+    {
+        sStats.invalidAccesses++;
+        _ChangedLocked();
+        pthread_mutex_unlock(&sLock);
+
+        _PublishStats();
+        ALOGE("buffer=%p released but not registered in pid %d", Handle, getpid());
+        return -ENOENT;
+    }
+
+    refs = (int)--entry->refs;
+    if( refs == 0 )
+    {
+        registry_buffer * buffer = entry->buffer;
+
+        *link = entry->next;
+        sStats.handles--;
+
+        if( --buffer->refs == 0 )
+        {
+            registry_buffer ** blink = &sBuffers[_HashIdentity(buffer->kind, buffer->id)];
+
+            while( *blink != buffer )
+                blink = &(*blink)->next;
+            *blink = buffer->next;
+
+            sStats.buffers--;
+            sStats.importedBytes -= buffer->size;
+            if( buffer->kind == IDENTITY_GCMEM )
+                sStats.videoMemoryBytes -= buffer->size;
+            else if( buffer->kind == IDENTITY_ION_PHYS )
+                sStats.contiguousBytes -= buffer->size;
+            free(buffer);
+        }
+
+        free(entry);
+        _ChangedLocked();
+    }
+
+    pthread_mutex_unlock(&sLock);
+
+    if( refs == 0 )
+        _PublishStats();
+    return refs;
+}
+
+/*******************************************************************************
+**
+**  gc_gralloc_registry_validate
+**
+**  Check a handle against the registry instead of trusting its contents.
+**  Catches handles used before registration or after unregistration, and
+**  handles whose surface changed under the registry.
+**
+**  INPUT:
+**
+**      buffer_handle_t Handle
+**          Specified buffer handle.
+**
+**  OUTPUT:
+**
+**      0 if the handle is live in this process, -EINVAL otherwise.
+*/
+int
+gc_gralloc_registry_validate(
+    buffer_handle_t Handle
+    )
+{
+    registry_entry * entry;
+    int valid;
+
+    pthread_mutex_lock(&sLock);
+    entry = _FindEntryLocked(Handle);
+    valid = entry != NULL
+         && entry->surface == ((const private_handle_t*)Handle)->surface;
+    if( !valid )
+    {
+        sStats.invalidAccesses++;
+        _ChangedLocked();
+    }
+    pthread_mutex_unlock(&sLock);
+
+    if( valid )
+    {
+        /* Write totals a batched change left behind. */
+        _PublishStats();
+        return 0;
+    }
+
+    _PublishStats();
+
+    if( entry != NULL )
+        ALOGE("buffer=%p surface changed since registration", Handle);
+    else if( private_handle_t::validate(Handle) == 0 )
+        ALOGE("buffer=%p used without registration in pid %d", Handle, getpid());
+
+    return -EINVAL;
+}
+
+/*******************************************************************************
+**
+**  gc_gralloc_registry_get_stats
+**
+**  Snapshot of the registry totals.
+**
+**  OUTPUT:
+**
+**      gc_gralloc_registry_stats * Stats
+**          Point to save the totals.
+*/
+void
+gc_gralloc_registry_get_stats(
+    gc_gralloc_registry_stats * Stats
+    )
+{
+    pthread_mutex_lock(&sLock);
+    *Stats = sStats;
+    pthread_mutex_unlock(&sLock);
+}
+
+/*******************************************************************************
+**
+**  gc_gralloc_registry_account_layout
+**
+**  Account the memory saved by the layout of a newly allocated buffer.
+**
+**  INPUT:
+**
+**      int64_t Saved
+**          Legacy size minus actual size, in bytes.
+**
+**  OUTPUT:
+**
+**      Nothing.
+*/
+void
+gc_gralloc_registry_account_layout(
+    int64_t Saved
+    )
+{
+    if( Saved == 0 )
+        return;
+
+    pthread_mutex_lock(&sLock);
+    sStats.layoutBytesSaved += Saved;
+    _ChangedLocked();
+    pthread_mutex_unlock(&sLock);
+
+    _PublishStats();
+}
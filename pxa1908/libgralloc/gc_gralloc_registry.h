@@ -0,0 +1,118 @@
+/*
+ * Copyright (C) 2016 The CyanogenMod Project
+ *               2017 The LineageOS Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __gc_gralloc_registry_h_
+#define __gc_gralloc_registry_h_
+
+/*
+ * Layout of the per-process registry statistics published by gralloc.
+ *
+ * This header is shared with libmemtrack and must stay plain C without any
+ * GAL dependency.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+
+/* With debug.gralloc.registry.stats set, every process which registers
+ * buffers and may write here publishes its totals, in a file named after its
+ * pid. The directory is created by gralloc.rc, sepolicy lets SurfaceFlinger
+ * and system_server in. Totals are written at most once per
+ * GC_GRALLOC_REGISTRY_PUBLISH_MS, so a file may lag that long behind.
+ * libmemtrack removes the files of dead processes, and falls back to the ION
+ * heap dump for processes without one. */
+#define GC_GRALLOC_REGISTRY_STATS_DIR   "/data/misc/gralloc"
+#define GC_GRALLOC_REGISTRY_STATS_PROP  "debug.gralloc.registry.stats"
+#define GC_GRALLOC_REGISTRY_PUBLISH_MS  1000
+
+#define GC_GRALLOC_REGISTRY_MAGIC       0x47524547 /* 'GREG' */
+
+struct gc_gralloc_registry_stats
+{
+    uint32_t magic;
+    uint32_t pid;
+
+    /* Process start time in clock ticks after boot, field 22 of
+     * /proc/<pid>/stat. Guards readers against recycled pids. */
+    uint64_t startTime;
+
+    /* Distinct buffers referenced by this process. */
+    uint32_t buffers;
+
+    /* Registered (or locally allocated) handles. */
+    uint32_t handles;
+
+    /* Sum of the sizes of all distinct buffers. */
+    uint64_t importedBytes;
+
+    /* Part of importedBytes in GAL video memory, which memtrack reports as GL
+     * from the gcmem driver, and in physically contiguous ION buffers, which
+     * it reports as OTHER from the carveout heap. The rest is what the ION
+     * system heap holds for this process. */
+    uint64_t videoMemoryBytes;
+    uint64_t contiguousBytes;
+
+    /* Misuse counters. */
+    uint32_t doubleRegistrations;
+    uint32_t invalidAccesses;
+
+    /* Bytes saved by consumer based layouts against the fixed legacy
+     * alignment, summed over all ION buffers allocated by this process.
+     * Negative when the layouts cost more. */
+    int64_t layoutBytesSaved;
+};
+
+static inline int
+gc_gralloc_read_start_time(
+    pid_t Pid,
+    uint64_t * StartTime
+    )
+{
+    char path[64];
+    char line[512];
+    char * p;
+    FILE * file;
+    int i;
+
+    snprintf(path, sizeof(path), "/proc/%d/stat", Pid);
+    file = fopen(path, "r");
+    if( file == NULL )
+        return -1;
+
+    p = fgets(line, sizeof(line), file);
+    fclose(file);
+    if( p == NULL )
+        return -1;
+
+    /* The command name may contain blanks, skip past its closing bracket. */
+    p = strrchr(line, ')');
+    if( p == NULL )
+        return -1;
+
+    /* starttime is the 20th field after the command name. */
+    for( i = 0; i < 20 && p != NULL; ++i )
+        p = strchr(p + 1, ' ');
+
+    if( p == NULL || sscanf(p, " %llu", (unsigned long long*)StartTime) != 1 )
+        return -1;
+
+    return 0;
+}
+
+#endif /* __gc_gralloc_registry_h_ */
@@ -17,6 +17,7 @@
 
 #include <unistd.h>
 #include <errno.h>
+#include <stdarg.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -243,10 +244,11 @@ extern int gralloc_alloc_framebuffer(alloc_device_t *device, int w, int h, int f
     {
         /* We ran out of buffers. */
         ALOGE("Out of buffers");
+        pthread_mutex_unlock(&m->lock);
         return -ENOMEM;
     }
 
-    bufferSize = m->finfo.line_length * (m->info.yres_virtual / m->numBuffers);
+    bufferSize = fb_get_slot_size(m);
 
     hnd = new private_handle_t(dup(m->framebuffer->fd), h * sizeofLine, private_handle_t::PRIV_FLAGS_FRAMEBUFFER);
 
@@ -286,8 +288,7 @@ extern int gralloc_free_framebuffer(alloc_device_t *device, buffer_handle_t hand
         return -EINVAL;
 
     module->bufferMask &= ~(1 << (hnd->base - module->framebuffer->base)
-                            / (module->finfo.line_length
-                             * module->info.yres ));
+                            / fb_get_slot_size(module));
 
     gc_gralloc_unwrap(hnd);
     close(hnd->fd);
@@ -362,6 +363,66 @@ extern int gralloc_perform(struct gralloc_module_t const* module,
         int operation, ... )
 {
     //log_func_entry;
-    return 0;
+    private_module_t *m = (private_module_t*)module;
+    buffer_handle_t handle;
+    int res = 0;
+    va_list args;
+
+    va_start(args, operation);
+    switch( operation )
+    {
+        case GRALLOC_MODULE_PERFORM_SET_FB_ACQUIRE_FENCE:
+        {
+            handle = va_arg(args, buffer_handle_t);
+            int fd = va_arg(args, int);
+            res = fb_set_acquire_fence(m, handle, fd);
+            break;
+        }
+        case GRALLOC_MODULE_PERFORM_GET_FB_RELEASE_FENCE:
+        {
+            handle = va_arg(args, buffer_handle_t);
+            int *fd = va_arg(args, int*);
+            res = fb_get_release_fence(m, handle, fd);
+            break;
+        }
+        case GRALLOC_MODULE_PERFORM_GET_FB_HEADER:
+        {
+            handle = va_arg(args, buffer_handle_t);
+            uint32_t *offset = va_arg(args, uint32_t*);
+            res = fb_get_header(m, handle, offset);
+            break;
+        }
+        case GRALLOC_MODULE_PERFORM_SET_FB_COMPRESSED:
+        {
+            handle = va_arg(args, buffer_handle_t);
+            int compressed = va_arg(args, int);
+            res = fb_set_compressed(m, handle, compressed);
+            break;
+        }
+        case GRALLOC_MODULE_PERFORM_GET_FB_COMPRESSED:
+        {
+            handle = va_arg(args, buffer_handle_t);
+            int *compressed = va_arg(args, int*);
+            res = fb_get_compressed(m, handle, compressed);
+            break;
+        }
+        case GRALLOC_MODULE_PERFORM_GET_FB_STATS:
+        {
+            private_fb_stats_t *stats = va_arg(args, private_fb_stats_t*);
+            res = fb_get_stats(m, stats);
+            break;
+        }
+        case GRALLOC_MODULE_PERFORM_GET_REGISTRY_STATS:
+        {
+            gc_gralloc_registry_stats *stats = va_arg(args, gc_gralloc_registry_stats*);
+            gc_gralloc_registry_get_stats(stats);
+            break;
+        }
+        default:
+            break;
+    }
+    va_end(args);
+
+    return res;
 }
 
@@ -48,6 +48,65 @@ struct private_handle_t;
 
 #define GRALLOC_USAGE_MRVL_PRIVATE_1 0x400000
 
+/* gralloc_module_t::perform operations.
+ *
+ * GRALLOC_MODULE_PERFORM_SET_FB_ACQUIRE_FENCE (buffer_handle_t, int fd)
+ *     Fence the next post of a framebuffer buffer waits for in the display
+ *     controller. fd is duplicated.
+ *
+ * GRALLOC_MODULE_PERFORM_GET_FB_RELEASE_FENCE (buffer_handle_t, int *fd)
+ *     Release fence of the last post of a framebuffer buffer, the caller owns
+ *     it. -1 if there is none.
+ *
+ * GRALLOC_MODULE_PERFORM_GET_FB_HEADER (buffer_handle_t, uint32_t *offset)
+ *     Offset from the start of a framebuffer buffer of the room reserved for
+ *     its compression header. 0 if framebuffer compression is disabled.
+ *
+ * GRALLOC_MODULE_PERFORM_SET_FB_COMPRESSED (buffer_handle_t, int compressed)
+ *     Whether the frame just rendered into a framebuffer buffer is compressed,
+ *     with its header at the offset above. Only applies to the next post of
+ *     this buffer, writers of compressed frames set it for every frame.
+ *
+ * GRALLOC_MODULE_PERFORM_GET_FB_COMPRESSED (buffer_handle_t, int *compressed)
+ *     Whether the frame in a framebuffer buffer is compressed: the value set
+ *     above until the post, then the state of that post.
+ *
+ * GRALLOC_MODULE_PERFORM_GET_FB_STATS (private_fb_stats_t *stats)
+ *     Framebuffer scan-out bandwidth counters.
+ *
+ * GRALLOC_MODULE_PERFORM_GET_REGISTRY_STATS (struct gc_gralloc_registry_stats *stats)
+ *     Buffers registered by the calling process, see gc_gralloc_registry.h.
+ */
+#define GRALLOC_MODULE_PERFORM_SET_FB_ACQUIRE_FENCE  0x4D560001
+#define GRALLOC_MODULE_PERFORM_GET_FB_RELEASE_FENCE  0x4D560002
+#define GRALLOC_MODULE_PERFORM_GET_FB_HEADER         0x4D560003
+#define GRALLOC_MODULE_PERFORM_SET_FB_COMPRESSED     0x4D560004
+#define GRALLOC_MODULE_PERFORM_GET_FB_STATS          0x4D560005
+#define GRALLOC_MODULE_PERFORM_GET_REGISTRY_STATS    0x4D560006
+#define GRALLOC_MODULE_PERFORM_GET_FB_COMPRESSED     0x4D560007
+
+typedef struct private_fb_stats
+{
+    /* Posted frames, and how many of them were compressed. */
+    uint64_t frames;
+    uint64_t compressedFrames;
+
+    /* Pixel bytes posted, counted uncompressed. */
+    uint64_t bytes;
+
+    /* Compressed frames whose header could be sampled, and the bytes the
+     * display did not have to fetch for them. */
+    uint64_t sampledFrames;
+    uint64_t bytesSaved;
+
+    /* Bytes saved by the last sampled frame. */
+    uint32_t lastBytesSaved;
+
+    /* CLOCK_MONOTONIC times in ns around the flip ioctls of the last post. */
+    int64_t lastPostStart;
+    int64_t lastPostEnd;
+} private_fb_stats_t;
+
 class __DEBUG_CLASS_LOG__
 {
     const char* _func;
@@ -29,7 +29,9 @@ BOARD_ENABLE_OVERLAY ?= false
 
 LOCAL_SRC_FILES := \
     hwcomposer.cpp \
-    HWCDisplayEventMonitor.cpp
+    HWCDisplayEventMonitor.cpp \
+    HWCTrace.cpp \
+    HWCCapture.cpp
 
 LOCAL_SRC_FILES += \
     HWBaselayComposer.cpp
@@ -73,7 +75,8 @@ endif
 
 ifeq ($(BOARD_ENABLE_WFD_OPTIMIZATION), true)
 LOCAL_C_INCLUDES += \
-    frameworks/native/services 
+    frameworks/native/services \
+    system/core/libsync/
 endif
 
 LOCAL_PRELINK_MODULE := false
@@ -91,6 +94,12 @@ LOCAL_SHARED_LIBRARIES += libbinder \
                           libsync
 endif
 
+ifeq ($(BOARD_ENABLE_WFD_OPTIMIZATION), true)
+ifneq ($(BOARD_ENABLE_OVERLAY), true)
+LOCAL_SHARED_LIBRARIES += libsync
+endif
+endif
+
 LOCAL_MODULE := hwcomposer.$(TARGET_BOARD_PLATFORM)
 
 LOCAL_CFLAGS:= -DLOG_TAG=\"HWComposerMarvell\"
@@ -116,4 +125,47 @@ endif
 
 LOCAL_MODULE_TAGS := optional
 
+# Directory of the trace export and the capture log.
+LOCAL_INIT_RC := hwcomposer.rc
+
 include $(BUILD_SHARED_LIBRARY)
+
+# Decoder and replay of the capture log
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := HWCCaptureTool.cpp
+LOCAL_C_INCLUDES := $(common_includes) \
+    hardware/libhardware/include
+LOCAL_SHARED_LIBRARIES := $(common_libs)
+LOCAL_MODULE := hwc_capture
+LOCAL_MODULE_TAGS := optional
+include $(BUILD_EXECUTABLE)
+
+# Decoder of a pulled log, its replay composes the sets on the CPU through the
+# area code of the GC composer
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := HWCCaptureTool.cpp \
+    ../libHWComposerGC/gc_hwc_area.cpp
+LOCAL_C_INCLUDES := $(LOCAL_PATH)/../libHWComposerGC \
+    hardware/marvell/libprebuilt/pxa1908/libGAL/include
+LOCAL_MODULE := hwc_capture
+LOCAL_MODULE_TAGS := optional
+include $(BUILD_HOST_EXECUTABLE)
+
+# Host unit test of the virtual display mirroring queue, sync and the 2D
+# engine are faked by the test
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := HWVirtualComposer.cpp tests/HWVirtualComposer_test.cpp
+LOCAL_C_INCLUDES := $(common_includes) \
+    hardware/libhardware/include \
+    hardware/marvell/libprebuilt/pxa1908/libGAL/include \
+    system/core/libsync/ \
+    system/core/libsync/include
+LOCAL_SHARED_LIBRARIES := liblog libutils libcutils
+# Layers keep the encoder window in a 32 bit field.
+LOCAL_MULTILIB := 32
+LOCAL_MODULE := hwc_virtual_test
+LOCAL_MODULE_TAGS := optional
+include $(BUILD_HOST_NATIVE_TEST)
@@ -23,7 +23,9 @@
 #include <hardware/hardware.h>
 #include <hardware/hwcomposer.h>
 #include <surfaceflinger/Transform.h>
+#include <utils/Timers.h>
 #include "GcuEngine.h"
+#include "HWCTrace.h"
 
 #include <mrvl_pxl_formats.h>
 
@@ -33,6 +35,13 @@ GcuEngine::GcuEngine() : mGCUContextPtr(NULL)
                        , mFlushAtEnd(false)
                        , mAndPatternPtr(NULL)
                        , mOrPatternPtr(NULL)
+                       , mYUVOutputProbed(false)
+                       , mYUVOutputSupported(false)
+                       , mScratchSurface(NULL)
+                       , mScratchVirtAddr(NULL)
+                       , mScratchPhysAddr(0)
+                       , mScratchWidth(0)
+                       , mScratchHeight(0)
 {
     if(!Init()) {
         ALOGE("GcuEngine initialization failed!");
@@ -55,6 +64,10 @@ GcuEngine::~GcuEngine()
         }
     }
 
+    if (NULL != mScratchSurface){
+        gcuDestroySurface(mGCUContextPtr, mScratchSurface);
+    }
+
     if (mGCUContextPtr != NULL) {
         gcuDestroyContext(mGCUContextPtr);
     }
@@ -148,6 +161,33 @@ void GcuEngine::preparePatternSurfaces()
 #endif
 }
 
+/*
+ * Bytes written to the destination, for the frame trace.
+ */
+static uint64_t getBlitBytes(PBlitDataDesc blitDesc)
+{
+    uint64_t pixels;
+    if(NULL != blitDesc->mDstRect){
+        pixels = uint64_t(blitDesc->mDstRect->r - blitDesc->mDstRect->l) *
+                 uint64_t(blitDesc->mDstRect->b - blitDesc->mDstRect->t);
+    }else{
+        pixels = uint64_t(blitDesc->mDstWidth) * blitDesc->mDstHeight;
+    }
+
+    switch (blitDesc->mDstFormat) {
+        case HAL_PIXEL_FORMAT_RGBA_8888:
+        case HAL_PIXEL_FORMAT_RGBX_8888:
+        case HAL_PIXEL_FORMAT_BGRA_8888:
+            return pixels * 4;
+        case HAL_PIXEL_FORMAT_RGB_565:
+        case HAL_PIXEL_FORMAT_CbYCrY_422_I:
+        case HAL_PIXEL_FORMAT_YCbCr_422_I:
+            return pixels * 2;
+        default:
+            return pixels * 3 / 2;
+    }
+}
+
 bool GcuEngine::Blit(PBlitDataDesc blitDesc)
 {
     blitDesc->dump();
@@ -193,7 +233,11 @@ bool GcuEngine::Blit(PBlitDataDesc blitDesc)
     }
 
     if (mFlushAtEnd) {
-        gcuFlush(mGCUContextPtr);
+        commit(false);
+    }
+
+    if (result && HWCTrace::isEnabled()) {
+        HWCTrace::addBlit(getBlitBytes(blitDesc));
     }
 
 #if HARDWARE_ENGINE_SWITCH
@@ -203,6 +247,21 @@ bool GcuEngine::Blit(PBlitDataDesc blitDesc)
     return result;
 }
 
+void GcuEngine::commit(bool wait)
+{
+    nsecs_t start = HWCTrace::isEnabled() ? systemTime(SYSTEM_TIME_MONOTONIC) : 0;
+
+    if (wait) {
+        gcuFinish(mGCUContextPtr);
+    } else {
+        gcuFlush(mGCUContextPtr);
+    }
+
+    if (start != 0) {
+        HWCTrace::addFlush(systemTime(SYSTEM_TIME_MONOTONIC) - start);
+    }
+}
+
 bool GcuEngine::RopBlit(PBlitDataDesc blitDesc)
 {
     GCU_ROP_DATA bltData;
@@ -239,7 +298,7 @@ bool GcuEngine::RopBlit(PBlitDataDesc blitDesc)
 
     gcuSet(mGCUContextPtr, GCU_QUALITY, GCU_QUALITY_NORMAL);
     gcuRop(mGCUContextPtr, &bltData);
-    gcuFinish(mGCUContextPtr);
+    commit(true);
 
     gcuSet(mGCUContextPtr, GCU_QUALITY, GCU_QUALITY_HIGH);
     gcuDestroySurface(mGCUContextPtr, pSrcSurface);
@@ -264,7 +323,7 @@ bool GcuEngine::FilterBlit(PBlitDataDesc blitDesc)
     bltData.rotation = getGCURotation(blitDesc->mRotationDegree);
 
     gcuBlit(mGCUContextPtr, &bltData);
-    gcuFinish(mGCUContextPtr);
+    commit(true);
 
     gcuDestroySurface(mGCUContextPtr, pSrcSurface);
     gcuDestroySurface(mGCUContextPtr, pDstSurface);
@@ -290,7 +349,7 @@ bool GcuEngine::SrcBlit(PBlitDataDesc blitDesc)
     bltData.rotation = getGCURotation(blitDesc->mRotationDegree);
 
     gcuBlit(mGCUContextPtr, &bltData);
-    gcuFinish(mGCUContextPtr);
+    commit(true);
 
     gcuDestroySurface(mGCUContextPtr, pSrcSurface);
     gcuDestroySurface(mGCUContextPtr, pDstSurface);
@@ -332,7 +391,7 @@ bool GcuEngine::FillBlit(PBlitDataDesc blitDesc)
     }
 
     gcuFill(mGCUContextPtr, &fillData);
-    gcuFinish(mGCUContextPtr);
+    commit(true);
     gcuDestroySurface(mGCUContextPtr, pDstSurface);
 
     return true;
@@ -437,6 +496,8 @@ GCU_FORMAT GcuEngine::getGCUFormat(uint32_t format)
             return GCU_FORMAT_YV12;
         case HAL_PIXEL_FORMAT_YCrCb_420_SP:
             return GCU_FORMAT_NV21;
+        case HAL_PIXEL_FORMAT_YCbCr_420_SP_MRVL:
+            return GCU_FORMAT_NV12;
         default:
             ALOGE("New type switch needed! %d, %s", __LINE__, __FUNCTION__);
     }
@@ -497,9 +558,84 @@ bool GcuEngine::BlitHintPic(uint32_t id, PBlitDataDesc blitDesc)
     bltData.rotation = getGCURotation(blitDesc->mRotationDegree);
 
     gcuBlit(mGCUContextPtr, &bltData);
-    gcuFinish(mGCUContextPtr);
+    commit(true);
 
     gcuDestroySurface(mGCUContextPtr, pDstSurface);
 
     return true;
 }
+
+bool GcuEngine::isYUVOutputSupported()
+{
+    if(mYUVOutputProbed){
+        return mYUVOutputSupported;
+    }
+
+    GCUVirtualAddr virtAddr;
+    GCUPhysicalAddr physAddr;
+    GCUSurface pSrcSurface = _gcuCreateBuffer(mGCUContextPtr, 64, 64, GCU_FORMAT_ABGR8888,
+                                              &virtAddr, &physAddr);
+    GCUSurface pDstSurface = _gcuCreateBuffer(mGCUContextPtr, 64, 64, GCU_FORMAT_NV12,
+                                              &virtAddr, &physAddr);
+
+    if(NULL != pSrcSurface && NULL != pDstSurface){
+        GCU_BLT_DATA bltData;
+        GCU_RECT srcRect, dstRect;
+        srcRect.left   = 0;
+        srcRect.right  = 64;
+        srcRect.top    = 0;
+        srcRect.bottom = 64;
+        dstRect.left   = 0;
+        dstRect.right  = 32;
+        dstRect.top    = 0;
+        dstRect.bottom = 32;
+
+        memset(&bltData, 0, sizeof(bltData));
+        bltData.pSrcSurface = pSrcSurface;
+        bltData.pDstSurface = pDstSurface;
+        bltData.pSrcRect = &srcRect;
+        bltData.pDstRect = &dstRect;
+        bltData.rotation = GCU_ROTATION_0;
+
+        // Drop any error left by a previous call.
+        gcuGetError();
+        gcuBlit(mGCUContextPtr, &bltData);
+        gcuFinish(mGCUContextPtr);
+        mYUVOutputSupported = (GCU_NO_ERROR == gcuGetError());
+    }
+
+    if(NULL != pSrcSurface){
+        gcuDestroySurface(mGCUContextPtr, pSrcSurface);
+    }
+    if(NULL != pDstSurface){
+        gcuDestroySurface(mGCUContextPtr, pDstSurface);
+    }
+
+    mYUVOutputProbed = true;
+    ALOGI("GCU %s write NV12.", mYUVOutputSupported ? "can" : "can not");
+    return mYUVOutputSupported;
+}
+
+bool GcuEngine::getScratchBuffer(uint32_t width, uint32_t height,
+                                 void** virtAddr, uint32_t* physAddr)
+{
+    if(NULL == mScratchSurface || mScratchWidth != width || mScratchHeight != height){
+        if(NULL != mScratchSurface){
+            gcuDestroySurface(mGCUContextPtr, mScratchSurface);
+        }
+
+        mScratchSurface = _gcuCreateBuffer(mGCUContextPtr, width, height, GCU_FORMAT_ABGR8888,
+                                           &mScratchVirtAddr, &mScratchPhysAddr);
+        if(NULL == mScratchSurface){
+            ALOGE("ERROR: Can not allocate a %dx%d scratch buffer!", width, height);
+            return false;
+        }
+
+        mScratchWidth = width;
+        mScratchHeight = height;
+    }
+
+    *virtAddr = (void*)mScratchVirtAddr;
+    *physAddr = (uint32_t)mScratchPhysAddr;
+    return true;
+}
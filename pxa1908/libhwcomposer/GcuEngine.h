@@ -257,6 +257,13 @@ public:
 
     bool    BlitHintPic(uint32_t id, PBlitDataDesc blitDesc);
 
+    ///< whether the 2D core can write NV12, probed on first use.
+    bool    isYUVOutputSupported();
+
+    ///< ABGR8888 buffer kept across frames, reallocated on size change.
+    bool    getScratchBuffer(uint32_t width, uint32_t height,
+                             void** virtAddr, uint32_t* physAddr);
+
 protected:
     bool    FilterBlit(PBlitDataDesc blitDesc);
     bool    SrcBlit(PBlitDataDesc blitDesc);
@@ -278,6 +285,9 @@ private:
     ///< create a tiny buffer to do ROP.
     void           preparePatternSurfaces();
 
+    ///< gcuFinish, or gcuFlush without wait, timed for the frame trace.
+    void           commit(bool wait);
+
 private:
 
     GCUContext     mGCUContextPtr;
@@ -287,6 +297,15 @@ private:
 
     GCUSurface     mHintSurface[MAX_HINT_PICS];
 
+    bool           mYUVOutputProbed;
+    bool           mYUVOutputSupported;
+
+    GCUSurface     mScratchSurface;
+    GCUVirtualAddr mScratchVirtAddr;
+    GCUPhysicalAddr mScratchPhysAddr;
+    uint32_t       mScratchWidth;
+    uint32_t       mScratchHeight;
+
 };
 
 #ifdef __cplusplus
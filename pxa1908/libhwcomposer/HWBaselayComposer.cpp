@@ -19,7 +19,9 @@
 #include "HWBaselayComposer.h"
 #ifdef ENABLE_HWC_GC_PATH
     #include "HWCGCInterface.h"
+    #include "gc_hwc_trace.h"
 #endif
+#include "HWCTrace.h"
 #include <cutils/properties.h>
 #include <cutils/log.h>
 
@@ -82,7 +84,19 @@ int HWBaselayComposer::prepare(hwc_composer_device_1_t *dev, size_t numDisplays,
 int HWBaselayComposer::set(hwc_composer_device_1_t *dev, size_t numDisplays, hwc_display_contents_1_t** displays)
 {
 #ifdef ENABLE_HWC_GC_PATH
-    return hwc_set_gc(mHwc, numDisplays, displays);
+    int status = hwc_set_gc(mHwc, numDisplays, displays);
+
+    // Stages inside the GC composer, the baselay set stage covers them.
+    if(HWCTrace::isEnabled()){
+        struct hwcStageTimes times;
+        if(hwc_get_stage_times(&mHwc->common, &times) == 0){
+            HWCTrace::setStage(HWC_TRACE_GC_SPLIT, times.splitStart, times.splitEnd);
+            HWCTrace::setStage(HWC_TRACE_GC_COMPOSE, times.composeStart, times.composeEnd);
+            HWCTrace::setStage(HWC_TRACE_GC_COMMIT, times.commitStart, times.commitEnd);
+        }
+    }
+
+    return status;
 #else
     return 0;
 #endif
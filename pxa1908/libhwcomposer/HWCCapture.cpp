@@ -0,0 +1,338 @@
+/*
+ * Copyright (C) 2016 The CyanogenMod Project
+ *               2017 The LineageOS Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <cutils/log.h>
+#include <cutils/properties.h>
+#include <utils/Vector.h>
+
+#include <gralloc_priv.h>
+
+#include "HWCCapture.h"
+
+namespace android{
+
+/*
+ * Contents of one layer buffer, read before set hands the acquire fence over.
+ */
+struct HWCCaptureContent{
+    uint8_t* data;
+    uint32_t size;
+    uint32_t hash;
+};
+
+bool HWCCapture::sEnabled = false;
+
+///< persist.hwc.capture.buffers.
+static bool sBuffers = false;
+
+static const gralloc_module_t* sGralloc = NULL;
+
+///< log, -1 once capture stopped.
+static int sFd = -1;
+
+static uint32_t sFrames = 0;
+static uint32_t sCalls = 0;
+static uint64_t sBytes = 0;
+
+///< call being recorded, owned by the composition thread.
+static int64_t sStart;
+static Vector<int32_t> sRequested;
+static Vector<HWCCaptureContent> sContents;
+
+///< serialised call, written at once.
+static uint8_t* sBuffer = NULL;
+static size_t sSize = 0;
+static size_t sCapacity = 0;
+
+static inline int64_t captureNow()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return int64_t(ts.tv_sec) * 1000000000LL + ts.tv_nsec;
+}
+
+static uint32_t captureHash(const uint8_t* data, uint32_t size)
+{
+    uint32_t hash = 2166136261U;
+    for(uint32_t i = 0; i < size; ++i){
+        hash ^= data[i];
+        hash *= 16777619U;
+    }
+    return hash;
+}
+
+static inline void captureRect(HWCCaptureRect& out, const hwc_rect_t& rect)
+{
+    out.left = rect.left;
+    out.top = rect.top;
+    out.right = rect.right;
+    out.bottom = rect.bottom;
+}
+
+static void captureStop(const char* reason)
+{
+    if(sFd < 0)
+        return;
+
+    ALOGW("Capture stopped after %u calls: %s", sCalls, reason);
+    close(sFd);
+    sFd = -1;
+}
+
+static void capturePut(const void* data, size_t size)
+{
+    if(sSize + size > sCapacity){
+        size_t capacity = (sSize + size) * 2;
+        uint8_t* buffer = (uint8_t*)realloc(sBuffer, capacity);
+        if(buffer == NULL){
+            captureStop("out of memory");
+            return;
+        }
+        sBuffer = buffer;
+        sCapacity = capacity;
+    }
+
+    memcpy(sBuffer + sSize, data, size);
+    sSize += size;
+}
+
+static void captureFlush()
+{
+    if(sFd >= 0 && sSize > 0){
+        if(sBytes + sSize > HWC_CAPTURE_MAX_BYTES)
+            captureStop("log full");
+        else if(write(sFd, sBuffer, sSize) != (ssize_t)sSize)
+            captureStop(strerror(errno));
+        else
+            sBytes += sSize;
+    }
+
+    sSize = 0;
+}
+
+static void captureRelease()
+{
+    for(size_t i = 0; i < sContents.size(); ++i){
+        free(sContents[i].data);
+    }
+    sContents.clear();
+}
+
+/*
+ * Copy the contents of a layer buffer once it is rendered.
+ */
+static void captureContent(const hwc_layer_1_t* layer, HWCCaptureContent& content)
+{
+    private_handle_t* handle = (private_handle_t*)layer->handle;
+    void* vaddr = NULL;
+
+    if(handle == NULL || sGralloc == NULL || handle->size <= 0)
+        return;
+
+    if(layer->acquireFenceFd >= 0){
+        struct pollfd fd = { layer->acquireFenceFd, POLLIN, 0 };
+        if(poll(&fd, 1, HWC_CAPTURE_FENCE_TIMEOUT) <= 0){
+            ALOGW("Capture: layer buffer %p not rendered in time, contents skipped", handle);
+            return;
+        }
+    }
+
+    if(sGralloc->lock(sGralloc, handle, GRALLOC_USAGE_SW_READ_OFTEN,
+                      0, 0, handle->width, handle->height, &vaddr) != 0){
+        return;
+    }
+
+    content.data = (uint8_t*)malloc(handle->size);
+    if(content.data != NULL){
+        memcpy(content.data, vaddr, handle->size);
+        content.size = handle->size;
+        content.hash = captureHash(content.data, content.size);
+    }
+
+    sGralloc->unlock(sGralloc, handle);
+}
+
+void HWCCapture::init(const gralloc_module_t* gralloc)
+{
+    char value[PROPERTY_VALUE_MAX];
+    property_get("persist.hwc.capture", value, "0");
+    sEnabled = (atoi(value) == 1);
+    if(!sEnabled)
+        return;
+
+    property_get("persist.hwc.capture.buffers", value, "0");
+    sBuffers = (atoi(value) == 1);
+    sGralloc = gralloc;
+
+    sFd = open(HWC_CAPTURE_FILE, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if(sFd < 0){
+        ALOGE("Capture: failed to open %s: %s", HWC_CAPTURE_FILE, strerror(errno));
+        return;
+    }
+
+    HWCCaptureHeader header;
+    header.magic = HWC_CAPTURE_MAGIC;
+    header.version = HWC_CAPTURE_VERSION;
+    header.callSize = sizeof(HWCCaptureCall);
+    header.displaySize = sizeof(HWCCaptureDisplay);
+    header.layerSize = sizeof(HWCCaptureLayer);
+    capturePut(&header, sizeof(header));
+    captureFlush();
+
+    ALOGI("Capturing prepare/set into %s%s", HWC_CAPTURE_FILE,
+          sBuffers ? " with buffer contents" : "");
+}
+
+void HWCCapture::beginCall(HWC_CAPTURE_CALL call, size_t numDisplays,
+                           hwc_display_contents_1_t** displays)
+{
+    if(sFd < 0)
+        return;
+
+    sStart = captureNow();
+    sRequested.clear();
+    captureRelease();
+
+    for(size_t i = 0; displays && i < numDisplays; ++i){
+        if(displays[i] == NULL)
+            continue;
+
+        for(size_t j = 0; j < displays[i]->numHwLayers; ++j){
+            const hwc_layer_1_t& layer = displays[i]->hwLayers[j];
+            sRequested.add(layer.compositionType);
+
+            // Set takes the acquire fences, read the buffers before it.
+            if(sBuffers && call == HWC_CAPTURE_SET){
+                HWCCaptureContent content = { NULL, 0, 0 };
+                captureContent(&layer, content);
+                sContents.add(content);
+            }
+        }
+    }
+}
+
+void HWCCapture::endCall(HWC_CAPTURE_CALL call, size_t numDisplays,
+                         hwc_display_contents_1_t** displays, int status)
+{
+    if(sFd < 0){
+        captureRelease();
+        return;
+    }
+
+    HWCCaptureCall record;
+    record.call = call;
+    record.frame = sFrames;
+    record.numDisplays = displays ? numDisplays : 0;
+    record.status = status;
+    record.start = sStart;
+    record.end = captureNow();
+    capturePut(&record, sizeof(record));
+
+    size_t index = 0;
+    for(size_t i = 0; i < record.numDisplays; ++i){
+        hwc_display_contents_1_t* list = displays[i];
+
+        HWCCaptureDisplay display;
+        memset(&display, 0, sizeof(display));
+        if(list != NULL){
+            display.present = 1;
+            display.flags = list->flags;
+            display.numHwLayers = list->numHwLayers;
+        }
+        capturePut(&display, sizeof(display));
+
+        for(size_t j = 0; j < display.numHwLayers; ++j, ++index){
+            const hwc_layer_1_t& layer = list->hwLayers[j];
+            const private_handle_t* handle = (const private_handle_t*)layer.handle;
+
+            HWCCaptureLayer out;
+            memset(&out, 0, sizeof(out));
+            out.handle = (uint64_t)(uintptr_t)layer.handle;
+            out.requestedType = index < sRequested.size() ? sRequested[index] : layer.compositionType;
+            out.compositionType = layer.compositionType;
+            out.hints = layer.hints;
+            out.flags = layer.flags;
+            out.transform = layer.transform;
+            out.blending = layer.blending;
+            captureRect(out.sourceCrop, layer.sourceCrop);
+            captureRect(out.displayFrame, layer.displayFrame);
+            out.planeAlpha = layer.planeAlpha;
+            out.numVisibleRects = layer.visibleRegionScreen.numRects;
+            out.acquireFence = layer.acquireFenceFd >= 0;
+
+            if(handle != NULL){
+                out.width = handle->width;
+                out.height = handle->height;
+                out.format = handle->format;
+                out.stride = handle->stride;
+            }
+
+            HWCCaptureContent* content = index < sContents.size() ? &sContents.editItemAt(index) : NULL;
+            if(content != NULL && content->data != NULL){
+                out.contentSize = content->size;
+                out.contentHash = content->hash;
+            }
+
+            capturePut(&out, sizeof(out));
+            for(size_t k = 0; k < out.numVisibleRects; ++k){
+                HWCCaptureRect rect;
+                captureRect(rect, layer.visibleRegionScreen.rects[k]);
+                capturePut(&rect, sizeof(rect));
+            }
+
+            if(out.contentSize > 0){
+                // Contents go straight to the log, no need to copy them twice.
+                captureFlush();
+                if(sFd >= 0 && sBytes + content->size > HWC_CAPTURE_MAX_BYTES)
+                    captureStop("log full");
+                if(sFd >= 0){
+                    if(write(sFd, content->data, content->size) != (ssize_t)content->size)
+                        captureStop(strerror(errno));
+                    else
+                        sBytes += content->size;
+                }
+            }
+        }
+    }
+
+    captureFlush();
+    captureRelease();
+
+    sCalls++;
+    if(call == HWC_CAPTURE_SET)
+        sFrames++;
+}
+
+void HWCCapture::dump(String8& result)
+{
+    if(!sEnabled)
+        return;
+
+    result.appendFormat("Capture: %u frames, %u calls, %llu KB in %s%s\n",
+                        sFrames, sCalls, (unsigned long long)(sBytes >> 10), HWC_CAPTURE_FILE,
+                        sFd < 0 ? " (stopped)" : "");
+}
+
+}// end of namespace android
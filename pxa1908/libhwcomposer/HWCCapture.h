@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) 2016 The CyanogenMod Project
+ *               2017 The LineageOS Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __HWC_CAPTURE_H__
+#define __HWC_CAPTURE_H__
+
+#include <stdint.h>
+
+#include <utils/String8.h>
+#include <hardware/hwcomposer.h>
+#include <hardware/gralloc.h>
+
+#include "HWCTrace.h"
+#include "HWCCaptureFormat.h"
+
+namespace android{
+
+///< capture stops once the log reaches this size.
+#define HWC_CAPTURE_MAX_BYTES   (256 << 20)
+
+///< ms waited for a layer buffer to be rendered before its contents are read.
+#define HWC_CAPTURE_FENCE_TIMEOUT 100
+
+/*
+ * Serialises every prepare and set into HWC_CAPTURE_FILE so a frame stream
+ * can be studied off the device.
+ *
+ * Calls are recorded by the composition thread only. Everything but
+ * isEnabled() is a no-op unless persist.hwc.capture is set when the device
+ * is opened. Buffer contents are read at set when persist.hwc.capture.buffers
+ * is set too, which stalls on every layer.
+ */
+class HWCCapture
+{
+public:
+    static void init(const gralloc_module_t* gralloc);
+
+    static inline bool isEnabled(){
+        return sEnabled;
+    }
+
+    static void beginCall(HWC_CAPTURE_CALL call, size_t numDisplays,
+                          hwc_display_contents_1_t** displays);
+
+    static void endCall(HWC_CAPTURE_CALL call, size_t numDisplays,
+                        hwc_display_contents_1_t** displays, int status);
+
+    static void dump(String8& result);
+
+private:
+    static bool sEnabled;
+};
+
+}// end of namespace android
+
+#endif
@@ -0,0 +1,116 @@
+/*
+ * Copyright (C) 2016 The CyanogenMod Project
+ *               2017 The LineageOS Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __HWC_CAPTURE_FORMAT_H__
+#define __HWC_CAPTURE_FORMAT_H__
+
+/*
+ * Layout of the capture log, shared by the composer and the hwc_capture
+ * decoder. Only depends on stdint.h so the decoder builds on the host.
+ */
+
+#include <stdint.h>
+
+namespace android{
+
+enum HWC_CAPTURE_CALL{
+    HWC_CAPTURE_PREPARE = 0,
+    HWC_CAPTURE_SET,
+};
+
+///< binary log in HWC_TRACE_DIR, truncated when the device is opened.
+#define HWC_CAPTURE_FILE        "/data/misc/hwc/capture"
+
+#define HWC_CAPTURE_MAGIC       0x43435748 /* 'HWCC' */
+#define HWC_CAPTURE_VERSION     1
+
+///< hwc_rect_t, visible rects are stored as these too.
+struct HWCCaptureRect{
+    int32_t left;
+    int32_t top;
+    int32_t right;
+    int32_t bottom;
+};
+
+/*
+ * The log is a HWCCaptureHeader followed by calls. Each call is a
+ * HWCCaptureCall, then for each display a HWCCaptureDisplay and its layers.
+ * Each layer is a HWCCaptureLayer, its visible rects and contentSize bytes of
+ * buffer contents.
+ */
+struct HWCCaptureHeader{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t callSize;
+    uint16_t displaySize;
+    uint16_t layerSize;
+};
+
+struct HWCCaptureCall{
+    ///< HWC_CAPTURE_CALL.
+    uint32_t call;
+    uint32_t frame;
+    uint32_t numDisplays;
+
+    ///< return of hwc_set, 0 for prepare.
+    int32_t status;
+
+    ///< CLOCK_MONOTONIC in ns around the call.
+    int64_t start;
+    int64_t end;
+};
+
+struct HWCCaptureDisplay{
+    ///< 0 for a NULL list, nothing else is valid then.
+    uint32_t present;
+    uint32_t flags;
+    uint32_t numHwLayers;
+};
+
+struct HWCCaptureLayer{
+    ///< identity only, the same handle is the same buffer.
+    uint64_t handle;
+
+    ///< type asked by SurfaceFlinger, and the one after the call, which is the
+    ///< composition decision for prepare.
+    int32_t requestedType;
+    int32_t compositionType;
+
+    uint32_t hints;
+    uint32_t flags;
+    uint32_t transform;
+    int32_t blending;
+    HWCCaptureRect sourceCrop;
+    HWCCaptureRect displayFrame;
+    uint32_t planeAlpha;
+    uint32_t numVisibleRects;
+    int32_t acquireFence;
+
+    ///< buffer description, 0 without a handle.
+    int32_t width;
+    int32_t height;
+    int32_t format;
+    int32_t stride;
+
+    ///< buffer contents following the visible rects, and their FNV-1a hash.
+    uint32_t contentSize;
+    uint32_t contentHash;
+};
+
+}// end of namespace android
+
+#endif
@@ -0,0 +1,919 @@
+/*
+ * Copyright (C) 2016 The CyanogenMod Project
+ *               2017 The LineageOS Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Decoder and replay of the prepare/set capture log.
+ *
+ * usage: hwc_capture [-s] [-r] [file]
+ *
+ *   (none)  print every call, its displays and layers with their composition
+ *           decision and content hash.
+ *   -s      print a summary only: decisions per type, decisions which changed
+ *           between two prepares of the same layer, sets whose contents all
+ *           matched the previous set.
+ *   -r      on the device, replay the captured prepares through the
+ *           hwcomposer HAL and report the layers whose decision differs from
+ *           the capture. Buffers are allocated once per captured handle and
+ *           filled with the captured contents, if any. Set is never called,
+ *           nothing is shown, but SurfaceFlinger must be stopped as the HAL
+ *           is opened a second time.
+ *           On the host, replay the captured sets through the area split of
+ *           the GC composer with a CPU blitter, and print the time and the
+ *           CRC-32 of each composed frame. Needs a log with buffer contents,
+ *           layers without them are left out of the frame.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <map>
+#include <vector>
+
+#ifdef __ANDROID__
+#include <hardware/hardware.h>
+#include <hardware/hwcomposer.h>
+#include <hardware/gralloc.h>
+
+#include <gralloc_priv.h>
+#else
+#include <time.h>
+
+#include <gc_hwc_area.h>
+#endif
+
+#include "HWCCaptureFormat.h"
+
+using namespace android;
+
+struct CaptureLayer{
+    HWCCaptureLayer layer;
+    std::vector<HWCCaptureRect> rects;
+
+    ///< only read for the replay.
+    std::vector<uint8_t> content;
+};
+
+struct CaptureDisplay{
+    HWCCaptureDisplay display;
+    std::vector<CaptureLayer> layers;
+};
+
+struct CaptureCall{
+    HWCCaptureCall call;
+    std::vector<CaptureDisplay> displays;
+};
+
+static const char* typeName(int32_t type)
+{
+    ///< HWC_FRAMEBUFFER .. HWC_CURSOR_OVERLAY.
+    static const char* const names[] = {
+        "FB", "OVERLAY", "BACKGROUND", "FB_TARGET", "SIDEBAND", "CURSOR",
+    };
+
+    if(type >= 0 && type < (int32_t)(sizeof(names) / sizeof(names[0])))
+        return names[type];
+    return "?";
+}
+
+#define CAPTURE_TYPES 6
+
+/*
+ * Read one call. Returns 1 for a call, 0 at the end of the log and -1 for a
+ * truncated or corrupted one.
+ */
+static int readCall(FILE* file, CaptureCall& out, bool contents)
+{
+    out.displays.clear();
+
+    size_t n = fread(&out.call, 1, sizeof(out.call), file);
+    if(n != sizeof(out.call))
+        return (n == 0 && feof(file)) ? 0 : -1;
+
+    // numDisplays comes from a size_t, guard against garbage.
+    if(out.call.call > HWC_CAPTURE_SET || out.call.numDisplays > 16)
+        return -1;
+
+    out.displays.resize(out.call.numDisplays);
+    for(size_t i = 0; i < out.displays.size(); ++i){
+        CaptureDisplay& display = out.displays[i];
+        if(fread(&display.display, sizeof(display.display), 1, file) != 1)
+            return -1;
+
+        display.layers.resize(display.display.numHwLayers);
+        for(size_t j = 0; j < display.layers.size(); ++j){
+            CaptureLayer& layer = display.layers[j];
+            if(fread(&layer.layer, sizeof(layer.layer), 1, file) != 1)
+                return -1;
+
+            layer.rects.resize(layer.layer.numVisibleRects);
+            if(layer.rects.size() > 0
+               && fread(&layer.rects[0], sizeof(HWCCaptureRect), layer.rects.size(), file) != layer.rects.size())
+                return -1;
+
+            if(layer.layer.contentSize == 0)
+                continue;
+
+            if(!contents){
+                if(fseek(file, layer.layer.contentSize, SEEK_CUR) != 0)
+                    return -1;
+                continue;
+            }
+
+            layer.content.resize(layer.layer.contentSize);
+            if(fread(&layer.content[0], 1, layer.content.size(), file) != layer.content.size())
+                return -1;
+        }
+    }
+
+    return 1;
+}
+
+static void printCall(const CaptureCall& call)
+{
+    const HWCCaptureCall& c = call.call;
+    printf("frame %u %s %lld us status %d\n", c.frame,
+           c.call == HWC_CAPTURE_PREPARE ? "prepare" : "set",
+           (long long)((c.end - c.start) / 1000), c.status);
+
+    for(size_t i = 0; i < call.displays.size(); ++i){
+        const CaptureDisplay& display = call.displays[i];
+        if(!display.display.present){
+            printf("  display %zu: none\n", i);
+            continue;
+        }
+
+        printf("  display %zu: flags 0x%x, %u layers\n", i,
+               display.display.flags, display.display.numHwLayers);
+
+        for(size_t j = 0; j < display.layers.size(); ++j){
+            const HWCCaptureLayer& l = display.layers[j].layer;
+            printf("    %2zu %016llx %-10s -> %-10s fmt %d %dx%d (%d) "
+                   "crop [%d,%d,%d,%d] frame [%d,%d,%d,%d] tr %u bl 0x%x a %u "
+                   "rects %u hints 0x%x flags 0x%x",
+                   j, (unsigned long long)l.handle,
+                   typeName(l.requestedType), typeName(l.compositionType),
+                   l.format, l.width, l.height, l.stride,
+                   l.sourceCrop.left, l.sourceCrop.top, l.sourceCrop.right, l.sourceCrop.bottom,
+                   l.displayFrame.left, l.displayFrame.top, l.displayFrame.right, l.displayFrame.bottom,
+                   l.transform, l.blending, l.planeAlpha, l.numVisibleRects, l.hints, l.flags);
+            if(l.contentSize > 0)
+                printf(" hash %08x", l.contentHash);
+            printf("\n");
+        }
+    }
+}
+
+/*
+ * Totals of the log. The last prepare and set of each display are kept to
+ * spot decisions and contents changing while the layer stack stays the same.
+ */
+struct CaptureSummary{
+    CaptureSummary() : calls(0), prepares(0), sets(0), prepareNs(0), setNs(0), flips(0),
+                       unchangedSets(0), hashedSets(0){
+        memset(decisions, 0, sizeof(decisions));
+    }
+
+    uint32_t calls;
+    uint32_t prepares;
+    uint32_t sets;
+    uint64_t prepareNs;
+    uint64_t setNs;
+    uint32_t decisions[CAPTURE_TYPES + 1];
+    uint32_t flips;
+    uint32_t unchangedSets;
+    uint32_t hashedSets;
+    std::map<size_t, std::vector<CaptureLayer> > lastPrepare;
+    std::map<size_t, std::vector<CaptureLayer> > lastSet;
+};
+
+static bool sameStack(const std::vector<CaptureLayer>& a, const std::vector<CaptureLayer>& b)
+{
+    if(a.size() != b.size())
+        return false;
+
+    for(size_t i = 0; i < a.size(); ++i){
+        if(a[i].layer.handle != b[i].layer.handle)
+            return false;
+    }
+    return true;
+}
+
+static void summarise(CaptureSummary& s, const CaptureCall& call)
+{
+    bool prepare = call.call.call == HWC_CAPTURE_PREPARE;
+    bool hashed = false;
+    bool unchanged = true;
+
+    s.calls++;
+    if(prepare){
+        s.prepares++;
+        s.prepareNs += call.call.end - call.call.start;
+    }else{
+        s.sets++;
+        s.setNs += call.call.end - call.call.start;
+    }
+
+    for(size_t i = 0; i < call.displays.size(); ++i){
+        const CaptureDisplay& display = call.displays[i];
+        if(!display.display.present)
+            continue;
+
+        const std::vector<CaptureLayer>& layers = display.layers;
+        std::vector<CaptureLayer>& last = prepare ? s.lastPrepare[i] : s.lastSet[i];
+        bool stack = sameStack(layers, last);
+
+        for(size_t j = 0; j < layers.size(); ++j){
+            const HWCCaptureLayer& l = layers[j].layer;
+
+            if(prepare){
+                int32_t type = l.compositionType;
+                s.decisions[(type >= 0 && type < CAPTURE_TYPES) ? type : CAPTURE_TYPES]++;
+
+                if(stack && last[j].layer.compositionType != l.compositionType){
+                    s.flips++;
+                    printf("frame %u display %zu layer %zu %016llx: %s -> %s\n",
+                           call.call.frame, i, j, (unsigned long long)l.handle,
+                           typeName(last[j].layer.compositionType), typeName(l.compositionType));
+                }
+            }else if(l.contentSize > 0){
+                hashed = true;
+                if(!stack || last[j].layer.contentHash != l.contentHash)
+                    unchanged = false;
+            }
+        }
+
+        last = layers;
+    }
+
+    if(!prepare && hashed){
+        s.hashedSets++;
+        if(unchanged)
+            s.unchangedSets++;
+    }
+}
+
+static void printSummary(const CaptureSummary& s)
+{
+    printf("%u calls: %u prepares avg %llu us, %u sets avg %llu us\n", s.calls,
+           s.prepares, (unsigned long long)(s.prepares ? s.prepareNs / s.prepares / 1000 : 0),
+           s.sets, (unsigned long long)(s.sets ? s.setNs / s.sets / 1000 : 0));
+
+    printf("decisions:");
+    for(int32_t type = 0; type <= CAPTURE_TYPES; ++type){
+        if(s.decisions[type] > 0)
+            printf(" %s %u", type < CAPTURE_TYPES ? typeName(type) : "other", s.decisions[type]);
+    }
+    printf("\n");
+
+    printf("decision changes on an unchanged layer stack: %u\n", s.flips);
+    if(s.hashedSets > 0)
+        printf("sets with unchanged contents: %u of %u\n", s.unchangedSets, s.hashedSets);
+}
+
+#ifdef __ANDROID__
+
+/*
+ * Rebuild the captured prepares on this device and compare the decisions.
+ */
+class CaptureReplay
+{
+public:
+    CaptureReplay() : mGralloc(NULL), mAlloc(NULL), mHwc(NULL), mPrepares(0), mLayers(0),
+                      mMismatches(0){}
+
+    ~CaptureReplay(){
+        for(std::map<uint64_t, buffer_handle_t>::iterator it = mBuffers.begin();
+            it != mBuffers.end(); ++it){
+            if(it->second != NULL)
+                mAlloc->free(mAlloc, it->second);
+        }
+
+        if(mHwc != NULL)
+            hwc_close_1(mHwc);
+        if(mAlloc != NULL)
+            gralloc_close(mAlloc);
+    }
+
+    int open(){
+        const hw_module_t* module = NULL;
+
+        if(hw_get_module(GRALLOC_HARDWARE_MODULE_ID, &module) != 0 || gralloc_open(module, &mAlloc) != 0){
+            fprintf(stderr, "replay: no gralloc\n");
+            return -1;
+        }
+        mGralloc = (const gralloc_module_t*)module;
+
+        if(hw_get_module(HWC_HARDWARE_MODULE_ID, &module) != 0 || hwc_open_1(module, &mHwc) != 0){
+            fprintf(stderr, "replay: no hwcomposer\n");
+            return -1;
+        }
+        return 0;
+    }
+
+    void replay(const CaptureCall& call){
+        if(call.call.call == HWC_CAPTURE_SET){
+            // Set carries the contents SurfaceFlinger rendered for the frame.
+            for(size_t i = 0; i < call.displays.size(); ++i){
+                for(size_t j = 0; j < call.displays[i].layers.size(); ++j)
+                    fill(call.displays[i].layers[j]);
+            }
+            return;
+        }
+
+        std::vector<hwc_display_contents_1_t*> displays(call.displays.size(), (hwc_display_contents_1_t*)NULL);
+        std::vector<std::vector<hwc_rect_t> > rects;
+
+        for(size_t i = 0; i < call.displays.size(); ++i){
+            const CaptureDisplay& display = call.displays[i];
+            if(!display.display.present)
+                continue;
+
+            size_t size = sizeof(hwc_display_contents_1_t) + display.layers.size() * sizeof(hwc_layer_1_t);
+            hwc_display_contents_1_t* list = (hwc_display_contents_1_t*)calloc(1, size);
+            if(list == NULL)
+                break;
+
+            list->retireFenceFd = -1;
+            list->flags = display.display.flags;
+            list->numHwLayers = display.layers.size();
+
+            // The HAL has no state of its own yet, start from a new geometry.
+            if(mPrepares == 0)
+                list->flags |= HWC_GEOMETRY_CHANGED;
+
+            for(size_t j = 0; j < display.layers.size(); ++j){
+                const CaptureLayer& in = display.layers[j];
+                hwc_layer_1_t& layer = list->hwLayers[j];
+
+                layer.compositionType = in.layer.requestedType;
+                layer.flags = in.layer.flags;
+                layer.handle = buffer(in.layer);
+                layer.transform = in.layer.transform;
+                layer.blending = in.layer.blending;
+                copyRect(layer.sourceCrop, in.layer.sourceCrop);
+                copyRect(layer.displayFrame, in.layer.displayFrame);
+                layer.planeAlpha = (uint8_t)in.layer.planeAlpha;
+                layer.acquireFenceFd = -1;
+                layer.releaseFenceFd = -1;
+
+                rects.push_back(std::vector<hwc_rect_t>(in.rects.size()));
+                std::vector<hwc_rect_t>& visible = rects.back();
+                for(size_t k = 0; k < in.rects.size(); ++k)
+                    copyRect(visible[k], in.rects[k]);
+
+                layer.visibleRegionScreen.numRects = visible.size();
+                layer.visibleRegionScreen.rects = visible.empty() ? NULL : &visible[0];
+            }
+
+            displays[i] = list;
+        }
+
+        if(mHwc->prepare(mHwc, displays.size(), displays.empty() ? NULL : &displays[0]) != 0)
+            fprintf(stderr, "replay: frame %u prepare failed\n", call.call.frame);
+
+        for(size_t i = 0; i < displays.size(); ++i){
+            if(displays[i] == NULL)
+                continue;
+
+            for(size_t j = 0; j < displays[i]->numHwLayers; ++j){
+                const HWCCaptureLayer& in = call.displays[i].layers[j].layer;
+                int32_t type = displays[i]->hwLayers[j].compositionType;
+
+                mLayers++;
+                if(type != in.compositionType){
+                    mMismatches++;
+                    printf("frame %u display %zu layer %zu %016llx: captured %s, replayed %s\n",
+                           call.call.frame, i, j, (unsigned long long)in.handle,
+                           typeName(in.compositionType), typeName(type));
+                }
+            }
+
+            free(displays[i]);
+        }
+
+        mPrepares++;
+    }
+
+    void report(){
+        printf("replayed %u prepares, %u layers, %u decisions differ\n",
+               mPrepares, mLayers, mMismatches);
+    }
+
+private:
+    template<typename A, typename B>
+    static void copyRect(A& out, const B& in){
+        out.left = in.left;
+        out.top = in.top;
+        out.right = in.right;
+        out.bottom = in.bottom;
+    }
+
+    buffer_handle_t buffer(const HWCCaptureLayer& layer){
+        if(layer.handle == 0 || layer.width <= 0 || layer.height <= 0)
+            return NULL;
+
+        std::map<uint64_t, buffer_handle_t>::iterator it = mBuffers.find(layer.handle);
+        if(it != mBuffers.end())
+            return it->second;
+
+        buffer_handle_t handle = NULL;
+        int stride = 0;
+        if(mAlloc->alloc(mAlloc, layer.width, layer.height, layer.format,
+                         GRALLOC_USAGE_HW_COMPOSER | GRALLOC_USAGE_HW_TEXTURE | GRALLOC_USAGE_SW_WRITE_OFTEN,
+                         &handle, &stride) != 0){
+            fprintf(stderr, "replay: failed to allocate %dx%d format %d\n",
+                    layer.width, layer.height, layer.format);
+            handle = NULL;
+        }
+
+        // A failed allocation stays NULL, the layer is replayed without buffer.
+        mBuffers[layer.handle] = handle;
+        return handle;
+    }
+
+    void fill(const CaptureLayer& layer){
+        buffer_handle_t handle = buffer(layer.layer);
+        void* vaddr = NULL;
+
+        if(handle == NULL || layer.content.empty())
+            return;
+
+        const private_handle_t* hnd = (const private_handle_t*)handle;
+        size_t size = layer.content.size() < (size_t)hnd->size ? layer.content.size() : (size_t)hnd->size;
+
+        if(mGralloc->lock(mGralloc, handle, GRALLOC_USAGE_SW_WRITE_OFTEN,
+                          0, 0, layer.layer.width, layer.layer.height, &vaddr) != 0)
+            return;
+
+        memcpy(vaddr, &layer.content[0], size);
+        mGralloc->unlock(mGralloc, handle);
+    }
+
+    const gralloc_module_t* mGralloc;
+    alloc_device_t* mAlloc;
+    hwc_composer_device_1_t* mHwc;
+
+    ///< replayed buffer of each captured handle.
+    std::map<uint64_t, buffer_handle_t> mBuffers;
+
+    uint32_t mPrepares;
+    uint32_t mLayers;
+    uint32_t mMismatches;
+};
+
+#else
+
+///< values of hwcomposer_defs.h and graphics.h, which the host build lacks.
+enum{
+    CAPTURE_OVERLAY = 1,
+    CAPTURE_FRAMEBUFFER_TARGET = 3,
+
+    ///< layers the GC composer blits, see libHWComposerGC/gc_hwc.h.
+    CAPTURE_BLITTER = 100,
+    CAPTURE_DIM,
+    CAPTURE_CLEAR_HOLE,
+};
+
+enum{
+    CAPTURE_BLENDING_NONE = 0x0100,
+    CAPTURE_BLENDING_PREMULT = 0x0105,
+    CAPTURE_BLENDING_COVERAGE = 0x0405,
+};
+
+enum{
+    CAPTURE_FLIP_H = 0x01,
+    CAPTURE_FLIP_V = 0x02,
+    CAPTURE_ROT_90 = 0x04,
+};
+
+enum{
+    CAPTURE_RGBA_8888 = 1,
+    CAPTURE_RGBX_8888 = 2,
+    CAPTURE_RGB_565 = 4,
+    CAPTURE_BGRA_8888 = 5,
+};
+
+static inline int64_t captureNow()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return int64_t(ts.tv_sec) * 1000000000LL + ts.tv_nsec;
+}
+
+static uint32_t captureCrc(const uint8_t* data, size_t size)
+{
+    static uint32_t table[256];
+
+    if(table[1] == 0){
+        for(uint32_t i = 0; i < 256; ++i){
+            uint32_t c = i;
+            for(int k = 0; k < 8; ++k)
+                c = (c & 1) ? 0xEDB88320U ^ (c >> 1) : c >> 1;
+            table[i] = c;
+        }
+    }
+
+    uint32_t crc = ~0U;
+    for(size_t i = 0; i < size; ++i)
+        crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+static inline uint32_t div255(uint32_t value)
+{
+    return (value + 127) / 255;
+}
+
+/*
+ * Compose the captured sets on the host. Areas are split, corrected and
+ * merged by the area code of the GC composer, and the owners of each area
+ * are blended bottom to top into an RGBA_8888 frame by the CPU, so the CRC
+ * of a frame changes with the composition, not with the 2D core.
+ */
+class CaptureCompose
+{
+public:
+    CaptureCompose() : mWidth(0), mFrames(0), mComposeNs(0), mCapturedNs(0), mMissing(0), mFailed(0){
+        memset(&mArena, 0, sizeof(mArena));
+        memset(&mScreen, 0, sizeof(mScreen));
+    }
+
+    ~CaptureCompose(){
+        hwcResetArena(&mArena);
+        hwcTrimArena(&mArena, 0);
+    }
+
+    void replay(const CaptureCall& call){
+        // A set without the contents of a buffer reuses the last ones read.
+        for(size_t i = 0; i < call.displays.size(); ++i){
+            for(size_t j = 0; j < call.displays[i].layers.size(); ++j){
+                const CaptureLayer& layer = call.displays[i].layers[j];
+                if(!layer.content.empty())
+                    mContents[layer.layer.handle] = layer.content;
+            }
+        }
+
+        if(call.call.call != HWC_CAPTURE_SET)
+            return;
+
+        for(size_t i = 0; i < call.displays.size(); ++i){
+            if(!call.displays[i].display.present)
+                continue;
+
+            std::vector<uint32_t>& frame = mTargets[i];
+            uint32_t missing = 0;
+            int64_t start = captureNow();
+            int layers = compose(call.displays[i], frame, missing);
+            int64_t ns = captureNow() - start;
+
+            if(layers < 0){
+                mFailed++;
+                printf("frame %u display %zu: not composed\n", call.call.frame, i);
+                continue;
+            }
+
+            uint32_t crc = captureCrc((const uint8_t*)(frame.empty() ? NULL : &frame[0]),
+                                      frame.size() * sizeof(uint32_t));
+            printf("frame %u display %zu: %d layers, %u without contents, %lld us "
+                   "(captured %lld us) crc %08x\n",
+                   call.call.frame, i, layers, missing, (long long)(ns / 1000),
+                   (long long)((call.call.end - call.call.start) / 1000), crc);
+
+            mFrames++;
+            mComposeNs += ns;
+            mCapturedNs += call.call.end - call.call.start;
+            mMissing += missing;
+        }
+    }
+
+    void report(){
+        printf("composed %u frames avg %llu us, captured sets avg %llu us, "
+               "%u layers without contents, %u frames failed\n", mFrames,
+               (unsigned long long)(mFrames ? mComposeNs / mFrames / 1000 : 0),
+               (unsigned long long)(mFrames ? mCapturedNs / mFrames / 1000 : 0),
+               mMissing, mFailed);
+    }
+
+private:
+    static bool composed(int32_t type){
+        return type == CAPTURE_OVERLAY || type == CAPTURE_FRAMEBUFFER_TARGET
+            || (type >= CAPTURE_BLITTER && type <= CAPTURE_CLEAR_HOLE);
+    }
+
+    static bool clip(gcsRECT& rect, const gcsRECT& bounds){
+        if(rect.left < bounds.left) rect.left = bounds.left;
+        if(rect.top < bounds.top) rect.top = bounds.top;
+        if(rect.right > bounds.right) rect.right = bounds.right;
+        if(rect.bottom > bounds.bottom) rect.bottom = bounds.bottom;
+        return rect.left < rect.right && rect.top < rect.bottom;
+    }
+
+    static gcsRECT toRect(const HWCCaptureRect& in){
+        gcsRECT rect = { in.left, in.top, in.right, in.bottom };
+        return rect;
+    }
+
+    /*
+     * Compose one display into frame, sized by its framebuffer target.
+     * Returns the layers composed, -1 if the areas can not be built.
+     */
+    int compose(const CaptureDisplay& display, std::vector<uint32_t>& frame, uint32_t& missing){
+        const std::vector<CaptureLayer>& layers = display.layers;
+        gcsRECT screen = { 0, 0, 0, 0 };
+        int count = 0;
+
+        for(size_t j = 0; j < layers.size(); ++j){
+            if(layers[j].layer.compositionType == CAPTURE_FRAMEBUFFER_TARGET)
+                screen = toRect(layers[j].layer.displayFrame);
+        }
+
+        if(screen.right <= screen.left || screen.bottom <= screen.top || layers.size() > HWC_MAX_LAYERS)
+            return -1;
+
+        mWidth = screen.right - screen.left;
+        mScreen = screen;
+        frame.assign((size_t)mWidth * (screen.bottom - screen.top), 0U);
+
+        // Worm holes stay in the no owner area, cleared like the GC composer.
+        hwcResetArena(&mArena);
+        hwcArea* head = hwcAllocateArea(&mArena, NULL, &screen, NULL);
+        if(head == NULL)
+            return -1;
+
+        for(size_t j = 0; j < layers.size(); ++j){
+            const CaptureLayer& layer = layers[j];
+            if(!composed(layer.layer.compositionType))
+                continue;
+
+            count++;
+            if(layer.layer.compositionType == CAPTURE_FRAMEBUFFER_TARGET
+               || layer.layer.compositionType == CAPTURE_BLITTER){
+                std::map<uint64_t, std::vector<uint8_t> >::const_iterator it = mContents.find(layer.layer.handle);
+                if(it == mContents.end() || bytesPerPixel(layer.layer.format) == 0)
+                    missing++;
+            }
+
+            // Framebuffer target lists carry no visible region of their own.
+            std::vector<gcsRECT> rects;
+            for(size_t k = 0; k < layer.rects.size(); ++k)
+                rects.push_back(toRect(layer.rects[k]));
+            if(rects.empty())
+                rects.push_back(toRect(layer.layer.displayFrame));
+
+            for(size_t k = 0; k < rects.size(); ++k){
+                if(clip(rects[k], screen)
+                   && hwcSplitArea(&mArena, head, &rects[k], j) != gcvSTATUS_OK)
+                    return -1;
+            }
+        }
+
+        // Clear hole and overlay areas are only cleared without other layers,
+        // see the corrections of hwcSet.
+        for(hwcArea* area = head; area != NULL; area = area->next){
+            for(gctUINT32 i = hwcOwnersNext(&area->owners, 0); i < HWC_MAX_LAYERS;
+                i = hwcOwnersNext(&area->owners, i + 1)){
+                int32_t type = layers[i].layer.compositionType;
+
+                if((type == CAPTURE_CLEAR_HOLE && hwcOwnersBelow(&area->owners, i))
+                   || (type == CAPTURE_OVERLAY
+                       && (hwcOwnersBelow(&area->owners, i)
+                           || hwcOwnersNext(&area->owners, i + 1) != HWC_MAX_LAYERS)))
+                    hwcOwnersRemove(&area->owners, i);
+            }
+        }
+
+        hwcMergeArea(head);
+
+        for(hwcArea* area = head; area != NULL; area = area->next){
+            for(gctUINT32 i = hwcOwnersNext(&area->owners, 0); i < HWC_MAX_LAYERS;
+                i = hwcOwnersNext(&area->owners, i + 1))
+                blit(layers[i], area->rect, frame);
+        }
+
+        return count;
+    }
+
+    static int bytesPerPixel(int32_t format){
+        switch(format){
+        case CAPTURE_RGBA_8888:
+        case CAPTURE_RGBX_8888:
+        case CAPTURE_BGRA_8888:
+            return 4;
+        case CAPTURE_RGB_565:
+            return 2;
+        default:
+            return 0;
+        }
+    }
+
+    static void readPixel(const uint8_t* p, int32_t format, uint32_t c[4]){
+        switch(format){
+        case CAPTURE_BGRA_8888:
+            c[0] = p[2]; c[1] = p[1]; c[2] = p[0]; c[3] = p[3];
+            break;
+        case CAPTURE_RGB_565:{
+            uint32_t v = p[0] | (p[1] << 8);
+            c[0] = ((v >> 11) & 0x1F) * 255 / 31;
+            c[1] = ((v >> 5) & 0x3F) * 255 / 63;
+            c[2] = (v & 0x1F) * 255 / 31;
+            c[3] = 255;
+            break;
+        }
+        default:
+            c[0] = p[0]; c[1] = p[1]; c[2] = p[2];
+            c[3] = format == CAPTURE_RGBX_8888 ? 255 : p[3];
+            break;
+        }
+    }
+
+    /*
+     * Blend the part Rect of a layer into frame, nearest sampled through its
+     * crop, transform and blending.
+     */
+    void blit(const CaptureLayer& in, const gcsRECT& rect, std::vector<uint32_t>& frame){
+        const HWCCaptureLayer& l = in.layer;
+        uint32_t alpha = l.planeAlpha > 255 ? 255 : l.planeAlpha;
+
+        if(l.compositionType == CAPTURE_OVERLAY || l.compositionType == CAPTURE_CLEAR_HOLE
+           || l.compositionType == CAPTURE_DIM){
+            uint32_t keep = l.compositionType == CAPTURE_DIM ? 255 - alpha : 0;
+            for(int32_t y = rect.top; y < rect.bottom; ++y){
+                uint8_t* d = (uint8_t*)&frame[(size_t)(y - mScreen.top) * mWidth + (rect.left - mScreen.left)];
+                for(int32_t x = rect.left; x < rect.right; ++x, d += 4){
+                    for(int k = 0; k < 4; ++k)
+                        d[k] = div255(d[k] * keep);
+                }
+            }
+            return;
+        }
+
+        std::map<uint64_t, std::vector<uint8_t> >::const_iterator it = mContents.find(l.handle);
+        int bpp = bytesPerPixel(l.format);
+        if(it == mContents.end() || bpp == 0 || l.width <= 0 || l.height <= 0
+           || it->second.size() < (size_t)l.stride * l.height * bpp)
+            return;
+
+        const uint8_t* src = &it->second[0];
+        float frameW = l.displayFrame.right - l.displayFrame.left;
+        float frameH = l.displayFrame.bottom - l.displayFrame.top;
+        float cropW = l.sourceCrop.right - l.sourceCrop.left;
+        float cropH = l.sourceCrop.bottom - l.sourceCrop.top;
+        if(frameW <= 0 || frameH <= 0 || cropW <= 0 || cropH <= 0)
+            return;
+
+        for(int32_t y = rect.top; y < rect.bottom; ++y){
+            uint8_t* d = (uint8_t*)&frame[(size_t)(y - mScreen.top) * mWidth + (rect.left - mScreen.left)];
+            float fy = (y + 0.5f - l.displayFrame.top) / frameH;
+
+            for(int32_t x = rect.left; x < rect.right; ++x, d += 4){
+                float fx = (x + 0.5f - l.displayFrame.left) / frameW;
+
+                // Undo the rotation, applied after the flips.
+                float u = (l.transform & CAPTURE_ROT_90) ? fy : fx;
+                float v = (l.transform & CAPTURE_ROT_90) ? 1.0f - fx : fy;
+                if(l.transform & CAPTURE_FLIP_H)
+                    u = 1.0f - u;
+                if(l.transform & CAPTURE_FLIP_V)
+                    v = 1.0f - v;
+
+                int32_t sx = l.sourceCrop.left + (int32_t)(u * cropW);
+                int32_t sy = l.sourceCrop.top + (int32_t)(v * cropH);
+                sx = sx < 0 ? 0 : (sx >= l.width ? l.width - 1 : sx);
+                sy = sy < 0 ? 0 : (sy >= l.height ? l.height - 1 : sy);
+
+                uint32_t c[4];
+                readPixel(src + ((size_t)sy * l.stride + sx) * bpp, l.format, c);
+
+                if(l.blending == CAPTURE_BLENDING_PREMULT){
+                    uint32_t sa = div255(c[3] * alpha);
+                    for(int k = 0; k < 4; ++k){
+                        uint32_t value = div255(c[k] * alpha) + div255(d[k] * (255 - sa));
+                        d[k] = value > 255 ? 255 : value;
+                    }
+                }else if(l.blending == CAPTURE_BLENDING_COVERAGE || alpha < 255){
+                    uint32_t sa = l.blending == CAPTURE_BLENDING_COVERAGE ? div255(c[3] * alpha) : alpha;
+                    for(int k = 0; k < 3; ++k)
+                        d[k] = div255(c[k] * sa + d[k] * (255 - sa));
+                    d[3] = sa + div255(d[3] * (255 - sa));
+                }else{
+                    d[0] = c[0]; d[1] = c[1]; d[2] = c[2]; d[3] = 255;
+                }
+            }
+        }
+    }
+
+    hwcAreaArena mArena;
+
+    ///< last contents of each captured handle.
+    std::map<uint64_t, std::vector<uint8_t> > mContents;
+
+    ///< composed frame of each display, and the bounds of the one being
+    ///< composed.
+    std::map<size_t, std::vector<uint32_t> > mTargets;
+    gcsRECT mScreen;
+    int32_t mWidth;
+
+    uint32_t mFrames;
+    uint64_t mComposeNs;
+    uint64_t mCapturedNs;
+    uint32_t mMissing;
+    uint32_t mFailed;
+};
+
+#endif
+
+int main(int argc, char** argv)
+{
+    bool summary = false;
+    bool replay = false;
+    int opt;
+
+    while((opt = getopt(argc, argv, "sr")) != -1){
+        switch(opt){
+        case 's':
+            summary = true;
+            break;
+        case 'r':
+            replay = true;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-s] [-r] [file]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    const char* filename = optind < argc ? argv[optind] : HWC_CAPTURE_FILE;
+
+    FILE* file = fopen(filename, "rb");
+    if(file == NULL){
+        fprintf(stderr, "%s: %s\n", filename, strerror(errno));
+        return 1;
+    }
+
+    HWCCaptureHeader header;
+    if(fread(&header, sizeof(header), 1, file) != 1
+       || header.magic != HWC_CAPTURE_MAGIC
+       || header.version != HWC_CAPTURE_VERSION
+       || header.callSize != sizeof(HWCCaptureCall)
+       || header.displaySize != sizeof(HWCCaptureDisplay)
+       || header.layerSize != sizeof(HWCCaptureLayer)){
+        fprintf(stderr, "%s: not a capture log of this version\n", filename);
+        fclose(file);
+        return 1;
+    }
+
+#ifdef __ANDROID__
+    CaptureReplay player;
+    if(replay && player.open() != 0){
+        fclose(file);
+        return 1;
+    }
+#else
+    CaptureCompose player;
+#endif
+
+    CaptureSummary stats;
+    CaptureCall call;
+    uint32_t calls = 0;
+    int result;
+    while((result = readCall(file, call, replay)) > 0){
+        calls++;
+        if(replay){
+            player.replay(call);
+            continue;
+        }
+        if(summary)
+            summarise(stats, call);
+        else
+            printCall(call);
+    }
+
+    if(result < 0)
+        fprintf(stderr, "%s: truncated after %u calls\n", filename, calls);
+
+    if(summary)
+        printSummary(stats);
+
+    if(replay)
+        player.report();
+
+    fclose(file);
+    return result < 0 ? 1 : 0;
+}
@@ -0,0 +1,328 @@
+/*
+ * Copyright (C) 2016 The CyanogenMod Project
+ *               2017 The LineageOS Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <cutils/log.h>
+#include <cutils/atomic.h>
+#include <cutils/properties.h>
+
+#include "HWCTrace.h"
+
+namespace android{
+
+/*
+ * One ring slot. mSeq is odd while the composition thread rewrites the
+ * record, readers retry or skip a slot whose mSeq moved during their copy.
+ */
+struct HWCTraceSlot{
+    volatile int32_t mSeq;
+    HWCTraceRecord   mRecord;
+};
+
+static const char* sStageNames[HWC_TRACE_STAGE_COUNT] = {
+    "overlay prepare",
+    "virtual prepare",
+    "baselay prepare",
+    "baselay set",
+    "gc split",
+    "gc compose",
+    "gc commit",
+    "virtual set",
+    "overlay set",
+    "fb post",
+};
+
+///< upper bounds in ms of the frame time histogram buckets, the last is open.
+static const int sFrameBuckets[] = { 4, 8, 12, 16, 33, 50 };
+#define HWC_TRACE_BUCKETS   (sizeof(sFrameBuckets) / sizeof(sFrameBuckets[0]) + 1)
+
+bool HWCTrace::sEnabled = false;
+
+static HWCTraceSlot   sRing[HWC_TRACE_FRAMES];
+static volatile int32_t sFrames = 0;
+
+///< frame being recorded, owned by the composition thread.
+static HWCTraceRecord sCurrent;
+
+///< blits of any thread, taken into the frame open when endFrame runs.
+static volatile uint32_t sBlits = 0;
+static volatile uint64_t sBlitBytes = 0;
+static volatile uint32_t sFlushes = 0;
+static volatile int64_t sFlushTime = 0;
+
+static inline int64_t traceNow()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return int64_t(ts.tv_sec) * 1000000000LL + ts.tv_nsec;
+}
+
+void HWCTrace::init()
+{
+    char value[PROPERTY_VALUE_MAX];
+    property_get("persist.hwc.trace", value, "0");
+    sEnabled = (atoi(value) == 1);
+    if(sEnabled){
+        ALOGI("Frame tracing enabled, %d frames kept", HWC_TRACE_FRAMES);
+    }
+}
+
+void HWCTrace::beginFrame(size_t numDisplays, hwc_display_contents_1_t** displays)
+{
+    if(!sEnabled)
+        return;
+
+    memset(&sCurrent, 0, sizeof(sCurrent));
+    sCurrent.frame = sFrames;
+    sCurrent.numDisplays = numDisplays;
+    for(size_t i = 0; displays && i < numDisplays; ++i){
+        if(displays[i])
+            sCurrent.numLayers += displays[i]->numHwLayers;
+    }
+}
+
+void HWCTrace::endFrame(size_t numDisplays, hwc_display_contents_1_t** displays)
+{
+    if(!sEnabled)
+        return;
+
+    for(size_t i = 0; displays && i < numDisplays; ++i){
+        if(displays[i] == NULL)
+            continue;
+
+        for(size_t j = 0; j < displays[i]->numHwLayers; ++j){
+            int32_t type = displays[i]->hwLayers[j].compositionType;
+            if(type == HWC_FRAMEBUFFER)
+                sCurrent.numFbLayers++;
+            else if(type == HWC_OVERLAY)
+                sCurrent.numHwcLayers++;
+        }
+    }
+
+    // The worker threads may add more meanwhile, they go to the next frame.
+    sCurrent.numBlits = __sync_fetch_and_and(&sBlits, 0);
+    sCurrent.bytesMoved = __sync_fetch_and_and(&sBlitBytes, 0);
+    sCurrent.numFlushes = __sync_fetch_and_and(&sFlushes, 0);
+    sCurrent.flushTime = __sync_fetch_and_and(&sFlushTime, 0);
+
+    // Publish the frame into its slot.
+    HWCTraceSlot& slot = sRing[sCurrent.frame & (HWC_TRACE_FRAMES - 1)];
+    int32_t seq = slot.mSeq;
+    android_atomic_release_store(seq + 1, &slot.mSeq);
+    android_memory_barrier();
+    memcpy(&slot.mRecord, &sCurrent, sizeof(sCurrent));
+    android_atomic_release_store(seq + 2, &slot.mSeq);
+    android_atomic_release_store(sCurrent.frame + 1, &sFrames);
+}
+
+void HWCTrace::beginStage(HWC_TRACE_STAGE stage)
+{
+    sCurrent.start[stage] = traceNow();
+}
+
+void HWCTrace::endStage(HWC_TRACE_STAGE stage)
+{
+    sCurrent.end[stage] = traceNow();
+}
+
+void HWCTrace::setStage(HWC_TRACE_STAGE stage, int64_t start, int64_t end)
+{
+    if(!sEnabled)
+        return;
+
+    sCurrent.start[stage] = start;
+    sCurrent.end[stage] = end;
+}
+
+void HWCTrace::addBlit(uint64_t bytes)
+{
+    if(!sEnabled)
+        return;
+
+    // Called from the WFD worker too, sCurrent is not ours to touch.
+    __sync_fetch_and_add(&sBlits, 1);
+    __sync_fetch_and_add(&sBlitBytes, bytes);
+}
+
+void HWCTrace::addFlush(int64_t time)
+{
+    if(!sEnabled)
+        return;
+
+    __sync_fetch_and_add(&sFlushes, 1);
+    __sync_fetch_and_add(&sFlushTime, time);
+}
+
+/*
+ * Copy the published frames oldest first, skipping the slot being rewritten.
+ */
+static uint32_t readRing(HWCTraceRecord* records)
+{
+    uint32_t frames = android_atomic_acquire_load(&sFrames);
+    uint32_t first = frames > HWC_TRACE_FRAMES ? frames - HWC_TRACE_FRAMES : 0;
+    uint32_t count = 0;
+
+    for(uint32_t f = first; f < frames; ++f){
+        HWCTraceSlot& slot = sRing[f & (HWC_TRACE_FRAMES - 1)];
+        int32_t seq = android_atomic_acquire_load(&slot.mSeq);
+        if(seq & 1)
+            continue;
+
+        memcpy(&records[count], &slot.mRecord, sizeof(HWCTraceRecord));
+        android_memory_barrier();
+        if(slot.mSeq != seq || records[count].frame != f)
+            continue;
+
+        count++;
+    }
+
+    return count;
+}
+
+void HWCTrace::dump(String8& result)
+{
+    if(!sEnabled)
+        return;
+
+    HWCTraceRecord* records = new HWCTraceRecord[HWC_TRACE_FRAMES];
+    uint32_t count = readRing(records);
+
+    int64_t total[HWC_TRACE_STAGE_COUNT];
+    int64_t worst[HWC_TRACE_STAGE_COUNT];
+    uint32_t runs[HWC_TRACE_STAGE_COUNT];
+    uint32_t histogram[HWC_TRACE_BUCKETS];
+    uint64_t blits = 0, bytes = 0, flushes = 0;
+    int64_t flushTime = 0;
+    memset(total, 0, sizeof(total));
+    memset(worst, 0, sizeof(worst));
+    memset(runs, 0, sizeof(runs));
+    memset(histogram, 0, sizeof(histogram));
+
+    for(uint32_t i = 0; i < count; ++i){
+        int64_t first = 0, last = 0;
+        for(int s = 0; s < HWC_TRACE_STAGE_COUNT; ++s){
+            if(records[i].start[s] == 0 || records[i].end[s] < records[i].start[s])
+                continue;
+
+            int64_t t = records[i].end[s] - records[i].start[s];
+            total[s] += t;
+            worst[s] = t > worst[s] ? t : worst[s];
+            runs[s]++;
+
+            first = (first == 0 || records[i].start[s] < first) ? records[i].start[s] : first;
+            last = records[i].end[s] > last ? records[i].end[s] : last;
+        }
+
+        // Frame time from the first stage of prepare to the end of the post.
+        uint32_t b = 0;
+        while(b < HWC_TRACE_BUCKETS - 1 && last - first >= sFrameBuckets[b] * 1000000LL)
+            b++;
+        histogram[b]++;
+
+        blits += records[i].numBlits;
+        bytes += records[i].bytesMoved;
+        flushes += records[i].numFlushes;
+        flushTime += records[i].flushTime;
+    }
+
+    result.appendFormat("Frame trace: last %u frames, %llu blits, %llu KB moved\n",
+                        count, (unsigned long long)blits, (unsigned long long)(bytes >> 10));
+    if(flushes > 0){
+        result.appendFormat("  gcu flush        %5llu runs, avg %6lld us\n", (unsigned long long)flushes,
+                            (long long)(flushTime / (int64_t)flushes / 1000));
+    }
+    for(int s = 0; s < HWC_TRACE_STAGE_COUNT; ++s){
+        if(runs[s] == 0)
+            continue;
+        result.appendFormat("  %-16s %5u runs, avg %6lld us, max %6lld us\n", sStageNames[s], runs[s],
+                            (long long)(total[s] / runs[s] / 1000), (long long)(worst[s] / 1000));
+    }
+
+    result.append("  frame time (ms):");
+    for(uint32_t b = 0; b < HWC_TRACE_BUCKETS; ++b){
+        if(b < HWC_TRACE_BUCKETS - 1)
+            result.appendFormat(" <%d: %u", sFrameBuckets[b], histogram[b]);
+        else
+            result.appendFormat(" >=%d: %u\n", sFrameBuckets[b - 1], histogram[b]);
+    }
+
+    // Writing a file is not for every dumpsys, only when asked for.
+    char value[PROPERTY_VALUE_MAX];
+    property_get("debug.hwc.trace.export", value, "0");
+    if(atoi(value) == 1){
+        int res = exportRing(HWC_TRACE_FILE);
+        if(res != 0)
+            result.appendFormat("  failed to write %s: %s\n", HWC_TRACE_FILE, strerror(-res));
+        else
+            result.appendFormat("  exported to %s\n", HWC_TRACE_FILE);
+    }
+
+    delete[] records;
+}
+
+/*
+ * Write the ring oldest first, through a temporary file so readers never see
+ * a partial export.
+ */
+int HWCTrace::exportRing(const char* path)
+{
+    if(!sEnabled)
+        return -ENODEV;
+
+    HWCTraceRecord* records = new HWCTraceRecord[HWC_TRACE_FRAMES];
+    HWCTraceHeader header;
+    char tmp[PATH_MAX];
+    int res = 0;
+
+    header.magic = HWC_TRACE_MAGIC;
+    header.version = HWC_TRACE_VERSION;
+    header.recordSize = sizeof(HWCTraceRecord);
+    header.stageCount = HWC_TRACE_STAGE_COUNT;
+    header.count = readRing(records);
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if(fd < 0){
+        res = -errno;
+        delete[] records;
+        return res;
+    }
+
+    ssize_t size = header.count * sizeof(HWCTraceRecord);
+    if(write(fd, &header, sizeof(header)) != sizeof(header)
+    || write(fd, records, size) != size){
+        res = -EIO;
+    }
+
+    close(fd);
+    if(res == 0 && rename(tmp, path) != 0){
+        res = -errno;
+    }
+
+    delete[] records;
+    return res;
+}
+
+}// end of namespace android
@@ -0,0 +1,155 @@
+/*
+ * Copyright (C) 2016 The CyanogenMod Project
+ *               2017 The LineageOS Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __HWC_TRACE_H__
+#define __HWC_TRACE_H__
+
+#include <stdint.h>
+
+#include <utils/String8.h>
+#include <hardware/hwcomposer.h>
+
+namespace android{
+
+/*
+ * Stages of one frame, in the order hwc_prepare and hwc_set run them.
+ */
+enum HWC_TRACE_STAGE{
+    HWC_TRACE_OVERLAY_PREPARE = 0,
+    HWC_TRACE_VIRTUAL_PREPARE,
+    HWC_TRACE_BASELAY_PREPARE,
+    HWC_TRACE_BASELAY_SET,
+
+    ///< inside baselay set, reported by the GC composer.
+    HWC_TRACE_GC_SPLIT,
+    HWC_TRACE_GC_COMPOSE,
+    HWC_TRACE_GC_COMMIT,
+
+    HWC_TRACE_VIRTUAL_SET,
+    HWC_TRACE_OVERLAY_SET,
+
+    ///< flip ioctls of the framebuffer post, reported by gralloc.
+    HWC_TRACE_FB_POST,
+
+    HWC_TRACE_STAGE_COUNT,
+};
+
+///< binary export, written on dump while debug.hwc.trace.export is 1. The
+///< directory comes from hwcomposer.rc, see sepolicy/ for the access.
+#define HWC_TRACE_DIR           "/data/misc/hwc"
+#define HWC_TRACE_FILE          HWC_TRACE_DIR "/trace"
+
+#define HWC_TRACE_MAGIC         0x54435748 /* 'HWCT' */
+#define HWC_TRACE_VERSION       2
+
+///< frames kept, the oldest get overwritten. Must be a power of 2.
+#define HWC_TRACE_FRAMES        256
+
+struct HWCTraceHeader{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t recordSize;
+    uint32_t stageCount;
+
+    ///< records following the header, oldest first.
+    uint32_t count;
+};
+
+struct HWCTraceRecord{
+    uint32_t frame;
+    uint32_t numDisplays;
+    uint32_t numLayers;
+
+    ///< layers left to GLES, and layers composed by the GC path or the overlay.
+    uint32_t numFbLayers;
+    uint32_t numHwcLayers;
+
+    ///< GcuEngine blits of all threads and the destination bytes they wrote.
+    uint32_t numBlits;
+    uint64_t bytesMoved;
+
+    ///< GcuEngine flushes of all threads and the ns they waited.
+    uint32_t numFlushes;
+    int64_t flushTime;
+
+    ///< CLOCK_MONOTONIC in ns, 0 when the stage did not run.
+    int64_t start[HWC_TRACE_STAGE_COUNT];
+    int64_t end[HWC_TRACE_STAGE_COUNT];
+};
+
+/*
+ * Per frame timeline of the composer.
+ *
+ * Frames are recorded by the composition thread only and published into a
+ * ring that dump reads without taking any lock. addBlit() and addFlush() may
+ * be called from any thread. Everything but isEnabled()
+ * is a no-op unless persist.hwc.trace is set when the device is opened.
+ */
+class HWCTrace
+{
+public:
+    static void init();
+
+    static inline bool isEnabled(){
+        return sEnabled;
+    }
+
+    static void beginFrame(size_t numDisplays, hwc_display_contents_1_t** displays);
+
+    static void endFrame(size_t numDisplays, hwc_display_contents_1_t** displays);
+
+    static void beginStage(HWC_TRACE_STAGE stage);
+
+    static void endStage(HWC_TRACE_STAGE stage);
+
+    static void setStage(HWC_TRACE_STAGE stage, int64_t start, int64_t end);
+
+    static void addBlit(uint64_t bytes);
+
+    static void addFlush(int64_t time);
+
+    static void dump(String8& result);
+
+    static int exportRing(const char* path);
+
+private:
+    static bool sEnabled;
+};
+
+/*
+ * Times the enclosing scope as one stage.
+ */
+class HWCTraceScope
+{
+public:
+    HWCTraceScope(HWC_TRACE_STAGE stage) : mStage(stage){
+        if(HWCTrace::isEnabled())
+            HWCTrace::beginStage(mStage);
+    }
+
+    ~HWCTraceScope(){
+        if(HWCTrace::isEnabled())
+            HWCTrace::endStage(mStage);
+    }
+
+private:
+    HWC_TRACE_STAGE mStage;
+};
+
+}// end of namespace android
+
+#endif
@@ -31,6 +31,7 @@ HWOverlayComposer::HWOverlayComposer() : m_nOverlayChannel(HWC_DISPLAY_PRIMARY+1
                                        , m_bRunning(false)
                                        , m_bDeferredClose(true)
                                        , m_pDefaultDisplayInfo(NULL)
+                                       , m_pFbModule(NULL)
                                        , m_pPrimaryFbLayer(NULL)
                                        , m_pGcuEngine(NULL)
                                        , m_bDebugClear(false)
@@ -47,6 +48,12 @@ HWOverlayComposer::HWOverlayComposer() : m_nOverlayChannel(HWC_DISPLAY_PRIMARY+1
     m_pGcuEngine = new GcuEngine;
 }
 
+void HWOverlayComposer::setSourceDisplayInfo(const private_module_t* module)
+{
+    m_pFbModule = module;
+    m_pDefaultDisplayInfo = &module->info;
+}
+
 HWOverlayComposer::~HWOverlayComposer()
 {
     for(uint32_t i = 0; i < m_nOverlayChannel; ++i){
@@ -355,8 +362,7 @@ void HWOverlayComposer::colorFillFrameBuffer(uint32_t nColor)
 
     BlitDataDescription blitDesc;
     uint32_t width = m_pDefaultDisplayInfo->xres_virtual;
-    uint32_t nBufferCnt = m_pDefaultDisplayInfo->yres_virtual / m_pDefaultDisplayInfo->yres + 1;
-    uint32_t height = m_pDefaultDisplayInfo->yres_virtual / nBufferCnt;
+    uint32_t height = m_pDefaultDisplayInfo->yres;
     buffer_handle_t srcBufferHandle = m_pPrimaryFbLayer->handle;
     if(NULL == srcBufferHandle){
         return;
@@ -386,6 +392,15 @@ void HWOverlayComposer::colorFillFrameBuffer(uint32_t nColor)
     if(!m_pGcuEngine->Blit(&blitDesc)){
         ALOGE("ERROR: GCU 2D Fill Blit Error!");
     }
+
+    ///< the whole buffer is rewritten uncompressed.
+    int compressed = 0;
+    m_pFbModule->base.perform(&m_pFbModule->base, GRALLOC_MODULE_PERFORM_GET_FB_COMPRESSED,
+                              dstBufferHandle, &compressed);
+    if(compressed){
+        m_pFbModule->base.perform(&m_pFbModule->base, GRALLOC_MODULE_PERFORM_SET_FB_COMPRESSED,
+                                  dstBufferHandle, 0);
+    }
 }
 
 void HWOverlayComposer::finishCompose()
@@ -424,8 +439,7 @@ void HWOverlayComposer::transparentizeFrameBuffer(uint32_t nAlpha)
 
     BlitDataDescription blitDesc;
     uint32_t width = m_pDefaultDisplayInfo->xres_virtual;
-    uint32_t nBufferCnt = m_pDefaultDisplayInfo->yres_virtual / m_pDefaultDisplayInfo->yres + 1;
-    uint32_t height = m_pDefaultDisplayInfo->yres_virtual / nBufferCnt;
+    uint32_t height = m_pDefaultDisplayInfo->yres;
 
     buffer_handle_t srcBufferHandle = m_pPrimaryFbLayer->handle;
     if(NULL == srcBufferHandle){
@@ -437,6 +451,15 @@ void HWOverlayComposer::transparentizeFrameBuffer(uint32_t nAlpha)
     private_handle_t* pDstPrivHandle = private_handle_t::dynamicCast(dstBufferHandle);
     uint32_t nRop = (nAlpha == 0) ? 0x88 : 0xEE;
 
+    ///< GCU can not blend into a compressed frame.
+    int compressed = 0;
+    m_pFbModule->base.perform(&m_pFbModule->base, GRALLOC_MODULE_PERFORM_GET_FB_COMPRESSED,
+                              dstBufferHandle, &compressed);
+    if(compressed){
+        ALOGW("Can not transparentize a compressed framebuffer!");
+        return;
+    }
+
     savedAlpha = nAlpha;
     ConstructBlitDataDescription(blitDesc, GPU_BLIT_ROP, true, DISPLAY_SURFACE_ROTATION_0,
                                  width, height,
@@ -533,7 +556,7 @@ void HWOverlayComposer::dump(String8& result, char* buffer, int size, bool dumpM
         for(uint32_t i = 0; i < vDrawingOverlay.size(); ++i){
             sprintf(buffer, "        [%d] Overlay Layer: [%p]\n", i, vDrawingOverlay[i]);
             result.append(buffer);
-            sprintf(buffer, "        [%d] Overlay Handle: [%p]\n", i, vCurrentOverlay[i]->handle);
+            sprintf(buffer, "        [%d] Overlay Handle: [%p]\n", i, vDrawingOverlay[i]->handle);
             result.append(buffer);
             hwc_rect_t& displayFrame = vDrawingOverlay[i]->displayFrame;
             sprintf(buffer, "        [%d] Overlay Rect : [%d %d %d %d]\n",
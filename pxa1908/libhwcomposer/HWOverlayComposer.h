@@ -29,6 +29,7 @@
 #include "OverlayDevice.h"
 #include "GcuEngine.h"
 
+struct private_module_t;
 
 namespace android{
 
@@ -74,9 +75,7 @@ public:
 
     /*set FB info.
      */
-    void setSourceDisplayInfo(const fb_var_screeninfo* info){
-        m_pDefaultDisplayInfo = info;
-    }
+    void setSourceDisplayInfo(const private_module_t* module);
 
     bool hasOverlayComposition(){
         return m_bRunning;
@@ -208,6 +207,9 @@ private:
     ///< fb info, for resolution etc.
     const fb_var_screeninfo* m_pDefaultDisplayInfo;
 
+    ///< gralloc module, marks framebuffer targets compressed through perform.
+    const private_module_t* m_pFbModule;
+
     ///< current compositor target layer.
     hwc_layer_1_t* m_pPrimaryFbLayer;
 
@@ -26,9 +26,21 @@
 #include <hardware/hardware.h>
 #include <hardware/hwcomposer.h>
 
+#include <utils/Timers.h>
+
+#include <unistd.h>
+#include <sync/sync.h>
+// system/core/libsync
+#include <sw_sync.h>
+
 #include "gralloc_priv.h"
+#include "mrvl_pxl_formats.h"
 #include "HWVirtualComposer.h"
 
+#if defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
 #ifdef LOG_TAG
 #undef LOG_TAG
 #endif
@@ -39,19 +51,147 @@
 
 using namespace android;
 
+static inline bool isEmptyRect(const hwc_rect_t& r)
+{
+    return (r.left >= r.right) || (r.top >= r.bottom);
+}
+
+static void unionRect(hwc_rect_t& dst, const hwc_rect_t& r)
+{
+    if(isEmptyRect(r)){
+        return;
+    }
+
+    if(isEmptyRect(dst)){
+        dst = r;
+        return;
+    }
+
+    dst.left   = r.left   < dst.left   ? r.left   : dst.left;
+    dst.top    = r.top    < dst.top    ? r.top    : dst.top;
+    dst.right  = r.right  > dst.right  ? r.right  : dst.right;
+    dst.bottom = r.bottom > dst.bottom ? r.bottom : dst.bottom;
+}
+
+static void intersectRect(hwc_rect_t& dst, const hwc_rect_t& r)
+{
+    dst.left   = r.left   > dst.left   ? r.left   : dst.left;
+    dst.top    = r.top    > dst.top    ? r.top    : dst.top;
+    dst.right  = r.right  < dst.right  ? r.right  : dst.right;
+    dst.bottom = r.bottom < dst.bottom ? r.bottom : dst.bottom;
+}
+
 HWVirtualComposer::HWVirtualComposer() : m_bRunning(false)
                                        , m_bClearBuffer(false)
+                                       , m_bPassThroughEnabled(true)
+                                       , m_bYUVOutput(true)
                                        , m_pPrimaryFbLayer(NULL)
                                        , m_pGcuEngine(NULL)
                                        , m_pDefaultDisplayInfo(NULL)
+                                       , m_pGrallocModule(NULL)
                                        , m_previousDisplayMode(DISPLAY_CONTENT_UNKNOWN)
+                                       , m_nFrames(0)
+                                       , m_nFailedFrames(0)
+                                       , m_nPassThroughFrames(0)
+                                       , m_nYUVFrames(0)
+                                       , m_nCpuConvertedFrames(0)
+                                       , m_bDamageEnabled(true)
+                                       , m_nFrameNumber(0)
+                                       , m_nMaxInterval(0)
+                                       , m_nMinInterval(0)
+                                       , m_nFrameInterval(0)
+                                       , m_nLastMirrorTime(0)
+                                       , m_nPrepareTime(0)
+                                       , m_nUnchangedDrops(0)
+                                       , m_nRateDrops(0)
+                                       , m_nBehindFrames(0)
+                                       , m_nDequeueWaitSum(0)
+                                       , m_nDequeueWaitMax(0)
+                                       , m_nLatencySum(0)
+                                       , m_nLatencyMax(0)
+                                       , m_nLastDequeueWait(0)
+                                       , m_bLastBehind(false)
+                                       , m_nBlittedPixels(0)
+                                       , m_nFullPixels(0)
+                                       , m_pWorker(NULL)
+                                       , m_bJobQueued(false)
+                                       , m_bExit(false)
+                                       , m_nSyncTimelineFd(-1)
+                                       , m_nFenceStamp(0)
+                                       , m_nBusyDrops(0)
+                                       , m_nAcquireTimeouts(0)
 {
+    char value[PROPERTY_VALUE_MAX];
+    property_get("hwc.virtual.passthrough", value, "1");
+    m_bPassThroughEnabled = (atoi(value) == 1);
+    property_get("hwc.virtual.yuv", value, "1");
+    m_bYUVOutput = (atoi(value) == 1);
+    property_get("hwc.virtual.damage", value, "1");
+    m_bDamageEnabled = (atoi(value) == 1);
+
+    ///< the governor moves between these rates, starting from the fastest.
+    property_get("hwc.virtual.fps", value, "60");
+    int fps = atoi(value) > 0 ? atoi(value) : 60;
+    m_nMinInterval = s2ns(1) / fps;
+    property_get("hwc.virtual.fps.min", value, "15");
+    fps = atoi(value) > 0 ? atoi(value) : 15;
+    m_nMaxInterval = s2ns(1) / fps;
+    if(m_nMaxInterval < m_nMinInterval){
+        m_nMaxInterval = m_nMinInterval;
+    }
+    m_nFrameInterval = m_nMinInterval;
+    memset(&m_pendingDamage, 0, sizeof(m_pendingDamage));
+
+    m_job.acquireFenceFd = -1;
+    m_job.bCompressed = false;
+    m_job.fenceSteps = 0;
+
     m_pGcuEngine = new GcuEngine;
     m_pGcuEngine->LoadHintPic(0, "/etc/hint.bmp");
+
+    ///< without a timeline the source can not be held, mirror in set().
+    property_get("hwc.virtual.async", value, "1");
+    if(atoi(value) == 1){
+        m_nSyncTimelineFd = sw_sync_timeline_create();
+        if(m_nSyncTimelineFd < 0){
+            ALOGE("ERROR: can't create sw_sync_timeline, mirroring synchronously!");
+        }else{
+            m_pWorker = new HWVirtualComposerThread(this);
+            if(NO_ERROR != m_pWorker->run("HWVirtualComposer", PRIORITY_DISPLAY)){
+                ALOGE("ERROR: can't start the virtual composer thread, mirroring synchronously!");
+                m_pWorker.clear();
+            }
+        }
+    }
 }
 
 HWVirtualComposer::~HWVirtualComposer()
 {
+    if(NULL != m_pWorker.get()){
+        {
+            Mutex::Autolock lock(m_lock);
+            m_bExit = true;
+            m_jobCondition.signal();
+        }
+        m_pWorker->requestExitAndWait();
+        m_pWorker.clear();
+    }
+
+    ///< a frame the worker never took, hand its source back.
+    if(m_bJobQueued){
+        if(m_job.acquireFenceFd >= 0){
+            close(m_job.acquireFenceFd);
+        }
+        sw_sync_timeline_inc(m_nSyncTimelineFd, m_job.fenceSteps);
+        releaseTargets(m_job);
+        m_bJobQueued = false;
+    }
+
+    if(m_nSyncTimelineFd >= 0){
+        close(m_nSyncTimelineFd);
+        m_nSyncTimelineFd = -1;
+    }
+
     if(NULL != m_pGcuEngine){
         delete m_pGcuEngine;
         m_pGcuEngine = NULL;
@@ -128,6 +268,8 @@ bool HWVirtualComposer::readyToRun(size_t numDisplays, hwc_display_contents_1_t*
 uint32_t HWVirtualComposer::prepare(size_t numDisplays, hwc_display_contents_1_t** displays)
 {
     ATRACE_CALL();
+    Mutex::Autolock lock(m_lock);
+    m_nPrepareTime = systemTime(SYSTEM_TIME_MONOTONIC);
 
     ///< check all conditions before we do virtual composition.
     if(readyToRun(numDisplays, displays)){
@@ -158,6 +300,11 @@ uint32_t HWVirtualComposer::prepare(size_t numDisplays, hwc_display_contents_1_t
             }
         }
 
+        ///< frames shown while stopped were not tracked, damage all.
+        if(!m_bRunning){
+            m_vPrimaryLayers.clear();
+        }
+
         m_bRunning = true;
         return HWC_DISPLAY_EXTERNAL + 1; //leave virtual display device along.
     }else{
@@ -174,22 +321,93 @@ uint32_t HWVirtualComposer::prepare(size_t numDisplays, hwc_display_contents_1_t
     }
 }
 
-void HWVirtualComposer::set(size_t numDisplays, hwc_display_contents_1_t** displays)
+void HWVirtualComposer::set(size_t numDisplays, hwc_display_contents_1_t** displays, int acquireFenceFd)
 {
     ATRACE_CALL();
+    VirtualJob job;
+    VirtualJob replaced;
+    bool bReady = false;
+    bool bQueued = false;
+    bool bReplaced = false;
+    job.acquireFenceFd = acquireFenceFd;
+    job.bCompressed = false;
+    job.fenceSteps = 1;
+
+    m_lock.lock();
+    bReady = buildJob(numDisplays, displays, job);
+    if(bReady && (NULL != m_pWorker.get()) && attachReleaseFence(m_pPrimaryFbLayer)){
+        ///< the worker is still busy, mirror the newest frame next. The
+        ///< damage of the older one stays in the history.
+        if(m_bJobQueued){
+            replaced = m_job;
+            job.fenceSteps += m_job.fenceSteps;
+            bReplaced = true;
+            m_nBusyDrops++;
+        }
+        m_job = job;
+        m_bJobQueued = true;
+        m_jobCondition.signal();
+        bQueued = true;
+    }
+    m_lock.unlock();
+
+    if(bReplaced){
+        if(replaced.acquireFenceFd >= 0){
+            close(replaced.acquireFenceFd);
+        }
+        releaseTargets(replaced);
+    }
+
+    if(bQueued){
+        return;
+    }
+
+    if(bReady){
+        runJob(job);
+        releaseTargets(job);
+    }else if(job.acquireFenceFd >= 0){
+        close(job.acquireFenceFd);
+    }
+}
+
+/*
+ * Drop the windows buildJob() held for the targets of a job.
+ */
+void HWVirtualComposer::releaseTargets(VirtualJob& job)
+{
+    for(size_t i = 0; i < job.targets.size(); ++i){
+        ANativeWindow* pNativeWindow = job.targets[i].window;
+        pNativeWindow->common.decRef(&pNativeWindow->common);
+    }
+    job.targets.clear();
+}
+
+/*
+ * Take the frame to mirror from the lists of set(), with m_lock held. False
+ * when there is nothing to mirror this frame.
+ */
+bool HWVirtualComposer::buildJob(size_t numDisplays, hwc_display_contents_1_t** displays, VirtualJob& job)
+{
     if( !m_bRunning
         || (numDisplays <= HWC_DISPLAY_EXTERNAL)
         || NULL == displays){
-        return;
+        return false;
     }
 
     hwc_display_contents_1_t* pPrimaryDisplayContents = displays[0];
     if(NULL == pPrimaryDisplayContents || 0 == pPrimaryDisplayContents->numHwLayers){
         ALOGV("WARNING: NULL hwc_display_contents_1_t* in primary display device!");
-        return;
+        return false;
     }
     m_pPrimaryFbLayer = &(pPrimaryDisplayContents->hwLayers[pPrimaryDisplayContents->numHwLayers - 1]);
 
+    updateDamage(pPrimaryDisplayContents);
+
+    nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+    if(!governFrame(now)){
+        return false;
+    }
+
     // Loop for all virtual displays.
     for (uint32_t i = HWC_NUM_DISPLAY_TYPES; i < numDisplays; ++i) {
         hwc_display_contents_1_t* list = displays[i];
@@ -198,8 +416,9 @@ void HWVirtualComposer::set(size_t numDisplays, hwc_display_contents_1_t** displ
         bool bNeedCompose = (NULL != list) && (list->numHwLayers > 0);
         if(bNeedCompose){
             hwc_layer_1_t* destFbLayer = &(list->hwLayers[list->numHwLayers - 1]);
-            sp<HwcDisplayData>& displayData = m_displays.editValueFor(i);
+            const sp<HwcDisplayData>& displayData = m_displays.valueFor(i);
             if((NULL == destFbLayer) ||
+               (NULL == displayData.get()) ||
                (HWC_2D_TARGET != destFbLayer->compositionType) ||
                (displayData->m_pLayer != destFbLayer) ||
                (displayData->m_nDisplayMode != DISPLAY_CONTENT_MIRROR)){
@@ -207,35 +426,467 @@ void HWVirtualComposer::set(size_t numDisplays, hwc_display_contents_1_t** displ
                 continue;
             }
 
-            if(!blit(m_pPrimaryFbLayer, displayData)){
-                ALOGE("ERROR! blit from primary FB to virtual FB failed!");
+            ///< the window is only ours until the display goes, hold it
+            ///< for the worker.
+            ANativeWindow* pNativeWindow = (ANativeWindow*)destFbLayer->reserved[0];
+            if(NULL == pNativeWindow){
+                ALOGE("ERROR: Not a valid virtual framebuffer target!");
+                continue;
             }
+            pNativeWindow->common.incRef(&pNativeWindow->common);
+
+            VirtualTarget target;
+            target.data = displayData;
+            target.layer = *destFbLayer;
+            target.window = pNativeWindow;
+            job.targets.add(target);
         }
     }
+
+    if(job.targets.isEmpty()){
+        return false;
+    }
+
+    commitDamage();
+    m_nLastMirrorTime = now;
+
+    job.src = *m_pPrimaryFbLayer;
+    int compressed = 0;
+    if(NULL != m_pGrallocModule){
+        m_pGrallocModule->perform(m_pGrallocModule, GRALLOC_MODULE_PERFORM_GET_FB_COMPRESSED,
+                                  job.src.handle, &compressed);
+    }
+    job.bCompressed = (0 != compressed);
+    job.frame = m_nFrameNumber;
+    job.prepareTime = m_nPrepareTime;
+    return true;
 }
 
-void HWVirtualComposer::setSourceDisplayInfo(const fb_var_screeninfo* info){
-    m_pDefaultDisplayInfo = info;
+/*
+ * Hold the primary framebuffer target until the worker read it: its release
+ * fence also waits for the next step of the worker timeline.
+ */
+bool HWVirtualComposer::attachReleaseFence(hwc_layer_1_t* fbLayer)
+{
+    int fenceFd = sw_sync_fence_create(m_nSyncTimelineFd, "hwc_virtual", m_nFenceStamp + 1);
+    if(fenceFd < 0){
+        ALOGE("ERROR: can't create the virtual composer fence, mirroring synchronously!");
+        return false;
+    }
+    m_nFenceStamp++;
+
+    if(fbLayer->releaseFenceFd >= 0){
+        int mergedFd = sync_merge("hwc_virtual", fbLayer->releaseFenceFd, fenceFd);
+        if(mergedFd < 0){
+            ///< keep the flip ordered before the worker.
+            ALOGE("ERROR: can't merge the virtual composer fence!");
+            sync_wait(fbLayer->releaseFenceFd, VIRTUAL_ACQUIRE_TIMEOUT);
+            mergedFd = fenceFd;
+        }else{
+            close(fenceFd);
+        }
+        close(fbLayer->releaseFenceFd);
+        fbLayer->releaseFenceFd = mergedFd;
+    }else{
+        fbLayer->releaseFenceFd = fenceFd;
+    }
+
+    return true;
 }
 
-bool HWVirtualComposer::blit(hwc_layer_1_t* src, sp<HwcDisplayData>& displayData)
+/*
+ * Mirror one primary frame into every virtual display of the job, on the
+ * worker or in set() when mirroring synchronously.
+ */
+void HWVirtualComposer::runJob(VirtualJob& job)
 {
-    const hwc_layer_1_t* dst = displayData->m_pLayer;
-    ANativeWindow* pNativeWindow = (ANativeWindow*)dst->reserved[0];
-    if(NULL == pNativeWindow){
-        ALOGE("ERROR: Not a valid virtual framebuffer target!");
+    ATRACE_CALL();
+
+    ///< not under m_blitLock, dump() would wait for the GPU too.
+    if(job.acquireFenceFd >= 0){
+        int err = sync_wait(job.acquireFenceFd, VIRTUAL_ACQUIRE_TIMEOUT);
+        close(job.acquireFenceFd);
+        job.acquireFenceFd = -1;
+        if(err < 0){
+            ///< the buffers keep their frame, so the damage is not lost.
+            ALOGE("ERROR: primary framebuffer not rendered in %d ms, frame skipped!", VIRTUAL_ACQUIRE_TIMEOUT);
+            Mutex::Autolock lock(m_lock);
+            m_nAcquireTimeouts++;
+            return;
+        }
+    }
+
+    Mutex::Autolock blitLock(m_blitLock);
+
+    {
+        Mutex::Autolock lock(m_lock);
+        for(size_t i = 0; i < job.targets.size(); ++i){
+            const sp<HwcDisplayData>& displayData = job.targets[i].data;
+            if(displayData->m_bReset){
+                displayData->m_vBuffer.clear();
+                displayData->m_vBufferFrames.clear();
+                displayData->m_bReset = false;
+            }
+        }
+    }
+
+    for(size_t i = 0; i < job.targets.size(); ++i){
+        VirtualTarget& target = job.targets.editItemAt(i);
+
+        m_nFrames++;
+        if(!blit(&job.src, &target.layer, target.data, job)){
+            ALOGE("ERROR! blit from primary FB to virtual FB failed!");
+            m_nFailedFrames++;
+            continue;
+        }
+
+        Mutex::Autolock lock(m_lock);
+        adaptRate();
+    }
+}
+
+/*
+ * Wait for the next frame from set(), mirror it and hand its source back.
+ */
+bool HWVirtualComposer::workerLoop()
+{
+    VirtualJob job;
+    {
+        Mutex::Autolock lock(m_lock);
+        while(!m_bJobQueued && !m_bExit){
+            m_jobCondition.wait(m_lock);
+        }
+
+        if(m_bExit){
+            return false;
+        }
+
+        job = m_job;
+        m_job.targets.clear();
+        m_job.acquireFenceFd = -1;
+        m_bJobQueued = false;
+    }
+
+    runJob(job);
+    releaseTargets(job);
+    sw_sync_timeline_inc(m_nSyncTimelineFd, job.fenceSteps);
+    return true;
+}
+
+bool HWVirtualComposerThread::threadLoop()
+{
+    return m_pComposer->workerLoop();
+}
+
+/*
+ * Skip the frame when nothing changed since the last mirrored one, or when
+ * it comes sooner than the current rate allows. The damage of skipped
+ * frames accumulates until the next mirrored one.
+ */
+bool HWVirtualComposer::governFrame(nsecs_t now)
+{
+    if(isEmptyRect(m_pendingDamage)){
+        m_nUnchangedDrops++;
         return false;
     }
 
+    if(now - m_nLastMirrorTime + VIRTUAL_FRAME_SLACK < m_nFrameInterval){
+        m_nRateDrops++;
+        return false;
+    }
+
+    return true;
+}
+
+/*
+ * Slow down quickly while the encoder holds its buffers back, speed up
+ * slowly again once it keeps up.
+ */
+void HWVirtualComposer::adaptRate()
+{
+    if(m_bLastBehind || m_nLastDequeueWait > VIRTUAL_BACKPRESSURE_WAIT){
+        m_nFrameInterval += m_nFrameInterval / 4;
+        if(m_nFrameInterval > m_nMaxInterval){
+            m_nFrameInterval = m_nMaxInterval;
+        }
+    }else if(m_nFrameInterval > m_nMinInterval){
+        m_nFrameInterval -= ms2ns(1);
+        if(m_nFrameInterval < m_nMinInterval){
+            m_nFrameInterval = m_nMinInterval;
+        }
+    }
+}
+
+/*
+ * Record what changed in the primary framebuffer this frame: the layers
+ * whose buffer or plane alpha changed, everything on geometry changes.
+ * Layers without a buffer may change without notice and always count.
+ */
+void HWVirtualComposer::updateDamage(hwc_display_contents_1_t* list)
+{
+    hwc_rect_t damage;
+    size_t count = list->numHwLayers - 1;
+    bool bFull = (list->flags & HWC_GEOMETRY_CHANGED) || (count != m_vPrimaryLayers.size());
+
+    if(count != m_vPrimaryLayers.size()){
+        LayerState state;
+        memset(&state, 0, sizeof(state));
+        m_vPrimaryLayers.clear();
+        m_vPrimaryLayers.insertAt(state, 0, count);
+    }
+
+    memset(&damage, 0, sizeof(damage));
+    for(size_t i = 0; i < count; ++i){
+        const hwc_layer_1_t& layer = list->hwLayers[i];
+        LayerState& state = m_vPrimaryLayers.editItemAt(i);
+
+        if(bFull
+           || NULL == layer.handle
+           || (layer.flags & HWC_SKIP_LAYER)
+           || state.handle != layer.handle
+           || state.planeAlpha != layer.planeAlpha){
+            unionRect(damage, layer.displayFrame);
+        }
+
+        state.handle = layer.handle;
+        state.planeAlpha = layer.planeAlpha;
+    }
+
+    if(bFull){
+        damage.left   = 0;
+        damage.top    = 0;
+        damage.right  = m_pDefaultDisplayInfo->xres;
+        damage.bottom = m_pDefaultDisplayInfo->yres;
+    }
+
+    unionRect(m_pendingDamage, damage);
+}
+
+/*
+ * Close the damage of the frame about to be mirrored into the history.
+ */
+void HWVirtualComposer::commitDamage()
+{
+    m_damage[++m_nFrameNumber % VIRTUAL_DAMAGE_HISTORY] = m_pendingDamage;
+    memset(&m_pendingDamage, 0, sizeof(m_pendingDamage));
+}
+
+/*
+ * Union of the damage since the frame last mirrored into buffer. False when
+ * the buffer is new or older than the history, and needs a full blit.
+ */
+bool HWVirtualComposer::getStaleRect(sp<HwcDisplayData>& displayData, ANativeWindowBuffer* buffer,
+                                     uint64_t frame, hwc_rect_t& stale)
+{
+    ssize_t index = displayData->m_vBufferFrames.indexOfKey(buffer);
+    if(index < 0){
+        return false;
+    }
+
+    ///< set() may have committed newer frames over the oldest history.
+    Mutex::Autolock lock(m_lock);
+    uint64_t last = displayData->m_vBufferFrames.valueAt(index);
+    if(last >= frame || m_nFrameNumber - last > VIRTUAL_DAMAGE_HISTORY){
+        return false;
+    }
+
+    memset(&stale, 0, sizeof(stale));
+    for(uint64_t f = last + 1; f <= frame; ++f){
+        unionRect(stale, m_damage[f % VIRTUAL_DAMAGE_HISTORY]);
+    }
+
+    return true;
+}
+
+void HWVirtualComposer::dump(String8& result, char* buffer, int size, bool dumpManager)
+{
+    Mutex::Autolock blitLock(m_blitLock);
+    Mutex::Autolock lock(m_lock);
+
+    result.append("--------------- HWC Virtual Composer Info ---------------\n");
+    snprintf(buffer, size, "    [Running] : [%d], [Mirrored Frames] : [%llu], [Pass Through] : [%llu], [Failed] : [%llu]\n",
+             m_bRunning, (unsigned long long)m_nFrames, (unsigned long long)m_nPassThroughFrames,
+             (unsigned long long)m_nFailedFrames);
+    result.append(buffer);
+    snprintf(buffer, size, "    [NV12 Frames] : [%llu], [CPU Converted] : [%llu]\n",
+             (unsigned long long)m_nYUVFrames, (unsigned long long)m_nCpuConvertedFrames);
+    result.append(buffer);
+    snprintf(buffer, size, "    [Damage] : [%d], [Blitted Pixels] : [%llu%%]\n", m_bDamageEnabled,
+             m_nFullPixels ? (unsigned long long)(m_nBlittedPixels * 100 / m_nFullPixels) : 100ULL);
+    result.append(buffer);
+    snprintf(buffer, size, "    [Rate] : [%lld fps], [Dropped Unchanged] : [%llu], [Dropped Rate] : [%llu], [Consumer Behind] : [%llu]\n",
+             (long long)(s2ns(1) / m_nFrameInterval), (unsigned long long)m_nUnchangedDrops,
+             (unsigned long long)m_nRateDrops, (unsigned long long)m_nBehindFrames);
+    result.append(buffer);
+    snprintf(buffer, size, "    [Async] : [%d], [Replaced Queued] : [%llu], [Acquire Timeouts] : [%llu]\n",
+             NULL != m_pWorker.get(), (unsigned long long)m_nBusyDrops,
+             (unsigned long long)m_nAcquireTimeouts);
+    result.append(buffer);
+    if(m_nFrames > 0){
+        snprintf(buffer, size, "    [Dequeue Wait] : [avg %lld us, max %lld us], [Latency] : [avg %lld us, max %lld us]\n",
+                 (long long)ns2us(m_nDequeueWaitSum / m_nFrames), (long long)ns2us(m_nDequeueWaitMax),
+                 (long long)ns2us(m_nLatencySum / m_nFrames), (long long)ns2us(m_nLatencyMax));
+        result.append(buffer);
+    }
+
+    for(uint32_t i = 0; i < m_displays.size(); ++i){
+        const sp<HwcDisplayData>& displayData = m_displays.valueAt(i);
+        snprintf(buffer, size, "    [%d] Mode : [%d], Transform : [%d], Cleared Buffers : [%d]\n",
+                 m_displays.keyAt(i), displayData->m_nDisplayMode, displayData->m_nTransform,
+                 displayData->m_vBuffer.size());
+        result.append(buffer);
+    }
+}
+
+void HWVirtualComposer::setSourceDisplayInfo(const private_module_t* module){
+    m_pDefaultDisplayInfo = &module->info;
+    m_pGrallocModule = &module->base;
+}
+
+/*
+ * BT.601 limited range RGBA to NV12, chroma from the average of each pair
+ * of the even rows. width must be even.
+ */
+static void convertRGBAToNV12(const uint8_t* src, uint32_t srcStride,
+                              uint8_t* dstY, uint8_t* dstUV, uint32_t dstStride,
+                              uint32_t width, uint32_t height)
+{
+    for(uint32_t y = 0; y < height; ++y){
+        const uint8_t* s = src + y * srcStride;
+        uint8_t* d = dstY + y * dstStride;
+        uint8_t* uv = (y & 1) ? NULL : dstUV + (y >> 1) * dstStride;
+        uint32_t x = 0;
+
+#if defined(__ARM_NEON__)
+        for(; x + 16 <= width; x += 16){
+            uint8x16x4_t rgba = vld4q_u8(s + x * 4);
+
+            uint16x8_t lo = vmull_u8(vget_low_u8(rgba.val[0]), vdup_n_u8(66));
+            lo = vmlal_u8(lo, vget_low_u8(rgba.val[1]), vdup_n_u8(129));
+            lo = vmlal_u8(lo, vget_low_u8(rgba.val[2]), vdup_n_u8(25));
+            uint16x8_t hi = vmull_u8(vget_high_u8(rgba.val[0]), vdup_n_u8(66));
+            hi = vmlal_u8(hi, vget_high_u8(rgba.val[1]), vdup_n_u8(129));
+            hi = vmlal_u8(hi, vget_high_u8(rgba.val[2]), vdup_n_u8(25));
+            uint8x16_t luma = vcombine_u8(vrshrn_n_u16(lo, 8), vrshrn_n_u16(hi, 8));
+            vst1q_u8(d + x, vaddq_u8(luma, vdupq_n_u8(16)));
+
+            if(NULL != uv){
+                int16x8_t r = vreinterpretq_s16_u16(vrshrq_n_u16(vpaddlq_u8(rgba.val[0]), 1));
+                int16x8_t g = vreinterpretq_s16_u16(vrshrq_n_u16(vpaddlq_u8(rgba.val[1]), 1));
+                int16x8_t b = vreinterpretq_s16_u16(vrshrq_n_u16(vpaddlq_u8(rgba.val[2]), 1));
+
+                int16x8_t u = vmulq_n_s16(b, 112);
+                u = vmlsq_n_s16(u, r, 38);
+                u = vmlsq_n_s16(u, g, 74);
+                int16x8_t v = vmulq_n_s16(r, 112);
+                v = vmlsq_n_s16(v, g, 94);
+                v = vmlsq_n_s16(v, b, 18);
+
+                uint8x8x2_t chroma;
+                chroma.val[0] = vqmovun_s16(vaddq_s16(vrshrq_n_s16(u, 8), vdupq_n_s16(128)));
+                chroma.val[1] = vqmovun_s16(vaddq_s16(vrshrq_n_s16(v, 8), vdupq_n_s16(128)));
+                vst2_u8(uv + x, chroma);
+            }
+        }
+#endif
+        for(; x < width; x += 2){
+            const uint8_t* p = s + x * 4;
+            d[x]     = (uint8_t)(((66 * p[0] + 129 * p[1] + 25 * p[2] + 128) >> 8) + 16);
+            d[x + 1] = (uint8_t)(((66 * p[4] + 129 * p[5] + 25 * p[6] + 128) >> 8) + 16);
+
+            if(NULL != uv){
+                int r = (p[0] + p[4] + 1) >> 1;
+                int g = (p[1] + p[5] + 1) >> 1;
+                int b = (p[2] + p[6] + 1) >> 1;
+                uv[x]     = (uint8_t)(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+                uv[x + 1] = (uint8_t)(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+            }
+        }
+    }
+}
+
+bool HWVirtualComposer::lockYUVBuffer(private_handle_t* pPrivHandle, uint8_t** pY, uint8_t** pUV)
+{
+    void* vaddr = NULL;
+    if(NULL == m_pGrallocModule
+       || 0 != m_pGrallocModule->lock(m_pGrallocModule, pPrivHandle, GRALLOC_USAGE_SW_WRITE_OFTEN,
+                                      0, 0, pPrivHandle->width, pPrivHandle->height, &vaddr)){
+        ALOGE("ERROR: Can not lock the virtual framebuffer for CPU access!");
+        return false;
+    }
+
+    *pY = (uint8_t*)vaddr;
+    *pUV = *pY + pPrivHandle->mem_xstride * pPrivHandle->mem_ystride;
+    return true;
+}
+
+void HWVirtualComposer::unlockYUVBuffer(private_handle_t* pPrivHandle)
+{
+    m_pGrallocModule->unlock(m_pGrallocModule, pPrivHandle);
+}
+
+/*
+ * Whether the sink shows the primary framebuffer as is: no rotation, no
+ * scale and no border to clear. The format may differ, the NV12 sink of the
+ * encoder then takes a converting blit at 1:1, still without a clear.
+ */
+bool HWVirtualComposer::isPassThrough(const hwc_layer_1_t* src, const hwc_layer_1_t* dst,
+                                      const private_handle_t* pDstPrivHandle)
+{
+    const hwc_rect_t& crop = src->sourceCrop;
+    const hwc_rect_t& frame = dst->displayFrame;
+
+    return m_bPassThroughEnabled
+        && (0 == dst->transform)
+        && (crop.right - crop.left == frame.right - frame.left)
+        && (crop.bottom - crop.top == frame.bottom - frame.top)
+        && (0 == frame.left) && (0 == frame.top)
+        && (pDstPrivHandle->width == frame.right)
+        && (pDstPrivHandle->height == frame.bottom);
+}
+
+bool HWVirtualComposer::blit(const hwc_layer_1_t* src, const hwc_layer_1_t* dst,
+                             sp<HwcDisplayData>& displayData, const VirtualJob& job)
+{
+    ///< GCU can not read a compressed frame.
+    if(job.bCompressed){
+        ALOGE("ERROR: Can not mirror a compressed primary framebuffer!");
+        return false;
+    }
+
+    ///< held by the job, see buildJob().
+    ANativeWindow* pNativeWindow = (ANativeWindow*)dst->reserved[0];
+
+    ///< let the encoder take the frame without converting it.
+    if(m_bYUVOutput && !displayData->m_bYUVRequested){
+        if(0 != native_window_set_buffers_format(pNativeWindow, HAL_PIXEL_FORMAT_YCbCr_420_SP_MRVL)){
+            ALOGW("WARNING: Virtual framebuffer target does not take NV12 buffers!");
+        }
+        displayData->m_bYUVRequested = true;
+    }
+
+    int behind = 0;
+    pNativeWindow->query(pNativeWindow, NATIVE_WINDOW_CONSUMER_RUNNING_BEHIND, &behind);
+    m_bLastBehind = (0 != behind);
+    if(m_bLastBehind){
+        m_nBehindFrames++;
+    }
+
     ANativeWindowBuffer* pNativeBuffer = NULL;
+    nsecs_t dequeueStart = systemTime(SYSTEM_TIME_MONOTONIC);
     int32_t ret = pNativeWindow->dequeueBuffer_DEPRECATED(pNativeWindow, &pNativeBuffer);
+    m_nLastDequeueWait = systemTime(SYSTEM_TIME_MONOTONIC) - dequeueStart;
+    m_nDequeueWaitSum += m_nLastDequeueWait;
+    if(m_nLastDequeueWait > m_nDequeueWaitMax){
+        m_nDequeueWaitMax = m_nLastDequeueWait;
+    }
     if(0 > ret || NULL == pNativeBuffer){
         ALOGE("ERROR: Can not get a valid buffer handle from virtual framebuffer target!");
         return false;
     }
 
     uint32_t width = m_pDefaultDisplayInfo->xres_virtual;
-    uint32_t height = m_pDefaultDisplayInfo->yres_virtual >> 1; // now we assume there are only 2 buffers in LCD.
+    uint32_t height = m_pDefaultDisplayInfo->yres;
     uint32_t orientation = resolveDisplayOrientation(dst->transform);
     BlitDataDescription blitDesc;
     DISP_RECT srcRect;
@@ -245,11 +896,19 @@ bool HWVirtualComposer::blit(hwc_layer_1_t* src, sp<HwcDisplayData>& displayData
     buffer_handle_t dstBufferHandle = pNativeBuffer->handle;
     private_handle_t* pDstPrivHandle = private_handle_t::dynamicCast(dstBufferHandle);
 
-    bool bIsSecureContents = false;
-    static bool preSecureState = false;
-    if(preSecureState != bIsSecureContents){
-        displayData->m_vBuffer.clear();
-    }
+    bool bPassThrough = false;
+    bool bSrcBlit = false;
+    bool bYUVSink = false;
+    bool bConvertOnCpu = false;
+    bool bClear = false;
+    void* pScratch = NULL;
+    uint32_t targetAddr = 0;
+    uint32_t targetStride = 0;
+    uint32_t targetFormat = 0;
+    uint8_t* pY = NULL;
+    uint8_t* pUV = NULL;
+    hwc_rect_t stale;
+    bool bMirrored = false;
 
     if(NULL == pSrcPrivHandle || NULL == pDstPrivHandle){
         ALOGE("ERROR! pSrcPrivHandle = %p, pDstPrivHandle = %p", pSrcPrivHandle, pDstPrivHandle);
@@ -261,7 +920,44 @@ bool HWVirtualComposer::blit(hwc_layer_1_t* src, sp<HwcDisplayData>& displayData
     srcRect.r              = src->sourceCrop.right;
     srcRect.b              = src->sourceCrop.bottom;
 
-    if(!displayData->isBufferCleared(pNativeBuffer)){
+    targetAddr   = pDstPrivHandle->physAddr;
+    targetStride = pDstPrivHandle->mem_xstride;
+    targetFormat = pDstPrivHandle->format;
+    bYUVSink = (HAL_PIXEL_FORMAT_YCbCr_420_SP_MRVL == pDstPrivHandle->format);
+    bConvertOnCpu = bYUVSink && !m_pGcuEngine->isYUVOutputSupported();
+
+    if(bConvertOnCpu){
+        ///< scale and rotate into RGBA, converted below. The scratch is
+        ///< shared by all buffers, so it is cleared every frame.
+        if(!m_pGcuEngine->getScratchBuffer(pDstPrivHandle->width, pDstPrivHandle->height,
+                                           &pScratch, &targetAddr)){
+            goto ERROR_OUT;
+        }
+        targetStride = pDstPrivHandle->width * 4;
+        targetFormat = HAL_PIXEL_FORMAT_RGBA_8888;
+        bClear = true;
+    }else{
+        ///< the copy covers the whole buffer, which then needs a clear again
+        ///< if the geometry changes.
+        bPassThrough = isPassThrough(src, dst, pDstPrivHandle);
+        if(bPassThrough){
+            displayData->removeClearedBuffer(pNativeBuffer);
+            m_nPassThroughFrames++;
+        }
+        bClear = !bPassThrough && !displayData->isBufferCleared(pNativeBuffer);
+        bSrcBlit = bPassThrough && (pSrcPrivHandle->format == pDstPrivHandle->format);
+    }
+
+    if(bClear && bYUVSink && !bConvertOnCpu){
+        ///< black in limited range, the 2D core only blits into NV12.
+        if(!lockYUVBuffer(pDstPrivHandle, &pY, &pUV)){
+            goto ERROR_OUT;
+        }
+        ///< the UV plane starts after mem_ystride rows, clear all of them.
+        memset(pY, 16, pDstPrivHandle->mem_xstride * pDstPrivHandle->mem_ystride);
+        memset(pUV, 128, pDstPrivHandle->mem_xstride * (pDstPrivHandle->mem_ystride >> 1));
+        unlockYUVBuffer(pDstPrivHandle);
+    }else if(bClear){
         dstRect.l              = 0;
         dstRect.t              = 0;
         dstRect.r              = pDstPrivHandle->width;
@@ -271,16 +967,18 @@ bool HWVirtualComposer::blit(hwc_layer_1_t* src, sp<HwcDisplayData>& displayData
                                      pSrcPrivHandle->format, &srcRect,
                                      pSrcPrivHandle->physAddr, 0, 0,
                                      width*4, 0, 0,
-                                     pDstPrivHandle->width, pDstPrivHandle->height, pDstPrivHandle->format,
+                                     pDstPrivHandle->width, pDstPrivHandle->height, targetFormat,
                                      &dstRect, &dstRect, 1,
-                                     pDstPrivHandle->physAddr, pDstPrivHandle->mem_xstride,
+                                     targetAddr, targetStride,
                                      0xFF000000, 0, 0, NULL, true, 0x0);
 
         if(!m_pGcuEngine->Blit(&blitDesc)){
             ALOGE("ERROR: GCU 2D Fill Blit Error!");
             goto ERROR_OUT;
         }
+    }
 
+    if(bClear && !bConvertOnCpu){
         displayData->addClearedBuffer(pNativeBuffer);
     }
 
@@ -288,32 +986,99 @@ bool HWVirtualComposer::blit(hwc_layer_1_t* src, sp<HwcDisplayData>& displayData
     dstRect.t              = dst->displayFrame.top;
     dstRect.r              = dst->displayFrame.right;
     dstRect.b              = dst->displayFrame.bottom;
+    m_nFullPixels += (dstRect.r - dstRect.l) * (dstRect.b - dstRect.t);
+
+    ///< a freshly cleared buffer, the shared scratch or a rotation need
+    ///< the whole frame.
+    if(m_bDamageEnabled && !bClear && !bConvertOnCpu && (0 == dst->transform)
+       && getStaleRect(displayData, pNativeBuffer, job.frame, stale)){
+        const hwc_rect_t& crop = src->sourceCrop;
+        const hwc_rect_t& frame = dst->displayFrame;
+        int cw = crop.right - crop.left;
+        int ch = crop.bottom - crop.top;
+        int fw = frame.right - frame.left;
+        int fh = frame.bottom - frame.top;
+
+        if(cw != fw || ch != fh){
+            ///< room for the filter taps around the damage.
+            stale.left   -= VIRTUAL_DAMAGE_MARGIN;
+            stale.top    -= VIRTUAL_DAMAGE_MARGIN;
+            stale.right  += VIRTUAL_DAMAGE_MARGIN;
+            stale.bottom += VIRTUAL_DAMAGE_MARGIN;
+        }
 
-    ConstructBlitDataDescription(blitDesc, GPU_BLIT_FILTER, true, orientation,
+        intersectRect(stale, crop);
+        if(isEmptyRect(stale) || cw <= 0 || ch <= 0){
+            goto BLIT_DONE;
+        }
+
+        srcRect.l = stale.left;
+        srcRect.t = stale.top;
+        srcRect.r = stale.right;
+        srcRect.b = stale.bottom;
+
+        dstRect.l = frame.left + (stale.left - crop.left) * fw / cw;
+        dstRect.t = frame.top  + (stale.top - crop.top) * fh / ch;
+        dstRect.r = frame.left + ((stale.right - crop.left) * fw + cw - 1) / cw;
+        dstRect.b = frame.top  + ((stale.bottom - crop.top) * fh + ch - 1) / ch;
+    }
+    m_nBlittedPixels += (dstRect.r - dstRect.l) * (dstRect.b - dstRect.t);
+
+    ConstructBlitDataDescription(blitDesc, bSrcBlit ? GPU_BLIT_SRC : GPU_BLIT_FILTER, true, orientation,
                                  width, height,
                                  pSrcPrivHandle->format, &srcRect,
                                  pSrcPrivHandle->physAddr, 0, 0,
                                  width*4, 0, 0,
-                                 pDstPrivHandle->width, pDstPrivHandle->height, pDstPrivHandle->format,
+                                 pDstPrivHandle->width, pDstPrivHandle->height, targetFormat,
                                  &dstRect, &dstRect, 1,
-                                 pDstPrivHandle->physAddr, pDstPrivHandle->mem_xstride,
+                                 targetAddr, targetStride,
                                  0, 0, 0, NULL, true, 0x0);
 
     if(!m_pGcuEngine->Blit(&blitDesc)){
-        ALOGE("ERROR: GCU 2D Filter Blit Error!");
+        ALOGE("ERROR: GCU 2D %s Blit Error!", bSrcBlit ? "Src" : "Filter");
         goto ERROR_OUT;
     }
 
+    if(bConvertOnCpu){
+        if(!lockYUVBuffer(pDstPrivHandle, &pY, &pUV)){
+            goto ERROR_OUT;
+        }
+        convertRGBAToNV12((const uint8_t*)pScratch, targetStride, pY, pUV,
+                          pDstPrivHandle->mem_xstride, pDstPrivHandle->width, pDstPrivHandle->height);
+        unlockYUVBuffer(pDstPrivHandle);
+        m_nCpuConvertedFrames++;
+    }
+
+BLIT_DONE:
+    if(bYUVSink){
+        m_nYUVFrames++;
+    }
+
+    displayData->m_vBufferFrames.add(pNativeBuffer, job.frame);
+    bMirrored = true;
+
     /*
     dumpOneFrame((void*)pDstPrivHandle->base, pDstPrivHandle->width,
                  pDstPrivHandle->height, pDstPrivHandle->format);
     */
 
 ERROR_OUT:
+    ///< partly written, blit it whole next time.
+    if(!bMirrored){
+        displayData->m_vBufferFrames.removeItem(pNativeBuffer);
+    }
+
     //queue back to WFD AVstreaming pipeline.
     ret = pNativeWindow->queueBuffer_DEPRECATED(pNativeWindow, pNativeBuffer);
     if(0 > ret){
         ALOGE("ERROR: Queue buffer failed!");
+    }else{
+        ///< from the prepare of the primary frame to its hand over.
+        nsecs_t latency = systemTime(SYSTEM_TIME_MONOTONIC) - job.prepareTime;
+        m_nLatencySum += latency;
+        if(latency > m_nLatencyMax){
+            m_nLatencyMax = latency;
+        }
     }
 
     return (ret >= 0);
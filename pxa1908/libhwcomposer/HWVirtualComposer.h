@@ -21,12 +21,35 @@
 #include <linux/fb.h>
 #include <utils/RefBase.h>
 #include <utils/Log.h>
+#include <utils/Timers.h>
+#include <utils/Thread.h>
+#include <utils/Condition.h>
 #include <hardware/hardware.h>
 #include <hardware/hwcomposer.h>
+#include <hardware/gralloc.h>
+#include <system/window.h>
 #include "GcuEngine.h"
 
+struct private_module_t;
+struct private_handle_t;
+
 namespace android{
 
+///< frames of primary damage kept, older virtual buffers are blitted whole.
+#define VIRTUAL_DAMAGE_HISTORY  4
+
+///< source pixels added around scaled damage for the filter taps.
+#define VIRTUAL_DAMAGE_MARGIN   4
+
+///< vsync jitter tolerated by the frame rate cap.
+#define VIRTUAL_FRAME_SLACK     ms2ns(2)
+
+///< a dequeue blocking longer than this means the encoder is behind.
+#define VIRTUAL_BACKPRESSURE_WAIT ms2ns(4)
+
+///< ms the worker waits for the primary framebuffer to be rendered.
+#define VIRTUAL_ACQUIRE_TIMEOUT 1000
+
 /**
  * Refer to WindowManagerService.java.
  *    private static final int DISPLAY_CONTENT_UNKNOWN = 0;
@@ -39,9 +62,31 @@ enum DISPLAY_CONTENT_MODE{
     DISPLAY_CONTENT_UNIQUE = 2,
 };
 
+class HWVirtualComposer;
+
+/*
+ * Mirrors the frames queued by HWVirtualComposer::set() off the composition
+ * thread.
+ */
+class HWVirtualComposerThread : public Thread
+{
+    friend class HWVirtualComposer;
+private:
+    HWVirtualComposerThread(HWVirtualComposer* composer) : Thread(false)
+                                                         , m_pComposer(composer)
+    {
+    }
+
+    bool threadLoop();
+
+private:
+    HWVirtualComposer* m_pComposer;
+};
 
 class HWVirtualComposer
 {
+    friend class HWVirtualComposerThread;
+
 public:
     HWVirtualComposer();
 
@@ -54,18 +99,19 @@ public:
     uint32_t prepare(size_t numDisplays, hwc_display_contents_1_t** displays);
 
     /*set
-     *
+     * acquireFenceFd is a fence of the primary framebuffer target owned by
+     * the composer, the frame is mirrored once it signals.
      */
-    void set(size_t numDisplays, hwc_display_contents_1_t** displays);
+    void set(size_t numDisplays, hwc_display_contents_1_t** displays, int acquireFenceFd = -1);
 
     /*dump
      *
      */
-    void dump(String8& result, char* buffer, int size, bool dumpManager = true){}
+    void dump(String8& result, char* buffer, int size, bool dumpManager = true);
 
     /*set FB info.
      */
-    void setSourceDisplayInfo(const fb_var_screeninfo* info);
+    void setSourceDisplayInfo(const private_module_t* module);
 
     /*get running status.
      */
@@ -81,6 +127,8 @@ private:
                                                    , m_nDisplayMode(DISPLAY_CONTENT_UNKNOWN)
                                                    , m_hFbHandle(NULL)
                                                    , m_nTransform(-1)
+                                                   , m_bYUVRequested(false)
+                                                   , m_bReset(false)
         {
             if(NULL != m_pLayer) {
                 // save important info. Because m_player is just a saved pointer value.
@@ -95,6 +143,7 @@ private:
         {
             m_pLayer = NULL;
             m_vBuffer.clear();
+            m_vBufferFrames.clear();
         }
 
     public:
@@ -106,6 +155,10 @@ private:
             m_vBuffer.add(buffer);
         }
 
+        void removeClearedBuffer(ANativeWindowBuffer* buffer){
+            m_vBuffer.remove(buffer);
+        }
+
         bool isEqual(const hwc_layer_1_t* layer) const
         {
             if(NULL != layer && NULL != m_pLayer)
@@ -119,8 +172,9 @@ private:
             if (bResetClearStatus
                 || (m_hFbHandle != layer->handle)
                 || (m_nTransform != layer->transform) ){
-                ///< params change, reset all saved cleared buffers.
-                m_vBuffer.clear();
+                ///< params change, reset all saved cleared buffers before
+                ///< the next blit. The worker owns them.
+                m_bReset = true;
             }
 
             m_pLayer = layer;
@@ -143,13 +197,83 @@ private:
 
         ///< cleared buffer list of fb dest.
         SortedVector<ANativeWindowBuffer*> m_vBuffer;
+
+        ///< NV12 buffers asked from the encoder window.
+        bool m_bYUVRequested;
+
+        ///< frame last mirrored into each buffer, for its age.
+        KeyedVector<ANativeWindowBuffer*, uint64_t> m_vBufferFrames;
+
+        ///< cleared and mirrored buffers are stale, set under m_lock.
+        bool m_bReset;
+    };
+
+    struct LayerState
+    {
+        buffer_handle_t handle;
+        uint8_t planeAlpha;
+    };
+
+    ///< one virtual display to mirror into, its target layer copied from set.
+    ///< window is the one of layer.reserved[0], referenced until the job ran.
+    struct VirtualTarget
+    {
+        sp<HwcDisplayData> data;
+        hwc_layer_1_t layer;
+        ANativeWindow* window;
+    };
+
+    ///< one primary frame for the worker. The layers are copies, the lists
+    ///< of set() are gone by the time it runs.
+    struct VirtualJob
+    {
+        hwc_layer_1_t src;
+        ///< src is compressed, read in set() before the next post reuses it.
+        bool bCompressed;
+        int acquireFenceFd;
+        ///< worker timeline steps to signal once it ran, one per frame it
+        ///< replaced in the queue and one for itself.
+        uint32_t fenceSteps;
+        uint64_t frame;
+        nsecs_t prepareTime;
+        Vector<VirtualTarget> targets;
     };
 
 private:
 
     bool readyToRun(size_t numDisplays, hwc_display_contents_1_t** displays);
 
-    bool blit(hwc_layer_1_t* src, sp<HwcDisplayData>& displayData);
+    bool buildJob(size_t numDisplays, hwc_display_contents_1_t** displays, VirtualJob& job);
+
+    bool attachReleaseFence(hwc_layer_1_t* fbLayer);
+
+    void runJob(VirtualJob& job);
+
+    void releaseTargets(VirtualJob& job);
+
+    bool workerLoop();
+
+    bool blit(const hwc_layer_1_t* src, const hwc_layer_1_t* dst,
+              sp<HwcDisplayData>& displayData, const VirtualJob& job);
+
+    bool isPassThrough(const hwc_layer_1_t* src, const hwc_layer_1_t* dst,
+                       const private_handle_t* pDstPrivHandle);
+
+    void updateDamage(hwc_display_contents_1_t* list);
+
+    void commitDamage();
+
+    bool governFrame(nsecs_t now);
+
+    void adaptRate();
+
+    bool getStaleRect(sp<HwcDisplayData>& displayData, ANativeWindowBuffer* buffer,
+                      uint64_t frame, hwc_rect_t& stale);
+
+    ///< CPU access to an NV12 sink buffer, when the 2D core can not write it.
+    bool lockYUVBuffer(private_handle_t* pPrivHandle, uint8_t** pY, uint8_t** pUV);
+
+    void unlockYUVBuffer(private_handle_t* pPrivHandle);
 
     DISPLAY_SURFACE_ROTATION resolveDisplayOrientation(uint32_t orientation);
 
@@ -159,15 +283,94 @@ private:
     bool m_bRunning;
     bool m_bClearBuffer;
 
+    ///< hwc.virtual.passthrough, plain copy when the sink matches the panel.
+    bool m_bPassThroughEnabled;
+
+    ///< hwc.virtual.yuv, feed the encoder NV12 instead of RGBA.
+    bool m_bYUVOutput;
+
     hwc_layer_1_t* m_pPrimaryFbLayer;
 
     GcuEngine*     m_pGcuEngine;
 
     const fb_var_screeninfo* m_pDefaultDisplayInfo;
 
+    const gralloc_module_t* m_pGrallocModule;
+
     DefaultKeyedVector<uint32_t, sp<HwcDisplayData> > m_displays;
 
     int m_previousDisplayMode;
+
+    ///< mirrored frames, and the ones whose blits failed.
+    uint64_t m_nFrames;
+    uint64_t m_nFailedFrames;
+
+    ///< mirrored frames which needed neither a clear nor a scale.
+    uint64_t m_nPassThroughFrames;
+
+    ///< NV12 frames, and the ones converted by the CPU.
+    uint64_t m_nYUVFrames;
+    uint64_t m_nCpuConvertedFrames;
+
+    ///< hwc.virtual.damage, only blit what is stale in the dequeued buffer.
+    bool m_bDamageEnabled;
+
+    ///< primary layers of the last frame, and the damage of recent frames.
+    Vector<LayerState> m_vPrimaryLayers;
+    hwc_rect_t m_damage[VIRTUAL_DAMAGE_HISTORY];
+    uint64_t m_nFrameNumber;
+
+    ///< damage of the frames since the last mirrored one.
+    hwc_rect_t m_pendingDamage;
+
+    ///< mirroring interval, between hwc.virtual.fps and hwc.virtual.fps.min.
+    nsecs_t m_nMaxInterval;
+    nsecs_t m_nMinInterval;
+    nsecs_t m_nFrameInterval;
+    nsecs_t m_nLastMirrorTime;
+    nsecs_t m_nPrepareTime;
+
+    ///< governor statistics.
+    uint64_t m_nUnchangedDrops;
+    uint64_t m_nRateDrops;
+    uint64_t m_nBehindFrames;
+    nsecs_t m_nDequeueWaitSum;
+    nsecs_t m_nDequeueWaitMax;
+    nsecs_t m_nLatencySum;
+    nsecs_t m_nLatencyMax;
+
+    ///< backpressure seen by the last blit.
+    nsecs_t m_nLastDequeueWait;
+    bool m_bLastBehind;
+
+    ///< destination pixels blitted, and the pixels a full blit would take.
+    uint64_t m_nBlittedPixels;
+    uint64_t m_nFullPixels;
+
+    ///< hwc.virtual.async, mirror on m_pWorker instead of in set().
+    sp<HWVirtualComposerThread> m_pWorker;
+
+    ///< single slot queue, a newer frame replaces one the worker did not
+    ///< take yet.
+    VirtualJob m_job;
+    bool m_bJobQueued;
+    bool m_bExit;
+    Condition m_jobCondition;
+
+    ///< sw_sync timeline of the worker, one step per queued frame.
+    int m_nSyncTimelineFd;
+    uint32_t m_nFenceStamp;
+
+    ///< frames replaced in the queue, and never rendered. Under m_lock.
+    uint64_t m_nBusyDrops;
+    uint64_t m_nAcquireTimeouts;
+
+    ///< guards m_displays, damage, governor and queue, held briefly.
+    Mutex m_lock;
+
+    ///< held by whoever blits, guards the blit statistics and the buffers
+    ///< of each HwcDisplayData. Taken before m_lock.
+    Mutex m_blitLock;
 };
 
 }
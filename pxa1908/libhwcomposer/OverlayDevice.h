@@ -278,6 +278,9 @@ public:
 
         sprintf(buffer, "Overlay Device Info\n");
         result.append(buffer);
+        snprintf(buffer, size, "    [Open] : [%d], [Frames] : [%u], [DMA Ready] : [%d], [Shadow Addr] : [%p]\n",
+                 m_bOpen, m_nFrameCount, readyDrawOverlay(), m_pShadowAddr);
+        result.append(buffer);
     }
 
     bool readyDrawOverlay(){
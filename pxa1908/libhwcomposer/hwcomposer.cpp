@@ -18,6 +18,7 @@
 #include <hardware/hardware.h>
 
 #include <fcntl.h>
+#include <unistd.h>
 #include <errno.h>
 
 #include <cutils/log.h>
@@ -38,6 +39,8 @@
 #include "HWVirtualComposer.h"
 #endif
 #include "HWCFenceManager.h"
+#include "HWCTrace.h"
+#include "HWCCapture.h"
 
 #include "HWBaselayComposer.h"
 #include "HWCDisplayEventMonitor.h"
@@ -45,6 +48,7 @@
 #include "hwcomposer_defs_mrvl.h"
 
 #include <gralloc_priv.h>
+#include <gc_gralloc_registry.h>
 
 #define ATRACE_TAG ATRACE_TAG_GRAPHICS
 #include <utils/Trace.h>
@@ -82,6 +86,19 @@ struct hwc_context_t {
     framebuffer_device_t *fbdev[HWC_NUM_DISPLAY_TYPES + 3];
 
     sp<HWCDisplayEventMonitor> monitor;
+
+    ///< start of the last framebuffer post seen by the frame trace.
+    int64_t lastPostStart;
+
+    ///< composition path chosen for the primary display, counted per prepare.
+    struct {
+        uint64_t frames;
+        uint64_t glesFrames;
+        uint64_t hwcFrames;
+        uint64_t mixedFrames;
+        uint32_t lastFbLayers;
+        uint32_t lastHwcLayers;
+    } composition;
 };
 
 static int hwc_device_open(const struct hw_module_t* module, const char* name,
@@ -123,29 +140,132 @@ static void dump_layer(hwc_layer_1_t const* l) {
             l->displayFrame.bottom);
 }
 
+static void hwc_count_composition(struct hwc_context_t *ctx, hwc_display_contents_1_t* list)
+{
+    if(list == NULL)
+        return;
+
+    uint32_t fbLayers = 0, hwcLayers = 0;
+    for(size_t i = 0; i < list->numHwLayers; ++i){
+        if(list->hwLayers[i].compositionType == HWC_FRAMEBUFFER)
+            fbLayers++;
+        else if(list->hwLayers[i].compositionType == HWC_OVERLAY)
+            hwcLayers++;
+    }
+
+    ctx->composition.frames++;
+    if(hwcLayers == 0)
+        ctx->composition.glesFrames++;
+    else if(fbLayers == 0)
+        ctx->composition.hwcFrames++;
+    else
+        ctx->composition.mixedFrames++;
+    ctx->composition.lastFbLayers = fbLayers;
+    ctx->composition.lastHwcLayers = hwcLayers;
+}
+
 static int hwc_prepare(hwc_composer_device_1_t *dev, size_t numDisplays, hwc_display_contents_1_t** displays) {
     ATRACE_CALL();
     if (displays) {
         struct hwc_context_t *ctx = (struct hwc_context_t *)dev;
         uint32_t numRestDisplays = numDisplays;
+        HWCTrace::beginFrame(numDisplays, displays);
+        if(HWCCapture::isEnabled())
+            HWCCapture::beginCall(HWC_CAPTURE_PREPARE, numDisplays, displays);
 #ifdef ENABLE_OVERLAY
         if( !ctx->skip && ctx->overlayComposer ) {
+            HWCTraceScope trace(HWC_TRACE_OVERLAY_PREPARE);
             ctx->overlayComposer->prepare(numDisplays, displays);
         }
 #endif
 #ifdef ENABLE_WFD_OPTIMIZATION
         if( !ctx->skip && ctx->virtualComposer ) {
+            HWCTraceScope trace(HWC_TRACE_VIRTUAL_PREPARE);
             numRestDisplays = ctx->virtualComposer->prepare(numDisplays, displays);
         }
 #endif
 #ifdef ENABLE_HWC_GC_PATH
-        if(ctx->baseComposer)
+        if(ctx->baseComposer){
+            HWCTraceScope trace(HWC_TRACE_BASELAY_PREPARE);
             ctx->baseComposer->prepare(&ctx->device, numRestDisplays, displays);
+        }
 #endif
+        if(numDisplays > 0)
+            hwc_count_composition(ctx, displays[HWC_DISPLAY_PRIMARY]);
+        if(HWCCapture::isEnabled())
+            HWCCapture::endCall(HWC_CAPTURE_PREPARE, numDisplays, displays, 0);
     }
     return 0;
 }
 
+static hwc_layer_1_t* hwc_get_fb_target(hwc_display_contents_1_t* list)
+{
+    if(list == NULL || list->numHwLayers == 0)
+        return NULL;
+
+    hwc_layer_1_t* layer = &list->hwLayers[list->numHwLayers - 1];
+    if(layer->compositionType != HWC_FRAMEBUFFER_TARGET || layer->handle == NULL)
+        return NULL;
+
+    return layer;
+}
+
+/*
+ * Let the display controller wait for the framebuffer target instead of the
+ * posting thread: gralloc passes the acquire fence with the flip, and returns
+ * the release fence of the flip instead of waiting for vsync.
+ */
+static void hwc_set_fb_acquire_fence(struct hwc_context_t *ctx, hwc_display_contents_1_t* list)
+{
+    hwc_layer_1_t* fbTarget = hwc_get_fb_target(list);
+    if(fbTarget == NULL || ctx->fbdev[HWC_DISPLAY_PRIMARY] == NULL)
+        return;
+
+    gralloc_module_t* m = (gralloc_module_t*)ctx->fbdev[HWC_DISPLAY_PRIMARY]->common.module;
+    m->perform(m, GRALLOC_MODULE_PERFORM_SET_FB_ACQUIRE_FENCE,
+               fbTarget->handle, fbTarget->acquireFenceFd);
+}
+
+static void hwc_get_fb_release_fence(struct hwc_context_t *ctx, hwc_display_contents_1_t* list)
+{
+    hwc_layer_1_t* fbTarget = hwc_get_fb_target(list);
+    if(fbTarget == NULL || ctx->fbdev[HWC_DISPLAY_PRIMARY] == NULL)
+        return;
+
+    int releaseFd = -1;
+    gralloc_module_t* m = (gralloc_module_t*)ctx->fbdev[HWC_DISPLAY_PRIMARY]->common.module;
+    m->perform(m, GRALLOC_MODULE_PERFORM_GET_FB_RELEASE_FENCE,
+               fbTarget->handle, &releaseFd);
+
+    if(releaseFd < 0)
+        return;
+
+    // Keep a fence the GC path already provided.
+    if(fbTarget->releaseFenceFd < 0)
+        fbTarget->releaseFenceFd = releaseFd;
+    else
+        close(releaseFd);
+}
+
+/*
+ * Take the flip times of the post made during this frame from gralloc.
+ */
+static void hwc_trace_fb_post(struct hwc_context_t *ctx)
+{
+    if(!HWCTrace::isEnabled() || ctx->fbdev[HWC_DISPLAY_PRIMARY] == NULL)
+        return;
+
+    private_fb_stats_t stats;
+    gralloc_module_t* m = (gralloc_module_t*)ctx->fbdev[HWC_DISPLAY_PRIMARY]->common.module;
+    if(m->perform(m, GRALLOC_MODULE_PERFORM_GET_FB_STATS, &stats) != 0)
+        return;
+
+    if(stats.lastPostStart != ctx->lastPostStart){
+        ctx->lastPostStart = stats.lastPostStart;
+        HWCTrace::setStage(HWC_TRACE_FB_POST, stats.lastPostStart, stats.lastPostEnd);
+    }
+}
+
 static int hwc_set(struct hwc_composer_device_1 *dev,
                 size_t numDisplays, hwc_display_contents_1_t** displays)
 {
@@ -153,14 +273,27 @@ static int hwc_set(struct hwc_composer_device_1 *dev,
     int status = 0;
     uint32_t numRestDisplays = numDisplays;
     struct hwc_context_t *ctx = (struct hwc_context_t *)dev;
+    hwc_display_contents_1_t* primary = (displays && numDisplays) ? displays[HWC_DISPLAY_PRIMARY] : NULL;
+
+    if(HWCCapture::isEnabled())
+        HWCCapture::beginCall(HWC_CAPTURE_SET, numDisplays, displays);
+    hwc_set_fb_acquire_fence(ctx, primary);
 #ifdef ENABLE_WFD_OPTIMIZATION
+    // The virtual composer reads the framebuffer target after the GC path
+    // took its acquire fence, keep a copy for it.
+    int virtualAcquireFd = -1;
     if(!ctx->skip && ctx->virtualComposer && ctx->virtualComposer->isRunning()){
         numRestDisplays = HWC_NUM_DISPLAY_TYPES;
+
+        hwc_layer_1_t* fbTarget = hwc_get_fb_target(primary);
+        if(fbTarget != NULL && fbTarget->acquireFenceFd >= 0)
+            virtualAcquireFd = dup(fbTarget->acquireFenceFd);
     }
 #endif
 #ifdef ENABLE_HWC_GC_PATH
     if(ctx->baseComposer)
     {
+        HWCTraceScope trace(HWC_TRACE_BASELAY_SET);
         status = ctx->baseComposer->set(&ctx->device, numRestDisplays, displays);
     }
     else
@@ -175,13 +308,17 @@ static int hwc_set(struct hwc_composer_device_1 *dev,
 #ifdef ENABLE_HWC_GC_PATH
     }
 #endif
+
+    hwc_get_fb_release_fence(ctx, primary);
 #ifdef ENABLE_WFD_OPTIMIZATION
     if( !ctx->skip && ctx->virtualComposer && ctx->virtualComposer->isRunning()) {
-        ctx->virtualComposer->set(numDisplays, displays);
+        HWCTraceScope trace(HWC_TRACE_VIRTUAL_SET);
+        ctx->virtualComposer->set(numDisplays, displays, virtualAcquireFd);
     }
 #endif
 #ifdef ENABLE_OVERLAY
     if(!ctx->skip && ctx->overlayComposer) {
+        HWCTraceScope trace(HWC_TRACE_OVERLAY_SET);
         ctx->overlayComposer->set(numDisplays, displays);
     }
 #endif
@@ -190,6 +327,10 @@ static int hwc_set(struct hwc_composer_device_1 *dev,
         ctx->overlayComposer->finishCompose();
     }
 #endif
+    hwc_trace_fb_post(ctx);
+    HWCTrace::endFrame(numDisplays, displays);
+    if(HWCCapture::isEnabled())
+        HWCCapture::endCall(HWC_CAPTURE_SET, numDisplays, displays, status);
     return status;
 }
 
@@ -349,24 +490,127 @@ static int hwc_getDisplayAttributes(struct hwc_composer_device_1* dev, int disp,
     return 0;
 }
 
+static void hwc_dump_fb_stats(struct hwc_context_t *ctx, String8& result)
+{
+    if(ctx->fbdev[HWC_DISPLAY_PRIMARY] == NULL)
+        return;
+
+    private_fb_stats_t stats;
+    gralloc_module_t* m = (gralloc_module_t*)ctx->fbdev[HWC_DISPLAY_PRIMARY]->common.module;
+    if(m->perform(m, GRALLOC_MODULE_PERFORM_GET_FB_STATS, &stats) != 0)
+        return;
+
+    result.appendFormat("Framebuffer: %llu frames (%llu compressed), %llu KB posted\n",
+                        (unsigned long long)stats.frames,
+                        (unsigned long long)stats.compressedFrames,
+                        (unsigned long long)(stats.bytes >> 10));
+    if(stats.sampledFrames > 0){
+        result.appendFormat("  compression saved %llu KB/frame on average, %u KB last frame\n",
+                            (unsigned long long)(stats.bytesSaved / stats.sampledFrames >> 10),
+                            stats.lastBytesSaved >> 10);
+    }
+}
+
+static void hwc_dump_composition(struct hwc_context_t *ctx, String8& result)
+{
+    result.appendFormat("Composition: %llu frames, %llu GLES only, %llu HWC only, %llu mixed%s\n",
+                        (unsigned long long)ctx->composition.frames,
+                        (unsigned long long)ctx->composition.glesFrames,
+                        (unsigned long long)ctx->composition.hwcFrames,
+                        (unsigned long long)ctx->composition.mixedFrames,
+                        ctx->skip ? " (persist.hwc.skip)" : "");
+    result.appendFormat("  last frame: %u GLES layers, %u HWC layers, GC path %s\n",
+                        ctx->composition.lastFbLayers, ctx->composition.lastHwcLayers,
+#ifdef ENABLE_HWC_GC_PATH
+                        ctx->baseComposer ? "enabled" : "disabled"
+#else
+                        "not built"
+#endif
+                        );
+}
+
+static void hwc_dump_gralloc_stats(struct hwc_context_t *ctx, String8& result)
+{
+    if(ctx->fbdev[HWC_DISPLAY_PRIMARY] == NULL)
+        return;
+
+    gc_gralloc_registry_stats stats;
+    gralloc_module_t* m = (gralloc_module_t*)ctx->fbdev[HWC_DISPLAY_PRIMARY]->common.module;
+    memset(&stats, 0, sizeof(stats));
+    if(m->perform(m, GRALLOC_MODULE_PERFORM_GET_REGISTRY_STATS, &stats) != 0)
+        return;
+
+    result.appendFormat("Gralloc: %u buffers, %u handles, %llu KB imported\n",
+                        stats.buffers, stats.handles,
+                        (unsigned long long)(stats.importedBytes >> 10));
+    if(stats.doubleRegistrations || stats.invalidAccesses){
+        result.appendFormat("  %u double registrations, %u invalid accesses\n",
+                            stats.doubleRegistrations, stats.invalidAccesses);
+    }
+}
+
+/*
+ * Copy the dump into the caller buffer, cut after the last complete line
+ * that fits.
+ */
+static void hwc_dump_copy(const String8& result, char *buff, int buff_len)
+{
+    static const char truncated[] = "...\n";
+
+    if(buff == NULL || buff_len <= 0)
+        return;
+
+    size_t len = result.length();
+    if(len < (size_t)buff_len){
+        memcpy(buff, result.string(), len + 1);
+        return;
+    }
+
+    if((size_t)buff_len <= sizeof(truncated)){
+        buff[0] = '\0';
+        return;
+    }
+
+    len = buff_len - sizeof(truncated);
+    while(len > 0 && result.string()[len - 1] != '\n')
+        len--;
+
+    memcpy(buff, result.string(), len);
+    memcpy(buff + len, truncated, sizeof(truncated));
+}
+
+/*
+ * The summaries come first, so they survive when the detailed composer state
+ * does not fit in buff.
+ */
 static void hwc_dump(hwc_composer_device_1_t *dev,
         char *buff,
         int buff_len) {
     struct hwc_context_t *ctx = (struct hwc_context_t *)dev;
     String8 result;
     char buffer[1024];
+
+    hwc_dump_composition(ctx, result);
+    HWCTrace::dump(result);
+    HWCCapture::dump(result);
+    hwc_dump_fb_stats(ctx, result);
+    hwc_dump_gralloc_stats(ctx, result);
 #ifdef ENABLE_OVERLAY
-    if(ctx->overlayComposer){
-        ctx->overlayComposer->dump(result, buffer, 1024);
-        strncpy(buff, result.string(), buff_len - 1);
+    if(ctx->pFenceManager){
+        ctx->pFenceManager->dump(result, buffer, sizeof(buffer));
     }
 #endif
 #ifdef ENABLE_WFD_OPTIMIZATION
     if(ctx->virtualComposer){
-        ctx->virtualComposer->dump(result, buffer, 1024);
-        strncpy(buff, result.string(), buff_len - 1);
+        ctx->virtualComposer->dump(result, buffer, sizeof(buffer));
+    }
+#endif
+#ifdef ENABLE_OVERLAY
+    if(ctx->overlayComposer){
+        ctx->overlayComposer->dump(result, buffer, sizeof(buffer));
     }
 #endif
+    hwc_dump_copy(result, buff, buff_len);
 }
 
 static int hwc_query(hwc_composer_device_1_t *dev,
@@ -478,6 +722,7 @@ static int hwc_device_open(const struct hw_module_t* module, const char* name,
 
         /* initialize our state here */
         memset(dev, 0, sizeof(*dev));
+        HWCTrace::init();
 
         /* initialize the procs */
         dev->device.common.tag = HARDWARE_DEVICE_TAG;
@@ -547,13 +792,14 @@ static int hwc_device_open(const struct hw_module_t* module, const char* name,
         }
 
         private_module_t * m = (private_module_t *) gralloc;
+        HWCCapture::init((const gralloc_module_t *) gralloc);
 #ifdef ENABLE_WFD_OPTIMIZATION
         if(dev->virtualComposer)
-            dev->virtualComposer->setSourceDisplayInfo(&m->info);
+            dev->virtualComposer->setSourceDisplayInfo(m);
 #endif
 #ifdef ENABLE_OVERLAY
         if(dev->overlayComposer)
-            dev->overlayComposer->setSourceDisplayInfo(&m->info);
+            dev->overlayComposer->setSourceDisplayInfo(m);
 #endif
 #endif
     }
@@ -0,0 +1,685 @@
+/*
+ * Copyright (C) 2017 The LineageOS Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <map>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <sync/sync.h>
+#include <sw_sync.h>
+#include <utils/Condition.h>
+#include <utils/Mutex.h>
+#include <utils/String8.h>
+
+#include "gralloc_priv.h"
+#include "HWVirtualComposer.h"
+
+using namespace android;
+
+///< panel of the tests, small enough to compare by pixel.
+#define TEST_W 64
+#define TEST_H 48
+
+/*
+ * Fences. Each one is a file descriptor of /dev/null, so numbers are unique
+ * while open, with its state kept here.
+ */
+struct FakeFence
+{
+    ///< sw_sync timeline value, or -1 for a fence signaled by the test.
+    int timeline;
+    unsigned point;
+    bool signaled;
+
+    ///< fences of sync_merge.
+    std::vector<FakeFence*> parts;
+
+    ///< threads which entered sync_wait on this fence.
+    int waiters;
+};
+
+static Mutex gFenceLock;
+static Condition gFenceCondition;
+static std::map<int, FakeFence*> gFences;
+static std::map<int, unsigned> gTimelines;
+
+static bool isSignaledLocked(const FakeFence* fence)
+{
+    if(!fence->parts.empty()){
+        for(size_t i = 0; i < fence->parts.size(); ++i){
+            if(!isSignaledLocked(fence->parts[i])){
+                return false;
+            }
+        }
+        return true;
+    }
+
+    if(fence->timeline >= 0){
+        return gTimelines[fence->timeline] >= fence->point;
+    }
+
+    return fence->signaled;
+}
+
+///< fences stay allocated until the end of the test, closed fds are reused.
+static std::vector<FakeFence*> gAllFences;
+
+static int addFence(FakeFence* fence)
+{
+    int fd = open("/dev/null", O_RDONLY);
+    Mutex::Autolock lock(gFenceLock);
+    fence->waiters = 0;
+    gFences[fd] = fence;
+    gAllFences.push_back(fence);
+    return fd;
+}
+
+static FakeFence* findFence(int fd)
+{
+    Mutex::Autolock lock(gFenceLock);
+    return gFences.count(fd) ? gFences[fd] : NULL;
+}
+
+static bool waitFence(FakeFence* fence, int timeout)
+{
+    nsecs_t end = systemTime(SYSTEM_TIME_MONOTONIC) + ms2ns(timeout);
+    Mutex::Autolock lock(gFenceLock);
+
+    fence->waiters++;
+    gFenceCondition.broadcast();
+
+    while(!isSignaledLocked(fence)){
+        nsecs_t left = end - systemTime(SYSTEM_TIME_MONOTONIC);
+        if(left <= 0){
+            return false;
+        }
+        gFenceCondition.waitRelative(gFenceLock, left);
+    }
+    return true;
+}
+
+static bool isSignaled(FakeFence* fence)
+{
+    Mutex::Autolock lock(gFenceLock);
+    return isSignaledLocked(fence);
+}
+
+static void signalFence(FakeFence* fence)
+{
+    Mutex::Autolock lock(gFenceLock);
+    fence->signaled = true;
+    gFenceCondition.broadcast();
+}
+
+///< until some thread waits on fence, the worker took the frame then.
+static bool waitWaiter(FakeFence* fence, int timeout)
+{
+    nsecs_t end = systemTime(SYSTEM_TIME_MONOTONIC) + ms2ns(timeout);
+    Mutex::Autolock lock(gFenceLock);
+
+    while(0 == fence->waiters){
+        nsecs_t left = end - systemTime(SYSTEM_TIME_MONOTONIC);
+        if(left <= 0){
+            return false;
+        }
+        gFenceCondition.waitRelative(gFenceLock, left);
+    }
+    return true;
+}
+
+///< after the composer is gone, nothing waits any more.
+static void clearFences()
+{
+    Mutex::Autolock lock(gFenceLock);
+    for(size_t i = 0; i < gAllFences.size(); ++i){
+        delete gAllFences[i];
+    }
+    gAllFences.clear();
+    gFences.clear();
+}
+
+static int createFence(bool signaled, FakeFence** out)
+{
+    FakeFence* fence = new FakeFence();
+    fence->timeline = -1;
+    fence->point = 0;
+    fence->signaled = signaled;
+    *out = fence;
+    return addFence(fence);
+}
+
+extern "C" int sync_wait(int fd, int timeout)
+{
+    FakeFence* fence = findFence(fd);
+    if(NULL == fence){
+        errno = EINVAL;
+        return -1;
+    }
+
+    if(!waitFence(fence, timeout)){
+        errno = ETIME;
+        return -1;
+    }
+    return 0;
+}
+
+extern "C" int sync_merge(const char* name, int fd1, int fd2)
+{
+    (void)name;
+    FakeFence* a = findFence(fd1);
+    FakeFence* b = findFence(fd2);
+    if(NULL == a || NULL == b){
+        errno = EINVAL;
+        return -1;
+    }
+
+    FakeFence* fence = new FakeFence();
+    fence->timeline = -1;
+    fence->point = 0;
+    fence->signaled = false;
+    fence->parts.push_back(a);
+    fence->parts.push_back(b);
+    return addFence(fence);
+}
+
+extern "C" int sw_sync_timeline_create(void)
+{
+    int fd = open("/dev/null", O_RDONLY);
+    Mutex::Autolock lock(gFenceLock);
+    gTimelines[fd] = 0;
+    return fd;
+}
+
+extern "C" int sw_sync_timeline_inc(int fd, unsigned count)
+{
+    Mutex::Autolock lock(gFenceLock);
+    gTimelines[fd] += count;
+    gFenceCondition.broadcast();
+    return 0;
+}
+
+extern "C" int sw_sync_fence_create(int fd, const char* name, unsigned value)
+{
+    (void)name;
+    FakeFence* fence = new FakeFence();
+    fence->timeline = fd;
+    fence->point = value;
+    fence->signaled = false;
+    return addFence(fence);
+}
+
+/*
+ * CPU 2D engine. Physical addresses are keys of gMemory, blits are nearest
+ * neighbour copies of 32 bit pixels.
+ */
+static std::map<uint32_t, uint32_t*> gMemory;
+static uint32_t gNextAddress = 0x10000000;
+
+static uint32_t mapMemory(uint32_t* pixels)
+{
+    gNextAddress += 0x01000000;
+    gMemory[gNextAddress] = pixels;
+    return gNextAddress;
+}
+
+GcuEngine::GcuEngine()
+{
+}
+
+GcuEngine::~GcuEngine()
+{
+}
+
+bool GcuEngine::LoadHintPic(uint32_t id, const char* fileName)
+{
+    (void)id;
+    (void)fileName;
+    return true;
+}
+
+bool GcuEngine::isYUVOutputSupported()
+{
+    return true;
+}
+
+bool GcuEngine::getScratchBuffer(uint32_t width, uint32_t height,
+                                 void** virtAddr, uint32_t* physAddr)
+{
+    (void)width;
+    (void)height;
+    (void)virtAddr;
+    (void)physAddr;
+    return false;
+}
+
+bool GcuEngine::Blit(PBlitDataDesc blitDesc)
+{
+    uint32_t* dst = gMemory[blitDesc->mDstAddr];
+    const DISP_RECT& d = *blitDesc->mDstRect;
+    uint32_t dstPitch = blitDesc->mDstStride / 4;
+
+    if(NULL == dst){
+        return false;
+    }
+
+    if(GPU_BLIT_FILL == blitDesc->mBlitType){
+        for(int y = d.t; y < d.b; ++y){
+            for(int x = d.l; x < d.r; ++x){
+                dst[y * dstPitch + x] = blitDesc->mFillColor;
+            }
+        }
+        return true;
+    }
+
+    uint32_t* src = gMemory[blitDesc->mSrcAddr];
+    const DISP_RECT& s = *blitDesc->mSrcRect;
+    uint32_t srcPitch = blitDesc->mSrcStride / 4;
+
+    if(NULL == src || d.r <= d.l || d.b <= d.t){
+        return false;
+    }
+
+    for(int y = d.t; y < d.b; ++y){
+        int sy = s.t + (y - d.t) * (s.b - s.t) / (d.b - d.t);
+        for(int x = d.l; x < d.r; ++x){
+            int sx = s.l + (x - d.l) * (s.r - s.l) / (d.r - d.l);
+            dst[y * dstPitch + x] = src[sy * srcPitch + sx];
+        }
+    }
+    return true;
+}
+
+/*
+ * Encoder window with three RGBA buffers, handed out in turn.
+ */
+#define WINDOW_BUFFERS 3
+
+struct StubWindow
+{
+    ANativeWindow window;
+    ANativeWindowBuffer buffers[WINDOW_BUFFERS];
+    private_handle_t* handles[WINDOW_BUFFERS];
+    uint32_t pixels[WINDOW_BUFFERS][TEST_W * TEST_H];
+
+    int refs;
+    int next;
+    int dequeued;
+
+    ///< buffer index of each queued frame.
+    std::vector<int> queued;
+};
+
+static StubWindow* getStubWindow(const void* window)
+{
+    return (StubWindow*)window;
+}
+
+static void windowIncRef(struct android_native_base_t* base)
+{
+    getStubWindow(base)->refs++;
+}
+
+static void windowDecRef(struct android_native_base_t* base)
+{
+    getStubWindow(base)->refs--;
+}
+
+static int windowQuery(const ANativeWindow* window, int what, int* value)
+{
+    (void)window;
+    (void)what;
+    *value = 0;
+    return 0;
+}
+
+static int windowPerform(ANativeWindow* window, int operation, ...)
+{
+    (void)window;
+    (void)operation;
+    return 0;
+}
+
+static int windowDequeue(ANativeWindow* window, ANativeWindowBuffer** buffer)
+{
+    StubWindow* w = getStubWindow(window);
+    *buffer = &w->buffers[w->next];
+    w->next = (w->next + 1) % WINDOW_BUFFERS;
+    w->dequeued++;
+    return 0;
+}
+
+static int windowQueue(ANativeWindow* window, ANativeWindowBuffer* buffer)
+{
+    StubWindow* w = getStubWindow(window);
+    w->queued.push_back(buffer - w->buffers);
+    return 0;
+}
+
+///< compression reported by the gralloc stub for the primary framebuffer.
+static int gCompressed = 0;
+
+static int modulePerform(struct gralloc_module_t const* module, int operation, ...)
+{
+    (void)module;
+    if(GRALLOC_MODULE_PERFORM_GET_FB_COMPRESSED != operation){
+        return -EINVAL;
+    }
+
+    va_list args;
+    va_start(args, operation);
+    va_arg(args, buffer_handle_t);
+    int* compressed = va_arg(args, int*);
+    *compressed = gCompressed;
+    va_end(args);
+    return 0;
+}
+
+///< the HAL keeps the window in a 32 bit layer field, see LOCAL_MULTILIB.
+static StubWindow gWindow;
+
+///< primary framebuffer, one buffer per frame color.
+#define FB_BUFFERS 3
+
+class VirtualComposerTest : public ::testing::Test
+{
+protected:
+    virtual void SetUp()
+    {
+        gCompressed = 0;
+
+        memset(&module, 0, sizeof(module));
+        module.base.perform = modulePerform;
+        module.info.xres = TEST_W;
+        module.info.yres = TEST_H;
+        module.info.xres_virtual = TEST_W;
+        module.fps = 60.0f;
+
+        gWindow.refs = 0;
+        gWindow.next = 0;
+        gWindow.dequeued = 0;
+        gWindow.queued.clear();
+        gWindow.window.common.incRef = windowIncRef;
+        gWindow.window.common.decRef = windowDecRef;
+        gWindow.window.query = windowQuery;
+        gWindow.window.perform = windowPerform;
+        gWindow.window.dequeueBuffer_DEPRECATED = windowDequeue;
+        gWindow.window.queueBuffer_DEPRECATED = windowQueue;
+        for(int i = 0; i < WINDOW_BUFFERS; ++i){
+            gWindow.handles[i] = newHandle(0, gWindow.pixels[i]);
+            gWindow.buffers[i].handle = gWindow.handles[i];
+        }
+
+        for(int i = 0; i < FB_BUFFERS; ++i){
+            fbHandles[i] = newHandle(private_handle_t::PRIV_FLAGS_FRAMEBUFFER, fbPixels[i]);
+        }
+
+        primary = newContents(2);
+        primary->hwLayers[0].compositionType = HWC_FRAMEBUFFER;
+        primary->hwLayers[0].handle = fbHandles[0];
+        primary->hwLayers[0].displayFrame = makeRect(0, 0, TEST_W, TEST_H);
+        primary->hwLayers[1].compositionType = HWC_FRAMEBUFFER_TARGET;
+        primary->hwLayers[1].sourceCrop = makeRect(0, 0, TEST_W, TEST_H);
+        primary->hwLayers[1].displayFrame = makeRect(0, 0, TEST_W, TEST_H);
+
+        virt = newContents(1);
+        virt->hwLayers[0].compositionType = HWC_FRAMEBUFFER_TARGET;
+        virt->hwLayers[0].displayFrame = makeRect(0, 0, TEST_W, TEST_H);
+        virt->hwLayers[0].reserved[0] = (int32_t)(intptr_t)&gWindow.window;
+        virt->hwLayers[0].reserved[1] = DISPLAY_CONTENT_MIRROR;
+
+        displays[0] = primary;
+        displays[1] = NULL;
+        displays[2] = virt;
+
+        composer = new HWVirtualComposer();
+        composer->setSourceDisplayInfo(&module);
+        primary->flags = HWC_GEOMETRY_CHANGED;
+        frame = 0;
+    }
+
+    virtual void TearDown()
+    {
+        delete composer;
+        EXPECT_EQ(0, gWindow.refs);
+        clearFences();
+
+        free(primary);
+        free(virt);
+        for(int i = 0; i < WINDOW_BUFFERS; ++i){
+            delete gWindow.handles[i];
+        }
+        for(int i = 0; i < FB_BUFFERS; ++i){
+            delete fbHandles[i];
+        }
+    }
+
+    static hwc_rect_t makeRect(int l, int t, int r, int b)
+    {
+        hwc_rect_t rect = { l, t, r, b };
+        return rect;
+    }
+
+    static hwc_display_contents_1_t* newContents(size_t count)
+    {
+        size_t size = sizeof(hwc_display_contents_1_t) + count * sizeof(hwc_layer_1_t);
+        hwc_display_contents_1_t* list = (hwc_display_contents_1_t*)calloc(1, size);
+        list->numHwLayers = count;
+        for(size_t i = 0; i < count; ++i){
+            list->hwLayers[i].acquireFenceFd = -1;
+            list->hwLayers[i].releaseFenceFd = -1;
+            list->hwLayers[i].planeAlpha = 0xFF;
+        }
+        return list;
+    }
+
+    static private_handle_t* newHandle(int flags, uint32_t* pixels)
+    {
+        private_handle_t* handle = new private_handle_t(-1, TEST_W * TEST_H * 4, flags);
+        handle->format = HAL_PIXEL_FORMAT_RGBA_8888;
+        handle->width = TEST_W;
+        handle->height = TEST_H;
+        handle->mem_xstride = TEST_W * 4;
+        handle->mem_ystride = TEST_H;
+        handle->physAddr = mapMemory(pixels);
+        return handle;
+    }
+
+    /*
+     * Render color into the next primary framebuffer and run prepare and
+     * set on it. displayFenceFd becomes the release fence of the target,
+     * the release fence the composer left there is returned.
+     */
+    int post(uint32_t color, int acquireFenceFd, int displayFenceFd = -1)
+    {
+        int fb = frame % FB_BUFFERS;
+        for(int i = 0; i < TEST_W * TEST_H; ++i){
+            fbPixels[fb][i] = color;
+        }
+
+        ///< the app layer changes every frame, and over the rate cap.
+        if(frame > 0){
+            usleep(25000);
+        }
+        primary->hwLayers[0].handle = fbHandles[fb];
+        primary->hwLayers[1].handle = fbHandles[fb];
+        primary->hwLayers[1].releaseFenceFd = displayFenceFd;
+        frame++;
+
+        composer->prepare(3, displays);
+        composer->set(3, displays, acquireFenceFd);
+        primary->flags = 0;
+
+        return primary->hwLayers[1].releaseFenceFd;
+    }
+
+    static bool hasColor(int buffer, uint32_t color)
+    {
+        for(int i = 0; i < TEST_W * TEST_H; ++i){
+            if(gWindow.pixels[buffer][i] != color){
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool dumpHas(const char* text)
+    {
+        String8 result;
+        char buffer[1024];
+        composer->dump(result, buffer, sizeof(buffer));
+        return NULL != strstr(result.string(), text);
+    }
+
+    private_module_t module;
+    private_handle_t* fbHandles[FB_BUFFERS];
+    uint32_t fbPixels[FB_BUFFERS][TEST_W * TEST_H];
+    hwc_display_contents_1_t* primary;
+    hwc_display_contents_1_t* virt;
+    hwc_display_contents_1_t* displays[3];
+    HWVirtualComposer* composer;
+    int frame;
+};
+
+TEST_F(VirtualComposerTest, MirrorsFrame)
+{
+    FakeFence* acquire;
+    int releaseFd = post(0xFF0000FF, createFence(true, &acquire));
+
+    FakeFence* release = findFence(releaseFd);
+    ASSERT_TRUE(NULL != release);
+    ASSERT_TRUE(waitFence(release, 1000));
+
+    ASSERT_EQ(1u, gWindow.queued.size());
+    EXPECT_TRUE(hasColor(gWindow.queued[0], 0xFF0000FF));
+    close(releaseFd);
+}
+
+TEST_F(VirtualComposerTest, ReleaseFenceWaitsForDisplayAndWorker)
+{
+    FakeFence* acquire;
+    FakeFence* display;
+    int acquireFd = createFence(false, &acquire);
+    int releaseFd = post(0xFF00FF00, acquireFd, createFence(false, &display));
+
+    ///< merged with the display fence, which the composer closed.
+    FakeFence* release = findFence(releaseFd);
+    ASSERT_TRUE(NULL != release);
+    EXPECT_EQ(2u, release->parts.size());
+
+    ///< shown and released by the display, but not read by the worker yet.
+    ASSERT_TRUE(waitWaiter(acquire, 1000));
+    signalFence(display);
+    EXPECT_FALSE(isSignaled(release));
+
+    signalFence(acquire);
+    EXPECT_TRUE(waitFence(release, 1000));
+    EXPECT_EQ(1u, gWindow.queued.size());
+    close(releaseFd);
+
+    ///< read by the worker, but still on the display.
+    int nextFd = post(0xFF00FFFF, -1, createFence(false, &display));
+    FakeFence* next = findFence(nextFd);
+    ASSERT_TRUE(NULL != next);
+    ASSERT_EQ(2u, next->parts.size());
+    ASSERT_TRUE(waitFence(next->parts[1], 1000));
+    EXPECT_EQ(2u, gWindow.queued.size());
+    EXPECT_FALSE(isSignaled(next));
+
+    signalFence(display);
+    EXPECT_TRUE(isSignaled(next));
+    close(nextFd);
+}
+
+TEST_F(VirtualComposerTest, NewerFrameReplacesQueuedOne)
+{
+    FakeFence* acquireA;
+    FakeFence* acquireB;
+    FakeFence* acquireC;
+
+    ///< the worker takes A and waits for it to be rendered.
+    int releaseA = post(0xFF0000AA, createFence(false, &acquireA));
+    ASSERT_TRUE(waitWaiter(acquireA, 1000));
+
+    ///< B waits in the queue, C takes its place.
+    int releaseB = post(0xFF0000BB, createFence(true, &acquireB));
+    EXPECT_EQ(2, gWindow.refs);
+    int releaseC = post(0xFF0000CC, createFence(true, &acquireC));
+    EXPECT_EQ(2, gWindow.refs);
+    EXPECT_TRUE(dumpHas("[Replaced Queued] : [1]"));
+
+    ///< B is only released with C.
+    FakeFence* fenceB = findFence(releaseB);
+    FakeFence* fenceC = findFence(releaseC);
+    ASSERT_TRUE(NULL != fenceB && NULL != fenceC);
+    EXPECT_FALSE(isSignaled(fenceB));
+
+    signalFence(acquireA);
+    ASSERT_TRUE(waitFence(fenceC, 1000));
+    EXPECT_TRUE(isSignaled(fenceB));
+    EXPECT_TRUE(isSignaled(findFence(releaseA)));
+
+    ///< A then C, B never reached the encoder.
+    ASSERT_EQ(2u, gWindow.queued.size());
+    EXPECT_TRUE(hasColor(gWindow.queued[0], 0xFF0000AA));
+    EXPECT_TRUE(hasColor(gWindow.queued[1], 0xFF0000CC));
+    EXPECT_EQ(0, gWindow.refs);
+
+    close(releaseA);
+    close(releaseB);
+    close(releaseC);
+}
+
+TEST_F(VirtualComposerTest, AcquireTimeoutSkipsFrame)
+{
+    FakeFence* acquire;
+
+    ///< never rendered, the worker gives up after VIRTUAL_ACQUIRE_TIMEOUT.
+    int releaseFd = post(0xFF123456, createFence(false, &acquire));
+    FakeFence* release = findFence(releaseFd);
+    ASSERT_TRUE(NULL != release);
+    ASSERT_TRUE(waitFence(release, VIRTUAL_ACQUIRE_TIMEOUT * 3));
+
+    EXPECT_EQ(0, gWindow.dequeued);
+    EXPECT_TRUE(dumpHas("[Acquire Timeouts] : [1]"));
+    close(releaseFd);
+
+    ///< the next frame is mirrored.
+    int nextFd = post(0xFF654321, -1);
+    ASSERT_TRUE(waitFence(findFence(nextFd), 1000));
+    ASSERT_EQ(1u, gWindow.queued.size());
+    EXPECT_TRUE(hasColor(gWindow.queued[0], 0xFF654321));
+    close(nextFd);
+}
+
+TEST_F(VirtualComposerTest, CompressedFrameNotMirrored)
+{
+    gCompressed = 1;
+
+    int releaseFd = post(0xFF000000, -1);
+    ASSERT_TRUE(waitFence(findFence(releaseFd), 1000));
+
+    EXPECT_EQ(0, gWindow.dequeued);
+    EXPECT_TRUE(dumpHas("[Failed] : [1]"));
+    close(releaseFd);
+}
@@ -21,7 +21,35 @@ include $(CLEAR_VARS)
 
 LOCAL_MODULE_RELATIVE_PATH := hw
 LOCAL_C_INCLUDES += hardware/libhardware/include
+LOCAL_C_INCLUDES += $(LOCAL_PATH)/../libgralloc
 LOCAL_SHARED_LIBRARIES := $(common_libs)
-LOCAL_SRC_FILES := memtrack_mrvl.c
+LOCAL_SRC_FILES := memtrack_mrvl.c memtrack_ion.c
 LOCAL_MODULE := memtrack.$(TARGET_BOARD_PLATFORM)
 include $(BUILD_SHARED_LIBRARY)
+
+# Sampler daemon of the memory timeline
+include $(CLEAR_VARS)
+
+LOCAL_C_INCLUDES += hardware/libhardware/include
+LOCAL_C_INCLUDES += $(LOCAL_PATH)/../libgralloc
+LOCAL_SHARED_LIBRARIES := $(common_libs)
+LOCAL_SRC_FILES := memtrack_mrvl.c memtrack_ion.c memtrack_timeline.c memtrack_timelined.c
+LOCAL_MODULE := memtrack_timelined
+LOCAL_MODULE_TAGS := optional
+LOCAL_INIT_RC := memtrack_timelined.rc
+include $(BUILD_EXECUTABLE)
+
+# CSV dumper for the memory timeline
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := memtrack_timeline_dump.c
+LOCAL_MODULE := memtrack_timeline
+LOCAL_MODULE_TAGS := optional
+include $(BUILD_EXECUTABLE)
+
+# Host unit test of the ION heap dump parser
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := memtrack_ion.c tests/memtrack_ion_test.cpp
+LOCAL_MODULE := memtrack_ion_test
+include $(BUILD_HOST_NATIVE_TEST)
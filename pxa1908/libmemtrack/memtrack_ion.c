@@ -0,0 +1,223 @@
+/*
+ * Copyright (C) 2016 The CyanogenMod Project
+ *               2017 The LineageOS Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "memtrack_mrvl.h"
+
+/*
+ * Parser of the ION heap debugfs dumps. Plain C without HAL dependency, so
+ * it is unit tested on the host, see tests/memtrack_ion_test.cpp.
+ */
+
+/* Client pids remembered per buffer line, further clients are only counted. */
+#define ION_MAX_LINE_CLIENTS    64
+
+static char *skip_blanks(char *p)
+{
+    while( *p == ' ' || *p == '\t' )
+        ++p;
+    return p;
+}
+
+static char *skip_token(char *p)
+{
+    while( *p && *p != ' ' && *p != '\t' && *p != '\n' )
+        ++p;
+    return p;
+}
+
+/*
+ * Parse one buffer line of an ION heap dump:
+ *   <buffer:hex> <size_KB> <hex> <refs> <name> [<pid> <n> <n> <client>]...
+ * Returns the number of clients (pids holds the first max_pids of them),
+ * 0 if this is not a buffer line.
+ */
+extern int parse_ion_line(char *line, int *sizeKB, int *pids, int max_pids)
+{
+    char *p = line;
+    char *end;
+    int clients = 0;
+    int base;
+    int field;
+
+    // Buffer, size, hex and refs columns, then the buffer name
+    for( field = 0; field < 4; ++field )
+    {
+        base = (field == 0 || field == 2) ? 16 : 10;
+        p = skip_blanks(p);
+        long value = strtol(p, &end, base);
+        if( end == p )
+            return 0;
+        if( field == 1 )
+            *sizeKB = (int)value;
+        p = end;
+    }
+    p = skip_blanks(p);
+    if( *p == '\0' || *p == '\n' )
+        return 0;
+    p = skip_token(p);
+
+    // One bracket per client holding the buffer
+    while( 1 )
+    {
+        p = skip_blanks(p);
+        if( *p != '[' )
+            break;
+
+        int pid = (int)strtol(p + 1, &end, 10);
+        if( end == p + 1 )
+            break;
+        p = strchr(end, ']');
+        if( p == NULL || p == end )
+            break;
+        ++p;
+
+        if( clients < max_pids )
+            pids[clients] = pid;
+        ++clients;
+    }
+
+    return clients;
+}
+
+extern struct ion_usage *find_ion_usage(struct ion_snapshot *snapshot, int pid, int insert)
+{
+    size_t mask;
+    size_t slot;
+
+    if( insert && (snapshot->count + 1) * 2 > snapshot->capacity )
+    {
+        // Rehash into a table twice as large
+        struct ion_usage *old = snapshot->usage;
+        size_t capacity = snapshot->capacity;
+        size_t i;
+
+        snapshot->capacity = capacity ? capacity * 2 : ION_SNAPSHOT_MIN_PIDS;
+        snapshot->usage = calloc(snapshot->capacity, sizeof(struct ion_usage));
+        if( snapshot->usage == NULL )
+        {
+            snapshot->usage = old;
+            snapshot->capacity = capacity;
+            return NULL;
+        }
+
+        snapshot->count = 0;
+        for( i = 0; i < capacity; ++i )
+        {
+            if( old[i].pid > 0 )
+                *find_ion_usage(snapshot, old[i].pid, 1) = old[i];
+        }
+        free(old);
+    }
+
+    if( snapshot->capacity == 0 )
+        return NULL;
+
+    mask = snapshot->capacity - 1;
+    slot = ((uint32_t)pid * 2654435761U) & mask;
+    while( snapshot->usage[slot].pid != pid )
+    {
+        if( snapshot->usage[slot].pid == 0 )
+        {
+            if( !insert )
+                return NULL;
+            snapshot->usage[slot].pid = pid;
+            snapshot->count++;
+            break;
+        }
+        slot = (slot + 1) & mask;
+    }
+
+    return &snapshot->usage[slot];
+}
+
+/*
+ * Parse a heap dump once into the pid table of the snapshot.
+ */
+extern int collect_ion_snapshot(struct ion_snapshot *snapshot)
+{
+    FILE *file;
+    char line[1024];
+    int pids[ION_MAX_LINE_CLIENTS];
+    int sizeKB;
+    int clients;
+    int owners;
+    int i;
+    int j;
+
+    if( snapshot->usage )
+        memset(snapshot->usage, 0, snapshot->capacity * sizeof(struct ion_usage));
+    snapshot->count = 0;
+    snapshot->timestamp = now_ns();
+
+    file = fopen(snapshot->filename, "r");
+    if( file == NULL )
+    {
+        snapshot->result = -errno;
+        return snapshot->result;
+    }
+
+    while( fgets(line, sizeof(line), file) )
+    {
+        clients = parse_ion_line(line, &sizeKB, pids, ION_MAX_LINE_CLIENTS);
+        if( clients == 0 )
+            continue;
+
+        // A process holding several handles on the buffer is one owner
+        owners = 0;
+        for( i = 0; i < clients && i < ION_MAX_LINE_CLIENTS; ++i )
+        {
+            for( j = 0; j < owners && pids[j] != pids[i]; ++j )
+                ;
+            if( j == owners )
+                pids[owners++] = pids[i];
+        }
+        if( clients > ION_MAX_LINE_CLIENTS )
+            owners += clients - ION_MAX_LINE_CLIENTS;
+
+        for( i = 0; i < owners && i < ION_MAX_LINE_CLIENTS; ++i )
+        {
+            struct ion_usage *usage;
+            uint64_t bytes = (uint64_t)sizeKB * 1024;
+
+            if( pids[i] <= 0 )
+                continue;
+            usage = find_ion_usage(snapshot, pids[i], 1);
+            if( usage == NULL )
+                break;
+
+            if( owners == 1 )
+            {
+                usage->privateBytes += bytes;
+                usage->pssBytes += bytes;
+            }
+            else
+            {
+                usage->sharedBytes += bytes;
+                usage->pssBytes += bytes / (uint64_t)owners;
+            }
+        }
+    }
+
+    fclose(file);
+    snapshot->result = 0;
+    return 0;
+}
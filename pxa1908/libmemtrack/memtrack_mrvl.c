@@ -20,16 +20,32 @@
 #include <hardware/memtrack.h>
 
 #include "memtrack_mrvl.h"
+#include "gc_gralloc_registry.h"
 
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
 
+#include <cutils/properties.h>
+
+// Private bytes, then bytes of buffers shared with other processes
 extern struct memtrack_record record_templates[] = {
-    { 0x000, MEMTRACK_FLAG_NONSECURE|MEMTRACK_FLAG_PRIVATE|MEMTRACK_FLAG_SMAPS_ACCOUNTED },
     { 0x000, MEMTRACK_FLAG_NONSECURE|MEMTRACK_FLAG_PRIVATE|MEMTRACK_FLAG_SMAPS_UNACCOUNTED },
+    { 0x000, MEMTRACK_FLAG_NONSECURE|MEMTRACK_FLAG_SHARED|MEMTRACK_FLAG_SMAPS_UNACCOUNTED },
 };
 
+static struct ion_snapshot system_heap = { "/sys/kernel/debug/ion/heaps/system_heap" };
+static struct ion_snapshot carveout_heap = { "/sys/kernel/debug/ion/heaps/carveout_heap" };
+
+// Guards both heap snapshots, getMemory is called from binder threads
+static pthread_mutex_t snapshot_lock = PTHREAD_MUTEX_INITIALIZER;
+static int64_t snapshot_max_age = 1000000000LL;
+static int pss_mode;
+
 extern int read_gcmem_alloc(int pid, int *rsize)
 {
     char gcmem_file[128];
@@ -58,59 +74,157 @@ extern int read_gcmem_alloc(int pid, int *rsize)
     return 0;
 }
 
-extern int read_ion_debug(int pid, const char *filename, int *rsize)
+extern int read_gralloc_registry(int pid, int *rsize)
 {
-    FILE *file;
-    int res = -1;
-    char line[1024];
-    char *subline;
-    int i;
-    int sizeKB;
-    int readPID;
-    int offset;
+    char stats_file[128];
+    struct gc_gralloc_registry_stats stats;
+    uint64_t startTime;
+    ssize_t len;
+    int fd;
 
-    file = fopen(filename, "r");
-    if( file == NULL )
+    snprintf(stats_file, 128, GC_GRALLOC_REGISTRY_STATS_DIR "/%d", pid);
+    fd = open(stats_file, O_RDONLY | O_CLOEXEC);
+    if( fd < 0 )
         return -errno;
 
-    while( fgets(line, sizeof(line), file) )
+    len = pread(fd, &stats, sizeof(stats), 0);
+    close(fd);
+
+    if( len != sizeof(stats) || stats.magic != GC_GRALLOC_REGISTRY_MAGIC || stats.pid != (uint32_t)pid )
+        return -1;
+
+    // Left behind by a dead process, whose pid may have been recycled.
+    // A live owner notices the removal and publishes into a new file.
+    if( gc_gralloc_read_start_time(pid, &startTime) || startTime != stats.startTime )
+    {
+        unlink(stats_file);
+        return -1;
+    }
+
+    // Only what the ION system heap holds, the rest has a type of its own
+    *rsize = (int)((stats.importedBytes - stats.videoMemoryBytes - stats.contiguousBytes) / 1024);
+    return 0;
+}
+
+extern int read_ion_debug(int pid, struct ion_snapshot *snapshot, struct ion_usage *rusage)
+{
+    struct ion_usage *usage;
+    int res;
+
+    pthread_mutex_lock(&snapshot_lock);
+
+    if( snapshot->timestamp == 0 || now_ns() - snapshot->timestamp > snapshot_max_age )
+        collect_ion_snapshot(snapshot);
+
+    res = snapshot->result;
+    if( res == 0 )
     {
-        i = 0;
-        offset = 0;
-        // Find the size_KB column and the offset to pid
-        sscanf(line, "%*x %zu %*x %*u %*s%n ", &sizeKB, &offset);
-        if( offset )
+        usage = find_ion_usage(snapshot, pid, 0);
+        if( usage )
+            *rusage = *usage;
+        else
+            res = -1;
+    }
+
+    pthread_mutex_unlock(&snapshot_lock);
+    return res;
+}
+
+/*
+ * Parse both heaps now, for callers which want every pid at once.
+ */
+extern void refresh_ion_snapshots(void)
+{
+    pthread_mutex_lock(&snapshot_lock);
+    collect_ion_snapshot(&system_heap);
+    collect_ion_snapshot(&carveout_heap);
+    pthread_mutex_unlock(&snapshot_lock);
+}
+
+/*
+ * Pids found in either heap snapshot, unsorted and possibly repeated.
+ */
+extern size_t list_ion_pids(int *pids, size_t max_pids)
+{
+    struct ion_snapshot *heaps[] = { &system_heap, &carveout_heap };
+    size_t count = 0;
+    size_t h;
+    size_t i;
+
+    pthread_mutex_lock(&snapshot_lock);
+    for( h = 0; h < sizeof(heaps) / sizeof(heaps[0]); ++h )
+    {
+        for( i = 0; i < heaps[h]->capacity && count < max_pids; ++i )
         {
-            subline = &line[offset];
-            int found = 0;
-            while( 1 )
-            {
-                offset = 0;
-                sscanf(subline, " [%d %*d %*d %*[^]]]%n", &readPID, &offset);
-                if( offset == 0 )
-                    break;
-                ++i;
-                subline += offset;
-                if( readPID == pid )
-                    found = 1;
-            }
-            if( found )
-            {
-                res = offset;
-                *rsize = sizeKB/i;
-            }
+            if( heaps[h]->usage[i].pid > 0 )
+                pids[count++] = heaps[h]->usage[i].pid;
         }
     }
+    pthread_mutex_unlock(&snapshot_lock);
 
-    fclose(file);
+    return count;
+}
+
+/*
+ * Usage of one memtrack type for a pid, from the best available source.
+ */
+extern int read_memtrack_usage(int pid, int type, struct ion_usage *usage)
+{
+    int res;
+    int rsize = 0;
+
+    memset(usage, 0, sizeof(*usage));
+    if( type == MEMTRACK_TYPE_GL )
+    {
+        res = read_gcmem_alloc(pid, &rsize);
+        usage->privateBytes = (uint64_t)rsize * 1024; // Size is in KB
+        usage->pssBytes = usage->privateBytes;
+    }
+    else if( type == MEMTRACK_TYPE_GRAPHICS )
+    {
+        // The heap dump tells shared buffers apart, without debugfs fall
+        // back to what gralloc registered in the process itself and report
+        // it all as private
+        res = read_ion_debug(pid, &system_heap, usage);
+        if( res && read_gralloc_registry(pid, &rsize) == 0 )
+        {
+            usage->privateBytes = (uint64_t)rsize * 1024;
+            usage->pssBytes = usage->privateBytes;
+            res = 0;
+        }
+    }
+    else
+    {
+        res = read_ion_debug(pid, &carveout_heap, usage);
+    }
 
+    if( res )
+        memset(usage, 0, sizeof(*usage));
     return res;
 }
 
+/*
+ * Bytes charged to the process, the way the records report them.
+ */
+extern uint64_t memtrack_usage_total(const struct ion_usage *usage)
+{
+    return pss_mode ? usage->pssBytes : usage->privateBytes + usage->sharedBytes;
+}
+
 extern int mrvl_memtrack_init(const struct memtrack_module *module)
 {
+    char value[PROPERTY_VALUE_MAX];
+
     if(!module)
         return -1;
+
+    // How old a heap snapshot may get before queries parse the heap again
+    property_get("persist.memtrack.snapshot_ms", value, "1000");
+    snapshot_max_age = (int64_t)atoi(value) * 1000000LL;
+
+    // Charge shared buffers proportionally instead of in full to every owner
+    property_get("persist.memtrack.pss", value, "0");
+    pss_mode = atoi(value) != 0;
     return 0;
 }
 
@@ -121,8 +235,7 @@ extern int mrvl_memtrack_get_memory(const struct memtrack_module *module,
                                 size_t *num_records)
 {
     int nrecords;
-    int res;
-    int rsize = 0;
+    struct ion_usage usage;
     if( !module )
         return -1;
     if( type > MEMTRACK_TYPE_GRAPHICS )
@@ -136,28 +249,24 @@ extern int mrvl_memtrack_get_memory(const struct memtrack_module *module,
     if( nrecords )
     {
         memcpy(records, &record_templates, sizeof(struct memtrack_record) * nrecords);
-        if( type == MEMTRACK_TYPE_GL )
-        {
-            res = read_gcmem_alloc(pid, &rsize);
-        }
-        else
+        read_memtrack_usage(pid, type, &usage);
+
+        if( pss_mode )
         {
-            if( type == MEMTRACK_TYPE_GRAPHICS )
+            // Proportional share of shared buffers, private ones included
+            records[0].size_in_bytes = usage.privateBytes;
+            if( nrecords == 2 )
             {
-                res = read_ion_debug(pid, "/sys/kernel/debug/ion/heaps/system_heap", &rsize);
-            }
-            else
-            {
-                res = read_ion_debug(pid, "/sys/kernel/debug/ion/heaps/carveout_heap", &rsize);
+                records[1].flags = MEMTRACK_FLAG_NONSECURE|MEMTRACK_FLAG_SHARED_PSS|MEMTRACK_FLAG_SMAPS_UNACCOUNTED;
+                records[1].size_in_bytes = usage.pssBytes - usage.privateBytes;
             }
         }
-        if( res )
-            rsize = 0;
         else
-            rsize *= 1024; // Size is in KB, so convert it to B
-        records[0].size_in_bytes = 0;
-        if( nrecords == 2 )
-            records[1].size_in_bytes = rsize;
+        {
+            records[0].size_in_bytes = usage.privateBytes;
+            if( nrecords == 2 )
+                records[1].size_in_bytes = usage.sharedBytes;
+        }
     }
     return 0;
 }
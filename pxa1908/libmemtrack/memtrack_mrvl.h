@@ -18,5 +18,71 @@
 #ifndef _MEMTRACK_MRVL_H_
 #define _MEMTRACK_MRVL_H_
 
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+/* Initial size of the pid table of a heap snapshot, must be a power of 2. */
+#define ION_SNAPSHOT_MIN_PIDS   64
+
+struct ion_usage
+{
+    /* 0 marks a free slot. */
+    int pid;
+
+    /* Buffers held by this process only. */
+    uint64_t privateBytes;
+
+    /* Buffers also held by other processes, in full. */
+    uint64_t sharedBytes;
+
+    /* Private bytes plus an equal share of every shared buffer. */
+    uint64_t pssBytes;
+};
+
+/*
+ * Per-pid usage of one ION heap, parsed from its debugfs dump in a single
+ * pass and shared by all queries until it gets older than
+ * persist.memtrack.snapshot_ms (0: parse on every query).
+ */
+struct ion_snapshot
+{
+    const char *filename;
+
+    /* CLOCK_MONOTONIC time of the last parse in ns, 0 if never parsed. */
+    int64_t timestamp;
+
+    /* 0, or -errno when the heap dump could not be read. */
+    int result;
+
+    /* Open addressing table keyed by pid, capacity is a power of 2. */
+    struct ion_usage *usage;
+    size_t capacity;
+    size_t count;
+};
+
+static inline int64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+struct memtrack_module;
+
+extern int mrvl_memtrack_init(const struct memtrack_module *module);
+
+/* memtrack_ion.c */
+extern int parse_ion_line(char *line, int *sizeKB, int *pids, int max_pids);
+extern struct ion_usage *find_ion_usage(struct ion_snapshot *snapshot, int pid, int insert);
+extern int collect_ion_snapshot(struct ion_snapshot *snapshot);
+
+/* memtrack_mrvl.c */
+extern int read_ion_debug(int pid, struct ion_snapshot *snapshot, struct ion_usage *rusage);
+extern void refresh_ion_snapshots(void);
+extern size_t list_ion_pids(int *pids, size_t max_pids);
+extern int read_memtrack_usage(int pid, int type, struct ion_usage *usage);
+extern uint64_t memtrack_usage_total(const struct ion_usage *usage);
 
 #endif
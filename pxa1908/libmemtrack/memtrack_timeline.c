@@ -0,0 +1,241 @@
+/*
+ * Copyright (C) 2016 The CyanogenMod Project
+ *               2017 The LineageOS Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "memtrack_timeline"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <cutils/log.h>
+#include <hardware/memtrack.h>
+
+#include "memtrack_mrvl.h"
+#include "memtrack_timeline.h"
+#include "gc_gralloc_registry.h"
+
+/*
+ * Sampler of per-process graphics memory, run by memtrack_timelined.
+ *
+ * Every tick parses each ION heap once, then queries every process found in
+ * the heaps, in gcmem or in the gralloc registry through the same path as
+ * getMemory.
+ */
+
+static struct memtrack_timeline_record *ring;
+static uint32_t ring_head;
+static uint32_t ring_count;
+
+static uint32_t interval;
+static uint64_t start_time;
+static int64_t start_mono;
+
+static int64_t clock_ns(clockid_t clock)
+{
+    struct timespec ts;
+
+    clock_gettime(clock, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int compare_pids(const void *a, const void *b)
+{
+    return *(const int *)a - *(const int *)b;
+}
+
+/*
+ * Append the pids named by the numeric suffix of the entries of a directory.
+ */
+static size_t list_dir_pids(const char *dir, const char *prefix, int *pids, size_t count, size_t max_pids)
+{
+    size_t len = strlen(prefix);
+    struct dirent *entry;
+    DIR *d;
+
+    d = opendir(dir);
+    if( d == NULL )
+        return count;
+
+    while( count < max_pids && (entry = readdir(d)) != NULL )
+    {
+        char *end;
+        long pid;
+
+        if( strncmp(entry->d_name, prefix, len) )
+            continue;
+        pid = strtol(entry->d_name + len, &end, 10);
+        if( *end == '\0' && pid > 0 )
+            pids[count++] = (int)pid;
+    }
+
+    closedir(d);
+    return count;
+}
+
+static uint32_t usage_kb(int pid, int type)
+{
+    struct ion_usage usage;
+
+    if( read_memtrack_usage(pid, type, &usage) )
+        return 0;
+    return (uint32_t)(memtrack_usage_total(&usage) / 1024);
+}
+
+static void sample(int *pids)
+{
+    uint32_t now = (uint32_t)((clock_ns(CLOCK_MONOTONIC) - start_mono) / 1000000);
+    size_t count;
+    size_t i;
+
+    refresh_ion_snapshots();
+
+    count = list_ion_pids(pids, MEMTRACK_TIMELINE_MAX_PIDS);
+    count = list_dir_pids("/proc/driver/gcmem", "gcmem-", pids, count, MEMTRACK_TIMELINE_MAX_PIDS);
+    count = list_dir_pids(GC_GRALLOC_REGISTRY_STATS_DIR, "", pids, count, MEMTRACK_TIMELINE_MAX_PIDS);
+    qsort(pids, count, sizeof(int), compare_pids);
+
+    for( i = 0; i < count; ++i )
+    {
+        struct memtrack_timeline_record *record;
+
+        if( i > 0 && pids[i] == pids[i - 1] )
+            continue;
+
+        record = &ring[ring_head];
+        record->time = now;
+        record->pid = pids[i];
+        record->glKB = usage_kb(pids[i], MEMTRACK_TYPE_GL);
+        record->graphicsKB = usage_kb(pids[i], MEMTRACK_TYPE_GRAPHICS);
+        record->otherKB = usage_kb(pids[i], MEMTRACK_TYPE_OTHER);
+        if( !record->glKB && !record->graphicsKB && !record->otherKB )
+            continue;
+
+        ring_head = (ring_head + 1) % MEMTRACK_TIMELINE_RECORDS;
+        if( ring_count < MEMTRACK_TIMELINE_RECORDS )
+            ring_count++;
+    }
+}
+
+/*
+ * Write the ring oldest first, through a temporary file so readers never see
+ * a partial export.
+ */
+static int export_ring(void)
+{
+    struct memtrack_timeline_header header;
+    uint32_t first = (ring_head + MEMTRACK_TIMELINE_RECORDS - ring_count) % MEMTRACK_TIMELINE_RECORDS;
+    uint32_t tail = ring_count < MEMTRACK_TIMELINE_RECORDS - first ? ring_count : MEMTRACK_TIMELINE_RECORDS - first;
+    int fd;
+    int res = 0;
+
+    header.magic = MEMTRACK_TIMELINE_MAGIC;
+    header.version = MEMTRACK_TIMELINE_VERSION;
+    header.recordSize = sizeof(struct memtrack_timeline_record);
+    header.intervalMs = interval;
+    header.count = ring_count;
+    header.startTime = start_time;
+
+    fd = open(MEMTRACK_TIMELINE_FILE ".tmp", O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if( fd < 0 )
+        return -errno;
+
+    if( write(fd, &header, sizeof(header)) != sizeof(header)
+     || write(fd, &ring[first], tail * sizeof(ring[0])) != (ssize_t)(tail * sizeof(ring[0]))
+     || write(fd, &ring[0], (ring_count - tail) * sizeof(ring[0])) != (ssize_t)((ring_count - tail) * sizeof(ring[0])) )
+        res = -EIO;
+
+    close(fd);
+    if( res == 0 && rename(MEMTRACK_TIMELINE_FILE ".tmp", MEMTRACK_TIMELINE_FILE) )
+        res = -errno;
+
+    return res;
+}
+
+static void sampler_loop(int *pids)
+{
+    struct timespec next;
+    int64_t cpu_start = clock_ns(CLOCK_THREAD_CPUTIME_ID);
+    int64_t cpu;
+    int64_t elapsed;
+    uint32_t ticks = 0;
+    int warned = 0;
+    int res;
+
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    while( 1 )
+    {
+        sample(pids);
+
+        if( ++ticks % MEMTRACK_TIMELINE_EXPORT_TICKS == 0 )
+        {
+            res = export_ring();
+            if( res )
+                ALOGW("Failed to export %s: %s", MEMTRACK_TIMELINE_FILE, strerror(-res));
+
+            // Keep an eye on the cost of sampling
+            cpu = clock_ns(CLOCK_THREAD_CPUTIME_ID) - cpu_start;
+            elapsed = clock_ns(CLOCK_MONOTONIC) - start_mono;
+            if( !warned && cpu * 1000 > elapsed * MEMTRACK_TIMELINE_BUDGET )
+            {
+                ALOGW("Sampling every %u ms costs %lld.%lld%% cpu", interval,
+                      (long long)(cpu * 100 / elapsed), (long long)(cpu * 1000 / elapsed % 10));
+                warned = 1;
+            }
+        }
+
+        next.tv_sec += interval / 1000;
+        next.tv_nsec += (long)(interval % 1000) * 1000000L;
+        if( next.tv_nsec >= 1000000000L )
+        {
+            next.tv_sec++;
+            next.tv_nsec -= 1000000000L;
+        }
+        while( clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL) == EINTR )
+            ;
+    }
+}
+
+/*
+ * Sample every interval_ms in the calling thread. Only returns on error.
+ */
+extern int run_memtrack_timeline(uint32_t interval_ms)
+{
+    int *pids;
+
+    ring = calloc(MEMTRACK_TIMELINE_RECORDS, sizeof(ring[0]));
+    pids = malloc(MEMTRACK_TIMELINE_MAX_PIDS * sizeof(int));
+    if( ring == NULL || pids == NULL )
+    {
+        free(ring);
+        free(pids);
+        ring = NULL;
+        return -ENOMEM;
+    }
+
+    interval = interval_ms;
+    start_time = (uint64_t)(clock_ns(CLOCK_REALTIME) / 1000000);
+    start_mono = clock_ns(CLOCK_MONOTONIC);
+
+    ALOGI("Sampling graphics memory every %u ms into %s", interval, MEMTRACK_TIMELINE_FILE);
+    sampler_loop(pids);
+    return 0;
+}
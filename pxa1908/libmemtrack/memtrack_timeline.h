@@ -0,0 +1,81 @@
+/*
+ * Copyright (C) 2016 The CyanogenMod Project
+ *               2017 The LineageOS Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _MEMTRACK_TIMELINE_H_
+#define _MEMTRACK_TIMELINE_H_
+
+/*
+ * Layout of the memory timeline exported by memtrack_timelined.
+ *
+ * This header is shared with the memtrack_timeline dump tool and must stay
+ * free of any HAL dependency.
+ */
+
+#include <stdint.h>
+
+/* Exported ring, rewritten as a whole every MEMTRACK_TIMELINE_EXPORT_TICKS.
+ * The directory is created by memtrack_timelined.rc. */
+#define MEMTRACK_TIMELINE_DIR           "/data/misc/memtrack"
+#define MEMTRACK_TIMELINE_FILE          MEMTRACK_TIMELINE_DIR "/timeline"
+
+#define MEMTRACK_TIMELINE_MAGIC         0x4c54544d /* 'MTTL' */
+#define MEMTRACK_TIMELINE_VERSION       1
+
+/* Records kept in memory, the oldest get overwritten. */
+#define MEMTRACK_TIMELINE_RECORDS       16384
+
+/* Processes sampled per tick. */
+#define MEMTRACK_TIMELINE_MAX_PIDS      1024
+
+/* Ticks between two exports. */
+#define MEMTRACK_TIMELINE_EXPORT_TICKS  60
+
+/* Sampling cost budget, in thousandths of the interval. */
+#define MEMTRACK_TIMELINE_BUDGET        5
+
+struct memtrack_timeline_header
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t recordSize;
+
+    /* Sampling interval. */
+    uint32_t intervalMs;
+
+    /* Records following the header, oldest first. */
+    uint32_t count;
+
+    /* CLOCK_REALTIME in ms when sampling started. */
+    uint64_t startTime;
+};
+
+/* One process at one tick, only processes with some usage are recorded. */
+struct memtrack_timeline_record
+{
+    /* ms since startTime. */
+    uint32_t time;
+    int32_t pid;
+
+    /* MEMTRACK_TYPE_GL, MEMTRACK_TYPE_GRAPHICS and MEMTRACK_TYPE_OTHER. */
+    uint32_t glKB;
+    uint32_t graphicsKB;
+    uint32_t otherKB;
+};
+
+extern int run_memtrack_timeline(uint32_t interval_ms);
+
+#endif
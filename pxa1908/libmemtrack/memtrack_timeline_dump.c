@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2016 The CyanogenMod Project
+ *               2017 The LineageOS Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "memtrack_timeline.h"
+
+/*
+ * Print the memory timeline ring written by memtrack_timelined as CSV.
+ *
+ * usage: memtrack_timeline [file]
+ */
+int main(int argc, char **argv)
+{
+    const char *filename = argc > 1 ? argv[1] : MEMTRACK_TIMELINE_FILE;
+    struct memtrack_timeline_header header;
+    struct memtrack_timeline_record record;
+    FILE *file;
+    uint32_t i;
+
+    file = fopen(filename, "rb");
+    if( file == NULL )
+    {
+        fprintf(stderr, "%s: %s\n", filename, strerror(errno));
+        return 1;
+    }
+
+    if( fread(&header, sizeof(header), 1, file) != 1
+     || header.magic != MEMTRACK_TIMELINE_MAGIC
+     || header.version != MEMTRACK_TIMELINE_VERSION
+     || header.recordSize != sizeof(record) )
+    {
+        fprintf(stderr, "%s: not a memory timeline\n", filename);
+        fclose(file);
+        return 1;
+    }
+
+    printf("time_ms,pid,gl_kb,graphics_kb,other_kb\n");
+    for( i = 0; i < header.count; ++i )
+    {
+        if( fread(&record, sizeof(record), 1, file) != 1 )
+        {
+            fprintf(stderr, "%s: truncated after %u records\n", filename, i);
+            fclose(file);
+            return 1;
+        }
+
+        printf("%llu,%d,%u,%u,%u\n",
+               (unsigned long long)(header.startTime + record.time), record.pid,
+               record.glKB, record.graphicsKB, record.otherKB);
+    }
+
+    fclose(file);
+    return 0;
+}
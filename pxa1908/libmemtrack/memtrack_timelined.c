@@ -0,0 +1,55 @@
+/*
+ * Copyright (C) 2016 The CyanogenMod Project
+ *               2017 The LineageOS Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "memtrack_timelined"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <cutils/log.h>
+#include <cutils/properties.h>
+#include <hardware/memtrack.h>
+
+#include "memtrack_mrvl.h"
+#include "memtrack_timeline.h"
+
+extern struct memtrack_module HAL_MODULE_INFO_SYM;
+
+/*
+ * Sample the graphics memory of every process into MEMTRACK_TIMELINE_FILE
+ * every persist.memtrack.timeline_ms, exit at once when it is 0. Started at
+ * boot by memtrack_timelined.rc, so the memtrack HAL in system_server never
+ * runs a sampler thread itself.
+ */
+int main(void)
+{
+    char value[PROPERTY_VALUE_MAX];
+    int interval;
+    int res;
+
+    property_get("persist.memtrack.timeline_ms", value, "0");
+    interval = atoi(value);
+    if( interval <= 0 )
+        return 0;
+
+    // Same snapshot age and pss mode as the HAL
+    mrvl_memtrack_init(&HAL_MODULE_INFO_SYM);
+
+    res = run_memtrack_timeline((uint32_t)interval);
+    ALOGE("Memory timeline stopped: %s", strerror(-res));
+    return 1;
+}
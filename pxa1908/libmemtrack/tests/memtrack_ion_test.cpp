@@ -0,0 +1,219 @@
+/*
+ * Copyright (C) 2017 The LineageOS Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <string>
+
+#include <gtest/gtest.h>
+
+extern "C" {
+#include "memtrack_mrvl.h"
+}
+
+// Heap dump written to a temporary file, parsed by collect_ion_snapshot
+class IonSnapshotTest : public ::testing::Test
+{
+protected:
+    virtual void SetUp()
+    {
+        strcpy(path, "/tmp/memtrack_ion_XXXXXX");
+        int fd = mkstemp(path);
+        ASSERT_GE(fd, 0);
+        close(fd);
+        memset(&snapshot, 0, sizeof(snapshot));
+        snapshot.filename = path;
+    }
+
+    virtual void TearDown()
+    {
+        unlink(path);
+        free(snapshot.usage);
+    }
+
+    void writeDump(const std::string &dump)
+    {
+        FILE *file = fopen(path, "w");
+        ASSERT_TRUE(file != NULL);
+        fputs(dump.c_str(), file);
+        fclose(file);
+    }
+
+    struct ion_usage *usage(int pid)
+    {
+        return find_ion_usage(&snapshot, pid, 0);
+    }
+
+    char path[64];
+    struct ion_snapshot snapshot;
+};
+
+static int parse(const char *text, int *sizeKB, int *pids, int max_pids)
+{
+    char line[256];
+
+    strncpy(line, text, sizeof(line) - 1);
+    line[sizeof(line) - 1] = '\0';
+    return parse_ion_line(line, sizeKB, pids, max_pids);
+}
+
+TEST(IonLineTest, SingleClient)
+{
+    int sizeKB = 0;
+    int pids[4] = { 0 };
+
+    EXPECT_EQ(1, parse("e4a1b000 4096 1f 2 gralloc [1234 1 0 surfaceflinger]\n", &sizeKB, pids, 4));
+    EXPECT_EQ(4096, sizeKB);
+    EXPECT_EQ(1234, pids[0]);
+}
+
+TEST(IonLineTest, SeveralClients)
+{
+    int sizeKB = 0;
+    int pids[4] = { 0 };
+
+    EXPECT_EQ(3, parse("a0 8 0 3 buf [100 1 0 a] [200 1 0 b]\t[300 2 1 c]\n", &sizeKB, pids, 4));
+    EXPECT_EQ(8, sizeKB);
+    EXPECT_EQ(100, pids[0]);
+    EXPECT_EQ(200, pids[1]);
+    EXPECT_EQ(300, pids[2]);
+}
+
+TEST(IonLineTest, ClientsPastTheCapAreCounted)
+{
+    int sizeKB = 0;
+    int pids[2] = { 0 };
+
+    EXPECT_EQ(3, parse("a0 8 0 3 buf [100 1 0 a] [200 1 0 b] [300 1 0 c]", &sizeKB, pids, 2));
+    EXPECT_EQ(100, pids[0]);
+    EXPECT_EQ(200, pids[1]);
+}
+
+TEST(IonLineTest, NotABufferLine)
+{
+    int sizeKB = 0;
+    int pids[4] = { 0 };
+
+    EXPECT_EQ(0, parse("          client              pid             size\n", &sizeKB, pids, 4));
+    EXPECT_EQ(0, parse("----------------------------------------------------\n", &sizeKB, pids, 4));
+    EXPECT_EQ(0, parse("\n", &sizeKB, pids, 4));
+    EXPECT_EQ(0, parse("a0 8 0 3\n", &sizeKB, pids, 4));
+    EXPECT_EQ(0, parse("a0 8 0 3 buf\n", &sizeKB, pids, 4));
+}
+
+TEST(IonLineTest, MalformedBracketsEndTheClients)
+{
+    int sizeKB = 0;
+    int pids[4] = { 0 };
+
+    EXPECT_EQ(1, parse("a0 8 0 3 buf [100 1 0 a] [x 1 0 b]", &sizeKB, pids, 4));
+    EXPECT_EQ(1, parse("a0 8 0 3 buf [100 1 0 a] [200", &sizeKB, pids, 4));
+    EXPECT_EQ(0, parse("a0 8 0 3 buf [100]", &sizeKB, pids, 4));
+}
+
+TEST_F(IonSnapshotTest, MissingDumpReturnsErrno)
+{
+    unlink(path);
+    EXPECT_EQ(-ENOENT, collect_ion_snapshot(&snapshot));
+    EXPECT_EQ(-ENOENT, snapshot.result);
+}
+
+TEST_F(IonSnapshotTest, SingleOwnerIsPrivate)
+{
+    writeDump("          client              pid             size\n"
+              "a0 4 0 1 buf [100 1 0 app]\n"
+              "b0 8 0 1 buf [100 1 0 app]\n");
+    ASSERT_EQ(0, collect_ion_snapshot(&snapshot));
+
+    struct ion_usage *app = usage(100);
+    ASSERT_TRUE(app != NULL);
+    EXPECT_EQ(12u * 1024, app->privateBytes);
+    EXPECT_EQ(0u, app->sharedBytes);
+    EXPECT_EQ(12u * 1024, app->pssBytes);
+    EXPECT_TRUE(usage(200) == NULL);
+}
+
+TEST_F(IonSnapshotTest, SharedBufferIsSplitIntoPss)
+{
+    writeDump("a0 12 0 3 buf [100 1 0 app] [200 1 0 sf] [300 1 0 hwc]\n"
+              "b0 4 0 1 buf [200 1 0 sf]\n");
+    ASSERT_EQ(0, collect_ion_snapshot(&snapshot));
+
+    struct ion_usage *app = usage(100);
+    struct ion_usage *sf = usage(200);
+    ASSERT_TRUE(app != NULL);
+    ASSERT_TRUE(sf != NULL);
+    EXPECT_EQ(0u, app->privateBytes);
+    EXPECT_EQ(12u * 1024, app->sharedBytes);
+    EXPECT_EQ(4u * 1024, app->pssBytes);
+    EXPECT_EQ(4u * 1024, sf->privateBytes);
+    EXPECT_EQ(12u * 1024, sf->sharedBytes);
+    EXPECT_EQ(8u * 1024, sf->pssBytes);
+}
+
+TEST_F(IonSnapshotTest, RepeatedPidIsOneOwner)
+{
+    writeDump("a0 8 0 2 buf [100 1 0 app] [100 2 0 app]\n"
+              "b0 8 0 3 buf [100 1 0 app] [200 1 0 sf] [100 1 0 app]\n");
+    ASSERT_EQ(0, collect_ion_snapshot(&snapshot));
+
+    struct ion_usage *app = usage(100);
+    ASSERT_TRUE(app != NULL);
+    EXPECT_EQ(8u * 1024, app->privateBytes);
+    EXPECT_EQ(8u * 1024, app->sharedBytes);
+    EXPECT_EQ(12u * 1024, app->pssBytes);
+}
+
+TEST_F(IonSnapshotTest, TableGrowsPastMinimum)
+{
+    std::string dump;
+    char line[64];
+    int pid;
+
+    for( pid = 1; pid <= ION_SNAPSHOT_MIN_PIDS * 2; ++pid )
+    {
+        snprintf(line, sizeof(line), "%x 4 0 1 buf [%d 1 0 app]\n", pid, pid);
+        dump += line;
+    }
+    writeDump(dump);
+    ASSERT_EQ(0, collect_ion_snapshot(&snapshot));
+
+    EXPECT_EQ((size_t)ION_SNAPSHOT_MIN_PIDS * 2, snapshot.count);
+    EXPECT_GT(snapshot.capacity, snapshot.count);
+    for( pid = 1; pid <= ION_SNAPSHOT_MIN_PIDS * 2; ++pid )
+    {
+        struct ion_usage *u = usage(pid);
+        ASSERT_TRUE(u != NULL);
+        EXPECT_EQ(4u * 1024, u->privateBytes);
+    }
+}
+
+TEST_F(IonSnapshotTest, RecollectStartsOver)
+{
+    writeDump("a0 8 0 1 buf [100 1 0 app]\n");
+    ASSERT_EQ(0, collect_ion_snapshot(&snapshot));
+    writeDump("a0 4 0 1 buf [200 1 0 sf]\n");
+    ASSERT_EQ(0, collect_ion_snapshot(&snapshot));
+
+    EXPECT_TRUE(usage(100) == NULL);
+    ASSERT_TRUE(usage(200) != NULL);
+    EXPECT_EQ(4u * 1024, usage(200)->pssBytes);
+    EXPECT_EQ(1u, snapshot.count);
+}